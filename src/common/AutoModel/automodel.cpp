@@ -108,6 +108,10 @@ nlohmann::json AutoModel::_shared_setup_tokenizer(std::string model_path) {
     }
     this->user_system_prompt = "";
     this->extra_context["user_system_prompt"] = this->user_system_prompt;
+    // the token bytes belong to the previous vocabulary
+    this->grammar_vocab.reset();
+    this->grammar_matcher.reset();
+    this->grammar_text.clear();
     return tokenizer_config;
 }
 
@@ -134,38 +138,113 @@ void AutoModel::_shared_load_model(std::string model_path, json model_info, int
     } else {
         this->MAX_L = model_info["default_context_length"];
     }
+    // Tokens per prefill call, tuned per model in the model list
+    this->prefill_chunk = model_info.value("prefill_chunk", DEFAULT_PREFILL_CHUNK);
     
     this->is_model_loaded = true;
 
     this->token_history.clear();
     this->token_history.reserve(this->MAX_L);
     this->tokenizer = std::make_unique<Tokenizer>(this->model_path);
+    this->tmpl_cache.reset();
 
     this->last_token = -1;
     this->total_tokens = 0;
 }
 
+/// \brief Template and encode the messages of a request, only those not seen in an earlier one
+/// \param messages the messages
+/// \param tools the tools, as the model passes them to apply_chat_template
+/// \return the token ids, as the tokenizer gives them for apply_chat_template
+/// \note A REST client sends the whole conversation every turn; the rendering of what came
+///       before is taken from the template cache.
+std::vector<int> AutoModel::_encode_messages(nlohmann::ordered_json& messages, nlohmann::ordered_json tools) {
+    if (this->tmpl_cache == nullptr) {
+        this->tmpl_cache = std::make_unique<template_cache>();
+    }
+    auto render = [&](nlohmann::ordered_json& part, bool generation_prompt) {
+        this->add_generation_prompt = generation_prompt;
+        std::string text;
+        try {
+            text = this->apply_chat_template(part, tools);
+        }
+        catch (...) {
+            this->add_generation_prompt = true;
+            throw;
+        }
+        this->add_generation_prompt = true;
+        return text;
+    };
+    auto encode = [&](const std::string& text) {
+        return this->tokenizer->encode(text);
+    };
+    bool was_stable = this->tmpl_cache->is_stable();
+    std::vector<int> tokens = this->tmpl_cache->encode(messages, tools.dump() + this->extra_context.dump(), render, encode);
+    if (was_stable && !this->tmpl_cache->is_stable()) {
+        header_print("WARNING", "Chat template is not prefix-stable, " + this->tmpl_cache->stats()["reason"].get<std::string>() + "; every request is templated in full");
+    }
+    return tokens;
+}
+
 bool AutoModel::_shared_insert(chat_meta_info_t& meta_info, std::vector<int>& tokens, void* payload) {
-    if (this->total_tokens + tokens.size() >= this->MAX_L){
+    size_t cached = 0;
+    if (this->reuse_prefix) {
+        this->reuse_prefix = false;
+        cached = this->_rewind_to_common_prefix(tokens, payload);
+    }
+    std::vector<int> suffix(tokens.begin() + cached, tokens.end());
+    if (this->total_tokens + suffix.size() >= this->MAX_L && !this->_shift_context(suffix.size() + 1)){
         header_print("WARNING", "Max length reached, stopping prefilling...");
         return false;
     }
-    for (int token : tokens){
+    for (int token : suffix){
         this->token_history.push_back(token);
     }
+    if (payload != nullptr) {
+        this->history_has_payload = true;
+    }
     buffer<bf16> y;
+    // The hooks belong to this request only
+    prefill_hooks_t hooks = std::move(this->prefill_hooks);
+    this->prefill_hooks = prefill_hooks_t{};
 
     auto prefill_start_time = this->profiler_list[PREFILL_TIME].start();
-    y = this->lm_engine->prefill(tokens, payload);
-    auto prefill_end_time = this->profiler_list[PREFILL_TIME].stop(tokens.size());
+    if (payload != nullptr) {
+        y = this->lm_engine->prefill(suffix, payload);   // the payload goes with its placeholder tokens
+    }
+    else {
+        int done = chunked_prefill(this->lm_engine.get(), suffix, this->prefill_chunk, hooks, y);
+        if (done < (int)suffix.size()) {
+            this->profiler_list[PREFILL_TIME].stop(done);
+            header_print("FLM", "Prefill cancelled after " << done << " of " << suffix.size() << " tokens");
+            this->token_history.resize(this->token_history.size() - (suffix.size() - done));
+            this->total_tokens += done;
+            this->draft_in_sync = false;
+            meta_info.prompt_tokens = done;
+            meta_info.cached_tokens = cached;
+            meta_info.stop_reason = CANCEL_DETECTED;
+            return false;
+        }
+    }
+    if (this->draft_engine != nullptr && this->draft_in_sync) {
+        if (payload != nullptr) {
+            this->draft_in_sync = false;    // the draft cannot see images or audio
+        }
+        else {
+            this->draft_engine->prefill(suffix);
+        }
+    }
+    auto prefill_end_time = this->profiler_list[PREFILL_TIME].stop(suffix.size());
     meta_info.prefill_duration = (uint64_t)time_utils::duration_ns(prefill_start_time, prefill_end_time).first;
-    meta_info.prompt_tokens = tokens.size();
-    this->total_tokens += tokens.size() + 1;
+    meta_info.prompt_tokens = suffix.size();
+    meta_info.cached_tokens = cached;
+    this->total_tokens += suffix.size() + 1;
     if (this->total_tokens >= this->MAX_L){
         header_print("WARNING", "Max length reached, stopping prefilling...");
     }
     this->profiler_list[SAMPLING_TIME].start();
-    this->last_token = this->sampler->sample(y);
+    this->grammar_stalled = false;
+    this->last_token = this->_sample(y);
     this->profiler_list[SAMPLING_TIME].stop(1);
     return true;
 }
@@ -184,61 +263,183 @@ std::string AutoModel::_shared_generate(chat_meta_info_t& meta_info, int length_
     stop_reason_t reason = EOT_DETECTED;
     int last_sampled_token = this->last_token;
     this->token_history.push_back(this->last_token);
-    if (this->is_normal_token(last_sampled_token) && last_sampled_token != -1){
-        std::string token_str = this->tokenizer->run_time_decoder(last_sampled_token);
-        result += token_str;
-        os << token_str << std::flush;
 
+    // Host side of a token: detokenize and write; the stream parses and serializes on flush
+    auto emit = [&](decoded_token_t& token) {
+        this->profiler_list[TKOEN_DECODE_TIME].start();
+        if (this->is_normal_token(token.token_id)) { // filter out special tokens
+            std::string token_str = token.has_text ? std::move(token.text) : this->tokenizer->run_time_decoder(token.token_id);
+            if (token.has_logprobs) {
+                this->logprob_queue.push_back(std::move(token.logprobs));
+            }
+            os << token_str << std::flush;
+            result += token_str;
+        }
+        this->profiler_list[TKOEN_DECODE_TIME].stop(1);
+    };
+    // Stop sequences are matched here, on the decode thread, so that generation ends on the
+    // token that completes one; the consumer only emits the text the matcher let through
+    stop_matcher* stops = this->stop_sequences.get();
+    bool stop_hit = false;
+    if (stops != nullptr) {
+        stops->reset();
+    }
+    // Take the sampler's log-probabilities now, the next sample overwrites them
+    auto make_token = [&](int token_id) {
+        decoded_token_t token{token_id, false, {}, false, {}};
+        if (this->sampler->logprobs_enabled() && this->is_normal_token(token_id)) {
+            token.has_logprobs = true;
+            token.logprobs = this->sampler->get_logprobs();
+        }
+        if (stops != nullptr && !stop_hit && this->is_normal_token(token_id)) {
+            token.has_text = true;
+            stop_hit = stops->feed(this->tokenizer->run_time_decoder(token_id), token.text);
+        }
+        return token;
+    };
+    // Text held back by the matcher that turned out not to be a stop sequence
+    auto release_held = [&]() {
+        if (stops != nullptr && !stop_hit) {
+            std::string held = stops->flush();
+            if (!held.empty()) {
+                os << held << std::flush;
+                result += held;
+            }
+        }
+    };
+
+    this->profiler_list[TKOEN_DECODE_TIME].reset();
+    decoded_token_t first_token = make_token(last_sampled_token);
+    emit(first_token);   // the sampler still holds the logprobs of the prefill token
+    if (stop_hit) {
+        meta_info.stop_reason = STOP_SEQUENCE_DETECTED;
+        meta_info.stop_sequence = stops->get_match();
+        return result;
     }
     if (this->is_eos(last_sampled_token)){
+        release_held();
+        if (this->grammar_stalled) {
+            meta_info.stop_reason = ERROR_DETECTED;
+        }
         return result;
     }
     this->profiler_list[DECODING_TIME].reset();
-    this->profiler_list[TKOEN_DECODE_TIME].reset();
-    if (this->total_tokens >= this->MAX_L){
+    causal_lm* draft = this->draft_in_sync ? this->draft_engine.get() : nullptr;
+    prompt_lookup* lookup = this->use_prompt_lookup ? this->lookup.get() : nullptr;
+    bool speculate = this->speculator != nullptr && (draft != nullptr || lookup != nullptr);
+    if (this->speculator != nullptr) {
+        this->speculator->set_proposers(draft, lookup);
+        this->speculator->reset_stats();
+    }
+    if (this->total_tokens >= this->MAX_L && !this->_shift_context(1)){
         header_print("WARNING", "Max length reached, stopping generation...");
         reason = MAX_LENGTH_REACHED;
+        release_held();
         return result;
     }
-    while (this->total_tokens < this->MAX_L){
-        if (is_cancelled()) {
-            reason = CANCEL_DETECTED;
-            // reset stream content 
-            buffer_.clear();
-            current_mode_ = StreamEventType::CONTENT;
-            tool_name_.clear();
-            is_in_tool_block_ = false;
-            break;
-        }
-        this->profiler_list[DECODING_TIME].start();
-        buffer<bf16> y = this->lm_engine->forward(last_sampled_token);
-        this->profiler_list[DECODING_TIME].stop(1);
 
+    // The consumer emits token n while the NPU computes token n + 1
+    std::unique_ptr<decode_pipeline> pipeline = nullptr;
+    if (this->pipelined_decode) {
+        pipeline = std::make_unique<decode_pipeline>(emit);
+    }
+    // A speculative round emits several tokens; each is sampled by the target in order
+    std::vector<decoded_token_t> step_tokens;
+    auto sample_row = [&](buffer<bf16>& y) {
         this->profiler_list[SAMPLING_TIME].start();
-        int sampled_token = this->sampler->sample(y);
+        int sampled_token = this->_sample(y);
         this->profiler_list[SAMPLING_TIME].stop(1);
-        this->total_tokens++;
-        last_sampled_token = sampled_token;
-
-        this->profiler_list[TKOEN_DECODE_TIME].start();
-        if (this->is_normal_token(sampled_token)){ // filter out special tokens
-            std::string token_str = this->tokenizer->run_time_decoder(sampled_token);
-            os << token_str << std::flush;
-            result += token_str;
-        }
-        this->profiler_list[TKOEN_DECODE_TIME].stop(1);
-        this->token_history.push_back(sampled_token);
-        if (this->is_eos(sampled_token)){
-            this->lm_engine->forward(last_sampled_token);
+        step_tokens.push_back(make_token(sampled_token));
+        return sampled_token;
+    };
+    auto stop_on_eos = [&](int token) { return this->is_eos(token) || stop_hit; };
+    // Shift early enough that a speculative round still fits
+    int headroom = speculate ? this->speculator->get_draft_len() + 1 : 1;
+    bool done = false;
+    while (!done){
+        if (this->total_tokens + headroom > this->MAX_L && !this->_shift_context(headroom)
+            && this->total_tokens >= this->MAX_L) {
             break;
         }
-        meta_info.generated_tokens++;
-        if ((length_limit > 0) && (meta_info.generated_tokens >= length_limit)){
-            reason = MAX_LENGTH_REACHED;
+        if (is_cancelled()) {
+            reason = CANCEL_DETECTED;
             break;
         }
+        step_tokens.clear();
+        if (speculate) {
+            int budget = this->MAX_L - this->total_tokens;
+            if (length_limit > 0) {
+                budget = std::min(budget, length_limit - meta_info.generated_tokens);
+            }
+            this->profiler_list[DECODING_TIME].start();
+            int emitted = this->speculator->step(last_sampled_token, budget, sample_row, stop_on_eos);
+            this->profiler_list[DECODING_TIME].stop(emitted);
+        }
+        else {
+            this->profiler_list[DECODING_TIME].start();
+            buffer<bf16> y = this->lm_engine->forward(last_sampled_token);
+            this->profiler_list[DECODING_TIME].stop(1);
+            sample_row(y);
+        }
+
+        for (decoded_token_t& token : step_tokens) {
+            int sampled_token = token.token_id;
+            // make_token ends a speculative round on the token that completes a stop sequence
+            bool at_stop = stop_hit && &token == &step_tokens.back();
+            this->total_tokens++;
+            last_sampled_token = sampled_token;
+
+            if (pipeline != nullptr) {
+                if (!pipeline->push(std::move(token))) {
+                    done = true;    // the output stream failed, finish() rethrows
+                    break;
+                }
+            }
+            else {
+                emit(token);
+            }
+            this->token_history.push_back(sampled_token);
+            if (at_stop) {
+                meta_info.generated_tokens++;
+                reason = STOP_SEQUENCE_DETECTED;
+                meta_info.stop_sequence = stops->get_match();
+            }
+            if (this->is_eos(sampled_token) || at_stop){
+                if (speculate) {
+                    this->speculator->append(last_sampled_token);
+                }
+                else {
+                    this->lm_engine->forward(last_sampled_token);
+                }
+                done = true;
+                break;
+            }
+            meta_info.generated_tokens++;
+            if ((length_limit > 0) && (meta_info.generated_tokens >= length_limit)){
+                reason = MAX_LENGTH_REACHED;
+                done = true;
+                break;
+            }
+        }
+    }
+    if (speculate) {
+        this->speculator->flush();
+    }
+    if (pipeline != nullptr) {
+        pipeline->finish();
+    }
+    release_held();
+    if (reason == CANCEL_DETECTED) {
+        // reset stream content, the consumer is done with it
+        buffer_.clear();
+        current_mode_ = StreamEventType::CONTENT;
+        tool_name_.clear();
+        is_in_tool_block_ = false;
     }
     meta_info.decoding_duration = (uint64_t)(time_utils::cast_to_us(this->profiler_list[DECODING_TIME].get_total_time()).first) * 1e3;
+    if (reason == EOT_DETECTED && this->grammar_stalled) {
+        reason = ERROR_DETECTED;
+    }
     meta_info.stop_reason = reason;
     if (this->total_tokens >= this->MAX_L){
         header_print("WARNING", "Max length reached, stopping generation...");
@@ -366,6 +567,434 @@ StreamResult AutoModel::_shared_think_tool_calling_pasrsed(const std::string con
     return result;
 }
 
+/// \brief Keep the KV of the common prefix of tokens and token_history, drop the rest
+/// \param tokens the whole prompt of the request
+/// \param payload the image or audio payload of the request
+/// \return the number of leading tokens already in the KV cache
+/// \note At least one token is left to prefill, its logits start the answer. Prompts with a
+///       payload are not matched: image and audio placeholders are the same ids whatever
+///       the content, and the engines keep extra position state after them.
+size_t AutoModel::_rewind_to_common_prefix(const std::vector<int>& tokens, void* payload) {
+    size_t cached = this->lm_engine->get_current_context_length();
+    size_t keep = 0;
+    if (payload == nullptr && !this->history_has_payload && !tokens.empty()) {
+        size_t limit = std::min({this->token_history.size(), cached, tokens.size() - 1});
+        while (keep < limit && this->token_history[keep] == tokens[keep]) {
+            keep++;
+        }
+    }
+    if (keep < cached && (keep == 0 || !this->kv_rewind_supported() || !this->lm_engine->truncate_to(keep))) {
+        keep = 0;
+    }
+    if (keep == 0) {
+        this->clear_context();
+        return 0;
+    }
+    if (this->draft_engine != nullptr && !(this->draft_in_sync && this->draft_engine->truncate_to(keep))) {
+        this->draft_in_sync = false;
+    }
+    if (this->lookup != nullptr) {
+        this->lookup->truncate(keep);
+    }
+    this->token_history.resize(keep);
+    this->total_tokens = keep;
+    this->last_token = -1;
+    this->sampler->reset_penalties();
+    header_print("FLM", "Reusing " << keep << " cached tokens, prefilling " << tokens.size() - keep);
+    return keep;
+}
+
+/// \brief Reuse the KV cache across requests that resend the conversation
+/// \note The next insert must carry the whole conversation, the model templates it
+///       from the start
+void AutoModel::start_new_prompt() {
+    this->reuse_prefix = true;
+    this->is_first_prompt = true;
+}
+
+/// \brief Build the engine of a draft model
+/// \param config the configuration of the draft model
+/// \return nullptr if the architecture has no engine that can serve as a draft
+/// \note Only attention-only text engines: the draft is rewound after every round.
+std::unique_ptr<causal_lm> AutoModel::create_draft_engine(LM_Config& config) {
+    if (config.model_type == "qwen3") {
+        return std::make_unique<qwen3_npu>(config, this->npu.get(), this->MAX_L);
+    }
+    if (config.model_type == "llama") {
+        return std::make_unique<llama_npu>(config, this->npu.get(), this->MAX_L);
+    }
+    return nullptr;
+}
+
+/// \brief Why speculative decoding cannot run on the loaded model
+/// \return empty if it can
+/// \note A target that verifies one token per forward pass makes every round slower
+///       than plain decoding, so speculation is refused rather than enabled at a loss.
+std::string AutoModel::speculation_unavailable() {
+    if (!this->is_model_loaded || this->lm_engine == nullptr) {
+        return "no model is loaded";
+    }
+    if (!this->kv_rewind_supported()) {
+        return "KV rollback is not available for " + this->current_model;
+    }
+    if (!this->lm_engine->has_batched_verify()) {
+        return "the " + this->current_model + " engine verifies one token per pass, speculation would be slower";
+    }
+    return "";
+}
+
+/// \brief Pair a small draft model with this one for speculative decoding
+/// \param draft_model_path the path of the draft model, same tokenizer as this one
+/// \param draft_len the number of tokens the draft proposes per round
+/// \return false if the pair is not usable, decoding is then left as it was
+bool AutoModel::load_draft_model(std::string draft_model_path, int draft_len) {
+    this->unload_draft_model();
+    std::string unavailable = this->speculation_unavailable();
+    if (!unavailable.empty()) {
+        header_print("WARNING", "Speculative decoding is off: " << unavailable);
+        return false;
+    }
+    LM_Config draft_config;
+    draft_config.from_pretrained(draft_model_path);
+    if (draft_config.vocab_size != this->lm_config->vocab_size) {
+        header_print("WARNING", "Draft model vocabulary (" << draft_config.vocab_size << ") differs from the target ("
+                     << this->lm_config->vocab_size << "), speculative decoding is off");
+        return false;
+    }
+    std::unique_ptr<causal_lm> draft = this->create_draft_engine(draft_config);
+    if (draft == nullptr) {
+        header_print("WARNING", "No draft engine for model type " << draft_config.model_type << ", speculative decoding is off");
+        return false;
+    }
+    header_print("FLM", "Loading draft model: " << draft_model_path);
+    {
+        Q4NX draft_q4nx(draft_model_path);
+        draft->load_weights(draft_q4nx);
+    }
+    this->draft_engine = std::move(draft);
+    this->_ensure_speculator(draft_len);
+    this->clear_context();
+    return true;
+}
+
+/// \brief Go back to plain decoding and free the draft model
+void AutoModel::unload_draft_model() {
+    if (this->speculator != nullptr) {
+        this->speculator->set_proposers(nullptr, nullptr);
+    }
+    this->draft_engine.reset();
+    this->draft_in_sync = false;
+}
+
+/// \brief Create the speculative decoder on first use
+/// \param draft_len the number of tokens proposed per round, -1 to keep it
+void AutoModel::_ensure_speculator(int draft_len) {
+    if (this->speculator == nullptr) {
+        this->speculator = std::make_unique<speculative_decoder>(this->lm_engine.get(), nullptr,
+                                                                 this->lm_config->vocab_size, draft_len > 0 ? draft_len : 4);
+    }
+    else if (draft_len > 0) {
+        this->speculator->set_draft_len(draft_len);
+    }
+}
+
+/// \brief Keep going past the context length by evicting the middle of the conversation
+/// \param enable false to stop at the context length
+/// \param sink_tokens the number of leading tokens that are never evicted
+void AutoModel::set_context_shift(bool enable, int sink_tokens) {
+    if (!enable) {
+        this->context_shifter.reset();
+        return;
+    }
+    if (this->context_shifter == nullptr || this->context_shifter->get_sink_tokens() != sink_tokens) {
+        this->context_shifter = std::make_unique<context_shift>(sink_tokens);
+    }
+}
+
+/// \brief Save the conversation to a session snapshot
+/// \param path the snapshot file, replaced once the new one is complete
+/// \param compress whether to compress the K/V caches
+/// \return false if nothing was written
+bool AutoModel::save_session(const std::string& path, bool compress) {
+    if (!this->is_model_loaded || this->lm_engine == nullptr) {
+        header_print("WARNING", "No model loaded");
+        return false;
+    }
+    bool with_kv = this->lm_engine->can_restore_kv();
+    if (this->history_has_payload && !with_kv) {
+        header_print("WARNING", "The conversation holds an image or audio that cannot be prefilled again, session not saved");
+        return false;
+    }
+    time_utils::time_point start = time_utils::now();
+    int kv_length = this->lm_engine->get_current_context_length();
+    int num_layers = this->lm_config->num_hidden_layers;
+    int num_kv_heads = this->lm_config->num_key_value_heads;
+
+    kv_session::writer out(path, compress);
+    if (!out.is_open()) {
+        header_print("WARNING", "Cannot write " << path);
+        return false;
+    }
+    bool ok = out.write(kv_session::BLOB_TOKENS, 0, 0, this->token_history.data(), this->token_history.size());
+    for (int layer = 0; with_kv && ok && layer < num_layers; layer++) {
+        for (int head = 0; ok && head < num_kv_heads; head++) {
+            buffer<bf16> k = this->lm_engine->get_k_cache(layer, head);
+            buffer<bf16> v = this->lm_engine->get_v_cache(layer, head);
+            ok = out.write(kv_session::BLOB_K_CACHE, layer, head, k.data(), k.size())
+                && out.write(kv_session::BLOB_V_CACHE, layer, head, v.data(), v.size());
+        }
+    }
+
+    sampler_state_t sampler_state = this->sampler->get_state();
+    nlohmann::json state = {
+        {"model", this->current_model},
+        {"vocab_size", this->lm_config->vocab_size},
+        {"num_layers", num_layers},
+        {"num_kv_heads", num_kv_heads},
+        {"kv", with_kv},
+        {"kv_length", kv_length},
+        {"total_tokens", this->total_tokens},
+        {"last_token", this->last_token},
+        {"is_first_prompt", this->is_first_prompt},
+        {"history_has_payload", this->history_has_payload},
+        {"sampler", {
+            {"top_k", sampler_state.config.top_k},
+            {"top_p", sampler_state.config.top_p},
+            {"min_p", sampler_state.config.min_p},
+            {"temperature", sampler_state.config.temperature},
+            {"rep_penalty", sampler_state.config.rep_penalty},
+            {"freq_penalty", sampler_state.config.freq_penalty},
+            {"pre_penalty", sampler_state.config.pre_penalty},
+            {"rep_penalty_window", sampler_state.config.rep_penalty_window},
+            {"freq_penalty_window", sampler_state.config.freq_penalty_window},
+            {"repeat_last_n", sampler_state.config.repeat_last_n},
+            {"rng_seed", sampler_state.rng_seed},
+            {"rng_counter", sampler_state.rng_counter}
+        }}
+    };
+    u64 bytes = out.get_bytes();
+    if (!ok || !out.finish(state)) {
+        header_print("WARNING", "Failed to write " << path);
+        return false;
+    }
+    time_utils::time_with_unit time = time_utils::re_unit(time_utils::duration_us(start, time_utils::now()));
+    header_print("FLM", "Session saved: " << this->token_history.size() << " tokens"
+                 << (with_kv ? " with KV cache, " : ", ") << std::fixed << std::setprecision(1)
+                 << bytes / 1048576.0 << " MB in " << time.first << " " << time.second);
+    return true;
+}
+
+/// \brief Resume a conversation from a session snapshot of the same model
+/// \param path the snapshot file
+/// \return false if the snapshot is missing, corrupt or from another model
+/// \note Without restorable K/V caches the tokens are prefilled again in chunks, with the
+///       hooks of set_prefill_hooks, which still skips templating and tokenizing the conversation.
+bool AutoModel::load_session(const std::string& path, bool* kv_restored) {
+    if (kv_restored != nullptr) {
+        *kv_restored = false;
+    }
+    if (!this->is_model_loaded || this->lm_engine == nullptr) {
+        header_print("WARNING", "No model loaded");
+        return false;
+    }
+    time_utils::time_point start = time_utils::now();
+    kv_session::reader in(path);
+    if (!in.is_open()) {
+        header_print("WARNING", "Not a session snapshot: " << path);
+        return false;
+    }
+    const nlohmann::json& state = in.get_state();
+    int num_layers = this->lm_config->num_hidden_layers;
+    int num_kv_heads = this->lm_config->num_key_value_heads;
+    if (state.value("model", std::string()) != this->current_model
+        || state.value("vocab_size", 0u) != this->lm_config->vocab_size
+        || state.value("num_layers", 0) != num_layers || state.value("num_kv_heads", 0) != num_kv_heads) {
+        header_print("WARNING", "The session was saved with " << state.value("model", std::string("another model"))
+                     << ", not " << this->current_model);
+        return false;
+    }
+    std::vector<int> tokens;
+    int kv_length = state.value("kv_length", -1);
+    const int vocab_size = (int)this->lm_config->vocab_size;
+    auto out_of_vocab = [vocab_size](int token) { return token < 0 || token >= vocab_size; };
+    int last_token = state.value("last_token", -1);
+    if (!in.read_tokens(tokens) || kv_length < 0 || kv_length > (int)tokens.size()
+        || std::any_of(tokens.begin(), tokens.end(), out_of_vocab) || (last_token != -1 && out_of_vocab(last_token))) {
+        header_print("WARNING", "Corrupt session snapshot: " << path);
+        return false;
+    }
+    if (tokens.size() >= this->MAX_L) {
+        header_print("WARNING", "The session holds " << tokens.size() << " tokens, more than the context length " << this->MAX_L);
+        return false;
+    }
+    bool has_payload = state.value("history_has_payload", false);
+    // The hooks belong to this load only
+    prefill_hooks_t hooks = std::move(this->prefill_hooks);
+    this->prefill_hooks = prefill_hooks_t{};
+
+    this->clear_context();
+    bool restored = false;
+    if (state.value("kv", false) && this->lm_engine->can_restore_kv()) {
+        std::vector<u8> k_scratch, v_scratch;
+        restored = true;
+        for (int layer = 0; restored && layer < num_layers; layer++) {
+            for (int head = 0; restored && head < num_kv_heads; head++) {
+                const kv_session::blob_entry_t* k = in.find(kv_session::BLOB_K_CACHE, layer, head);
+                const kv_session::blob_entry_t* v = in.find(kv_session::BLOB_V_CACHE, layer, head);
+                const void* k_data = k != nullptr ? in.data(*k, k_scratch) : nullptr;
+                const void* v_data = v != nullptr ? in.data(*v, v_scratch) : nullptr;
+                restored = k_data != nullptr && v_data != nullptr
+                    && this->lm_engine->restore_kv_cache(layer, head, (const bf16*)k_data, k->count, (const bf16*)v_data, v->count);
+            }
+        }
+        restored = restored && this->lm_engine->restore_context_length(kv_length);
+        if (!restored) {
+            this->lm_engine->clear_context();
+        }
+    }
+    std::vector<int> kept(tokens.begin(), tokens.begin() + kv_length);
+    if (!restored) {
+        if (has_payload) {
+            header_print("WARNING", "The session holds an image or audio and its KV cache cannot be restored");
+            this->clear_context();
+            return false;
+        }
+        buffer<bf16> y;
+        if (!kept.empty() && chunked_prefill(this->lm_engine.get(), kept, this->prefill_chunk, hooks, y) < (int)kept.size()) {
+            header_print("FLM", "Session load cancelled");
+            this->clear_context();
+            return false;
+        }
+    }
+    if (this->draft_engine != nullptr) {
+        // A payload never reaches the draft, it stays out of sync as it was
+        this->draft_in_sync = !has_payload;
+        if (this->draft_in_sync && !kept.empty()) {
+            buffer<bf16> y;
+            prefill_hooks_t draft_hooks = {hooks.is_cancelled, nullptr};
+            if (chunked_prefill(this->draft_engine.get(), kept, this->prefill_chunk, draft_hooks, y) < (int)kept.size()) {
+                header_print("FLM", "Session load cancelled");
+                this->clear_context();
+                return false;
+            }
+        }
+    }
+
+    this->token_history = tokens;
+    this->total_tokens = state.value("total_tokens", (uint32_t)tokens.size());
+    this->last_token = last_token;
+    this->is_first_prompt = state.value("is_first_prompt", tokens.empty());
+    this->history_has_payload = has_payload;
+    if (state.contains("sampler") && state["sampler"].is_object()) {
+        const nlohmann::json& s = state["sampler"];
+        sampler_state_t sampler_state = this->sampler->get_state();
+        sampler_state.config.top_k = s.value("top_k", sampler_state.config.top_k);
+        sampler_state.config.top_p = s.value("top_p", sampler_state.config.top_p);
+        sampler_state.config.min_p = s.value("min_p", sampler_state.config.min_p);
+        sampler_state.config.temperature = s.value("temperature", sampler_state.config.temperature);
+        sampler_state.config.rep_penalty = s.value("rep_penalty", sampler_state.config.rep_penalty);
+        sampler_state.config.freq_penalty = s.value("freq_penalty", sampler_state.config.freq_penalty);
+        sampler_state.config.pre_penalty = s.value("pre_penalty", sampler_state.config.pre_penalty);
+        sampler_state.config.rep_penalty_window = s.value("rep_penalty_window", sampler_state.config.rep_penalty_window);
+        sampler_state.config.freq_penalty_window = s.value("freq_penalty_window", sampler_state.config.freq_penalty_window);
+        sampler_state.config.repeat_last_n = s.value("repeat_last_n", sampler_state.config.repeat_last_n);
+        sampler_state.rng_seed = s.value("rng_seed", sampler_state.rng_seed);
+        sampler_state.rng_counter = s.value("rng_counter", sampler_state.rng_counter);
+        this->sampler->set_state(sampler_state);
+    }
+    time_utils::time_with_unit time = time_utils::re_unit(time_utils::duration_us(start, time_utils::now()));
+    header_print("FLM", "Session loaded: " << tokens.size() << " tokens, "
+                 << (restored ? "KV cache restored" : "prefilled again") << " in " << time.first << " " << time.second);
+    if (kv_restored != nullptr) {
+        *kv_restored = restored;
+    }
+    return true;
+}
+
+/// \brief Keep preprocessed images for the requests that send them again
+/// \param max_bytes the memory for their pixel values, 0 turns the cache off
+/// \param max_images the number of images kept
+void AutoModel::set_image_cache(size_t max_bytes, size_t max_images) {
+    if (max_bytes == 0 || max_images == 0) {
+        this->preprocessed_images.reset();
+        return;
+    }
+    if (this->preprocessed_images == nullptr) {
+        this->preprocessed_images = std::make_unique<image_cache>(max_bytes, max_images);
+    }
+    else {
+        this->preprocessed_images->set_limits(max_bytes, max_images);
+    }
+}
+
+/// \brief Image cache statistics, null when the cache is off or the model takes no images
+nlohmann::json AutoModel::image_cache_stats() {
+    if (this->preprocessed_images == nullptr) {
+        return nullptr;
+    }
+    nlohmann::json stats = this->preprocessed_images->stats();
+    if (stats["hits"] == 0 && stats["misses"] == 0) {
+        return nullptr;
+    }
+    return stats;
+}
+
+/// \brief Make room for needed more tokens by evicting the middle of the context
+/// \param needed the number of tokens about to be added
+/// \return false if context shifting is off or cannot make room
+/// \note Contexts with an image or audio payload are not shifted: the engines keep position
+///       state for it that a re-prefill without the payload would lose.
+bool AutoModel::_shift_context(int needed) {
+    if (this->context_shifter == nullptr || this->history_has_payload) {
+        return false;
+    }
+    if (this->speculator != nullptr) {
+        this->speculator->flush();
+    }
+    auto [begin, end] = this->context_shifter->shift(this->lm_engine.get(), this->token_history, needed, this->MAX_L,
+                                                     this->kv_rewind_supported());
+    if (begin >= end) {
+        return false;
+    }
+    int evicted = end - begin;
+    this->total_tokens -= evicted;
+    if (this->draft_engine != nullptr && this->draft_in_sync && !this->draft_engine->evict(begin, end)) {
+        // The draft is small, re-prefilling it keeps speculation going
+        int length = this->draft_engine->get_current_context_length() - evicted;
+        std::vector<int> kept(this->token_history.begin(), this->token_history.begin() + std::max(length, 0));
+        this->draft_engine->clear_context();
+        if (!kept.empty()) {
+            this->draft_engine->prefill(kept);
+        }
+    }
+    if (this->lookup != nullptr) {
+        this->lookup->truncate(begin);
+    }
+    header_print("FLM", "Context shift: evicted " << evicted << " tokens after the first " << begin);
+    return true;
+}
+
+/// \brief Propose tokens by looking up the last generated n-gram in the history
+/// \param enable whether to speculate from the prompt, per request
+/// \param draft_len the number of tokens proposed per round, -1 to keep it
+/// \return false if speculation cannot run on the model, see speculation_unavailable
+bool AutoModel::set_prompt_lookup(bool enable, int draft_len) {
+    if (!enable) {
+        this->use_prompt_lookup = false;
+        return true;
+    }
+    if (!this->speculation_unavailable().empty()) {
+        this->use_prompt_lookup = false;
+        return false;
+    }
+    if (this->lookup == nullptr) {
+        this->lookup = std::make_unique<prompt_lookup>(this->token_history);
+    }
+    this->_ensure_speculator(draft_len);
+    this->use_prompt_lookup = true;
+    return true;
+}
+
 /// \brief Clear the context
 /// \note The function will clear the context
 /// \note The function will reset the total tokens
@@ -377,6 +1006,17 @@ void AutoModel::clear_context() {
     this->last_token = -1;
     this->token_history.clear();
     this->lm_engine->clear_context();
+    if (this->draft_engine != nullptr) {
+        this->draft_engine->clear_context();
+        this->draft_in_sync = true;
+    }
+    if (this->speculator != nullptr) {
+        this->speculator->reset();
+        this->speculator->reset_stats();
+    }
+    if (this->lookup != nullptr) {
+        this->lookup->reset();
+    }
     this->total_tokens = 0;
     this->sampler->reset_penalties();
     for (size_t i = 0; i < PROFILER_TYPE_NUM; i++) {
@@ -384,6 +1024,8 @@ void AutoModel::clear_context() {
     }
     this->last_prefill_time = { 0, "us" };
     this->is_first_prompt = true;
+    this->reuse_prefix = false;
+    this->history_has_payload = false;
 }
 
 
@@ -415,6 +1057,9 @@ void AutoModel::set_max_length(unsigned int MAX_L) {
     if (this->lm_engine != nullptr) {
         this->lm_engine->update_max_length(MAX_L);
     }
+    if (this->draft_engine != nullptr) {
+        this->draft_engine->update_max_length(MAX_L);
+    }
 }
 
 /// \brief Show the model info
@@ -456,6 +1101,30 @@ std::string AutoModel::show_profile() {
     // ss << "    Average token encoding speed: " << this->profiler_list[TKOEN_ENCODE_TIME].get_average_speed() << " tokens/s" << std::endl;
     // ss << "    Average token decoding speed: " << this->profiler_list[TKOEN_DECODE_TIME].get_average_speed() << " tokens/s" << std::endl;
     // ss << "    Average overall speed:        " << this->profiler_list[TOTAL_TIME].get_average_speed() << " tokens/s" << std::endl;
+    if (this->context_shifter != nullptr && this->context_shifter->get_stats().shifts > 0) {
+        const context_shift::stats_t& stats = this->context_shifter->get_stats();
+        time = this->context_shifter->shift_time.get_total_time();
+        ss << "    Context shifts:      " << stats.shifts << " (" << stats.evicted << " tokens evicted, "
+           << stats.reprefilled << " re-prefilled, " << time.first << " " << time.second << ")" << std::endl;
+    }
+    if (this->speculator != nullptr && this->speculator->get_stats().rounds > 0) {
+        const speculative_decoder::stats_t& stats = this->speculator->get_stats();
+        ss << "    Speculative decoding:" << std::endl;
+        if (stats.proposed > 0) {
+            ss << "      Acceptance rate:            " << 100.0 * stats.accepted / stats.proposed << " % ("
+               << stats.accepted << "/" << stats.proposed << ")" << std::endl;
+        }
+        ss << "      Tokens per target pass:     " << (double)stats.emitted / stats.rounds << std::endl;
+        if (stats.lookup_proposed > 0) {
+            ss << "      Prompt lookup acceptance:   " << 100.0 * stats.lookup_accepted / stats.lookup_proposed << " % ("
+               << stats.lookup_accepted << "/" << stats.lookup_proposed << ")" << std::endl;
+        }
+        time = this->speculator->draft_time.get_total_time();
+        ss << "      Draft time:                 " << time.first << " " << time.second << std::endl;
+        time = this->speculator->verify_time.get_total_time();
+        ss << "      Verify time:                " << time.first << " " << time.second << std::endl;
+        ss << "      Effective decoding speed:   " << this->profiler_list[DECODING_TIME].get_average_speed() << " tokens/s" << std::endl;
+    }
 
     return ss.str();
 }
@@ -587,6 +1256,245 @@ void AutoModel::set_penalty_window(int penalty_window) {
     this->sampler->repeat_last_n = penalty_window;
 }
 
+/// \brief Set the sampler seed
+/// \param seed the seed, negative for a random one
+/// \note The same seed with the same prompt and parameters reproduces the same tokens
+void AutoModel::set_seed(i64 seed) {
+    this->sampler->set_seed(seed);
+}
+
+/// \brief Report log-probabilities for the generated tokens
+/// \param enable whether to report them
+/// \param top_n the number of alternatives per token, 0 to 20
+/// \note The function will drop log-probabilities left over from the last request
+void AutoModel::set_logprobs(bool enable, int top_n) {
+    if (top_n < 0 || top_n > 20) {
+        header_print("WARNING", "Top logprobs must be between 0 and 20");
+        top_n = std::clamp(top_n, 0, 20);
+    }
+    this->sampler->set_logprobs(enable, top_n);
+    this->logprob_queue.clear();
+}
+
+bool AutoModel::logprobs_enabled() {
+    return this->sampler->logprobs_enabled();
+}
+
+/// \brief Set the logit bias (OpenAI logit_bias)
+/// \param bias token id and bias pairs, -100 to 100, empty to clear
+/// \note Out-of-range biases are clamped, unknown token ids are ignored
+void AutoModel::set_logit_bias(const std::vector<std::pair<int, float>>& bias) {
+    std::vector<std::pair<int, float>> clamped;
+    clamped.reserve(bias.size());
+    for (const auto& [token_id, value] : bias) {
+        if (value < -100.0f || value > 100.0f) {
+            header_print("WARNING", "Logit bias must be between -100 and 100");
+        }
+        clamped.emplace_back(token_id, std::clamp(value, -100.0f, 100.0f));
+    }
+    this->sampler->set_logit_bias(clamped);
+}
+
+/// \brief Restrict generation to a set of tokens
+/// \param token_ids the allowed token ids, empty to lift the restriction
+/// \note Meant for classification-style prompts with a fixed label set.
+///       The eos tokens stay allowed so the answer can end after the label.
+void AutoModel::set_allowed_tokens(const std::vector<int>& token_ids) {
+    if (token_ids.empty()) {
+        this->sampler->clear_allowed_tokens();
+        return;
+    }
+    std::vector<int> allowed(token_ids);
+    allowed.insert(allowed.end(), this->eos_token_ids.begin(), this->eos_token_ids.end());
+    this->sampler->set_allowed_tokens(allowed);
+}
+
+/// \brief Token bytes of the loaded vocabulary, built on the first grammar request
+/// \note Special and eos tokens get no bytes, so a grammar never matches them as text
+std::shared_ptr<const grammar::TokenTrie> AutoModel::_grammar_vocab() {
+    if (this->grammar_vocab == nullptr) {
+        time_utils::time_point start = time_utils::now();
+        int vocab_size = std::min(this->tokenizer->vocab_size(), this->sampler->in_features);
+        std::vector<std::string> tokens(vocab_size);
+        for (int i = 0; i < vocab_size; i++) {
+            if (!this->tokenizer->is_special(i) && !this->is_eos(i)) {
+                tokens[i] = this->tokenizer->token_bytes(i);
+            }
+        }
+        this->grammar_vocab = std::make_shared<const grammar::TokenTrie>(std::move(tokens));
+        header_print("FLM", "Grammar vocabulary ready in "
+            << time_utils::duration_ns(start, time_utils::now()).first / 1000000 << " ms");
+    }
+    return this->grammar_vocab;
+}
+
+/// \brief Install a grammar, reusing the matcher and its mask cache if nothing changed
+/// \param gbnf the grammar
+/// \param trigger the text that starts a constrained span, empty to constrain from the start
+bool AutoModel::_set_grammar(const std::string& gbnf, const std::string& trigger, std::string* error) {
+    // the grammar mask takes the place of a user allowed-token set
+    this->sampler->clear_allowed_tokens();
+    std::string key = trigger + '\n' + gbnf;
+    if (this->grammar_matcher != nullptr && this->grammar_text == key) {
+        this->grammar_matcher->reset();
+        return true;
+    }
+    try {
+        this->grammar_matcher = std::make_unique<grammar::GrammarMatcher>(
+            grammar::Grammar::from_gbnf(gbnf), this->_grammar_vocab(), this->eos_token_ids, this->sampler->in_features);
+        this->grammar_matcher->set_trigger(trigger);
+        this->grammar_text = key;
+    }
+    catch (const std::exception& e) {
+        header_print("WARNING", "Invalid grammar, generation is not constrained: " << e.what());
+        if (error != nullptr) {
+            *error = std::string("Invalid grammar: ") + e.what();
+        }
+        this->clear_grammar();
+        return false;
+    }
+    return true;
+}
+
+/// \brief Constrain generation with a GBNF grammar
+/// \param gbnf the grammar, start rule "root"
+/// \param error set to the reason when it fails, may be nullptr
+/// \return false if the grammar does not parse, generation is then left free
+bool AutoModel::set_grammar(const std::string& gbnf, std::string* error) {
+    return this->_set_grammar(gbnf, "", error);
+}
+
+/// \brief Constrain generation to JSON matching a schema (response_format, format)
+/// \param schema the JSON schema
+/// \param error set to the reason when it fails, may be nullptr
+/// \return false if the schema cannot be compiled
+bool AutoModel::set_json_schema(const nlohmann::json& schema, std::string* error) {
+    std::string gbnf;
+    try {
+        gbnf = grammar::json_schema_to_gbnf(schema);
+    }
+    catch (const std::exception& e) {
+        header_print("WARNING", "Unsupported JSON schema, generation is not constrained: " << e.what());
+        if (error != nullptr) {
+            *error = std::string("Unsupported JSON schema: ") + e.what();
+        }
+        this->clear_grammar();
+        return false;
+    }
+    return this->_set_grammar(gbnf, "", error);
+}
+
+/// \brief Constrain the tool calls of the answer to the declared tools
+/// \param tools the OpenAI tools array
+/// \return false if the model has no tool-call markers or no tool has a name
+bool AutoModel::set_tool_grammar(const nlohmann::ordered_json& tools) {
+    auto [open_marker, close_marker] = this->tool_call_markers();
+    std::string gbnf;
+    if (!open_marker.empty()) {
+        try {
+            gbnf = grammar::tool_calls_to_gbnf(tools, close_marker);
+        }
+        catch (const std::exception& e) {
+            header_print("WARNING", "Unsupported tool parameters, tool calls are not constrained: " << e.what());
+        }
+    }
+    if (gbnf.empty()) {
+        this->clear_grammar();
+        return false;
+    }
+    return this->_set_grammar(gbnf, open_marker);
+}
+
+/// \brief Set the number of tokens per prefill call
+/// \param chunk the chunk size, 0 to prefill a prompt in one call
+void AutoModel::set_prefill_chunk(int chunk) {
+    this->prefill_chunk = std::max(chunk, 0);
+}
+
+/// \brief Set the cancellation and progress callbacks of the next insert or load_session
+/// \param is_cancelled checked between chunks, nullptr never cancels
+/// \param on_progress called after each chunk with the tokens done and the total, may be nullptr
+void AutoModel::set_prefill_hooks(std::function<bool()> is_cancelled, std::function<void(int, int)> on_progress) {
+    this->prefill_hooks.is_cancelled = std::move(is_cancelled);
+    this->prefill_hooks.on_progress = std::move(on_progress);
+}
+
+/// \brief End generation on any of several strings (OpenAI stop, Ollama options.stop)
+/// \param stops the stop sequences, empty to clear; the matched one is not emitted
+void AutoModel::set_stop_sequences(const std::vector<std::string>& stops) {
+    auto matcher = std::make_unique<stop_matcher>(stops);
+    if (matcher->empty()) {
+        this->stop_sequences.reset();
+        return;
+    }
+    this->stop_sequences = std::move(matcher);
+}
+
+/// \brief Drop the grammar, generation is free again
+void AutoModel::clear_grammar() {
+    if (this->grammar_matcher != nullptr) {
+        this->sampler->clear_allowed_tokens();
+    }
+    this->grammar_matcher.reset();
+    this->grammar_text.clear();
+}
+
+/// \brief Sample a token under the grammar of the request, if any
+/// \param y the logits
+/// \return the sampled token, eos if the grammar allows no token at all
+/// \note An empty mask is a dead grammar state; sampling the full vocabulary there would
+///       break the constraint, so generation ends with stop reason ERROR_DETECTED
+int AutoModel::_sample(buffer<bf16>& y) {
+    if (this->grammar_matcher == nullptr) {
+        return this->sampler->sample(y);
+    }
+    if (this->grammar_matcher->active()) {
+        const std::vector<u64>& mask = this->grammar_matcher->allowed_mask();
+        if (std::all_of(mask.begin(), mask.end(), [](u64 word) { return word == 0; })) {
+            header_print("WARNING", "No token fits the grammar, stopping generation");
+            this->grammar_stalled = true;
+            return this->eos_token_ids.front();
+        }
+        this->sampler->set_allowed_mask(mask);
+    }
+    else {
+        this->sampler->clear_allowed_tokens();
+    }
+    int token = this->sampler->sample(y);
+    if (!this->grammar_matcher->accept(token)) {
+        header_print("WARNING", "Sampled token " << token << " does not fit the grammar");
+    }
+    return token;
+}
+
+/// \brief Take the queued log-probabilities in OpenAI format
+/// \return the "content" array of an OpenAI logprobs object, the queue is emptied
+json AutoModel::take_logprobs_json() {
+    auto entry = [this](const token_logprob_t& t) {
+        std::string token_str = this->tokenizer->run_time_decoder(t.token_id);
+        json bytes = json::array();
+        for (unsigned char c : token_str) {
+            bytes.push_back(int(c));
+        }
+        // -inf is not valid JSON, OpenAI reports -9999 for such tokens
+        float logprob = std::isfinite(t.logprob) ? t.logprob : -9999.0f;
+        return json{{"token", token_str}, {"logprob", logprob}, {"bytes", bytes}};
+    };
+
+    json content = json::array();
+    for (const token_logprobs_t& lp : this->logprob_queue) {
+        json item = entry(lp.chosen);
+        json top = json::array();
+        for (const token_logprob_t& t : lp.top) {
+            top.push_back(entry(t));
+        }
+        item["top_logprobs"] = top;
+        content.push_back(item);
+    }
+    this->logprob_queue.clear();
+    return content;
+}
+
 /// \brief Start the ttft timer
 /// \note The function will start the ttft timer
 /// \note The function will reset the ttft timer
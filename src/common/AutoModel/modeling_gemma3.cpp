@@ -45,7 +45,7 @@ void Gemma3::setup_tokenizer(std::string model_path) {
 
 std::string Gemma3::apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools) {
     minja::chat_template_inputs inputs;
-    inputs.add_generation_prompt = true;
+    inputs.add_generation_prompt = this->add_generation_prompt;
     inputs.messages = messages;
     inputs.extra_context = this->extra_context;
     return this->chat_tmpl->apply(inputs);
@@ -93,42 +93,24 @@ bool Gemma3::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
         header_print("FLM", "Total images: " << total_images);
         // temporary solution
         if (total_images > 0){
-            pixel_values.resize(3 * 896 * 896 * sizeof(bf16) * total_images);
-            uint8_t* pixel_values_ptr = pixel_values.data();
+            std::vector<std::pair<std::string, bool>> image_sources;
             for (auto& message : input.messages){
                 nlohmann::ordered_json::array_t images = message.value("images", nlohmann::ordered_json::array());
                 for (auto& image : images){
-                    std::string image_str = image.get<std::string>();
-                    bytes image_rgb = load_image_base64(image_str);
-                    buffer<bf16> pv = preprocess_image(image_rgb);
-                    memcpy(pixel_values_ptr, pv.data(), pv.size() * sizeof(bf16));
-                    pixel_values_ptr += pv.size() * sizeof(bf16);
+                    image_sources.emplace_back(image.get<std::string>(), true);
                 }
             }
+            preprocess_images(image_sources, pixel_values);
         }
     }
     else { // from cli, typically only one image, typically a file path
         if (input.images.size() > 0){
-            pixel_values.resize(3 * 896 * 896 * sizeof(bf16) * input.images.size());
-            uint8_t* pixel_values_ptr = pixel_values.data();
             auto start_time = std::chrono::high_resolution_clock::now();
+            std::vector<std::pair<std::string, bool>> image_sources;
             for (auto& image : input.images){
-                bytes image_rgb = load_image(image);
-                if (image_rgb.size() == 0){
-                    header_print("FLM", "Error: Could not load image: " << image);
-                    header_print("FLM", "Please check if the file exists and is readable.");
-                    continue;
-                }
-                
-                buffer<bf16> pv = preprocess_image(image_rgb);
-                if (pv.size() == 0){
-                    header_print("FLM", "Error: Could not preprocess image: " << image);
-                    header_print("FLM", "Please check if the image is valid.");
-                    continue;
-                }
-                memcpy(pixel_values_ptr, pv.data(), pv.size() * sizeof(bf16));
-                pixel_values_ptr += pv.size() * sizeof(bf16);
+                image_sources.emplace_back(image, false);
             }
+            preprocess_images(image_sources, pixel_values);
             auto end_time = std::chrono::high_resolution_clock::now();
             auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
             header_print("FLM", "Image loaded in " << duration.count() << "ms");
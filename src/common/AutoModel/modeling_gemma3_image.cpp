@@ -7,14 +7,19 @@
 
 #include "AutoModel/modeling_gemma3.hpp"
 
-bytes Gemma3::load_image(const std::string& filename) {
+bytes Gemma3::load_image(const std::string& filename, ImageReader& image_reader_) {
     constexpr int target_width = 896;
     constexpr int target_height = 896;
 
+    // a large photo decodes reduced, down to twice the model input
+    const decode_target_t decode_target = [=](int width, int height, int& resized_width, int& resized_height) {
+        resized_width = target_width;
+        resized_height = target_height;
+    };
     image_data_t decoded;
     image_data_t resized;
 
-    if (!image_reader_.load_image(filename, decoded)) {
+    if (!image_reader_.load_image(filename, decoded, decode_target)) {
         return bytes();
     }
 
@@ -30,14 +35,19 @@ bytes Gemma3::load_image(const std::string& filename) {
     return result;
 }
 
-bytes Gemma3::load_image_base64(const std::string& base64_string) {
+bytes Gemma3::load_image_base64(const std::string& base64_string, ImageReader& image_reader_) {
     constexpr int target_width = 896;
     constexpr int target_height = 896;
 
+    // a large photo decodes reduced, down to twice the model input
+    const decode_target_t decode_target = [=](int width, int height, int& resized_width, int& resized_height) {
+        resized_width = target_width;
+        resized_height = target_height;
+    };
     image_data_t decoded;
     image_data_t resized;
 
-    if (!image_reader_.load_image_base64(base64_string, decoded)) {
+    if (!image_reader_.load_image_base64(base64_string, decoded, decode_target)) {
         return bytes();
     }
 
@@ -55,34 +65,82 @@ bytes Gemma3::load_image_base64(const std::string& base64_string) {
 
 ///@brief: preprocess the image for gemma3 model
 ///@note: 1. Reorder: 896x896x3 -> 3x896x896
-///@param: image: the image to preprocess
-///@return: the preprocessed image
-buffer<bf16> Gemma3::preprocess_image(bytes& image) {
-    buffer<bf16> result(3 * 896 * 896);
-    const int total_pixels = 896 * 896;
-    image_data_t input;
-    input.width = 896;
-    input.height = 896;
-    input.pixels = image;
-
-    image_data_t chw;
-    if (!image_reader_.reorder_hwc_to_chw(input, chw) || chw.pixels.size() < static_cast<size_t>(total_pixels) * 3) {
+///        2. Normalize: (x / 255 - 0.5) / 0.5, as bf16
+///        in one vectorized read of the resized image
+///@param: image: the image to preprocess, 896x896 RGB, released afterwards
+///@param: pixel_values: where the 3x896x896 values go
+///@return: false if the image is not 896x896x3
+bool Gemma3::preprocess_image(bytes& image, bf16* pixel_values) {
+    const size_t total_pixels = 896 * 896;
+    if (image.size() < total_pixels * 3) {
         image.release();
-        return result;
+        return false;
     }
+    imgproc::hwc_to_chw_normalize_bf16_optimized(image.data(), total_pixels, 1.0f / 255.0f, 0.5f, 0.5f, pixel_values);
+    image.release();
+    return true;
+}
 
-    const uint8_t* src = chw.pixels.data();
-    const float scale = 1.0f / 255.0f;
+///@brief: decode and preprocess the images of a request on the shared worker pool
+///@note: a client resends the images of the conversation every turn; a base64 image seen
+///       before is copied from the image cache instead of decoded again. Each image is
+///       written to its own slice of the payload, so the result does not depend on the
+///       worker order.
+///@param: sources: the images in request order, a base64 string (true) or a file path (false) each
+///@param: pixel_values: 3x896x896 values per image, in request order; a failed image stays zero
+void Gemma3::preprocess_images(const std::vector<std::pair<std::string, bool>>& sources, bytes& pixel_values) {
+    constexpr size_t image_values = 3 * 896 * 896;
+    worker_pool& pool = worker_pool::shared();
+    while (this->image_readers_.size() < pool.workers()) {
+        this->image_readers_.push_back(std::make_unique<ImageReader>());
+    }
+    pixel_values.resize(image_values * sizeof(bf16) * sources.size());
+    bf16* payload = reinterpret_cast<bf16*>(pixel_values.data());
+    std::vector<int> failed(sources.size(), 0); // 1: not loaded, 2: not preprocessed
+
+    pool.run(sources.size(), [&](size_t i, size_t worker) {
+        const auto& [source, is_base64] = sources[i];
+        bf16* slice = payload + i * image_values;
+        std::string key;
+        if (is_base64 && this->preprocessed_images != nullptr) {
+            key = image_cache::key(source, "gemma3:896x896");
+            std::shared_ptr<const preprocessed_image_t> cached = this->preprocessed_images->get(key);
+            if (cached != nullptr) {
+                std::copy(cached->pixels.begin(), cached->pixels.end(), slice);
+                return;
+            }
+        }
 
-    for (int c = 0; c < 3; ++c) {
-        const size_t channel_offset = static_cast<size_t>(c) * total_pixels;
-        for (int i = 0; i < total_pixels; ++i) {
-            float normalized = (static_cast<float>(src[channel_offset + i]) * scale - 0.5f) * 2.0f;
-            result[channel_offset + i] = bf16(normalized);
+        ImageReader& reader = *this->image_readers_[worker];
+        bytes image_rgb = is_base64 ? this->load_image_base64(source, reader) : this->load_image(source, reader);
+        if (image_rgb.size() == 0) {
+            failed[i] = 1;
         }
-    }
+        else if (!this->preprocess_image(image_rgb, slice)) {
+            failed[i] = 2;
+        }
+        if (failed[i] != 0) {
+            std::fill(slice, slice + image_values, bf16(0.0f));
+            return;
+        }
+        if (!key.empty()) {
+            auto entry = std::make_shared<preprocessed_image_t>();
+            entry->pixels.assign(slice, slice + image_values);
+            entry->width_resized = 896;
+            entry->height_resized = 896;
+            this->preprocessed_images->put(key, std::move(entry));
+        }
+    });
 
-    image_reader_.recycle(chw);
-    image.release();
-    return result;
+    for (size_t i = 0; i < sources.size(); i++) {
+        const std::string name = sources[i].second ? "image " + std::to_string(i + 1) : sources[i].first;
+        if (failed[i] == 1) {
+            header_print("FLM", "Error: Could not load image: " << name);
+            header_print("FLM", "Please check if the file exists and is readable.");
+        }
+        else if (failed[i] == 2) {
+            header_print("FLM", "Error: Could not preprocess image: " << name);
+            header_print("FLM", "Please check if the image is valid.");
+        }
+    }
 }
@@ -47,7 +47,7 @@ void Gemma3_Text_Only::setup_tokenizer(std::string model_path) {
 
 std::string Gemma3_Text_Only::apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools) {
     minja::chat_template_inputs inputs;
-    inputs.add_generation_prompt = true;
+    inputs.add_generation_prompt = this->add_generation_prompt;
     inputs.messages = messages;
     inputs.extra_context = this->extra_context;
     return this->chat_tmpl->apply(inputs);
@@ -56,22 +56,20 @@ std::string Gemma3_Text_Only::apply_chat_template(nlohmann::ordered_json& messag
 bool Gemma3_Text_Only::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
     // preprocess
     this->profiler_list[TKOEN_ENCODE_TIME].start();
-    std::string templated_text;
+    std::vector<int> tokens;
     if (input.messages.empty() && input.prompt.empty()) {
         header_print("WARNING", "No messages or prompt provided");
         return false;
     }
     if (!input.messages.empty()) { // already a formated messages, usually from REST API
-        templated_text = this->apply_chat_template(input.messages);
+        tokens = this->_encode_messages(input.messages);
     }
     else if (!input.prompt.empty()) { // a pure text, usually from the cli
         nlohmann::ordered_json messages;
 
         messages.push_back({ {"role", "user"}, {"content", input.prompt} });
-        templated_text = this->apply_chat_template(messages);
+        tokens = this->tokenizer->encode(this->apply_chat_template(messages));
     }
-
-    std::vector<int> tokens = this->tokenizer->encode(templated_text);
     
     // some models are very sensitive to this bos token, such as lfm2
     if (this->is_first_prompt == false) {
@@ -41,7 +41,7 @@ void GPT_OSS::setup_tokenizer(std::string model_path){
 
 std::string GPT_OSS::apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools) {
     minja::chat_template_inputs inputs;
-    inputs.add_generation_prompt = true;
+    inputs.add_generation_prompt = this->add_generation_prompt;
     inputs.messages = messages;
     inputs.extra_context = this->extra_context;
     inputs.extra_context["enable_thinking"] = this->enable_think;
@@ -57,25 +57,23 @@ bool GPT_OSS::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input)
 {
     // preprocess
     this->profiler_list[TKOEN_ENCODE_TIME].start();
-    std::string templated_text;
+    std::vector<int> tokens;
     if (input.messages.empty() && input.prompt.empty()) {
         header_print("WARNING", "No messages or prompt provided");
         return false;
     }
     if (!input.messages.empty()) { // already a formated messages, usually from REST API
         tools = input.tools;
-        templated_text = this->apply_chat_template(input.messages);
+        tokens = this->_encode_messages(input.messages);
         //templated_text = this->apply_chat_template(input.messages, input.tools);
     }
     else if (!input.prompt.empty()) { // a pure text, usually from the cli
         nlohmann::ordered_json messages;
 
         messages.push_back({ {"role", "user"}, {"content", input.prompt} });
-        templated_text = this->apply_chat_template(messages);
+        tokens = this->tokenizer->encode(this->apply_chat_template(messages));
     }
 
-    std::vector<int> tokens = this->tokenizer->encode(templated_text);
-
     this->profiler_list[TKOEN_ENCODE_TIME].stop(tokens.size());
     return this->_shared_insert(meta_info, tokens);
 
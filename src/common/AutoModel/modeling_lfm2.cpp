@@ -48,7 +48,7 @@ std::string LFM2::apply_chat_template(nlohmann::ordered_json& messages, nlohmann
     minja::chat_template_inputs inputs;
     minja::chat_template_options opt;
     opt.polyfill_tool_responses = false;
-    inputs.add_generation_prompt = true;
+    inputs.add_generation_prompt = this->add_generation_prompt;
     inputs.messages = messages;
     inputs.extra_context = this->extra_context;
     // inputs.tools = tools;
@@ -58,23 +58,21 @@ std::string LFM2::apply_chat_template(nlohmann::ordered_json& messages, nlohmann
 bool LFM2::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
     // preprocess
     this->profiler_list[TKOEN_ENCODE_TIME].start();
-    std::string templated_text;
+    std::vector<int> tokens;
     if (input.messages.empty() && input.prompt.empty()) {
         header_print("WARNING", "No messages or prompt provided");
         return false;
     }
     if (!input.messages.empty()) { // already a formated messages, usually from REST API
         //templated_text = this->apply_chat_template(input.messages);
-        templated_text = this->apply_chat_template(input.messages, input.tools);
+        tokens = this->_encode_messages(input.messages, input.tools);
     }
     else if (!input.prompt.empty()) { // a pure text, usually from the cli
         nlohmann::ordered_json messages;
 
         messages.push_back({ {"role", "user"}, {"content", input.prompt} });
-        templated_text = this->apply_chat_template(messages);
+        tokens = this->tokenizer->encode(this->apply_chat_template(messages));
     }
-
-    std::vector<int> tokens = this->tokenizer->encode(templated_text);
     
     // some models are very sensitive to this bos token, such as lfm2
     if (this->is_first_prompt == false) {
@@ -84,30 +82,7 @@ bool LFM2::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
 
     this->profiler_list[TKOEN_ENCODE_TIME].stop(tokens.size());
     // hardware
-    if (this->total_tokens + tokens.size() >= this->MAX_L){
-        header_print("WARNING", "Max length reached, stopping prefilling...");
-        return false;
-    }
-    for (int token : tokens){
-        this->token_history.push_back(token);
-    }
-    buffer<bf16> y;
-
-    auto prefill_start_time = this->profiler_list[PREFILL_TIME].start();
-    y = this->lm_engine->prefill(tokens, nullptr);
-
-
-    auto prefill_end_time = this->profiler_list[PREFILL_TIME].stop(tokens.size());
-    meta_info.prefill_duration = (uint64_t)time_utils::duration_ns(prefill_start_time, prefill_end_time).first;
-    meta_info.prompt_tokens = tokens.size();
-    this->total_tokens += tokens.size() + 1;
-    if (this->total_tokens >= this->MAX_L){
-        header_print("WARNING", "Max length reached, stopping prefilling...");
-    }
-    this->profiler_list[SAMPLING_TIME].start();
-    this->last_token = this->sampler->sample(y);
-    this->profiler_list[SAMPLING_TIME].stop(1);
-    return true;
+    return this->_shared_insert(meta_info, tokens);
 }
 
 
@@ -333,7 +308,7 @@ std::string LFM2_5_TK::apply_chat_template(nlohmann::ordered_json& messages, nlo
     minja::chat_template_inputs inputs;
     minja::chat_template_options opt;
     opt.polyfill_tool_responses = false;
-    inputs.add_generation_prompt = true;
+    inputs.add_generation_prompt = this->add_generation_prompt;
     inputs.messages = messages;
     inputs.extra_context = this->extra_context;
     inputs.tools = tools;
@@ -343,23 +318,21 @@ std::string LFM2_5_TK::apply_chat_template(nlohmann::ordered_json& messages, nlo
 bool LFM2_5_TK::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
     // preprocess
     this->profiler_list[TKOEN_ENCODE_TIME].start();
-    std::string templated_text;
+    std::vector<int> tokens;
     if (input.messages.empty() && input.prompt.empty()) {
         header_print("WARNING", "No messages or prompt provided");
         return false;
     }
     if (!input.messages.empty()) { // already a formated messages, usually from REST API
         //templated_text = this->apply_chat_template(input.messages);
-        templated_text = this->apply_chat_template(input.messages, input.tools);
+        tokens = this->_encode_messages(input.messages, input.tools);
     }
     else if (!input.prompt.empty()) { // a pure text, usually from the cli
         nlohmann::ordered_json messages;
 
         messages.push_back({ {"role", "user"}, {"content", input.prompt} });
-        templated_text = this->apply_chat_template(messages);
+        tokens = this->tokenizer->encode(this->apply_chat_template(messages));
     }
-
-    std::vector<int> tokens = this->tokenizer->encode(templated_text);
     
     // some models are very sensitive to this bos token, such as lfm2
     if (this->is_first_prompt == false) {
@@ -369,30 +342,7 @@ bool LFM2_5_TK::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
 
     this->profiler_list[TKOEN_ENCODE_TIME].stop(tokens.size());
     // hardware
-    if (this->total_tokens + tokens.size() >= this->MAX_L){
-        header_print("WARNING", "Max length reached, stopping prefilling...");
-        return false;
-    }
-    for (int token : tokens){
-        this->token_history.push_back(token);
-    }
-    buffer<bf16> y;
-
-    auto prefill_start_time = this->profiler_list[PREFILL_TIME].start();
-    y = this->lm_engine->prefill(tokens, nullptr);
-
-
-    auto prefill_end_time = this->profiler_list[PREFILL_TIME].stop(tokens.size());
-    meta_info.prefill_duration = (uint64_t)time_utils::duration_ns(prefill_start_time, prefill_end_time).first;
-    meta_info.prompt_tokens = tokens.size();
-    this->total_tokens += tokens.size() + 1;
-    if (this->total_tokens >= this->MAX_L){
-        header_print("WARNING", "Max length reached, stopping prefilling...");
-    }
-    this->profiler_list[SAMPLING_TIME].start();
-    this->last_token = this->sampler->sample(y);
-    this->profiler_list[SAMPLING_TIME].stop(1);
-    return true;
+    return this->_shared_insert(meta_info, tokens);
 }
 
 
@@ -44,7 +44,7 @@ void Llama3::setup_tokenizer(std::string model_path) {
 
 std::string Llama3::apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools) {
     minja::chat_template_inputs inputs;
-    inputs.add_generation_prompt = true;
+    inputs.add_generation_prompt = this->add_generation_prompt;
     inputs.messages = messages;
     inputs.extra_context = this->extra_context;
     return this->chat_tmpl->apply(inputs);
@@ -53,23 +53,21 @@ std::string Llama3::apply_chat_template(nlohmann::ordered_json& messages, nlohma
 bool Llama3::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
     // preprocess
     this->profiler_list[TKOEN_ENCODE_TIME].start();
-    std::string templated_text;
+    std::vector<int> tokens;
     if (input.messages.empty() && input.prompt.empty()) {
         header_print("WARNING", "No messages or prompt provided");
         return false;
     }
     if (!input.messages.empty()) { // already a formated messages, usually from REST API
-        templated_text = this->apply_chat_template(input.messages);
+        tokens = this->_encode_messages(input.messages);
     }
     else if (!input.prompt.empty()) { // a pure text, usually from the cli
         nlohmann::ordered_json messages;
 
         messages.push_back({ {"role", "user"}, {"content", input.prompt} });
-        templated_text = this->apply_chat_template(messages);
+        tokens = this->tokenizer->encode(this->apply_chat_template(messages));
     }
 
-    std::vector<int> tokens = this->tokenizer->encode(templated_text);
-
     // some models are very sensitive to this bos token, such as lfm2
     if (this->is_first_prompt == false) {
         tokens.erase(tokens.begin()); // remove bos token in multi round conversation
@@ -134,7 +132,7 @@ void DeepSeek_r1_8b::setup_tokenizer(std::string model_path) {
 
 std::string DeepSeek_r1_8b::apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools) {
     minja::chat_template_inputs inputs;
-    inputs.add_generation_prompt = true;
+    inputs.add_generation_prompt = this->add_generation_prompt;
     inputs.messages = messages;
     inputs.extra_context = this->extra_context;
     return this->chat_tmpl->apply(inputs);
@@ -143,23 +141,21 @@ std::string DeepSeek_r1_8b::apply_chat_template(nlohmann::ordered_json& messages
 bool DeepSeek_r1_8b::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
     // preprocess
     this->profiler_list[TKOEN_ENCODE_TIME].start();
-    std::string templated_text;
+    std::vector<int> tokens;
     if (input.messages.empty() && input.prompt.empty()) {
         header_print("WARNING", "No messages or prompt provided");
         return false;
     }
     if (!input.messages.empty()) { // already a formated messages, usually from REST API
-        templated_text = this->apply_chat_template(input.messages);
+        tokens = this->_encode_messages(input.messages);
     }
     else if (!input.prompt.empty()) { // a pure text, usually from the cli
         nlohmann::ordered_json messages;
 
         messages.push_back({ {"role", "user"}, {"content", input.prompt} });
-        templated_text = this->apply_chat_template(messages);
+        tokens = this->tokenizer->encode(this->apply_chat_template(messages));
     }
 
-    std::vector<int> tokens = this->tokenizer->encode(templated_text);
-
     // some models are very sensitive to this bos token, such as lfm2
     if (this->is_first_prompt == false) {
         tokens.erase(tokens.begin()); // remove bos token in multi round conversation
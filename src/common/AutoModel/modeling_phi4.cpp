@@ -81,7 +81,7 @@ void Phi4::setup_tokenizer(std::string model_path) {
 
 std::string Phi4::apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools) {
     minja::chat_template_inputs inputs;
-    inputs.add_generation_prompt = true;
+    inputs.add_generation_prompt = this->add_generation_prompt;
     inputs.messages = messages;
     inputs.extra_context = this->extra_context;
     return this->chat_tmpl->apply(inputs);
@@ -90,22 +90,20 @@ std::string Phi4::apply_chat_template(nlohmann::ordered_json& messages, nlohmann
 bool Phi4::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
     // preprocess
     this->profiler_list[TKOEN_ENCODE_TIME].start();
-    std::string templated_text;
+    std::vector<int> tokens;
     if (input.messages.empty() && input.prompt.empty()) {
         header_print("WARNING", "No messages or prompt provided");
         return false;
     }
     if (!input.messages.empty()) { // already a formated messages, usually from REST API
-        templated_text = this->apply_chat_template(input.messages);
+        tokens = this->_encode_messages(input.messages);
     }
     else if (!input.prompt.empty()) { // a pure text, usually from the cli
         nlohmann::ordered_json messages;
 
         messages.push_back({ {"role", "user"}, {"content", input.prompt} });
-        templated_text = this->apply_chat_template(messages);
+        tokens = this->tokenizer->encode(this->apply_chat_template(messages));
     }
-
-    std::vector<int> tokens = this->tokenizer->encode(templated_text);
     this->profiler_list[TKOEN_ENCODE_TIME].stop(tokens.size());
     // hardware
 
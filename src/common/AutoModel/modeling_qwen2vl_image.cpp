@@ -178,8 +178,9 @@ void Qwen2VL::preprocess_image(qwen2vl_image_t& image, std::vector<bf16> &pixel_
     );
     // std::cout << "resized_height "<< resized_height << " resized_width " << resized_width <<std::endl;
 
-    // Use non-optimized path for consistent results across platforms
-    auto resize_image =  imgproc::avx512::resize_bicubic_antialias_rgb_planar_avx512(
+    // AVX-512, AVX2 or scalar kernel, whichever this CPU runs; the SIMD resize may differ
+    // from the scalar one by a level, so pixel values depend on the CPU tier
+    auto resize_image =  imgproc::resize_bicubic_antialias_rgb_planar_optimized(
         image._data.data(), width, height, resized_width, resized_height, true
     );
 
@@ -242,7 +243,7 @@ void Qwen2VL::preprocess_image(qwen2vl_image_t& image, std::vector<bf16> &pixel_
     }
     
     // Apply rescale and normalization to first frame
-    imgproc::avx512::rescale_and_normalize_avx512(
+    imgproc::rescale_and_normalize_optimized(
         resize_image.data(), patch_vector_scratch.data(),
         resized_width, resized_height, channels,
         true, QWEN2_VISION_RESCALE_FACTOR,
@@ -47,7 +47,7 @@ void Qwen3VL::setup_tokenizer(std::string model_path) {
 
 std::string Qwen3VL::apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools) {
     minja::chat_template_inputs inputs;
-    inputs.add_generation_prompt = true;
+    inputs.add_generation_prompt = this->add_generation_prompt;
     inputs.messages = messages;
     
     if (!tools.empty())
@@ -69,20 +69,10 @@ bool Qwen3VL::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
     constexpr bool DEBUG_IMAGE_PREPROCESS = false;
     qwen3vl_image_payload_t image_payload;
     image_payload.num_images = 0;
-    if (input.images.size() > 0) {
-
-
-        // header_print("info", "Processing images...");
-        
-        // time_utils::time_point preprocess_start = time_utils::now();
-        for(const auto& img_str : input.images){
-            qwen3vl_image_t image = this->load_image(img_str);
-            
-            preprocess_image(image, image_payload._data__processed);
-            // Push the image AFTER preprocessing so grid_h and grid_w are set
-            image_payload.images.push_back(image);
-            image_payload.num_images++;
-        } 
+    // All images of the request, file paths first, then the base64 images of the messages
+    std::vector<std::pair<std::string, bool>> image_sources;
+    for (const auto& img_str : input.images) {
+        image_sources.emplace_back(img_str, false);
     }
     if (!input.messages.empty()) { // already a formated messages, usually from REST API
         json qwenvl_message = json::array();
@@ -121,10 +111,7 @@ bool Qwen3VL::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
                     if (!img_str.empty()) {
                         total_images++;
                     }
-                    qwen3vl_image_t image = this->load_image_base64(img_str);
-                    preprocess_image(image, image_payload._data__processed);
-                    image_payload.images.push_back(image);
-                    image_payload.num_images++;
+                    image_sources.emplace_back(img_str, true);
                 }
             }
         }
@@ -153,6 +140,8 @@ bool Qwen3VL::insert(chat_meta_info_t& meta_info, lm_uniform_input_t& input) {
         messages.push_back(content);
         templated_text = this->apply_chat_template(messages);
     }
+    // Decode and preprocess them concurrently, each into its own slice of the payload
+    this->preprocess_images(image_sources, image_payload);
     std::vector<int> tokens_init = this->tokenizer->encode(templated_text);
 
     // update the tokens to include the image tokens
@@ -7,42 +7,80 @@
 
 #include "AutoModel/modeling_qwen3vl.hpp"
 
-qwen3vl_image_t Qwen3VL::load_image(const std::string& filename) {
-    qwen3vl_image_t empty_result;
-    image_data_t decoded;
-    image_data_t reordered;
-    if (!image_reader_.load_image(filename, decoded)) {
-        return empty_result;
+///@brief: the size the pre-resize option takes an image to
+///@param: width, height: the image as encoded
+///@param: target_width, target_height: the pre-resized size
+///@return: false if the option leaves the image as it is
+bool Qwen3VL::pre_resize(int width, int height, int& target_width, int& target_height) {
+    int max_height;
+    switch(this->image_pre_resize) {
+        case 1:
+            max_height = 480;
+            break;
+        case 2:
+            max_height = 720;
+            break;
+        case 3:
+            max_height = 1080;
+            break;
+        case 4:
+            max_height = 1440;
+            break;
+        default:
+            max_height = height; // no resizing
+            break;
     }
+    if (height <= max_height) {
+        return false;
+    }
+    float ratio = static_cast<float>(max_height) / static_cast<float>(height);
+    target_width = static_cast<int>(static_cast<float>(width) * ratio);
+    target_height = max_height;
+    return true;
+}
 
-    if (this->image_pre_resize > 0) {
-        int max_height;
-        switch(this->image_pre_resize) {
-            case 1:
-                max_height = 480;
-                break;
-            case 2:
-                max_height = 720;
-                break;
-            case 3:
-                max_height = 1080;
-                break;
-            case 4:
-                max_height = 1440;
-            default:
-                max_height = decoded.height; // no resizing
-                break;
-        }
+///@brief: the decode target of an image, the size the model resizes it to
+///@note: a phone photo or a 4K screenshot decodes reduced when the pre-resize option or the
+///       smart resize takes it well below its encoded size
+decode_target_t Qwen3VL::decode_target() {
+    return [this](int width, int height, int& target_width, int& target_height) {
+        int resized_width = width;
+        int resized_height = height;
+        this->pre_resize(width, height, resized_width, resized_height);
+        smart_resize(
+            resized_height, resized_width,
+            target_height, target_width,
+            QWEN3_PATCH_SIZE * QWEN3_IMAGE_MERGE_SIZE,
+            QWEN3_SHORTEST_EDGE,
+            QWEN3_LONGEST_EDGE
+        );
+    };
+}
 
-        if (decoded.height > max_height) {
+///@brief: pre-resize, reorder to CHW and plan a decoded image
+///@note: the plan starts from the size of a full decode, so a reduced decode gets the same grid;
+///       a reduced decode already at or below the pre-resize size is not resized, that would upscale
+qwen3vl_image_t Qwen3VL::finish_image(image_data_t& decoded, ImageReader& image_reader_) {
+    qwen3vl_image_t empty_result{};
+    image_data_t reordered;
+    int width = decoded.source_width;
+    int height = decoded.source_height;
+
+    int target_width;
+    int target_height;
+    if (this->image_pre_resize > 0 && this->pre_resize(width, height, target_width, target_height)) {
+        if (decoded.width <= target_width && decoded.height <= target_height) {
+            width = target_width;
+            height = target_height;
+        }
+        else {
             image_data_t resized_image;
-            float ratio = static_cast<float>(max_height) / static_cast<float>(decoded.height);
-            int target_width = static_cast<int>(static_cast<float>(decoded.width) * ratio);
-            int target_height = max_height;
-            header_print_r("FLM", "Qwen3VL resizing image from (" + std::to_string(decoded.width) + ", " + std::to_string(decoded.height) + ") to (" + std::to_string(target_width) + ", " + std::to_string(target_height) + ")\n");
+            header_print_r("FLM", "Qwen3VL resizing image from (" + std::to_string(decoded.width) + ", " + std::to_string(decoded.height) + ") to (" + std::to_string(target_width) + ", " + std::to_string(target_height) + ")");
             if (image_reader_.resize_image(decoded, target_width, target_height, resized_image)) {
                 image_reader_.recycle(decoded);
                 decoded = std::move(resized_image);
+                width = target_width;
+                height = target_height;
             }
         }
     }
@@ -54,67 +92,29 @@ qwen3vl_image_t Qwen3VL::load_image(const std::string& filename) {
 
     image_reader_.recycle(decoded);
 
-    qwen3vl_image_t result;
+    qwen3vl_image_t result{};
     result.width = reordered.width;
     result.height = reordered.height;
     result._data = std::move(reordered.pixels);
     image_reader_.recycle(reordered);
+    this->plan_image(result, width, height);
     return result;
 }
 
-qwen3vl_image_t Qwen3VL::load_image_base64(const std::string& base64_string) {
-    qwen3vl_image_t empty_result;
+qwen3vl_image_t Qwen3VL::load_image(const std::string& filename, ImageReader& image_reader_) {
     image_data_t decoded;
-    image_data_t reordered;
-    if (!image_reader_.load_image_base64(base64_string, decoded)) {
-        return empty_result;
+    if (!image_reader_.load_image(filename, decoded, this->decode_target())) {
+        return qwen3vl_image_t{};
     }
+    return this->finish_image(decoded, image_reader_);
+}
 
-    if (this->image_pre_resize > 0) {
-        int max_height;
-        switch(this->image_pre_resize) {
-            case 1:
-                max_height = 480;
-                break;
-            case 2:
-                max_height = 720;
-                break;
-            case 3:
-                max_height = 1080;
-                break;
-            case 4:
-                max_height = 1440;
-                break;
-            default:
-                max_height = decoded.height; // no resizing
-                break;
-        }
-
-        if (decoded.height > max_height) {
-            image_data_t resized_image;
-            float ratio = static_cast<float>(max_height) / static_cast<float>(decoded.height);
-            int target_width = static_cast<int>(static_cast<float>(decoded.width) * ratio);
-            int target_height = max_height;
-            header_print_r("FLM", "Qwen3VL resizing image from (" + std::to_string(decoded.width) + ", " + std::to_string(decoded.height) + ") to (" + std::to_string(target_width) + ", " + std::to_string(target_height) + ")");
-            if (image_reader_.resize_image(decoded, target_width, target_height, resized_image)) {
-                image_reader_.recycle(decoded);
-                decoded = std::move(resized_image);
-            }
-        }
-    }
-    if (!image_reader_.reorder_hwc_to_chw(decoded, reordered)) {
-        image_reader_.recycle(decoded);
-        return empty_result;
+qwen3vl_image_t Qwen3VL::load_image_base64(const std::string& base64_string, ImageReader& image_reader_) {
+    image_data_t decoded;
+    if (!image_reader_.load_image_base64(base64_string, decoded, this->decode_target())) {
+        return qwen3vl_image_t{};
     }
-
-    image_reader_.recycle(decoded);
-
-    qwen3vl_image_t result;
-    result.width = reordered.width;
-    result.height = reordered.height;
-    result._data = std::move(reordered.pixels);
-    image_reader_.recycle(reordered);
-    return result;
+    return this->finish_image(decoded, image_reader_);
 }
 
 
@@ -154,16 +154,17 @@ void Qwen3VL::smart_resize(
 }
 
 
-///@brief: preprocess the image for Qwen3VL model
-///@note: Converts uint8 image to BF16 format, data is already in (3, H, W) CHW layout
-///@param: image: the image to preprocess (already in CHW format)
-///@return: the preprocessed image in BF16 format
-void Qwen3VL::preprocess_image(qwen3vl_image_t& image, std::vector<bf16> &pixel_values) {
-    const int width = image.width;
-    const int height = image.height;
-    const int channels = 3; // RGB
-    int resized_height; 
-    int resized_width;    
+///@brief: set the resized size and grid of a decoded image
+///@param: image: the decoded image, in (3, H, W) CHW layout
+///@param: width, height: the size a full decode gives, after the pre-resize
+///@return: the number of pixel values it takes in the payload, 0 if it did not decode
+size_t Qwen3VL::plan_image(qwen3vl_image_t& image, int width, int height) {
+    if (image.width <= 0 || image.height <= 0) {
+        image.width_resized = image.height_resized = image.grid_h = image.grid_w = 0;
+        return 0;
+    }
+    int resized_height;
+    int resized_width;
     // do the automatically resizing in here 
     smart_resize(
         height, width,
@@ -172,74 +173,113 @@ void Qwen3VL::preprocess_image(qwen3vl_image_t& image, std::vector<bf16> &pixel_
         QWEN3_SHORTEST_EDGE,
         QWEN3_LONGEST_EDGE
     );
-    // std::cout << "resized_height "<< resized_height << " resized_width " << resized_width <<std::endl;
+    image.width_resized = resized_width;
+    image.height_resized = resized_height;
+    image.grid_h = resized_height / QWEN3_PATCH_SIZE;
+    image.grid_w = resized_width / QWEN3_PATCH_SIZE;
+    return (size_t)resized_height * resized_width * 3 * QWEN3_TEMPORAL_PATCH_SIZE;
+}
 
-    // Cache size calculations for efficiency
-    const uint32_t single_frame_size = resized_height * resized_width * channels;
-    const uint32_t total_patch_size = single_frame_size * QWEN3_TEMPORAL_PATCH_SIZE;
-    const uint32_t grid_h = resized_height / QWEN3_PATCH_SIZE;
-    const uint32_t grid_w = resized_width / QWEN3_PATCH_SIZE;
+///@brief: preprocess the image for Qwen3VL model
+///@note: Resizes, normalizes, repeats for the temporal patch and reorders into merged patches
+///       in one tiled pass, data is already in (3, H, W) CHW layout
+///@param: image: the image to preprocess (already in CHW format), planned by plan_image
+///@param: pixel_values: the slice of the payload it goes to, plan_image values long
+void Qwen3VL::preprocess_image(qwen3vl_image_t& image, bf16* pixel_values) {
+    // AVX-512, AVX2 or scalar resize, whichever this CPU runs, a band of rows at a time;
+    // the SIMD resize may differ from the scalar one by a level
+    imgproc::resize_normalize_patches_bf16(
+        image._data.data(), image.width, image.height,
+        image.width_resized, image.height_resized,
+        QWEN3_VISION_RESCALE_FACTOR,
+        QWEN3_VISION_RESCALE_IMAGE_MEAN, QWEN3_VISION_RESCALE_IMAGE_STD,
+        QWEN3_TEMPORAL_PATCH_SIZE,
+        QWEN3_MERGE_SIZE,
+        QWEN3_PATCH_SIZE,
+        pixel_values
+    );
 
-    // Pre-allocate final buffer to avoid reallocation
-    const uint32_t prev_pixel_values_size = pixel_values.size();
-    pixel_values.resize(prev_pixel_values_size + total_patch_size);
+    image._data.free(); // free the data
 
-    // Use non-optimized path for consistent results across platforms
-    auto resize_image =  imgproc::avx512::resize_bicubic_antialias_rgb_planar_avx512(
-        image._data.data(), width, height, resized_width, resized_height, true
-    );
+    // release the original uint8_t data now, since is no longer useful to us
+}
 
-    // Reuse scratch buffer across calls to avoid repeated allocations
-    static thread_local std::vector<float> patch_vector_scratch;
-    if (patch_vector_scratch.size() < total_patch_size) {
-        patch_vector_scratch.resize(total_patch_size);
-    }
-    
-    // Apply rescale and normalization to first frame
-    imgproc::avx512::rescale_and_normalize_avx512(
-        resize_image.data(), patch_vector_scratch.data(),
-        resized_width, resized_height, channels,
-        true, QWEN3_VISION_RESCALE_FACTOR,
-        true, QWEN3_VISION_RESCALE_IMAGE_MEAN, QWEN3_VISION_RESCALE_IMAGE_STD
-    );
-    
-    // Replicate first frame for temporal patches (optimized for QWEN3_TEMPORAL_PATCH_SIZE = 2)
-    // This is more efficient than a loop for the common case
-    if constexpr (QWEN3_TEMPORAL_PATCH_SIZE == 2) {
-        memcpy(
-            patch_vector_scratch.data() + single_frame_size,
-            patch_vector_scratch.data(),
-            single_frame_size * sizeof(float)
-        );
-    } else {
-        // Generic loop for other TEMPORAL_PATCH_SIZE values
-        for(unsigned l = 1; l < QWEN3_TEMPORAL_PATCH_SIZE; l++){
-            memcpy(
-                patch_vector_scratch.data() + l * single_frame_size,
-                patch_vector_scratch.data(),
-                single_frame_size * sizeof(float)
-            );
-        }
+///@brief: decode and preprocess the images of a request on the shared worker pool
+///@note: a client resends the images of the conversation every turn; one seen before is
+///       copied from the image cache instead of decoded again. Each image is written to its
+///       own slice of the payload, so the result does not depend on the worker order.
+///@param: sources: the images in request order, a base64 string (true) or a file path (false) each
+///@param: payload: the images and their pixel values are appended, in request order
+void Qwen3VL::preprocess_images(const std::vector<std::pair<std::string, bool>>& sources, qwen3vl_image_payload_t& payload) {
+    worker_pool& pool = worker_pool::shared();
+    while (this->image_readers_.size() < pool.workers()) {
+        this->image_readers_.push_back(std::make_unique<ImageReader>());
     }
+    const size_t count = sources.size();
+    const std::string params = "qwen3vl:" + std::to_string(this->image_pre_resize) + ":"
+                               + std::to_string(QWEN3_SHORTEST_EDGE) + ":" + std::to_string(QWEN3_LONGEST_EDGE);
+    std::vector<qwen3vl_image_t> images(count);
+    std::vector<std::shared_ptr<const preprocessed_image_t>> cached(count);
+    std::vector<std::string> keys(count);
+    std::vector<size_t> sizes(count, 0);
 
-    // Reorder patches directly into pre-allocated pixel_values
-    imgproc::reorder_patches_inplace(
-        patch_vector_scratch.data(),
-        pixel_values.data() + prev_pixel_values_size,
-        1, 1, // something special for image
-        QWEN3_TEMPORAL_PATCH_SIZE,
-        channels,
-        grid_h, grid_w,
-        QWEN3_MERGE_SIZE,
-        QWEN3_PATCH_SIZE
-    );
+    // Decode, or find in the image cache
+    pool.run(count, [&](size_t i, size_t worker) {
+        const auto& [source, is_base64] = sources[i];
+        if (is_base64 && this->preprocessed_images != nullptr) {
+            keys[i] = image_cache::key(source, params);
+            cached[i] = this->preprocessed_images->get(keys[i]);
+            if (cached[i] != nullptr) {
+                images[i].width = cached[i]->width;
+                images[i].height = cached[i]->height;
+                images[i].width_resized = cached[i]->width_resized;
+                images[i].height_resized = cached[i]->height_resized;
+                images[i].grid_h = cached[i]->grid_h;
+                images[i].grid_w = cached[i]->grid_w;
+                sizes[i] = cached[i]->pixels.size();
+                return;
+            }
+        }
+        ImageReader& reader = *this->image_readers_[worker];
+        images[i] = is_base64 ? this->load_image_base64(source, reader) : this->load_image(source, reader);
+        sizes[i] = (size_t)images[i].height_resized * images[i].width_resized * 3 * QWEN3_TEMPORAL_PATCH_SIZE;
+    });
 
+    // Each image gets its slice of the payload, in request order
+    std::vector<size_t> offsets(count);
+    size_t total = payload._data__processed.size();
+    for (size_t i = 0; i < count; i++) {
+        offsets[i] = total;
+        total += sizes[i];
+    }
+    payload._data__processed.resize(total);
 
-    image.width_resized = resized_width;
-    image.height_resized = resized_height;
-    image.grid_h = grid_h;
-    image.grid_w = grid_w;
-    image._data.free(); // free the data
+    pool.run(count, [&](size_t i, size_t worker) {
+        bf16* slice = payload._data__processed.data() + offsets[i];
+        if (cached[i] != nullptr) {
+            std::copy(cached[i]->pixels.begin(), cached[i]->pixels.end(), slice);
+            return;
+        }
+        if (sizes[i] == 0) {
+            return;
+        }
+        this->preprocess_image(images[i], slice);
+        if (!keys[i].empty()) {
+            auto entry = std::make_shared<preprocessed_image_t>();
+            entry->pixels.assign(slice, slice + sizes[i]);
+            entry->width = images[i].width;
+            entry->height = images[i].height;
+            entry->width_resized = images[i].width_resized;
+            entry->height_resized = images[i].height_resized;
+            entry->grid_h = images[i].grid_h;
+            entry->grid_w = images[i].grid_w;
+            this->preprocessed_images->put(keys[i], std::move(entry));
+        }
+    });
 
-    // release the original uint8_t data now, since is no longer useful to us
+    for (qwen3vl_image_t& image : images) {
+        image._data.free();
+        payload.images.push_back(image);
+        payload.num_images++;
+    }
 }
@@ -153,6 +153,11 @@ static bool has_basic_image_integrity(const uint8_t* data, size_t size, int code
     return false;
 }
 
+// size / 2^shift rounded up, the size of a JPEG decoded at that lowres
+static int reduced_size(int size, int shift) {
+    return (size + (1 << shift) - 1) >> shift;
+}
+
 static void resolve_source_format_and_range(AVPixelFormat input_format,
                                             AVPixelFormat& resolved_format,
                                             int& src_full_range,
@@ -265,7 +270,7 @@ ImageReader::~ImageReader() {
     reset_decode_resources();
 }
 
-bool ImageReader::ensure_decode_resources(int codec_id) {
+bool ImageReader::ensure_decode_resources(int codec_id, int lowres) {
     if (!packet_) {
         packet_ = av_packet_alloc();
     }
@@ -279,7 +284,7 @@ bool ImageReader::ensure_decode_resources(int codec_id) {
         return false;
     }
 
-    if (!codec_ctx_ || cached_codec_id_ != codec_id) {
+    if (!codec_ctx_ || cached_codec_id_ != codec_id || cached_lowres_ != lowres) {
         if (codec_ctx_) {
             avcodec_free_context(&codec_ctx_);
         }
@@ -296,6 +301,7 @@ bool ImageReader::ensure_decode_resources(int codec_id) {
 
         codec_ctx_->thread_count = 1;
         codec_ctx_->thread_type = 0;
+        codec_ctx_->lowres = std::min<int>(lowres, codec->max_lowres);
 
         if (avcodec_open2(codec_ctx_, codec, nullptr) < 0) {
             avcodec_free_context(&codec_ctx_);
@@ -303,6 +309,7 @@ bool ImageReader::ensure_decode_resources(int codec_id) {
         }
 
         cached_codec_id_ = codec_id;
+        cached_lowres_ = lowres;
     }
 
     return true;
@@ -317,6 +324,8 @@ void ImageReader::reset_decode_resources() {
     sws_src_h_ = 0;
     sws_src_fmt_ = -1;
     sws_src_range_ = -1;
+    sws_dst_w_ = 0;
+    sws_dst_h_ = 0;
 
     if (rgb_frame_) {
         av_frame_free(&rgb_frame_);
@@ -331,6 +340,7 @@ void ImageReader::reset_decode_resources() {
         avcodec_free_context(&codec_ctx_);
     }
     cached_codec_id_ = -1;
+    cached_lowres_ = 0;
 }
 
 void ImageReader::initialize_ffmpeg() {
@@ -355,45 +365,158 @@ bool ImageReader::parse_image_header(const uint8_t* data, size_t size, int& code
     return false;
 }
 
-bool ImageReader::decode_bytes(const uint8_t* data, size_t size, image_data_t& out_image) {
-    int codec_id = AV_CODEC_ID_NONE;
-    // header_print_g("DEBUG", "Decoding image of size: " << std::to_string(size) << " bytes");
-    if (!parse_image_header(data, size, codec_id)) {
-        std::cerr << "Error: Unsupported image format (only JPEG/JPG and PNG supported)" << std::endl;
+bool ImageReader::parse_image_size(const uint8_t* data, size_t size, int codec_id, int& width, int& height) {
+    width = 0;
+    height = 0;
+    if (codec_id == AV_CODEC_ID_PNG) {
+        // IHDR comes first, checked by has_valid_png_structure
+        if (size < 24) {
+            return false;
+        }
+        width = static_cast<int>(read_be32(data + 16));
+        height = static_cast<int>(read_be32(data + 20));
+        return width > 0 && height > 0;
+    }
+    if (codec_id != AV_CODEC_ID_MJPEG) {
         return false;
     }
 
-    if (!has_basic_image_integrity(data, size, codec_id)) {
-        std::cerr << "Error: Image payload failed integrity check" << std::endl;
-        return false;
+    size_t pos = 2;
+    while (pos + 3 < size) {
+        if (data[pos] != 0xFF) {
+            ++pos;
+            continue;
+        }
+        while (pos < size && data[pos] == 0xFF) {
+            ++pos;
+        }
+        if (pos + 2 >= size) {
+            return false;
+        }
+        const uint8_t marker = data[pos++];
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) {
+            return false; // no frame header before the scan
+        }
+        const uint16_t seg_len = static_cast<uint16_t>((data[pos] << 8) | data[pos + 1]);
+        // SOF0 to SOF15, except DHT, JPG and DAC: precision, height, width
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (seg_len < 7 || pos + 7 > size) {
+                return false;
+            }
+            height = (data[pos + 3] << 8) | data[pos + 4];
+            width = (data[pos + 5] << 8) | data[pos + 6];
+            return width > 0 && height > 0;
+        }
+        if (seg_len < 2) {
+            return false;
+        }
+        pos += static_cast<size_t>(seg_len);
     }
+    return false;
+}
 
+bool ImageReader::decode_frame(const uint8_t* data, size_t size, int codec_id, int lowres) {
     reset_decode_resources();
 
-    if (!ensure_decode_resources(codec_id)) {
+    if (!ensure_decode_resources(codec_id, lowres)) {
         std::cerr << "Error: Could not initialize FFmpeg decode objects" << std::endl;
         return false;
     }
 
-    bool ok = false;
-    do {
-        av_frame_unref(frame_);
-        av_frame_unref(rgb_frame_);
-        av_packet_unref(packet_);
+    av_frame_unref(frame_);
+    av_frame_unref(rgb_frame_);
+    av_packet_unref(packet_);
 
-        packet_->data = const_cast<uint8_t*>(data);
-        packet_->size = static_cast<int>(size);
+    packet_->data = const_cast<uint8_t*>(data);
+    packet_->size = static_cast<int>(size);
 
-        if (avcodec_send_packet(codec_ctx_, packet_) < 0) {
+    // a reduced decode that fails is retried at full size, no need to report it
+    const bool quiet = lowres > 0;
+    bool ok = false;
+    if (avcodec_send_packet(codec_ctx_, packet_) < 0) {
+        if (!quiet) {
             std::cerr << "Error: Could not send packet for decoding" << std::endl;
-            break;
         }
-
-        if (avcodec_receive_frame(codec_ctx_, frame_) < 0) {
+    }
+    else if (avcodec_receive_frame(codec_ctx_, frame_) < 0) {
+        if (!quiet) {
             std::cerr << "Error: Could not decode image frame" << std::endl;
-            break;
         }
+    }
+    else {
+        ok = true;
+    }
+
+    av_packet_unref(packet_);
+    return ok;
+}
 
+bool ImageReader::decode_bytes(const uint8_t* data, size_t size, image_data_t& out_image, const decode_target_t& target) {
+    int codec_id = AV_CODEC_ID_NONE;
+    // header_print_g("DEBUG", "Decoding image of size: " << std::to_string(size) << " bytes");
+    if (!parse_image_header(data, size, codec_id)) {
+        std::cerr << "Error: Unsupported image format (only JPEG/JPG and PNG supported)" << std::endl;
+        return false;
+    }
+
+    if (!has_basic_image_integrity(data, size, codec_id)) {
+        std::cerr << "Error: Image payload failed integrity check" << std::endl;
+        return false;
+    }
+
+    // With a target much smaller than the image, let the JPEG decoder drop DCT coefficients:
+    // each lowres step halves both sides, as long as the decode stays twice the target
+    int source_width = 0;
+    int source_height = 0;
+    int target_width = 0;
+    int target_height = 0;
+    int lowres = 0;
+    const bool sized = target && parse_image_size(data, size, codec_id, source_width, source_height);
+    if (sized) {
+        target(source_width, source_height, target_width, target_height);
+        if (codec_id == AV_CODEC_ID_MJPEG && target_width > 0 && target_height > 0) {
+            while (lowres < 3 &&
+                   reduced_size(source_width, lowres + 1) >= 2 * target_width &&
+                   reduced_size(source_height, lowres + 1) >= 2 * target_height) {
+                ++lowres;
+            }
+        }
+    }
+
+    bool decoded = decode_frame(data, size, codec_id, lowres);
+    if (!decoded && lowres > 0) {
+        // not every JPEG has a reduced decode (lossless, for one)
+        lowres = 0;
+        decoded = decode_frame(data, size, codec_id, lowres);
+    }
+    if (!decoded) {
+        return false;
+    }
+    if (lowres == 0) {
+        source_width = frame_->width;
+        source_height = frame_->height;
+    }
+    if (target && !sized) {
+        target(source_width, source_height, target_width, target_height);
+    }
+
+    // What is left, from PNG or past the lowres steps, is area averaged in the RGB conversion
+    int dst_width = frame_->width;
+    int dst_height = frame_->height;
+    if (target_width > 0 && target_height > 0) {
+        const int factor = std::min(frame_->width / (2 * target_width), frame_->height / (2 * target_height));
+        if (factor >= 2) {
+            dst_width = frame_->width / factor;
+            dst_height = frame_->height / factor;
+        }
+    }
+    const bool reduce = dst_width != frame_->width || dst_height != frame_->height;
+
+    bool ok = false;
+    do {
         AVPixelFormat src_fmt = AV_PIX_FMT_NONE;
         int src_full_range = 0;
         resolve_source_format_and_range(static_cast<AVPixelFormat>(frame_->format),
@@ -406,7 +529,9 @@ bool ImageReader::decode_bytes(const uint8_t* data, size_t size, image_data_t& o
                                       sws_src_w_ != frame_->width ||
                                       sws_src_h_ != frame_->height ||
                                       sws_src_fmt_ != static_cast<int>(src_fmt) ||
-                                      sws_src_range_ != src_full_range;
+                                      sws_src_range_ != src_full_range ||
+                                      sws_dst_w_ != dst_width ||
+                                      sws_dst_h_ != dst_height;
         if (need_rebuild_sws) {
             if (sws_ctx_) {
                 sws_freeContext(sws_ctx_);
@@ -416,10 +541,10 @@ bool ImageReader::decode_bytes(const uint8_t* data, size_t size, image_data_t& o
             sws_ctx_ = sws_getContext(frame_->width,
                                       frame_->height,
                                       src_fmt,
-                                      frame_->width,
-                                      frame_->height,
+                                      dst_width,
+                                      dst_height,
                                       AV_PIX_FMT_RGB24,
-                                      SWS_BILINEAR,
+                                      reduce ? SWS_AREA : SWS_BILINEAR,
                                       nullptr,
                                       nullptr,
                                       nullptr);
@@ -428,6 +553,8 @@ bool ImageReader::decode_bytes(const uint8_t* data, size_t size, image_data_t& o
                 sws_src_h_ = frame_->height;
                 sws_src_fmt_ = static_cast<int>(src_fmt);
                 sws_src_range_ = src_full_range;
+                sws_dst_w_ = dst_width;
+                sws_dst_h_ = dst_height;
             }
         }
 
@@ -455,7 +582,7 @@ bool ImageReader::decode_bytes(const uint8_t* data, size_t size, image_data_t& o
             }
         }
 
-        const int rgb_size = av_image_get_buffer_size(AV_PIX_FMT_RGB24, frame_->width, frame_->height, 1);
+        const int rgb_size = av_image_get_buffer_size(AV_PIX_FMT_RGB24, dst_width, dst_height, 1);
         if (rgb_size <= 0) {
             std::cerr << "Error: Invalid decoded RGB buffer size" << std::endl;
             break;
@@ -471,8 +598,8 @@ bool ImageReader::decode_bytes(const uint8_t* data, size_t size, image_data_t& o
                                  rgb_frame_->linesize,
                                  buffer.data(),
                                  AV_PIX_FMT_RGB24,
-                                 frame_->width,
-                                 frame_->height,
+                                 dst_width,
+                                 dst_height,
                                  1) < 0) {
             std::cerr << "Error: Could not initialize RGB output frame" << std::endl;
             memory_pool_.recycle(std::move(buffer));
@@ -493,20 +620,20 @@ bool ImageReader::decode_bytes(const uint8_t* data, size_t size, image_data_t& o
         // header_print_g("DEBUG", "Successfully converted image to RGB24 format");
         recycle(out_image);
         // header_print_g("DEBUG", "Recycling previous output image data if any");
-        out_image.width = frame_->width;
-        out_image.height = frame_->height;
+        out_image.width = dst_width;
+        out_image.height = dst_height;
+        out_image.source_width = source_width;
+        out_image.source_height = source_height;
         out_image.pixels = std::move(buffer);
         
         // header_print_g("DEBUG", "Image decoding successful!");
         ok = true;
     } while (false);
 
-    av_packet_unref(packet_);
-
     return ok;
 }
 
-bool ImageReader::load_image(const std::string& filename, image_data_t& out_image) {
+bool ImageReader::load_image(const std::string& filename, image_data_t& out_image, const decode_target_t& target) {
     initialize_ffmpeg();
 
     if (!std::filesystem::exists(filename)) {
@@ -533,10 +660,10 @@ bool ImageReader::load_image(const std::string& filename, image_data_t& out_imag
         return false;
     }
 
-    return decode_bytes(data.data(), data.size(), out_image);
+    return decode_bytes(data.data(), data.size(), out_image, target);
 }
 
-bool ImageReader::load_image_base64(const std::string& base64_string, image_data_t& out_image) {
+bool ImageReader::load_image_base64(const std::string& base64_string, image_data_t& out_image, const decode_target_t& target) {
     initialize_ffmpeg();
 
     std::string payload = base64_string;
@@ -551,7 +678,7 @@ bool ImageReader::load_image_base64(const std::string& base64_string, image_data
         return false;
     }
 
-    return decode_bytes(reinterpret_cast<const uint8_t*>(decoded.data()), decoded.size(), out_image);
+    return decode_bytes(reinterpret_cast<const uint8_t*>(decoded.data()), decoded.size(), out_image, target);
 }
 
 bool ImageReader::resize_image(const image_data_t& input, int target_width, int target_height, image_data_t& output) {
@@ -608,6 +735,8 @@ bool ImageReader::resize_image(const image_data_t& input, int target_width, int
     recycle(output);
     output.width = target_width;
     output.height = target_height;
+    output.source_width = input.source_width;
+    output.source_height = input.source_height;
     output.pixels = std::move(out_buffer);
     return true;
 }
@@ -641,6 +770,8 @@ bool ImageReader::reorder_hwc_to_chw(const image_data_t& input, image_data_t& ou
     recycle(output);
     output.width = input.width;
     output.height = input.height;
+    output.source_width = input.source_width;
+    output.source_height = input.source_height;
     output.pixels = std::move(out_buffer);
     return true;
 }
@@ -729,6 +860,8 @@ void ImageReader::recycle(image_data_t& image) {
     }
     image.width = 0;
     image.height = 0;
+    image.source_width = 0;
+    image.source_height = 0;
 }
 
 
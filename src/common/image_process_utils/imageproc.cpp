@@ -1,10 +1,132 @@
 #include  "image_process_utils/imageproc.hpp"
 #include  "image_process_utils/imageprocAVX512.hpp"
+#include  "image_process_utils/imageprocAVX2.hpp"
 #include <immintrin.h>  // AVX-512 intrinsics
 #include <omp.h>         // OpenMP for multi-threading
+#include <atomic>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
 
 namespace imgproc {
 
+    static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+        for (int i = 0; i < 4; ++i) regs[i] = static_cast<uint32_t>(info[i]);
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    // Register state the OS saves on a context switch (XCR0)
+    static uint64_t xgetbv0() {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        uint32_t eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+    }
+
+    static isa_t probe_isa() {
+        uint32_t regs[4];
+        cpuid(0, 0, regs);
+        const uint32_t max_leaf = regs[0];
+        if (max_leaf < 7) {
+            return isa_t::scalar;
+        }
+        cpuid(1, 0, regs);
+        const bool osxsave = (regs[2] >> 27) & 1;
+        const bool avx = (regs[2] >> 28) & 1;
+        const bool fma = (regs[2] >> 12) & 1;
+        if (!osxsave || !avx) {
+            return isa_t::scalar;
+        }
+        const uint64_t xcr0 = xgetbv0();
+        const bool ymm_state = (xcr0 & 0x6) == 0x6;     // sse, avx
+        const bool zmm_state = (xcr0 & 0xe6) == 0xe6;   // and opmask, zmm0-15 upper, zmm16-31
+
+        cpuid(7, 0, regs);
+        const bool avx2 = (regs[1] >> 5) & 1;
+        const bool avx512f = (regs[1] >> 16) & 1;
+        const bool avx512dq = (regs[1] >> 17) & 1;
+        const bool avx512bw = (regs[1] >> 30) & 1;
+        const bool avx512vl = (regs[1] >> 31) & 1;
+
+        if (zmm_state && avx512f && avx512dq && avx512bw && avx512vl && fma) {
+            return isa_t::avx512;
+        }
+        if (ymm_state && avx2 && fma) {
+            return isa_t::avx2;
+        }
+        return isa_t::scalar;
+    }
+
+    static std::atomic<int> forced_isa{-1};
+
+    isa_t detect_isa() {
+        static const isa_t isa = probe_isa();
+        return isa;
+    }
+
+    isa_t active_isa() {
+        const int forced = forced_isa.load(std::memory_order_relaxed);
+        return forced < 0 ? detect_isa() : static_cast<isa_t>(forced);
+    }
+
+    void set_isa(isa_t isa) {
+        forced_isa.store(static_cast<int>(std::min(isa, detect_isa())), std::memory_order_relaxed);
+    }
+
+    const char* isa_name(isa_t isa) {
+        switch (isa) {
+            case isa_t::avx512: return "avx512";
+            case isa_t::avx2: return "avx2";
+            default: return "scalar";
+        }
+    }
+
+    resize_taps_t compute_resize_taps(int src_size, int dst_size, bool antialias) {
+        resize_taps_t taps;
+        taps.dst_size = dst_size;
+        taps.index.resize(4 * static_cast<size_t>(dst_size));
+        taps.weight.resize(4 * static_cast<size_t>(dst_size));
+
+        // Same scale, support and sigma as resize_bicubic_plane
+        const float scale = area_pixel_compute_scale(src_size, dst_size, false);
+        const bool do_antialias = antialias && (scale > 1.0f);
+        const float support = 2.0f;
+        const float clamped_scale = do_antialias ? scale : 1.0f;
+        const float sigma = do_antialias ? (clamped_scale * support) / 2.0f : 0.0f;
+
+        for (int dst = 0; dst < dst_size; ++dst) {
+            float real = area_pixel_compute_source_index(scale, dst, false, true);
+            int input = static_cast<int>(std::floor(real));
+            float w[4];
+            float wsum = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+                float d = real - (input + k - 1);
+                w[k] = bicubic_kernel(d / clamped_scale);
+                if (do_antialias) {
+                    w[k] *= gaussian(d, sigma);
+                }
+                wsum += w[k];
+            }
+            for (int k = 0; k < 4; ++k) {
+                const size_t at = static_cast<size_t>(k) * dst_size + dst;
+                taps.index[at] = clamp(input + k - 1, 0, src_size - 1);
+                taps.weight[at] = (wsum != 0.0f) ? w[k] / wsum : 0.0f;
+            }
+        }
+        return taps;
+    }
+
     std::vector<float> resize_bicubic_plane(
         const std::vector<float>& src,
         int src_w, int src_h,
@@ -72,6 +194,61 @@ namespace imgproc {
         return dst;
     }
 
+    void resize_bicubic_rows(
+        const uint8_t* src, int src_w,
+        const resize_taps_t& taps_x,
+        const resize_taps_t& taps_y,
+        int row_begin, int row_end,
+        uint8_t* dst,
+        float* row)
+    {
+        const int dst_w = taps_x.dst_size;
+        const size_t nx = static_cast<size_t>(dst_w);
+        const size_t ny = static_cast<size_t>(taps_y.dst_size);
+
+        for (int dst_y = row_begin; dst_y < row_end; ++dst_y) {
+            // Vertical pass over the whole source row
+            for (int x = 0; x < src_w; ++x) {
+                float sum = 0.0f;
+                for (size_t k = 0; k < 4; ++k) {
+                    sum += src[static_cast<size_t>(taps_y.index[k * ny + dst_y]) * src_w + x] * taps_y.weight[k * ny + dst_y];
+                }
+                row[x] = sum;
+            }
+
+            // Horizontal pass
+            uint8_t* out = dst + static_cast<size_t>(dst_y - row_begin) * dst_w;
+            for (int x = 0; x < dst_w; ++x) {
+                float sum = 0.0f;
+                for (size_t k = 0; k < 4; ++k) {
+                    sum += row[taps_x.index[k * nx + x]] * taps_x.weight[k * nx + x];
+                }
+                out[x] = round_to_uint8(sum);
+            }
+        }
+    }
+
+    void resize_bicubic_rows_optimized(
+        const uint8_t* src, int src_w,
+        const resize_taps_t& taps_x,
+        const resize_taps_t& taps_y,
+        int row_begin, int row_end,
+        uint8_t* dst,
+        float* row)
+    {
+        switch (active_isa()) {
+            case isa_t::avx512:
+                avx512::resize_bicubic_rows_avx512(src, src_w, taps_x, taps_y, row_begin, row_end, dst, row);
+                break;
+            case isa_t::avx2:
+                avx2::resize_bicubic_rows_avx2(src, src_w, taps_x, taps_y, row_begin, row_end, dst, row);
+                break;
+            default:
+                resize_bicubic_rows(src, src_w, taps_x, taps_y, row_begin, row_end, dst, row);
+                break;
+        }
+    }
+
     // Main planar RGB entry point
     std::vector<uint8_t> resize_bicubic_antialias_rgb_planar(
         const uint8_t* src,
@@ -114,7 +291,7 @@ namespace imgproc {
         int dst_w, int dst_h,
         bool antialias)
     {
-        if (avx512::has_avx512f()) {
+        if (active_isa() == isa_t::avx512) {
             return avx512::resize_bicubic_plane_avx512(src, src_w, src_h, dst_w, dst_h, antialias);
         } else {
             return resize_bicubic_plane(src, src_w, src_h, dst_w, dst_h, antialias);
@@ -127,10 +304,13 @@ namespace imgproc {
         int dst_w, int dst_h,
         bool antialias)
     {
-        if (avx512::has_avx512f()) {
-            return avx512::resize_bicubic_antialias_rgb_planar_avx512(src, src_w, src_h, dst_w, dst_h, antialias);
-        } else {
-            return resize_bicubic_antialias_rgb_planar(src, src_w, src_h, dst_w, dst_h, antialias);
+        switch (active_isa()) {
+            case isa_t::avx512:
+                return avx512::resize_bicubic_antialias_rgb_planar_avx512(src, src_w, src_h, dst_w, dst_h, antialias);
+            case isa_t::avx2:
+                return avx2::resize_bicubic_antialias_rgb_planar_avx2(src, src_w, src_h, dst_w, dst_h, antialias);
+            default:
+                return resize_bicubic_antialias_rgb_planar(src, src_w, src_h, dst_w, dst_h, antialias);
         }
     }
 
@@ -176,6 +356,11 @@ namespace imgproc {
                     }
                 }
             }
+        }else{
+            const size_t total = static_cast<size_t>(image_channels) * image_height * image_width;
+            for(size_t i = 0; i < total; i++){
+                output_buffer[i] = static_cast<float>(image_src[i]);
+            }
         }
 
 
@@ -193,14 +378,164 @@ namespace imgproc {
         float image_mean,
         float image_std 
     ) {
-        if (avx512::has_avx512f()) {
-            avx512::rescale_and_normalize_avx512(image_src, output_buffer, image_width, image_height, 
+        switch (active_isa()) {
+            case isa_t::avx512:
+                avx512::rescale_and_normalize_avx512(image_src, output_buffer, image_width, image_height, 
+                                                   image_channels, do_rescale, rescale_factor, 
+                                                   do_normalize, image_mean, image_std);
+                break;
+            case isa_t::avx2:
+                avx2::rescale_and_normalize_avx2(image_src, output_buffer, image_width, image_height, 
                                                image_channels, do_rescale, rescale_factor, 
                                                do_normalize, image_mean, image_std);
-        } else {
-            rescale_and_normalize(image_src, output_buffer, image_width, image_height, 
-                                image_channels, do_rescale, rescale_factor, 
-                                do_normalize, image_mean, image_std);
+                break;
+            default:
+                rescale_and_normalize(image_src, output_buffer, image_width, image_height, 
+                                    image_channels, do_rescale, rescale_factor, 
+                                    do_normalize, image_mean, image_std);
+                break;
+        }
+    }
+
+    // Auto-dispatching optimized version (per-channel mean/std)
+    void rescale_and_normalize_optimized(
+        const uint8_t *image_src,
+        float *output_buffer,
+        int image_width, int image_height, int image_channels,
+        bool do_rescale,
+        float rescale_factor,
+        bool do_normalize,
+        const std::vector<float>& image_mean,
+        const std::vector<float>& image_std
+    ) {
+        if (active_isa() == isa_t::avx512) {
+            avx512::rescale_and_normalize_avx512(image_src, output_buffer, image_width, image_height,
+                                               image_channels, do_rescale, rescale_factor,
+                                               do_normalize, image_mean, image_std);
+            return;
+        }
+        // One plane at a time with its own mean and std
+        const size_t plane_size = static_cast<size_t>(image_width) * image_height;
+        const int channels = std::min(image_channels, 3);
+        for (int c = 0; c < channels; ++c) {
+            float mean = (do_normalize && static_cast<size_t>(c) < image_mean.size()) ? image_mean[c] : 0.0f;
+            float std_dev = (do_normalize && static_cast<size_t>(c) < image_std.size()) ? image_std[c] : 1.0f;
+            rescale_and_normalize_optimized(image_src + c * plane_size, output_buffer + c * plane_size,
+                                            image_width, image_height, 1, do_rescale, rescale_factor,
+                                            do_normalize, mean, std_dev);
+        }
+    }
+
+    void hwc_to_chw_normalize_bf16(
+        const uint8_t* src,
+        size_t pixel_count,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        bf16* out_ptr)
+    {
+        const float std_inv = 1.0f / image_std;
+        bf16* r = out_ptr;
+        bf16* g = out_ptr + pixel_count;
+        bf16* b = out_ptr + 2 * pixel_count;
+        for (size_t i = 0; i < pixel_count; ++i) {
+            r[i] = bf16((static_cast<float>(src[3 * i]) * rescale_factor - image_mean) * std_inv);
+            g[i] = bf16((static_cast<float>(src[3 * i + 1]) * rescale_factor - image_mean) * std_inv);
+            b[i] = bf16((static_cast<float>(src[3 * i + 2]) * rescale_factor - image_mean) * std_inv);
+        }
+    }
+
+    void hwc_to_chw_normalize_bf16_optimized(
+        const uint8_t* src,
+        size_t pixel_count,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        bf16* out_ptr)
+    {
+        switch (active_isa()) {
+            case isa_t::avx512:
+                avx512::hwc_to_chw_normalize_bf16_avx512(src, pixel_count, rescale_factor, image_mean, image_std, out_ptr);
+                break;
+            case isa_t::avx2:
+                avx2::hwc_to_chw_normalize_bf16_avx2(src, pixel_count, rescale_factor, image_mean, image_std, out_ptr);
+                break;
+            default:
+                hwc_to_chw_normalize_bf16(src, pixel_count, rescale_factor, image_mean, image_std, out_ptr);
+                break;
+        }
+    }
+
+    void resize_normalize_patches_bf16(
+        const uint8_t* src,
+        int src_w, int src_h,
+        int dst_w, int dst_h,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        int temporal_patch_size,
+        int merge_size,
+        int patch_size,
+        bf16* out_ptr)
+    {
+        const int channels = 3;
+        const int band_h = merge_size * patch_size;
+        assert(dst_h % band_h == 0);
+        assert(dst_w % band_h == 0);
+
+        const resize_taps_t taps_x = compute_resize_taps(src_w, dst_w, true);
+        const resize_taps_t taps_y = compute_resize_taps(src_h, dst_h, true);
+
+        // Every uint8 level normalized the way rescale_and_normalize_optimized does it,
+        // with the mean and std fused with the rescale factor
+        const float shift = image_mean * (1.0f / rescale_factor);
+        const float scale = 1.0f / (image_std * (1.0f / rescale_factor));
+        bf16 levels[256];
+        for (int v = 0; v < 256; ++v) {
+            levels[v] = bf16((static_cast<float>(v) - shift) * scale);
+        }
+
+        const size_t src_plane_size = static_cast<size_t>(src_w) * src_h;
+        const size_t patch_area = static_cast<size_t>(patch_size) * patch_size;
+        const size_t patch_values = channels * temporal_patch_size * patch_area;
+        const int gh_group = dst_h / band_h;
+        const int gw_group = dst_w / band_h;
+
+        // Bands are independent; each one is written to its own run of patches
+        #pragma omp parallel for num_threads(4) schedule(dynamic, 1)
+        for (int gh_grp = 0; gh_grp < gh_group; ++gh_grp) {
+            std::vector<float> row(src_w);
+            std::vector<uint8_t> band(static_cast<size_t>(channels) * band_h * dst_w);
+            for (int c = 0; c < channels; ++c) {
+                resize_bicubic_rows_optimized(src + c * src_plane_size, src_w, taps_x, taps_y,
+                                              gh_grp * band_h, (gh_grp + 1) * band_h,
+                                              band.data() + static_cast<size_t>(c) * band_h * dst_w, row.data());
+            }
+
+            // Patches in (grid_w group, merge_h, merge_w) order, each (channel, temporal, patch_h, patch_w)
+            bf16* out = out_ptr + static_cast<size_t>(gh_grp) * gw_group * merge_size * merge_size * patch_values;
+            for (int gw_grp = 0; gw_grp < gw_group; ++gw_grp) {
+                for (int mh = 0; mh < merge_size; ++mh) {
+                    for (int mw = 0; mw < merge_size; ++mw) {
+                        const size_t x0 = static_cast<size_t>(gw_grp * merge_size + mw) * patch_size;
+                        for (int c = 0; c < channels; ++c) {
+                            const uint8_t* plane = band.data() + static_cast<size_t>(c) * band_h * dst_w;
+                            bf16* frame = out;
+                            for (int ph = 0; ph < patch_size; ++ph) {
+                                const uint8_t* line = plane + static_cast<size_t>(mh * patch_size + ph) * dst_w + x0;
+                                for (int pw = 0; pw < patch_size; ++pw) {
+                                    frame[ph * patch_size + pw] = levels[line[pw]];
+                                }
+                            }
+                            // The temporal copies of a still image, while the frame is in cache
+                            for (int tp = 1; tp < temporal_patch_size; ++tp) {
+                                memcpy(frame + tp * patch_area, frame, patch_area * sizeof(bf16));
+                            }
+                            out += temporal_patch_size * patch_area;
+                        }
+                    }
+                }
+            }
         }
     }
 
@@ -0,0 +1,201 @@
+#include  "image_process_utils/imageproc.hpp"
+#include  "image_process_utils/imageprocAVX2.hpp"
+#include <omp.h>  // OpenMP for multi-threading
+
+namespace imgproc {
+namespace avx2 {
+
+    // The 4 taps of each output row are summed over the whole source row (contiguous
+    // loads), then the 4 taps of each output column are gathered from it.
+    IMGPROC_TARGET_AVX2
+    void resize_bicubic_rows_avx2(
+        const uint8_t* src, int src_w,
+        const resize_taps_t& taps_x,
+        const resize_taps_t& taps_y,
+        int row_begin, int row_end,
+        uint8_t* dst,
+        float* row)
+    {
+        const int dst_w = taps_x.dst_size;
+        const size_t nx = static_cast<size_t>(dst_w);
+        const size_t ny = static_cast<size_t>(taps_y.dst_size);
+
+        for (int dst_y = row_begin; dst_y < row_end; ++dst_y) {
+            const uint8_t* r0 = src + static_cast<size_t>(taps_y.index[dst_y]) * src_w;
+            const uint8_t* r1 = src + static_cast<size_t>(taps_y.index[ny + dst_y]) * src_w;
+            const uint8_t* r2 = src + static_cast<size_t>(taps_y.index[2 * ny + dst_y]) * src_w;
+            const uint8_t* r3 = src + static_cast<size_t>(taps_y.index[3 * ny + dst_y]) * src_w;
+            const float wy0 = taps_y.weight[dst_y];
+            const float wy1 = taps_y.weight[ny + dst_y];
+            const float wy2 = taps_y.weight[2 * ny + dst_y];
+            const float wy3 = taps_y.weight[3 * ny + dst_y];
+
+            // Vertical pass
+            const __m256 v_wy0 = _mm256_set1_ps(wy0);
+            const __m256 v_wy1 = _mm256_set1_ps(wy1);
+            const __m256 v_wy2 = _mm256_set1_ps(wy2);
+            const __m256 v_wy3 = _mm256_set1_ps(wy3);
+            int x = 0;
+            for (; x + 8 <= src_w; x += 8) {
+                __m256 acc = _mm256_mul_ps(load_uint8x8_avx2(r0 + x), v_wy0);
+                acc = _mm256_fmadd_ps(load_uint8x8_avx2(r1 + x), v_wy1, acc);
+                acc = _mm256_fmadd_ps(load_uint8x8_avx2(r2 + x), v_wy2, acc);
+                acc = _mm256_fmadd_ps(load_uint8x8_avx2(r3 + x), v_wy3, acc);
+                _mm256_storeu_ps(row + x, acc);
+            }
+            for (; x < src_w; ++x) {
+                row[x] = r0[x] * wy0 + r1[x] * wy1 + r2[x] * wy2 + r3[x] * wy3;
+            }
+
+            // Horizontal pass
+            uint8_t* out = dst + static_cast<size_t>(dst_y - row_begin) * dst_w;
+            const int32_t* ix = taps_x.index.data();
+            const float* wx = taps_x.weight.data();
+            x = 0;
+            for (; x + 8 <= dst_w; x += 8) {
+                __m256 acc = _mm256_mul_ps(
+                    _mm256_i32gather_ps(row, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ix + x)), 4),
+                    _mm256_loadu_ps(wx + x));
+                for (size_t k = 1; k < 4; ++k) {
+                    acc = _mm256_fmadd_ps(
+                        _mm256_i32gather_ps(row, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ix + k * nx + x)), 4),
+                        _mm256_loadu_ps(wx + k * nx + x), acc);
+                }
+                store_uint8x8_avx2(acc, out + x);
+            }
+            for (; x < dst_w; ++x) {
+                float sum = 0.0f;
+                for (size_t k = 0; k < 4; ++k) {
+                    sum += row[ix[k * nx + x]] * wx[k * nx + x];
+                }
+                out[x] = round_to_uint8(sum);
+            }
+        }
+    }
+
+    // 16 values of one channel, normalized, to 16 bf16
+    IMGPROC_TARGET_AVX2
+    static inline void normalize_store_bf16x16_avx2(__m128i u8_vec, __m256 v_rescale, __m256 v_mean, __m256 v_std_inv, bf16* dst) {
+        __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(u8_vec));
+        __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(u8_vec, 8)));
+        lo = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(lo, v_rescale), v_mean), v_std_inv);
+        hi = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(hi, v_rescale), v_mean), v_std_inv);
+        // pack works per 128-bit lane, the permute puts the 4 quarters back in order
+        __m256i packed = _mm256_packus_epi32(float_to_bf16_bits_avx2(lo), float_to_bf16_bits_avx2(hi));
+        packed = _mm256_permute4x64_epi64(packed, 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), packed);
+    }
+
+    IMGPROC_TARGET_AVX2
+    void hwc_to_chw_normalize_bf16_avx2(
+        const uint8_t* src,
+        size_t pixel_count,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        bf16* out_ptr)
+    {
+        const __m256 v_rescale = _mm256_set1_ps(rescale_factor);
+        const __m256 v_mean = _mm256_set1_ps(image_mean);
+        const __m256 v_std_inv = _mm256_set1_ps(1.0f / image_std);
+        bf16* r = out_ptr;
+        bf16* g = out_ptr + pixel_count;
+        bf16* b = out_ptr + 2 * pixel_count;
+
+        size_t i = 0;
+        for (; i + 16 <= pixel_count; i += 16) {
+            __m128i r_vec, g_vec, b_vec;
+            deinterleave_rgb16_avx2(src + 3 * i, r_vec, g_vec, b_vec);
+            normalize_store_bf16x16_avx2(r_vec, v_rescale, v_mean, v_std_inv, r + i);
+            normalize_store_bf16x16_avx2(g_vec, v_rescale, v_mean, v_std_inv, g + i);
+            normalize_store_bf16x16_avx2(b_vec, v_rescale, v_mean, v_std_inv, b + i);
+        }
+        const float std_inv = 1.0f / image_std;
+        for (; i < pixel_count; ++i) {
+            r[i] = bf16((static_cast<float>(src[3 * i]) * rescale_factor - image_mean) * std_inv);
+            g[i] = bf16((static_cast<float>(src[3 * i + 1]) * rescale_factor - image_mean) * std_inv);
+            b[i] = bf16((static_cast<float>(src[3 * i + 2]) * rescale_factor - image_mean) * std_inv);
+        }
+    }
+
+    // AVX2 separable bicubic resize, planar RGB uint8 in and out
+    IMGPROC_TARGET_AVX2
+    std::vector<uint8_t> resize_bicubic_antialias_rgb_planar_avx2(
+        const uint8_t* src,
+        int src_w, int src_h,
+        int dst_w, int dst_h,
+        bool antialias)
+    {
+        const size_t src_plane_size = static_cast<size_t>(src_w) * src_h;
+        const size_t dst_plane_size = static_cast<size_t>(dst_w) * dst_h;
+
+        std::vector<uint8_t> dst(dst_plane_size * 3);
+        const resize_taps_t taps_x = compute_resize_taps(src_w, dst_w, antialias);
+        const resize_taps_t taps_y = compute_resize_taps(src_h, dst_h, antialias);
+
+        // Resize each plane in parallel, straight from uint8 with one float row of scratch
+        #pragma omp parallel for num_threads(3)
+        for (int c = 0; c < 3; ++c) {
+            std::vector<float> row(src_w);
+            resize_bicubic_rows_avx2(src + c * src_plane_size, src_w, taps_x, taps_y,
+                                     0, dst_h, dst.data() + c * dst_plane_size, row.data());
+        }
+        return dst;
+    }
+
+    // AVX2 rescale and normalize, same mean/std for all channels
+    IMGPROC_TARGET_AVX2
+    void rescale_and_normalize_avx2(
+        const uint8_t *image_src,
+        float *output_buffer,
+        int image_width, int image_height, int image_channels,
+        bool do_rescale,
+        float rescale_factor,
+        bool do_normalize,
+        float image_mean,
+        float image_std
+    ) {
+        // Apply the _fuse_mean_and_rescale_factor optimization
+        if (do_rescale && do_normalize) {
+            image_mean *= 1.0f / rescale_factor;
+            image_std *= 1.0f / rescale_factor;
+            do_rescale = false;
+        }
+
+        // (pixel - mean) / std, pixel * rescale_factor or just the pixel, as (pixel - shift) * scale
+        const float shift = do_normalize ? image_mean : 0.0f;
+        const float scale = do_normalize ? 1.0f / image_std : (do_rescale ? rescale_factor : 1.0f);
+
+        const size_t total_pixels = static_cast<size_t>(image_width) * image_height * image_channels;
+        const size_t simd_width = 8; // AVX2 processes 8 floats at once
+        const size_t unroll_factor = 4; // Process 32 elements per iteration
+        const size_t vectorized_count = (total_pixels / (simd_width * unroll_factor)) * (simd_width * unroll_factor);
+
+        const __m256 v_shift = _mm256_set1_ps(shift);
+        const __m256 v_scale = _mm256_set1_ps(scale);
+
+        size_t i = 0;
+        for (; i < vectorized_count; i += simd_width * unroll_factor) {
+            __m256 f32_vec0 = load_uint8x8_avx2(image_src + i);
+            __m256 f32_vec1 = load_uint8x8_avx2(image_src + i + 8);
+            __m256 f32_vec2 = load_uint8x8_avx2(image_src + i + 16);
+            __m256 f32_vec3 = load_uint8x8_avx2(image_src + i + 24);
+
+            _mm256_storeu_ps(output_buffer + i, _mm256_mul_ps(_mm256_sub_ps(f32_vec0, v_shift), v_scale));
+            _mm256_storeu_ps(output_buffer + i + 8, _mm256_mul_ps(_mm256_sub_ps(f32_vec1, v_shift), v_scale));
+            _mm256_storeu_ps(output_buffer + i + 16, _mm256_mul_ps(_mm256_sub_ps(f32_vec2, v_shift), v_scale));
+            _mm256_storeu_ps(output_buffer + i + 24, _mm256_mul_ps(_mm256_sub_ps(f32_vec3, v_shift), v_scale));
+        }
+
+        for (; i + simd_width <= total_pixels; i += simd_width) {
+            _mm256_storeu_ps(output_buffer + i, _mm256_mul_ps(_mm256_sub_ps(load_uint8x8_avx2(image_src + i), v_shift), v_scale));
+        }
+
+        // Handle remaining pixels with scalar code
+        for (; i < total_pixels; ++i) {
+            output_buffer[i] = (static_cast<float>(image_src[i]) - shift) * scale;
+        }
+    }
+
+} // namespace avx2
+} // namespace imgproc
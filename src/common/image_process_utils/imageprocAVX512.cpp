@@ -1,22 +1,19 @@
 
 #include  "image_process_utils/imageproc.hpp"
 #include  "image_process_utils/imageprocAVX512.hpp"
+#include  "image_process_utils/imageprocAVX2.hpp"
 #include <omp.h>  // OpenMP for multi-threading
 
 namespace imgproc {
 namespace avx512 {
 
-    std::vector<float> resize_bicubic_plane_avx512(
+    IMGPROC_TARGET_AVX512
+    static std::vector<float> resize_bicubic_plane_avx512_impl(
         const std::vector<float>& src,
         int src_w, int src_h,
         int dst_w, int dst_h,
         bool antialias)
     {
-        // Fallback to scalar implementation if AVX-512 not available
-        if (!has_avx512f()) {
-            return resize_bicubic_plane(src, src_w, src_h, dst_w, dst_h, antialias);
-        }
-
         std::vector<float> dst(dst_w * dst_h);
         
         // PyTorch's exact scale calculation (align_corners=False for resize)
@@ -162,84 +159,177 @@ namespace avx512 {
         return dst;
     }
 
-    // AVX-512 optimized main RGB planar entry point
-    std::vector<uint8_t> resize_bicubic_antialias_rgb_planar_avx512(
-        const uint8_t* src,
+    std::vector<float> resize_bicubic_plane_avx512(
+        const std::vector<float>& src,
         int src_w, int src_h,
         int dst_w, int dst_h,
         bool antialias)
     {
         // Fallback to scalar implementation if AVX-512 not available
         if (!has_avx512f()) {
-            return resize_bicubic_antialias_rgb_planar(src, src_w, src_h, dst_w, dst_h, antialias);
+            return resize_bicubic_plane(src, src_w, src_h, dst_w, dst_h, antialias);
         }
+        return resize_bicubic_plane_avx512_impl(src, src_w, src_h, dst_w, dst_h, antialias);
+    }
 
-        const size_t src_plane_size = static_cast<size_t>(src_w) * src_h;
-        const size_t dst_plane_size = static_cast<size_t>(dst_w) * dst_h;
-
-        std::vector<uint8_t> dst(dst_plane_size * 3);
-
-        // Convert to float per plane using AVX-512 optimized conversion
-        std::vector<float> r(src_plane_size), g(src_plane_size), b(src_plane_size);
-        
-        // Parallelize the uint8 to float conversion (OpenMP for 3 channels)
-        #pragma omp parallel sections num_threads(3)
-        {
-            #pragma omp section
-            {
-                convert_uint8_to_float_avx512(src, r.data(), src_plane_size);
-            }
-            #pragma omp section
-            {
-                convert_uint8_to_float_avx512(src + src_plane_size, g.data(), src_plane_size);
+    // The 4 taps of each output row are summed over the whole source row (contiguous
+    // loads), then the 4 taps of each output column are gathered from it.
+    IMGPROC_TARGET_AVX512
+    void resize_bicubic_rows_avx512(
+        const uint8_t* src, int src_w,
+        const resize_taps_t& taps_x,
+        const resize_taps_t& taps_y,
+        int row_begin, int row_end,
+        uint8_t* dst,
+        float* row)
+    {
+        const int dst_w = taps_x.dst_size;
+        const size_t nx = static_cast<size_t>(dst_w);
+        const size_t ny = static_cast<size_t>(taps_y.dst_size);
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 max_val = _mm512_set1_ps(255.0f);
+        const __m512 half = _mm512_set1_ps(0.5f);
+
+        for (int dst_y = row_begin; dst_y < row_end; ++dst_y) {
+            const uint8_t* r0 = src + static_cast<size_t>(taps_y.index[dst_y]) * src_w;
+            const uint8_t* r1 = src + static_cast<size_t>(taps_y.index[ny + dst_y]) * src_w;
+            const uint8_t* r2 = src + static_cast<size_t>(taps_y.index[2 * ny + dst_y]) * src_w;
+            const uint8_t* r3 = src + static_cast<size_t>(taps_y.index[3 * ny + dst_y]) * src_w;
+            const float wy0 = taps_y.weight[dst_y];
+            const float wy1 = taps_y.weight[ny + dst_y];
+            const float wy2 = taps_y.weight[2 * ny + dst_y];
+            const float wy3 = taps_y.weight[3 * ny + dst_y];
+
+            // Vertical pass
+            const __m512 v_wy0 = _mm512_set1_ps(wy0);
+            const __m512 v_wy1 = _mm512_set1_ps(wy1);
+            const __m512 v_wy2 = _mm512_set1_ps(wy2);
+            const __m512 v_wy3 = _mm512_set1_ps(wy3);
+            int x = 0;
+            for (; x + 16 <= src_w; x += 16) {
+                __m512 acc = _mm512_mul_ps(load_uint8x16_avx512(r0 + x), v_wy0);
+                acc = _mm512_fmadd_ps(load_uint8x16_avx512(r1 + x), v_wy1, acc);
+                acc = _mm512_fmadd_ps(load_uint8x16_avx512(r2 + x), v_wy2, acc);
+                acc = _mm512_fmadd_ps(load_uint8x16_avx512(r3 + x), v_wy3, acc);
+                _mm512_storeu_ps(row + x, acc);
             }
-            #pragma omp section
-            {
-                convert_uint8_to_float_avx512(src + 2 * src_plane_size, b.data(), src_plane_size);
+            for (; x < src_w; ++x) {
+                row[x] = r0[x] * wy0 + r1[x] * wy1 + r2[x] * wy2 + r3[x] * wy3;
             }
-        }
 
-        // Resize each plane using AVX-512 optimized bicubic (parallel processing of RGB channels)
-        std::vector<float> r_resized, g_resized, b_resized;
-        
-        #pragma omp parallel sections num_threads(3)
-        {
-            #pragma omp section
-            {
-                r_resized = resize_bicubic_plane_avx512(r, src_w, src_h, dst_w, dst_h, antialias);
-            }
-            #pragma omp section
-            {
-                g_resized = resize_bicubic_plane_avx512(g, src_w, src_h, dst_w, dst_h, antialias);
+            // Horizontal pass
+            uint8_t* out = dst + static_cast<size_t>(dst_y - row_begin) * dst_w;
+            const int32_t* ix = taps_x.index.data();
+            const float* wx = taps_x.weight.data();
+            x = 0;
+            for (; x + 16 <= dst_w; x += 16) {
+                __m512 acc = _mm512_mul_ps(
+                    _mm512_i32gather_ps(_mm512_loadu_si512(ix + x), row, 4),
+                    _mm512_loadu_ps(wx + x));
+                for (size_t k = 1; k < 4; ++k) {
+                    acc = _mm512_fmadd_ps(
+                        _mm512_i32gather_ps(_mm512_loadu_si512(ix + k * nx + x), row, 4),
+                        _mm512_loadu_ps(wx + k * nx + x), acc);
+                }
+                // Clamp to [0, 255], round half up and narrow
+                acc = _mm512_min_ps(_mm512_max_ps(acc, zero), max_val);
+                __m512i i32_vec = _mm512_cvttps_epi32(_mm512_add_ps(acc, half));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm512_cvtusepi32_epi8(i32_vec));
             }
-            #pragma omp section
-            {
-                b_resized = resize_bicubic_plane_avx512(b, src_w, src_h, dst_w, dst_h, antialias);
+            for (; x < dst_w; ++x) {
+                float sum = 0.0f;
+                for (size_t k = 0; k < 4; ++k) {
+                    sum += row[ix[k * nx + x]] * wx[k * nx + x];
+                }
+                out[x] = round_to_uint8(sum);
             }
         }
+    }
 
-        // Convert back to uint8 and store planar using AVX-512 optimized conversion (parallel)
-        #pragma omp parallel sections num_threads(3)
-        {
-            #pragma omp section
-            {
-                convert_float_to_uint8_avx512(r_resized.data(), dst.data(), dst_plane_size);
-            }
-            #pragma omp section
-            {
-                convert_float_to_uint8_avx512(g_resized.data(), dst.data() + dst_plane_size, dst_plane_size);
-            }
-            #pragma omp section
-            {
-                convert_float_to_uint8_avx512(b_resized.data(), dst.data() + 2 * dst_plane_size, dst_plane_size);
-            }
-        }
+    IMGPROC_TARGET_AVX512
+    static std::vector<uint8_t> resize_bicubic_antialias_rgb_planar_avx512_impl(
+        const uint8_t* src,
+        int src_w, int src_h,
+        int dst_w, int dst_h,
+        bool antialias)
+    {
+        const size_t src_plane_size = static_cast<size_t>(src_w) * src_h;
+        const size_t dst_plane_size = static_cast<size_t>(dst_w) * dst_h;
 
+        std::vector<uint8_t> dst(dst_plane_size * 3);
+        const resize_taps_t taps_x = compute_resize_taps(src_w, dst_w, antialias);
+        const resize_taps_t taps_y = compute_resize_taps(src_h, dst_h, antialias);
+
+        // Resize each plane in parallel, straight from uint8 with one float row of scratch
+        #pragma omp parallel for num_threads(3)
+        for (int c = 0; c < 3; ++c) {
+            std::vector<float> row(src_w);
+            resize_bicubic_rows_avx512(src + c * src_plane_size, src_w, taps_x, taps_y,
+                                       0, dst_h, dst.data() + c * dst_plane_size, row.data());
+        }
         return dst;
     }
 
-    // AVX-512 optimized rescale and normalize function
-    void rescale_and_normalize_avx512(
+    // 16 values of one channel, normalized, to 16 bf16 rounded to nearest even
+    IMGPROC_TARGET_AVX512
+    static inline void normalize_store_bf16x16_avx512(__m128i u8_vec, __m512 v_rescale, __m512 v_mean, __m512 v_std_inv, bf16* dst) {
+        __m512 values = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(u8_vec));
+        values = _mm512_mul_ps(_mm512_sub_ps(_mm512_mul_ps(values, v_rescale), v_mean), v_std_inv);
+        const __m512i bits = _mm512_castps_si512(values);
+        const __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(bits, 16), _mm512_set1_epi32(1));
+        const __m512i rounded = _mm512_add_epi32(bits, _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7FFF)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm512_cvtepi32_epi16(_mm512_srli_epi32(rounded, 16)));
+    }
+
+    IMGPROC_TARGET_AVX512
+    void hwc_to_chw_normalize_bf16_avx512(
+        const uint8_t* src,
+        size_t pixel_count,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        bf16* out_ptr)
+    {
+        const __m512 v_rescale = _mm512_set1_ps(rescale_factor);
+        const __m512 v_mean = _mm512_set1_ps(image_mean);
+        const __m512 v_std_inv = _mm512_set1_ps(1.0f / image_std);
+        bf16* r = out_ptr;
+        bf16* g = out_ptr + pixel_count;
+        bf16* b = out_ptr + 2 * pixel_count;
+
+        // the byte shuffles of the AVX2 kernel deinterleave, AVX-512 normalizes 16 at a time
+        size_t i = 0;
+        for (; i + 16 <= pixel_count; i += 16) {
+            __m128i r_vec, g_vec, b_vec;
+            avx2::deinterleave_rgb16_avx2(src + 3 * i, r_vec, g_vec, b_vec);
+            normalize_store_bf16x16_avx512(r_vec, v_rescale, v_mean, v_std_inv, r + i);
+            normalize_store_bf16x16_avx512(g_vec, v_rescale, v_mean, v_std_inv, g + i);
+            normalize_store_bf16x16_avx512(b_vec, v_rescale, v_mean, v_std_inv, b + i);
+        }
+        const float std_inv = 1.0f / image_std;
+        for (; i < pixel_count; ++i) {
+            r[i] = bf16((static_cast<float>(src[3 * i]) * rescale_factor - image_mean) * std_inv);
+            g[i] = bf16((static_cast<float>(src[3 * i + 1]) * rescale_factor - image_mean) * std_inv);
+            b[i] = bf16((static_cast<float>(src[3 * i + 2]) * rescale_factor - image_mean) * std_inv);
+        }
+    }
+
+    // AVX-512 separable bicubic resize, planar RGB uint8 in and out
+    std::vector<uint8_t> resize_bicubic_antialias_rgb_planar_avx512(
+        const uint8_t* src,
+        int src_w, int src_h,
+        int dst_w, int dst_h,
+        bool antialias)
+    {
+        // Fallback to scalar implementation if AVX-512 not available
+        if (!has_avx512f()) {
+            return resize_bicubic_antialias_rgb_planar(src, src_w, src_h, dst_w, dst_h, antialias);
+        }
+        return resize_bicubic_antialias_rgb_planar_avx512_impl(src, src_w, src_h, dst_w, dst_h, antialias);
+    }
+
+    IMGPROC_TARGET_AVX512
+    static void rescale_and_normalize_avx512_impl(
         const uint8_t *image_src,
         float *output_buffer,
         int image_width, int image_height, int image_channels,
@@ -249,14 +339,6 @@ namespace avx512 {
         float image_mean,
         float image_std
     ) {
-        // Fallback to scalar implementation if AVX-512 not available
-        if (!has_avx512f()) {
-            rescale_and_normalize(image_src, output_buffer, image_width, image_height, 
-                                image_channels, do_rescale, rescale_factor, 
-                                do_normalize, image_mean, image_std);
-            return;
-        }
-
         // Apply the _fuse_mean_and_rescale_factor optimization
         if (do_rescale && do_normalize) {
             image_mean *= 1.0f / rescale_factor;
@@ -386,6 +468,41 @@ namespace avx512 {
         }
     }
 
+    // AVX-512 optimized rescale and normalize function
+    void rescale_and_normalize_avx512(
+        const uint8_t *image_src,
+        float *output_buffer,
+        int image_width, int image_height, int image_channels,
+        bool do_rescale,
+        float rescale_factor,
+        bool do_normalize,
+        float image_mean,
+        float image_std
+    ) {
+        // Fallback to scalar implementation if AVX-512 not available
+        if (!has_avx512f()) {
+            rescale_and_normalize(image_src, output_buffer, image_width, image_height, 
+                                image_channels, do_rescale, rescale_factor, 
+                                do_normalize, image_mean, image_std);
+            return;
+        }
+        rescale_and_normalize_avx512_impl(image_src, output_buffer, image_width, image_height,
+                                          image_channels, do_rescale, rescale_factor,
+                                          do_normalize, image_mean, image_std);
+    }
+
+    IMGPROC_TARGET_AVX512
+    static void rescale_and_normalize_avx512_impl(
+        const uint8_t *image_src,
+        float *output_buffer,
+        int image_width, int image_height, int image_channels,
+        bool do_rescale,
+        float rescale_factor,
+        bool do_normalize,
+        const std::vector<float>& image_mean,
+        const std::vector<float>& image_std
+    );
+
     void rescale_and_normalize_avx512(
         const uint8_t *image_src,
         float *output_buffer,
@@ -427,7 +544,22 @@ namespace avx512 {
             }
             return;
         }
+        rescale_and_normalize_avx512_impl(image_src, output_buffer, image_width, image_height,
+                                          image_channels, do_rescale, rescale_factor,
+                                          do_normalize, image_mean, image_std);
+    }
 
+    IMGPROC_TARGET_AVX512
+    static void rescale_and_normalize_avx512_impl(
+        const uint8_t *image_src,
+        float *output_buffer,
+        int image_width, int image_height, int image_channels,
+        bool do_rescale,
+        float rescale_factor,
+        bool do_normalize,
+        const std::vector<float>& image_mean,
+        const std::vector<float>& image_std
+    ) {
         const size_t plane_size = static_cast<size_t>(image_width) * image_height;
         const int channels = std::min(image_channels, 3);
 
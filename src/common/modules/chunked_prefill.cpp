@@ -0,0 +1,43 @@
+/// \file chunked_prefill.cpp
+/// \brief chunked prefill
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note This is a source file for the chunked prefill
+#include "modules/chunked_prefill.hpp"
+
+#include <algorithm>
+
+/// \brief Prefill tokens in chunks
+/// \param engine the model
+/// \param tokens the tokens to append to the KV cache
+/// \param chunk the tokens per engine call, 0 or less for all of them in one call
+/// \param hooks the cancellation and progress callbacks
+/// \param y set to the logits of the last token once all tokens are in
+/// \return the number of tokens prefilled, fewer than tokens.size() if cancelled
+int chunked_prefill(causal_lm* engine, const std::vector<int>& tokens, int chunk,
+                    const prefill_hooks_t& hooks, buffer<bf16>& y) {
+    int total = (int)tokens.size();
+    if (chunk <= 0 || chunk >= total) {
+        chunk = total;
+    }
+    int done = 0;
+    std::vector<int> part;
+    part.reserve(chunk);
+    while (done < total) {
+        if (hooks.is_cancelled && hooks.is_cancelled()) {
+            break;
+        }
+        int n = std::min(chunk, total - done);
+        part.assign(tokens.begin() + done, tokens.begin() + done + n);
+        buffer<bf16> logits = engine->prefill(part);
+        done += n;
+        if (done == total) {
+            y = logits;
+        }
+        if (hooks.on_progress) {
+            hooks.on_progress(done, total);
+        }
+    }
+    return done;
+}
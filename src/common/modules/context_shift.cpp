@@ -0,0 +1,66 @@
+/// \file context_shift.cpp
+/// \brief context shift class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note This is a source file for the context shift class
+#include "modules/context_shift.hpp"
+
+#include <algorithm>
+
+/// \brief Constructor
+/// \param sink_tokens the number of leading tokens that are never evicted
+/// \param discard_ratio the share of the evictable tokens dropped per shift
+context_shift::context_shift(int sink_tokens, float discard_ratio)
+    : sink_tokens(std::max(0, sink_tokens)), discard_ratio(std::clamp(discard_ratio, 0.0f, 1.0f)) {}
+
+/// \brief Positions to evict so that needed more tokens fit
+/// \param length the number of tokens in the KV cache
+/// \param needed the number of tokens about to be added
+/// \param max_length the context length
+/// \return [begin, end) to evict, empty if the sinks and needed do not fit anyway
+/// \note Evicting a large share at once keeps shifts rare; the minimum leaves room for
+///       needed tokens with one position to spare.
+std::pair<int, int> context_shift::plan(int length, int needed, int max_length) const {
+    int sinks = std::min(this->sink_tokens, length);
+    int evictable = length - sinks;
+    int required = length + needed - max_length + 1;
+    if (evictable <= 0 || required > evictable) {
+        return {0, 0};
+    }
+    int discard = std::max(required, (int)(evictable * this->discard_ratio));
+    discard = std::clamp(discard, 1, evictable);
+    return {sinks, sinks + discard};
+}
+
+/// \brief Evict from the KV cache and the token history
+/// \param engine the model
+/// \param history the tokens in the KV cache, may hold one more not yet forwarded
+/// \param needed the number of tokens about to be added
+/// \param max_length the context length
+/// \param in_place whether the engine may evict in place, false forces a re-prefill
+/// \return [begin, end) of the evicted positions, empty if nothing was evicted
+std::pair<int, int> context_shift::shift(causal_lm* engine, std::vector<int>& history, int needed, int max_length,
+    bool in_place) {
+    int length = std::min<int>(engine->get_current_context_length(), history.size());
+    std::pair<int, int> range = this->plan(length, needed, max_length);
+    auto [begin, end] = range;
+    if (begin >= end) {
+        return {0, 0};
+    }
+    this->shift_time.start();
+    if (!(in_place && engine->evict(begin, end))) {
+        std::vector<int> kept(history.begin(), history.begin() + begin);
+        kept.insert(kept.end(), history.begin() + end, history.begin() + length);
+        engine->clear_context();
+        if (!kept.empty()) {
+            engine->prefill(kept);
+        }
+        this->stats.reprefilled += kept.size();
+    }
+    history.erase(history.begin() + begin, history.begin() + end);
+    this->shift_time.stop(end - begin);
+    this->stats.shifts++;
+    this->stats.evicted += end - begin;
+    return range;
+}
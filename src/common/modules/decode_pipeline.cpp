@@ -0,0 +1,62 @@
+/// \file decode_pipeline.cpp
+/// \brief decode pipeline class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note This is a source file for the decode pipeline class
+#include "modules/decode_pipeline.hpp"
+
+/// \brief Start the consumer thread
+/// \param consumer called for every token, on the consumer thread
+/// \param capacity the number of tokens the decode loop may run ahead
+decode_pipeline::decode_pipeline(consumer_t consumer, size_t capacity)
+    : consumer(std::move(consumer)), ring(capacity) {
+    this->worker = std::thread(&decode_pipeline::run, this);
+}
+
+decode_pipeline::~decode_pipeline() {
+    this->ring.close();
+    if (this->worker.joinable()) {
+        this->worker.join();
+    }
+}
+
+/// \brief Hand a token to the consumer
+/// \param token the token
+/// \return false if the consumer has failed, the decode loop should stop
+bool decode_pipeline::push(decoded_token_t&& token) {
+    if (this->failed.load(std::memory_order_acquire)) {
+        return false;
+    }
+    return this->ring.push(std::move(token));
+}
+
+/// \brief Wait until every pushed token is emitted
+/// \throws the exception of the consumer, if any
+void decode_pipeline::finish() {
+    this->ring.close();
+    if (this->worker.joinable()) {
+        this->worker.join();
+    }
+    if (this->error != nullptr) {
+        std::exception_ptr e = this->error;
+        this->error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void decode_pipeline::run() {
+    decoded_token_t token;
+    while (this->ring.pop(token)) {
+        try {
+            this->consumer(token);
+        }
+        catch (...) {
+            this->error = std::current_exception();
+            this->failed.store(true, std::memory_order_release);
+            // stop taking tokens, a full ring must not block the decode loop
+            this->ring.close();
+            return;
+        }
+    }
+}
@@ -0,0 +1,1078 @@
+/// \file grammar.cpp
+/// \brief grammar constrained decoding
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note GBNF parser, JSON schema translation and the token-level matcher
+#include "modules/grammar.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+namespace grammar {
+
+// ---------------------------------------------------------------------------
+// GBNF parser
+// ---------------------------------------------------------------------------
+
+namespace {
+
+constexpr u32 UNBOUNDED = std::numeric_limits<u32>::max();
+
+inline bool is_name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
+
+class gbnf_parser {
+public:
+    gbnf_parser(const std::string& text, Grammar& out) : src(text), out(out) {}
+
+    void parse(const std::string& root_name) {
+        this->skip_space(true);
+        while (this->pos < this->src.size()) {
+            std::string name = this->parse_name();
+            this->skip_space(false);
+            if (this->src.compare(this->pos, 3, "::=") != 0) {
+                this->fail("expecting ::=");
+            }
+            this->pos += 3;
+            this->skip_space(true);
+            u32 id = this->symbol(name);
+            if (this->defined[id]) {
+                this->fail("rule defined twice: " + name);
+            }
+            this->rules[id] = this->parse_alternatives(name, false);
+            this->defined[id] = true;
+            this->skip_space(true);
+        }
+
+        for (size_t i = 0; i < this->rules.size(); i++) {
+            if (!this->defined[i]) {
+                throw std::runtime_error("grammar: undefined rule " + this->names[i]);
+            }
+        }
+        auto root = this->symbols.find(root_name);
+        if (root == this->symbols.end()) {
+            throw std::runtime_error("grammar: missing root rule " + root_name);
+        }
+
+        // Flatten
+        this->out.root = root->second;
+        this->out.rule_names = this->names;
+        for (auto& rule : this->rules) {
+            u32 start = static_cast<u32>(this->out.elements.size());
+            this->out.rule_start.push_back(start);
+            std::vector<u32> alts = {start};
+            for (size_t i = 0; i < rule.size(); i++) {
+                if (rule[i].type == ELEM_ALT) {
+                    alts.push_back(start + static_cast<u32>(i) + 1);
+                }
+            }
+            this->out.rule_alts.push_back(alts);
+            this->out.elements.insert(this->out.elements.end(), rule.begin(), rule.end());
+        }
+    }
+
+private:
+    const std::string& src;
+    Grammar& out;
+    size_t pos = 0;
+
+    std::unordered_map<std::string, u32> symbols;
+    std::vector<std::string> names;
+    std::vector<std::vector<element_t>> rules;
+    std::vector<bool> defined;
+
+    [[noreturn]] void fail(const std::string& what) const {
+        throw std::runtime_error("grammar: " + what + " at offset " + std::to_string(this->pos));
+    }
+
+    u32 symbol(const std::string& name) {
+        auto it = this->symbols.find(name);
+        if (it != this->symbols.end()) {
+            return it->second;
+        }
+        u32 id = static_cast<u32>(this->rules.size());
+        this->symbols[name] = id;
+        this->names.push_back(name);
+        this->rules.emplace_back();
+        this->defined.push_back(false);
+        return id;
+    }
+
+    u32 generated_rule(const std::string& base) {
+        std::string name;
+        do {
+            name = base + "_" + std::to_string(this->rules.size());
+        } while (this->symbols.count(name));
+        u32 id = this->symbol(name);
+        this->defined[id] = true;
+        return id;
+    }
+
+    /// \brief Skip blanks and comments, newlines only inside groups
+    void skip_space(bool newlines) {
+        while (this->pos < this->src.size()) {
+            char c = this->src[this->pos];
+            if (c == '#') {
+                while (this->pos < this->src.size() && this->src[this->pos] != '\n') this->pos++;
+            }
+            else if (c == ' ' || c == '\t' || c == '\r' || (newlines && c == '\n')) {
+                this->pos++;
+            }
+            else {
+                break;
+            }
+        }
+    }
+
+    std::string parse_name() {
+        size_t begin = this->pos;
+        while (this->pos < this->src.size() && is_name_char(this->src[this->pos])) this->pos++;
+        if (this->pos == begin) {
+            this->fail("expecting a name");
+        }
+        return this->src.substr(begin, this->pos - begin);
+    }
+
+    u32 parse_hex(int digits) {
+        u32 value = 0;
+        for (int i = 0; i < digits; i++) {
+            if (this->pos >= this->src.size()) this->fail("truncated escape");
+            char c = this->src[this->pos++];
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else this->fail("bad hex digit");
+        }
+        return value;
+    }
+
+    /// \brief One code point of a literal or a class, escapes resolved
+    u32 parse_char() {
+        if (this->pos >= this->src.size()) this->fail("unexpected end of input");
+        unsigned char c = this->src[this->pos];
+        if (c == '\\') {
+            this->pos++;
+            if (this->pos >= this->src.size()) this->fail("truncated escape");
+            char e = this->src[this->pos++];
+            switch (e) {
+                case 'n': return '\n';
+                case 'r': return '\r';
+                case 't': return '\t';
+                case 'x': return this->parse_hex(2);
+                case 'u': return this->parse_hex(4);
+                case 'U': return this->parse_hex(8);
+                default:  return static_cast<unsigned char>(e);
+            }
+        }
+        // UTF-8
+        int width = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 0;
+        if (width == 0 || this->pos + width > this->src.size()) this->fail("invalid UTF-8");
+        u32 cp = width == 1 ? c : (c & (0x7F >> width));
+        for (int i = 1; i < width; i++) {
+            cp = (cp << 6) | (static_cast<unsigned char>(this->src[this->pos + i]) & 0x3F);
+        }
+        this->pos += width;
+        return cp;
+    }
+
+    element_t add_class(std::vector<std::pair<u32, u32>> ranges, bool negated) {
+        this->out.classes.push_back({std::move(ranges), negated});
+        return {ELEM_CHAR_CLASS, static_cast<u32>(this->out.classes.size() - 1)};
+    }
+
+    std::vector<element_t> parse_alternatives(const std::string& rule_name, bool nested) {
+        std::vector<element_t> seq;
+        this->parse_sequence(rule_name, seq, nested);
+        while (this->pos < this->src.size() && this->src[this->pos] == '|') {
+            this->pos++;
+            seq.push_back({ELEM_ALT, 0});
+            this->skip_space(true);
+            this->parse_sequence(rule_name, seq, nested);
+        }
+        seq.push_back({ELEM_END, 0});
+        return seq;
+    }
+
+    void parse_sequence(const std::string& rule_name, std::vector<element_t>& seq, bool nested) {
+        size_t last_start = seq.size();
+        while (this->pos < this->src.size()) {
+            char c = this->src[this->pos];
+            if (c == '"') {
+                this->pos++;
+                last_start = seq.size();
+                while (this->pos < this->src.size() && this->src[this->pos] != '"') {
+                    u32 cp = this->parse_char();
+                    seq.push_back(this->add_class({{cp, cp}}, false));
+                }
+                if (this->pos >= this->src.size()) this->fail("unterminated literal");
+                this->pos++;
+            }
+            else if (c == '[') {
+                this->pos++;
+                last_start = seq.size();
+                bool negated = false;
+                if (this->pos < this->src.size() && this->src[this->pos] == '^') {
+                    negated = true;
+                    this->pos++;
+                }
+                std::vector<std::pair<u32, u32>> ranges;
+                while (this->pos < this->src.size() && this->src[this->pos] != ']') {
+                    u32 lo = this->parse_char();
+                    u32 hi = lo;
+                    if (this->pos + 1 < this->src.size() && this->src[this->pos] == '-' && this->src[this->pos + 1] != ']') {
+                        this->pos++;
+                        hi = this->parse_char();
+                    }
+                    ranges.emplace_back(lo, hi);
+                }
+                if (this->pos >= this->src.size()) this->fail("unterminated char class");
+                this->pos++;
+                seq.push_back(this->add_class(std::move(ranges), negated));
+            }
+            else if (c == '.') {
+                this->pos++;
+                last_start = seq.size();
+                seq.push_back(this->add_class({}, true));
+            }
+            else if (c == '(') {
+                this->pos++;
+                this->skip_space(true);
+                last_start = seq.size();
+                u32 sub = this->generated_rule(rule_name);
+                this->rules[sub] = this->parse_alternatives(rule_name, true);
+                if (this->pos >= this->src.size() || this->src[this->pos] != ')') this->fail("expecting )");
+                this->pos++;
+                seq.push_back({ELEM_RULE_REF, sub});
+            }
+            else if (is_name_char(c)) {
+                // A name followed by ::= starts the next rule
+                size_t save = this->pos;
+                std::string name = this->parse_name();
+                this->skip_space(false);
+                if (this->src.compare(this->pos, 3, "::=") == 0) {
+                    this->pos = save;
+                    break;
+                }
+                this->pos = save + name.size();
+                last_start = seq.size();
+                seq.push_back({ELEM_RULE_REF, this->symbol(name)});
+            }
+            else if (c == '*' || c == '+' || c == '?' || c == '{') {
+                if (last_start == seq.size()) this->fail("repetition without an item");
+                u32 min_times = 0;
+                u32 max_times = UNBOUNDED;
+                this->pos++;
+                if (c == '+') {
+                    min_times = 1;
+                }
+                else if (c == '?') {
+                    max_times = 1;
+                }
+                else if (c == '{') {
+                    min_times = this->parse_int();
+                    if (this->src[this->pos] == ',') {
+                        this->pos++;
+                        max_times = this->src[this->pos] == '}' ? UNBOUNDED : this->parse_int();
+                    }
+                    else {
+                        max_times = min_times;
+                    }
+                    if (this->pos >= this->src.size() || this->src[this->pos] != '}') this->fail("expecting }");
+                    this->pos++;
+                    if (max_times < min_times) this->fail("bad repetition bounds");
+                }
+                this->repeat(rule_name, seq, last_start, min_times, max_times);
+            }
+            else {
+                break;
+            }
+            this->skip_space(nested);
+        }
+    }
+
+    u32 parse_int() {
+        size_t begin = this->pos;
+        while (this->pos < this->src.size() && this->src[this->pos] >= '0' && this->src[this->pos] <= '9') this->pos++;
+        if (begin == this->pos) this->fail("expecting a number");
+        return static_cast<u32>(std::stoul(this->src.substr(begin, this->pos - begin)));
+    }
+
+    /// \brief Lower item{min,max} into copies and generated rules
+    void repeat(const std::string& rule_name, std::vector<element_t>& seq, size_t last_start, u32 min_times, u32 max_times) {
+        std::vector<element_t> item(seq.begin() + last_start, seq.end());
+        seq.resize(last_start);
+        for (u32 i = 0; i < min_times; i++) {
+            seq.insert(seq.end(), item.begin(), item.end());
+        }
+        if (max_times == UNBOUNDED) {
+            // rec ::= item rec |
+            u32 rec = this->generated_rule(rule_name);
+            std::vector<element_t> body(item);
+            body.push_back({ELEM_RULE_REF, rec});
+            body.push_back({ELEM_ALT, 0});
+            body.push_back({ELEM_END, 0});
+            this->rules[rec] = std::move(body);
+            seq.push_back({ELEM_RULE_REF, rec});
+            return;
+        }
+        // opt_1 ::= item | ; opt_n ::= item opt_{n-1} |
+        int last = -1;
+        for (u32 i = min_times; i < max_times; i++) {
+            u32 opt = this->generated_rule(rule_name);
+            std::vector<element_t> body(item);
+            if (last >= 0) {
+                body.push_back({ELEM_RULE_REF, static_cast<u32>(last)});
+            }
+            body.push_back({ELEM_ALT, 0});
+            body.push_back({ELEM_END, 0});
+            this->rules[opt] = std::move(body);
+            last = static_cast<int>(opt);
+        }
+        if (last >= 0) {
+            seq.push_back({ELEM_RULE_REF, static_cast<u32>(last)});
+        }
+    }
+};
+
+} // namespace
+
+Grammar Grammar::from_gbnf(const std::string& text, const std::string& root) {
+    Grammar g;
+    gbnf_parser(text, g).parse(root);
+    return g;
+}
+
+Grammar Grammar::from_json_schema(const nlohmann::json& schema) {
+    return Grammar::from_gbnf(json_schema_to_gbnf(schema));
+}
+
+bool Grammar::class_match(u32 class_id, u32 cp) const {
+    const char_class_t& cls = this->classes[class_id];
+    bool in = false;
+    for (const auto& [lo, hi] : cls.ranges) {
+        if (cp >= lo && cp <= hi) {
+            in = true;
+            break;
+        }
+    }
+    return in != cls.negated;
+}
+
+bool Grammar::class_has_non_ascii(u32 class_id) const {
+    const char_class_t& cls = this->classes[class_id];
+    if (cls.negated) {
+        return true;
+    }
+    for (const auto& range : cls.ranges) {
+        if (range.second >= 0x80) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// JSON schema to GBNF
+// ---------------------------------------------------------------------------
+
+namespace {
+
+const char* const PRIMITIVE_RULES[][2] = {
+    {"space",         R"(| " " | "\n" [ \t]{0,20})"},
+    // \u escapes leave out the surrogate range, lone surrogates are not valid JSON text
+    {"char",          R"([^"\\\x7F\x00-\x1F] | [\\] (["\\/bfnrt] | "u" ([0-9a-cA-CeEfF] [0-9a-fA-F]{3} | [dD] [0-7] [0-9a-fA-F]{2})))"},
+    {"string",        R"("\"" char* "\"" space)"},
+    {"integral-part", R"([0] | [1-9] [0-9]{0,15})"},
+    {"decimal-part",  R"([0-9]{1,16})"},
+    {"number",        R"("-"? integral-part ("." decimal-part)? ([eE] [-+]? integral-part)? space)"},
+    {"integer",       R"("-"? integral-part space)"},
+    {"boolean",       R"(("true" | "false") space)"},
+    {"null",          R"("null" space)"},
+    {"value",         R"(object | array | string | number | boolean | null)"},
+    {"object",        R"("{" space (string ":" space value ("," space string ":" space value)*)? "}" space)"},
+    {"array",         R"("[" space (value ("," space value)*)? "]" space)"},
+};
+
+/// \brief Rules each primitive depends on
+const char* const PRIMITIVE_DEPS[][4] = {
+    {"string", "char", "space", nullptr},
+    {"number", "integral-part", "decimal-part", "space"},
+    {"integer", "integral-part", "space", nullptr},
+    {"value", "object", "array", nullptr},
+    {"object", "string", "value", "space"},
+    {"array", "value", "space", nullptr},
+    {"boolean", "space", nullptr, nullptr},
+    {"null", "space", nullptr, nullptr},
+};
+
+std::string gbnf_literal(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    const char* hex = "0123456789ABCDEF";
+                    out += "\\x";
+                    out += hex[(c >> 4) & 0xF];
+                    out += hex[c & 0xF];
+                }
+                else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+std::string rule_name_of(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        out += ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) ? c : '-';
+    }
+    return out.empty() ? "rule" : out;
+}
+
+class schema_converter {
+public:
+    explicit schema_converter(const nlohmann::json& root) : root(root) {}
+
+    /// \brief Add a rule for a schema and return its name
+    std::string visit(const nlohmann::json& schema, const std::string& name) {
+        return this->add_rule(name, this->body(schema, name));
+    }
+
+    /// \brief Name a rule, reusing an identical one and renaming on a clash
+    std::string add_rule(const std::string& name, const std::string& body) {
+        std::string key = rule_name_of(name);
+        auto it = this->rules.find(key);
+        if (it == this->rules.end() || it->second == body || it->second.empty()) {
+            this->rules[key] = body;
+            return key;
+        }
+        int i = 1;
+        while (this->rules.count(key + "-" + std::to_string(i)) && this->rules[key + "-" + std::to_string(i)] != body) i++;
+        key += "-" + std::to_string(i);
+        this->rules[key] = body;
+        return key;
+    }
+
+    std::string primitive(const std::string& name) {
+        if (this->rules.count(name)) {
+            return name;
+        }
+        for (const auto& rule : PRIMITIVE_RULES) {
+            if (name == rule[0]) {
+                this->rules[name] = rule[1];
+            }
+        }
+        for (const auto& deps : PRIMITIVE_DEPS) {
+            if (name == deps[0]) {
+                for (int i = 1; i < 4 && deps[i]; i++) {
+                    this->primitive(deps[i]);
+                }
+            }
+        }
+        return name;
+    }
+
+    std::string to_gbnf() const {
+        std::string out;
+        auto root_rule = this->rules.find("root");
+        if (root_rule != this->rules.end()) {
+            out += "root ::= " + root_rule->second + "\n";
+        }
+        for (const auto& [name, body] : this->rules) {
+            if (name != "root") {
+                out += name + " ::= " + body + "\n";
+            }
+        }
+        return out;
+    }
+
+private:
+    const nlohmann::json& root;
+    std::map<std::string, std::string> rules;
+    std::unordered_map<std::string, std::string> refs;
+
+    const nlohmann::json& resolve(const std::string& ref) {
+        if (ref.empty() || ref[0] != '#') {
+            throw std::runtime_error("grammar: only local $ref is supported: " + ref);
+        }
+        try {
+            return this->root.at(nlohmann::json::json_pointer(ref.substr(1)));
+        }
+        catch (const std::exception&) {
+            throw std::runtime_error("grammar: unresolved $ref " + ref);
+        }
+    }
+
+    std::string body(const nlohmann::json& schema, const std::string& name) {
+        if (!schema.is_object() || schema.empty()) {
+            return this->primitive("value");
+        }
+        if (schema.contains("$ref")) {
+            std::string ref = schema["$ref"].get<std::string>();
+            auto it = this->refs.find(ref);
+            if (it != this->refs.end()) {
+                return it->second;
+            }
+            std::string ref_name = "def-" + rule_name_of(ref.substr(ref.find_last_of('/') + 1));
+            // Register first so recursive schemas refer back to the rule
+            ref_name = this->add_rule(ref_name, "");
+            this->refs[ref] = ref_name;
+            this->rules[ref_name] = this->body(this->resolve(ref), ref_name);
+            return ref_name;
+        }
+        if (schema.contains("const")) {
+            return gbnf_literal(schema["const"].dump()) + " " + this->primitive("space");
+        }
+        if (schema.contains("enum") && schema["enum"].is_array()) {
+            std::string alts;
+            for (const auto& v : schema["enum"]) {
+                alts += (alts.empty() ? "" : " | ") + gbnf_literal(v.dump());
+            }
+            return "(" + alts + ") " + this->primitive("space");
+        }
+        for (const char* key : {"anyOf", "oneOf"}) {
+            if (schema.contains(key) && schema[key].is_array()) {
+                std::string alts;
+                int i = 0;
+                for (const auto& sub : schema[key]) {
+                    alts += (alts.empty() ? "" : " | ") + this->visit(sub, name + "-" + std::to_string(i++));
+                }
+                return alts;
+            }
+        }
+        if (schema.contains("allOf") && schema["allOf"].is_array()) {
+            nlohmann::json merged = {{"type", "object"}, {"properties", nlohmann::json::object()}, {"required", nlohmann::json::array()}};
+            for (const auto& part : schema["allOf"]) {
+                const nlohmann::json& sub = part.contains("$ref") ? this->resolve(part["$ref"].get<std::string>()) : part;
+                for (auto& [key, value] : sub.value("properties", nlohmann::json::object()).items()) {
+                    merged["properties"][key] = value;
+                }
+                for (const auto& key : sub.value("required", nlohmann::json::array())) {
+                    merged["required"].push_back(key);
+                }
+            }
+            return this->body(merged, name);
+        }
+
+        nlohmann::json type = schema.value("type", nlohmann::json());
+        if (type.is_array()) {
+            std::string alts;
+            for (const auto& t : type) {
+                nlohmann::json sub = schema;
+                sub["type"] = t;
+                alts += (alts.empty() ? "" : " | ") + this->visit(sub, name + "-" + t.get<std::string>());
+            }
+            return alts;
+        }
+        std::string t = type.is_string() ? type.get<std::string>() : "";
+        if (t.empty()) {
+            t = schema.contains("properties") ? "object" : schema.contains("items") ? "array" : "";
+        }
+
+        if (t == "object") {
+            return this->object_body(schema, name);
+        }
+        if (t == "array") {
+            this->primitive("space");
+            std::string item = schema.contains("items") ? this->visit(schema["items"], name + "-item") : this->primitive("value");
+            u32 min_items = schema.value("minItems", 0u);
+            u32 max_items = schema.contains("maxItems") ? schema["maxItems"].get<u32>() : UNBOUNDED;
+            std::string rest = "(\",\" " + this->primitive("space") + " " + item + ")";
+            std::string list;
+            if (max_items == 0) {
+                list = "";
+            }
+            else {
+                u32 rest_min = min_items > 0 ? min_items - 1 : 0;
+                std::string bounds = "{" + std::to_string(rest_min) + "," +
+                    (max_items == UNBOUNDED ? "" : std::to_string(max_items - 1)) + "}";
+                list = item + " " + rest + bounds;
+                if (min_items == 0) {
+                    list = "(" + list + ")?";
+                }
+            }
+            return "\"[\" space " + list + " \"]\" space";
+        }
+        if (t == "string") {
+            if (schema.contains("minLength") || schema.contains("maxLength")) {
+                this->primitive("string");
+                u32 min_len = schema.value("minLength", 0u);
+                std::string max_len = schema.contains("maxLength") ? std::to_string(schema["maxLength"].get<u32>()) : "";
+                return "\"\\\"\" char{" + std::to_string(min_len) + "," + max_len + "} \"\\\"\" space";
+            }
+            return this->primitive("string");
+        }
+        if (t == "number" || t == "integer" || t == "boolean" || t == "null") {
+            return this->primitive(t);
+        }
+        return this->primitive("value");
+    }
+
+    std::string object_body(const nlohmann::json& schema, const std::string& name) {
+        this->primitive("space");
+        if (!schema.contains("properties")) {
+            if (schema.contains("additionalProperties") && schema["additionalProperties"].is_object()) {
+                std::string value = this->visit(schema["additionalProperties"], name + "-value");
+                std::string kv = this->primitive("string") + " \":\" space " + value;
+                return "\"{\" space (" + kv + " (\",\" space " + kv + ")*)? \"}\" space";
+            }
+            return this->primitive("object");
+        }
+
+        std::vector<std::string> required_names;
+        for (const auto& key : schema.value("required", nlohmann::json::array())) {
+            required_names.push_back(key.get<std::string>());
+        }
+        // Required properties first, then the optional ones, each in schema order
+        std::vector<std::string> required_kv, optional_kv;
+        for (auto& [key, sub] : schema["properties"].items()) {
+            std::string kv = gbnf_literal(nlohmann::json(key).dump()) + " space \":\" space " +
+                this->visit(sub, name + "-" + key);
+            bool required = std::find(required_names.begin(), required_names.end(), key) != required_names.end();
+            (required ? required_kv : optional_kv).push_back(kv);
+        }
+        std::string extra;
+        if (schema.contains("additionalProperties") &&
+            (schema["additionalProperties"].is_object() || schema["additionalProperties"] == true)) {
+            std::string value = schema["additionalProperties"].is_object() ?
+                this->visit(schema["additionalProperties"], name + "-additional") : this->primitive("value");
+            extra = this->primitive("string") + " \":\" space " + value;
+        }
+
+        std::string body;
+        if (!required_kv.empty()) {
+            for (size_t i = 0; i < required_kv.size(); i++) {
+                body += (i ? " \",\" space " : "") + required_kv[i];
+            }
+            for (const auto& kv : optional_kv) {
+                body += " (\",\" space " + kv + ")?";
+            }
+            if (!extra.empty()) {
+                body += " (\",\" space " + extra + ")*";
+            }
+        }
+        else if (!optional_kv.empty() || !extra.empty()) {
+            // Every property is optional: choose the first one present, the rest follow with commas
+            std::string alts;
+            for (size_t i = 0; i < optional_kv.size(); i++) {
+                std::string alt = optional_kv[i];
+                for (size_t j = i + 1; j < optional_kv.size(); j++) {
+                    alt += " (\",\" space " + optional_kv[j] + ")?";
+                }
+                if (!extra.empty()) {
+                    alt += " (\",\" space " + extra + ")*";
+                }
+                alts += (alts.empty() ? "" : " | ") + this->add_rule(name + "-from-" + std::to_string(i), alt);
+            }
+            if (!extra.empty()) {
+                alts += (alts.empty() ? "" : " | ") + extra + " (\",\" space " + extra + ")*";
+            }
+            body = "(" + alts + ")?";
+        }
+        return "\"{\" space " + body + " \"}\" space";
+    }
+};
+
+} // namespace
+
+std::string json_schema_to_gbnf(const nlohmann::json& schema) {
+    schema_converter converter(schema);
+    converter.visit(schema, "root");
+    return converter.to_gbnf();
+}
+
+std::string tool_calls_to_gbnf(const nlohmann::ordered_json& tools, const std::string& end_marker) {
+    nlohmann::json tools_json = nlohmann::json::parse(tools.dump());
+    schema_converter converter(tools_json);
+    std::string calls;
+    for (const auto& tool : tools_json) {
+        const nlohmann::json& function = tool.contains("function") ? tool["function"] : tool;
+        if (!function.contains("name") || !function["name"].is_string()) {
+            continue;
+        }
+        std::string name = function["name"].get<std::string>();
+        nlohmann::json parameters = function.value("parameters", nlohmann::json::object());
+        std::string args = converter.visit(parameters, name + "-arguments");
+        std::string call = "\"{\" space " + gbnf_literal("\"name\"") + " space \":\" space " +
+            gbnf_literal(nlohmann::json(name).dump()) + " space \",\" space " +
+            gbnf_literal("\"arguments\"") + " space \":\" space " + args + " \"}\" space";
+        calls += (calls.empty() ? "" : " | ") + converter.add_rule(name + "-call", call);
+    }
+    if (calls.empty()) {
+        return "";
+    }
+    converter.primitive("space");
+    converter.add_rule("root", "space (" + calls + ") " + gbnf_literal(end_marker));
+    return converter.to_gbnf();
+}
+
+// ---------------------------------------------------------------------------
+// Token trie
+// ---------------------------------------------------------------------------
+
+TokenTrie::TokenTrie(std::vector<std::string> tokens) : tokens(std::move(tokens)) {
+    for (int id = 0; id < this->vocab_size(); id++) {
+        if (!this->tokens[id].empty()) {
+            this->order.push_back(id);
+            this->max_len = std::max(this->max_len, this->tokens[id].size());
+        }
+    }
+    std::sort(this->order.begin(), this->order.end(), [this](int a, int b) {
+        return this->tokens[a] < this->tokens[b];
+    });
+    this->lcp.resize(this->order.size(), 0);
+    for (size_t i = 1; i < this->order.size(); i++) {
+        const std::string& a = this->tokens[this->order[i - 1]];
+        const std::string& b = this->tokens[this->order[i]];
+        size_t n = 0;
+        while (n < a.size() && n < b.size() && a[n] == b[n]) n++;
+        this->lcp[i] = static_cast<u32>(n);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Matcher
+// ---------------------------------------------------------------------------
+
+GrammarMatcher::GrammarMatcher(Grammar grammar, std::shared_ptr<const TokenTrie> trie,
+    const std::vector<int>& eos_token_ids, int mask_bits)
+    : grammar(std::move(grammar)), trie(std::move(trie)), eos_token_ids(eos_token_ids), mask_bits(mask_bits) {
+    this->path.resize(this->trie->max_len + 1);
+    this->reset();
+}
+
+void GrammarMatcher::set_trigger(const std::string& trigger) {
+    this->trigger = trigger;
+    this->reset();
+}
+
+void GrammarMatcher::reset() {
+    if (this->start_state < 0) {
+        // The start state expands every alternative of the root rule
+        std::vector<stack_t> stacks;
+        for (u32 alt : this->grammar.rule_alts[this->grammar.root]) {
+            stack_t s;
+            if (this->grammar.elements[alt].type != ELEM_END && this->grammar.elements[alt].type != ELEM_ALT) {
+                s.push_back(alt);
+            }
+            this->expand(s, stacks, 0);
+        }
+        this->start_state = this->intern(stacks, 0, 0);
+    }
+    this->current = this->start_state;
+    this->is_active = this->trigger.empty();
+    this->tail.clear();
+}
+
+void GrammarMatcher::expand(stack_t& stack, std::vector<stack_t>& out, int depth) const {
+    if (depth > 256) {
+        throw std::runtime_error("grammar: left recursion or nesting too deep");
+    }
+    if (stack.empty()) {
+        out.push_back(stack);
+        return;
+    }
+    u32 pos = stack.back();
+    const element_t& e = this->grammar.elements[pos];
+    if (e.type == ELEM_CHAR_CLASS) {
+        out.push_back(stack);
+        return;
+    }
+    // Rule reference: replace it by its continuation and each alternative
+    stack_t base(stack.begin(), stack.end() - 1);
+    elem_type_t next = this->grammar.elements[pos + 1].type;
+    if (next != ELEM_END && next != ELEM_ALT) {
+        base.push_back(pos + 1);
+    }
+    for (u32 alt : this->grammar.rule_alts[e.value]) {
+        stack_t s(base);
+        elem_type_t first = this->grammar.elements[alt].type;
+        if (first != ELEM_END && first != ELEM_ALT) {
+            s.push_back(alt);
+        }
+        this->expand(s, out, depth + 1);
+    }
+}
+
+void GrammarMatcher::advance(const std::vector<stack_t>& stacks, u32 cp, std::vector<stack_t>& out) const {
+    for (const stack_t& stack : stacks) {
+        if (stack.empty()) {
+            continue;
+        }
+        u32 pos = stack.back();
+        if (!this->grammar.class_match(this->grammar.elements[pos].value, cp)) {
+            continue;
+        }
+        stack_t s(stack.begin(), stack.end() - 1);
+        elem_type_t next = this->grammar.elements[pos + 1].type;
+        if (next != ELEM_END && next != ELEM_ALT) {
+            s.push_back(pos + 1);
+        }
+        this->expand(s, out, 0);
+    }
+}
+
+int GrammarMatcher::intern(std::vector<stack_t>& stacks, u32 partial_cp, u8 partial_left) {
+    std::sort(stacks.begin(), stacks.end());
+    stacks.erase(std::unique(stacks.begin(), stacks.end()), stacks.end());
+
+    std::string key;
+    key.reserve(8 + stacks.size() * 16);
+    auto put = [&key](u32 v) { key.append(reinterpret_cast<const char*>(&v), sizeof(v)); };
+    put(partial_cp);
+    put(partial_left);
+    for (const stack_t& s : stacks) {
+        put(static_cast<u32>(s.size()));
+        for (u32 v : s) put(v);
+    }
+    auto it = this->state_index.find(key);
+    if (it != this->state_index.end()) {
+        return it->second;
+    }
+
+    state_t st;
+    st.partial_cp = partial_cp;
+    st.partial_left = partial_left;
+    st.complete = partial_left == 0;
+    for (const stack_t& s : stacks) {
+        if (s.empty()) {
+            st.accepting = partial_left == 0;
+        }
+        else {
+            st.complete = false;
+            st.non_ascii |= this->grammar.class_has_non_ascii(this->grammar.elements[s.back()].value);
+        }
+    }
+    st.stacks = std::move(stacks);
+    int id = static_cast<int>(this->states.size());
+    this->states.push_back(std::move(st));
+    this->state_index.emplace(std::move(key), id);
+    return id;
+}
+
+/// \brief Transition on one byte, decoding UTF-8 into code points
+/// \return the next state, -1 if the byte is rejected
+int GrammarMatcher::step(int state_id, u8 byte) {
+    if (!this->states[state_id].next) {
+        this->states[state_id].next.reset(new int[256]);
+        std::fill_n(this->states[state_id].next.get(), 256, -2);
+    }
+    int cached = this->states[state_id].next[byte];
+    if (cached != -2) {
+        return cached;
+    }
+
+    const state_t& st = this->states[state_id];
+    std::vector<stack_t> stacks;
+    u32 cp = 0;
+    u8 left = 0;
+    bool dead = false;
+    if (st.partial_left == 0) {
+        if (byte < 0x80) {
+            this->advance(st.stacks, byte, stacks);
+        }
+        else if (!st.non_ascii) {
+            dead = true;
+        }
+        else if ((byte & 0xE0) == 0xC0) { cp = byte & 0x1F; left = 1; }
+        else if ((byte & 0xF0) == 0xE0) { cp = byte & 0x0F; left = 2; }
+        else if ((byte & 0xF8) == 0xF0) { cp = byte & 0x07; left = 3; }
+        else {
+            dead = true;
+        }
+        if (left > 0) {
+            stacks = st.stacks;
+        }
+    }
+    else if ((byte & 0xC0) != 0x80) {
+        dead = true;
+    }
+    else {
+        cp = (st.partial_cp << 6) | (byte & 0x3F);
+        left = st.partial_left - 1;
+        if (left == 0) {
+            this->advance(st.stacks, cp, stacks);
+            cp = 0;
+        }
+        else {
+            stacks = st.stacks;
+        }
+    }
+
+    int next = -1;
+    if (!dead && !stacks.empty()) {
+        next = this->intern(stacks, cp, left);
+    }
+    this->states[state_id].next[byte] = next;
+    return next;
+}
+
+/// \brief Walk the sorted vocabulary from a state, pruning dead prefixes
+void GrammarMatcher::compute_mask(int state_id, std::vector<u64>& mask) {
+    mask.assign((this->mask_bits + 63) / 64, 0);
+    const std::vector<int>& order = this->trie->order;
+    const std::vector<u32>& lcp = this->trie->lcp;
+    size_t valid = 1;                       // path[0 .. valid-1] hold the states of the current prefix
+    size_t dead_depth = std::numeric_limits<size_t>::max();
+    this->path[0] = state_id;
+
+    for (size_t i = 0; i < order.size(); i++) {
+        size_t shared = lcp[i];
+        if (shared >= dead_depth) {
+            continue;                       // same dead prefix as the previous token
+        }
+        dead_depth = std::numeric_limits<size_t>::max();
+        valid = std::min(valid, shared + 1);
+
+        int token_id = order[i];
+        const std::string& bytes = this->trie->bytes(token_id);
+        size_t k = valid - 1;
+        for (; k < bytes.size(); k++) {
+            int next = this->step(this->path[k], static_cast<u8>(bytes[k]));
+            if (next < 0) {
+                dead_depth = k + 1;
+                break;
+            }
+            this->path[k + 1] = next;
+        }
+        if (dead_depth != std::numeric_limits<size_t>::max()) {
+            valid = dead_depth;
+            continue;
+        }
+        valid = bytes.size() + 1;
+        if (token_id < this->mask_bits) {
+            mask[token_id >> 6] |= u64(1) << (token_id & 63);
+        }
+    }
+
+    if (this->states[state_id].accepting && this->trigger.empty()) {
+        for (int eos : this->eos_token_ids) {
+            if (eos >= 0 && eos < this->mask_bits) {
+                mask[eos >> 6] |= u64(1) << (eos & 63);
+            }
+        }
+    }
+}
+
+void GrammarMatcher::flush_cache() {
+    // Keep the current state, drop everything else
+    std::vector<stack_t> stacks = this->states[this->current].stacks;
+    u32 cp = this->states[this->current].partial_cp;
+    u8 left = this->states[this->current].partial_left;
+    this->states.clear();
+    this->state_index.clear();
+    this->mask_pool.clear();
+    this->mask_owner.clear();
+    this->mask_next = 0;
+    this->start_state = -1;
+    this->current = -1;
+    bool active = this->is_active;
+    std::string tail = this->tail;
+    this->reset();
+    this->is_active = active;
+    this->tail = tail;
+    this->current = this->intern(stacks, cp, left);
+}
+
+const std::vector<u64>& GrammarMatcher::allowed_mask() {
+    if (this->states.size() > MAX_STATES) {
+        this->flush_cache();
+    }
+    int slot = this->states[this->current].mask_slot;
+    if (slot >= 0) {
+        this->cache_hits++;
+        return this->mask_pool[slot];
+    }
+    this->cache_misses++;
+    if (this->mask_pool.size() < MAX_MASKS) {
+        slot = static_cast<int>(this->mask_pool.size());
+        this->mask_pool.emplace_back();
+        this->mask_owner.push_back(-1);
+    }
+    else {
+        slot = static_cast<int>(this->mask_next);
+        this->mask_next = (this->mask_next + 1) % MAX_MASKS;
+        if (this->mask_owner[slot] >= 0) {
+            this->states[this->mask_owner[slot]].mask_slot = -1;
+        }
+    }
+    this->compute_mask(this->current, this->mask_pool[slot]);
+    this->mask_owner[slot] = this->current;
+    this->states[this->current].mask_slot = slot;
+    return this->mask_pool[slot];
+}
+
+bool GrammarMatcher::accept(int token_id) {
+    static const std::string no_bytes;
+    const std::string& bytes = (token_id >= 0 && token_id < this->trie->vocab_size()) ?
+        this->trie->bytes(token_id) : no_bytes;
+
+    if (!this->is_active) {
+        // Lazy: look for the trigger in the recent text
+        this->tail += bytes;
+        size_t at = this->tail.find(this->trigger);
+        if (at == std::string::npos) {
+            if (this->tail.size() > this->trigger.size()) {
+                this->tail.erase(0, this->tail.size() - this->trigger.size());
+            }
+            return true;
+        }
+        std::string rest = this->tail.substr(at + this->trigger.size());
+        this->tail.clear();
+        this->current = this->start_state;
+        this->is_active = true;
+        for (char c : rest) {
+            int next = this->step(this->current, static_cast<u8>(c));
+            if (next < 0) {
+                this->is_active = false;
+                return false;
+            }
+            this->current = next;
+        }
+        return true;
+    }
+
+    if (std::find(this->eos_token_ids.begin(), this->eos_token_ids.end(), token_id) != this->eos_token_ids.end()) {
+        return this->is_accepting();
+    }
+    int state = this->current;
+    for (char c : bytes) {
+        state = this->step(state, static_cast<u8>(c));
+        if (state < 0) {
+            return false;
+        }
+    }
+    if (bytes.empty()) {
+        return false;
+    }
+    this->current = state;
+    if (!this->trigger.empty() && this->states[state].complete) {
+        // Span done, back to free generation until the next trigger
+        this->is_active = false;
+        this->current = this->start_state;
+    }
+    return true;
+}
+
+bool GrammarMatcher::is_accepting() const {
+    return this->states[this->current].accepting;
+}
+
+bool GrammarMatcher::is_complete() const {
+    return this->states[this->current].complete;
+}
+
+} // namespace grammar
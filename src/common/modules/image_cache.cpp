@@ -0,0 +1,159 @@
+/// \file image_cache.cpp
+/// \brief image cache class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note This is a source file for the image cache class
+#include "modules/image_cache.hpp"
+
+#include <cstring>
+
+/// \brief Constructor
+/// \param max_bytes the memory for the pixel values
+/// \param max_images the number of images kept
+image_cache::image_cache(size_t max_bytes, size_t max_images) : max_bytes(max_bytes), max_images(max_images) {}
+
+/// \brief Key of an image
+/// \param data the raw payload, e.g. the base64 string of a request
+/// \param params everything the preprocessing depends on, e.g. the model and target size
+std::string image_cache::key(const std::string& data, const std::string& params) {
+    auto [h1, h2] = image_cache::hash128(data.data(), data.size(), 0x464c4d);
+    uint64_t size = data.size();
+    std::string key(24, '\0');
+    memcpy(&key[0], &h1, 8);
+    memcpy(&key[8], &h2, 8);
+    memcpy(&key[16], &size, 8);
+    return key + params;
+}
+
+/// \brief Look an image up
+/// \return nullptr if it is not kept
+std::shared_ptr<const preprocessed_image_t> image_cache::get(const std::string& key) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->index.find(key);
+    if (found == this->index.end()) {
+        this->misses++;
+        return nullptr;
+    }
+    this->hits++;
+    this->entries.splice(this->entries.begin(), this->entries, found->second);
+    return found->second->image;
+}
+
+/// \brief Keep an image, the least recently used ones go to make room
+void image_cache::put(const std::string& key, std::shared_ptr<const preprocessed_image_t> image) {
+    if (image == nullptr) {
+        return;
+    }
+    size_t size = image->pixels.size() * sizeof(bf16);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (size > this->max_bytes || this->max_images == 0) {
+        this->too_large++;
+        return;
+    }
+    auto found = this->index.find(key);
+    if (found != this->index.end()) {
+        this->bytes -= found->second->bytes;
+        this->entries.erase(found->second);
+        this->index.erase(found);
+    }
+    this->entries.push_front({key, std::move(image), size});
+    this->index[key] = this->entries.begin();
+    this->bytes += size;
+    this->_trim();
+}
+
+/// \brief Change the limits, images go at once if they no longer fit
+void image_cache::set_limits(size_t max_bytes, size_t max_images) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->max_bytes = max_bytes;
+    this->max_images = max_images;
+    this->_trim();
+}
+
+/// \brief Drop all images
+void image_cache::clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries.clear();
+    this->index.clear();
+    this->bytes = 0;
+}
+
+/// \brief Hits, misses, evictions and the memory in use
+nlohmann::json image_cache::stats() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return {
+        {"images", this->entries.size()},
+        {"bytes", this->bytes},
+        {"max_images", this->max_images},
+        {"max_bytes", this->max_bytes},
+        {"hits", this->hits},
+        {"misses", this->misses},
+        {"evictions", this->evictions},
+        {"too_large", this->too_large}
+    };
+}
+
+/// \brief Drop least recently used images until the limits hold, lock held
+void image_cache::_trim() {
+    while (!this->entries.empty() && (this->bytes > this->max_bytes || this->entries.size() > this->max_images)) {
+        this->bytes -= this->entries.back().bytes;
+        this->index.erase(this->entries.back().key);
+        this->entries.pop_back();
+        this->evictions++;
+    }
+}
+
+/// \brief 128-bit hash of a byte range, MurmurHash3 x64, several GB/s
+std::pair<uint64_t, uint64_t> image_cache::hash128(const void* data, size_t size, uint64_t seed) {
+    const uint64_t c1 = 0x87c37b91114253d5ull;
+    const uint64_t c2 = 0x4cf5ad432745937full;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto fmix = [](uint64_t k) {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+    };
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t h1 = seed, h2 = seed;
+    size_t blocks = size / 16;
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, p + i * 16, 8);
+        memcpy(&k2, p + i * 16 + 8, 8);
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // The last up to 15 bytes
+    const uint8_t* tail = p + blocks * 16;
+    uint64_t k1 = 0, k2 = 0;
+    size_t rest = size & 15;
+    for (size_t i = rest; i > 8; i--) {
+        k2 ^= (uint64_t)tail[i - 1] << ((i - 9) * 8);
+    }
+    for (size_t i = rest < 8 ? rest : 8; i > 0; i--) {
+        k1 ^= (uint64_t)tail[i - 1] << ((i - 1) * 8);
+    }
+    if (rest > 8) {
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    if (rest > 0) {
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    return {h1, h2};
+}
@@ -0,0 +1,622 @@
+/// \file kv_session.cpp
+/// \brief session snapshot reader and writer
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Snapshot file format, byte-plane Huffman codec and memory mapping
+#include "modules/kv_session.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <queue>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace kv_session {
+
+namespace {
+
+constexpr char MAGIC[8] = {'F', 'L', 'M', 'S', 'E', 'S', 'S', '\0'};
+constexpr u32 VERSION = 1;
+constexpr u64 PAGE = 4096;
+constexpr size_t IO_BUFFER_BYTES = 8u << 20;
+
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 flags;          // bit 0: compressed blobs may be present
+    u64 index_offset;
+    u64 index_count;
+    u64 state_offset;
+    u64 state_size;
+    u8 reserved[16];
+} file_header_t;
+static_assert(sizeof(file_header_t) == 64, "the header is 64 bytes");
+static_assert(sizeof(blob_entry_t) == 40, "index entries are 40 bytes");
+
+inline int elem_size_of(u32 kind) {
+    return kind == BLOB_TOKENS ? 4 : 2;
+}
+
+// ---------------------------------------------------------------------------
+// Huffman codec
+// ---------------------------------------------------------------------------
+
+constexpr int MAX_CODE_LEN = 15;
+constexpr u8 PLANE_RAW = 0;
+constexpr u8 PLANE_HUFFMAN = 1;
+
+/// \brief Code lengths of at most MAX_CODE_LEN bits
+/// \note Frequencies are halved until the tree is shallow enough, which costs a fraction
+///       of a percent on skewed planes and never happens on typical ones.
+void build_lengths(const u64 freq[256], u8 lengths[256]) {
+    std::vector<u64> weight(freq, freq + 256);
+    while (true) {
+        std::memset(lengths, 0, 256);
+        std::vector<int> symbols;
+        for (int s = 0; s < 256; s++) {
+            if (weight[s] > 0) {
+                symbols.push_back(s);
+            }
+        }
+        if (symbols.size() <= 1) {
+            if (!symbols.empty()) {
+                lengths[symbols[0]] = 1;
+            }
+            return;
+        }
+        // Leaves first, then internal nodes; parent of the root is -1
+        std::vector<int> parent(2 * symbols.size() - 1, -1);
+        typedef std::pair<u64, int> node_t;
+        std::priority_queue<node_t, std::vector<node_t>, std::greater<node_t>> heap;
+        for (size_t i = 0; i < symbols.size(); i++) {
+            heap.push({weight[symbols[i]], (int)i});
+        }
+        int next = symbols.size();
+        while (heap.size() > 1) {
+            node_t a = heap.top();
+            heap.pop();
+            node_t b = heap.top();
+            heap.pop();
+            parent[a.second] = next;
+            parent[b.second] = next;
+            heap.push({a.first + b.first, next++});
+        }
+        // Internal nodes are created after their children, so depths resolve top-down
+        std::vector<int> depth(parent.size(), 0);
+        for (int n = (int)parent.size() - 2; n >= 0; n--) {
+            depth[n] = depth[parent[n]] + 1;
+        }
+        int max_depth = 0;
+        for (size_t i = 0; i < symbols.size(); i++) {
+            max_depth = std::max(max_depth, depth[i]);
+        }
+        if (max_depth <= MAX_CODE_LEN) {
+            for (size_t i = 0; i < symbols.size(); i++) {
+                lengths[symbols[i]] = (u8)depth[i];
+            }
+            return;
+        }
+        for (int s = 0; s < 256; s++) {
+            if (weight[s] > 0) {
+                weight[s] = (weight[s] >> 1) | 1;
+            }
+        }
+    }
+}
+
+/// \brief Canonical codes of the lengths
+void build_codes(const u8 lengths[256], u16 codes[256]) {
+    int count[MAX_CODE_LEN + 1] = {0};
+    for (int s = 0; s < 256; s++) {
+        count[lengths[s]]++;
+    }
+    count[0] = 0;
+    u16 next[MAX_CODE_LEN + 1] = {0};
+    u16 code = 0;
+    for (int len = 1; len <= MAX_CODE_LEN; len++) {
+        code = (code + count[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (int s = 0; s < 256; s++) {
+        codes[s] = lengths[s] ? next[lengths[s]]++ : 0;
+    }
+}
+
+/// \brief MSB-first bit writer
+class bit_writer {
+public:
+    bit_writer(std::vector<u8>& out) : out(out) {}
+    inline void put(u32 code, int len) {
+        this->acc = (this->acc << len) | code;
+        this->bits += len;
+        while (this->bits >= 8) {
+            this->bits -= 8;
+            this->out.push_back((u8)(this->acc >> this->bits));
+        }
+    }
+    inline void flush() {
+        if (this->bits > 0) {
+            this->out.push_back((u8)(this->acc << (8 - this->bits)));
+            this->bits = 0;
+        }
+    }
+
+private:
+    std::vector<u8>& out;
+    u64 acc = 0;
+    int bits = 0;
+};
+
+/// \brief MSB-first bit reader, reads zeros past the end
+class bit_reader {
+public:
+    bit_reader(const u8* data, size_t size) : data(data), size(size) {}
+    inline u32 peek(int len) {
+        while (this->bits <= 56) {
+            u64 byte = this->pos < this->size ? this->data[this->pos] : 0;
+            this->pos++;
+            this->acc |= byte << (56 - this->bits);
+            this->bits += 8;
+        }
+        return (u32)(this->acc >> (64 - len));
+    }
+    inline void skip(int len) {
+        this->acc <<= len;
+        this->bits -= len;
+    }
+    /// \brief Whether more bits were consumed than the stream holds
+    inline bool overrun() const { return this->pos * 8 - this->bits > this->size * 8; }
+
+private:
+    const u8* data;
+    size_t size;
+    size_t pos = 0;
+    u64 acc = 0;
+    int bits = 0;
+};
+
+void put_u64(std::vector<u8>& out, u64 value) {
+    u8 bytes[8];
+    std::memcpy(bytes, &value, 8);
+    out.insert(out.end(), bytes, bytes + 8);
+}
+
+bool get_u64(const u8*& data, const u8* end, u64& value) {
+    if (end - data < 8) {
+        return false;
+    }
+    std::memcpy(&value, data, 8);
+    data += 8;
+    return true;
+}
+
+/// \brief Append one byte plane, Huffman coded when that is smaller
+void encode_plane(const std::vector<u8>& plane, std::vector<u8>& out) {
+    u64 freq[256] = {0};
+    for (u8 b : plane) {
+        freq[b]++;
+    }
+    u8 lengths[256];
+    build_lengths(freq, lengths);
+    u64 bits = 0;
+    for (int s = 0; s < 256; s++) {
+        bits += freq[s] * lengths[s];
+    }
+    if (bits / 8 + 1 + 128 + 8 >= plane.size()) {
+        out.push_back(PLANE_RAW);
+        out.insert(out.end(), plane.begin(), plane.end());
+        return;
+    }
+    out.push_back(PLANE_HUFFMAN);
+    for (int s = 0; s < 256; s += 2) {
+        out.push_back((u8)(lengths[s] | (lengths[s + 1] << 4)));
+    }
+    u16 codes[256];
+    build_codes(lengths, codes);
+    put_u64(out, (bits + 7) / 8);
+    out.reserve(out.size() + (bits + 7) / 8);
+    bit_writer writer(out);
+    for (u8 b : plane) {
+        writer.put(codes[b], lengths[b]);
+    }
+    writer.flush();
+}
+
+/// \brief Decode one byte plane into every elem_size-th byte of out
+bool decode_plane(const u8*& data, const u8* end, u8* out, size_t n, int elem_size) {
+    if (data >= end) {
+        return false;
+    }
+    u8 mode = *data++;
+    if (mode == PLANE_RAW) {
+        if ((size_t)(end - data) < n) {
+            return false;
+        }
+        for (size_t i = 0; i < n; i++) {
+            out[i * elem_size] = data[i];
+        }
+        data += n;
+        return true;
+    }
+    if (mode != PLANE_HUFFMAN || end - data < 128) {
+        return false;
+    }
+    u8 lengths[256];
+    for (int s = 0; s < 256; s += 2) {
+        lengths[s] = data[s / 2] & 0x0F;
+        lengths[s + 1] = data[s / 2] >> 4;
+    }
+    data += 128;
+    u64 payload = 0;
+    if (!get_u64(data, end, payload) || (u64)(end - data) < payload) {
+        return false;
+    }
+    u16 codes[256];
+    build_codes(lengths, codes);
+    // One lookup per symbol: the next MAX_CODE_LEN bits index the symbol and its length
+    std::vector<u16> table(1u << MAX_CODE_LEN, 0);
+    for (int s = 0; s < 256; s++) {
+        int len = lengths[s];
+        if (len == 0) {
+            continue;
+        }
+        u32 first = (u32)codes[s] << (MAX_CODE_LEN - len);
+        u32 last = first + (1u << (MAX_CODE_LEN - len));
+        if (last > table.size()) {
+            return false;
+        }
+        for (u32 i = first; i < last; i++) {
+            table[i] = (u16)(s | (len << 8));
+        }
+    }
+    bit_reader reader(data, payload);
+    for (size_t i = 0; i < n; i++) {
+        u16 entry = table[reader.peek(MAX_CODE_LEN)];
+        int len = entry >> 8;
+        if (len == 0) {
+            return false;
+        }
+        out[i * elem_size] = (u8)entry;
+        reader.skip(len);
+    }
+    if (reader.overrun()) {
+        return false;
+    }
+    data += payload;
+    return true;
+}
+
+} // end of anonymous namespace
+
+/// \brief Compress elements of elem_size bytes
+/// \param data the elements
+/// \param bytes the size of data, a multiple of elem_size
+/// \param elem_size the element size, 1 to 8
+/// \param out the compressed bytes, replaced
+/// \note Caches are allocated for the full context, the unused tail is zero and costs
+///       nothing once trimmed.
+void compress(const u8* data, size_t bytes, int elem_size, std::vector<u8>& out) {
+    out.clear();
+    size_t kept = bytes;
+    while (kept > 0 && data[kept - 1] == 0) {
+        kept--;
+    }
+    kept = (kept + elem_size - 1) / elem_size * elem_size;
+    put_u64(out, kept);
+    size_t n = kept / elem_size;
+    std::vector<u8> plane(n);
+    for (int p = 0; p < elem_size; p++) {
+        for (size_t i = 0; i < n; i++) {
+            plane[i] = data[i * elem_size + p];
+        }
+        encode_plane(plane, out);
+    }
+}
+
+/// \brief Inverse of compress
+/// \param data the compressed bytes
+/// \param size the size of data
+/// \param elem_size the element size given to compress
+/// \param out bytes of decoded output, the size compress was given
+/// \param bytes the size of out
+/// \return false if data is corrupt
+bool decompress(const u8* data, size_t size, int elem_size, u8* out, size_t bytes) {
+    const u8* end = data + size;
+    u64 kept = 0;
+    if (!get_u64(data, end, kept) || kept > bytes || kept % elem_size != 0) {
+        return false;
+    }
+    if (bytes == 0) {
+        return true;    // out may be null
+    }
+    std::memset(out + kept, 0, bytes - kept);
+    size_t n = kept / elem_size;
+    for (int p = 0; p < elem_size; p++) {
+        if (!decode_plane(data, end, out + p, n, elem_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Writer
+// ---------------------------------------------------------------------------
+
+/// \brief Constructor
+/// \param path the snapshot file
+/// \param compress whether to compress the caches
+writer::writer(const std::string& path, bool compress)
+    : path(path), tmp_path(path + ".tmp"), compress_blobs(compress) {
+    this->file = std::fopen(this->tmp_path.c_str(), "wb");
+    if (this->file == nullptr) {
+        return;
+    }
+    this->io_buffer.resize(IO_BUFFER_BYTES);
+    std::setvbuf(this->file, this->io_buffer.data(), _IOFBF, this->io_buffer.size());
+    // Placeholder header, the real one goes in last
+    file_header_t header = {};
+    if (!this->put(&header, sizeof(header)) || !this->pad_to(PAGE)) {
+        this->abort();
+    }
+}
+
+writer::~writer() {
+    if (this->file != nullptr) {
+        this->abort();
+    }
+}
+
+/// \brief Append a blob
+/// \param kind what the blob holds
+/// \param layer the layer index, 0 for tokens
+/// \param idx the index, 0 for tokens
+/// \param data the elements
+/// \param count the number of elements
+/// \return false on a write error
+bool writer::write(blob_kind_t kind, int layer, int idx, const void* data, size_t count) {
+    if (this->file == nullptr) {
+        return false;
+    }
+    int elem_size = elem_size_of(kind);
+    size_t bytes = count * elem_size;
+    blob_entry_t entry = {(u32)kind, (u32)layer, (u32)idx, CODEC_STORED, 0, bytes, count};
+    if (this->compress_blobs && bytes > 0) {
+        compress((const u8*)data, bytes, elem_size, this->scratch);
+        if (this->scratch.size() < bytes) {
+            entry.codec = CODEC_HUFFMAN;
+            entry.stored_bytes = this->scratch.size();
+        }
+    }
+    bool ok = true;
+    if (entry.codec == CODEC_STORED) {
+        // Page aligned, so the mapping can be handed to the engine as it is
+        ok = this->pad_to(PAGE);
+        entry.offset = this->offset;
+        ok = ok && this->put(data, bytes);
+    }
+    else {
+        entry.offset = this->offset;
+        ok = this->put(this->scratch.data(), this->scratch.size());
+    }
+    if (!ok) {
+        this->abort();
+        return false;
+    }
+    this->index.push_back(entry);
+    return true;
+}
+
+/// \brief Write the index, the state and the header, and move the file in place
+/// \param state the JSON block
+/// \return false on a write error; the file is then removed
+bool writer::finish(const nlohmann::json& state) {
+    if (this->file == nullptr) {
+        return false;
+    }
+    file_header_t header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.flags = this->compress_blobs ? 1 : 0;
+    bool ok = this->pad_to(8);
+    header.index_offset = this->offset;
+    header.index_count = this->index.size();
+    ok = ok && this->put(this->index.data(), this->index.size() * sizeof(blob_entry_t));
+    std::string text = state.dump();
+    header.state_offset = this->offset;
+    header.state_size = text.size();
+    ok = ok && this->put(text.data(), text.size());
+    ok = ok && std::fflush(this->file) == 0 && std::fseek(this->file, 0, SEEK_SET) == 0;
+    ok = ok && std::fwrite(&header, sizeof(header), 1, this->file) == 1;
+    ok = ok && std::fclose(this->file) == 0;
+    this->file = nullptr;
+    if (ok) {
+        std::error_code ec;
+        std::filesystem::rename(this->tmp_path, this->path, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        std::remove(this->tmp_path.c_str());
+    }
+    return ok;
+}
+
+bool writer::put(const void* data, size_t bytes) {
+    if (bytes > 0 && std::fwrite(data, 1, bytes, this->file) != bytes) {
+        return false;
+    }
+    this->offset += bytes;
+    return true;
+}
+
+bool writer::pad_to(u64 alignment) {
+    static const u8 zeros[PAGE] = {0};
+    u64 padding = (alignment - this->offset % alignment) % alignment;
+    return this->put(zeros, padding);
+}
+
+void writer::abort() {
+    std::fclose(this->file);
+    this->file = nullptr;
+    std::remove(this->tmp_path.c_str());
+}
+
+// ---------------------------------------------------------------------------
+// Reader
+// ---------------------------------------------------------------------------
+
+/// \brief Constructor
+/// \param path the snapshot file
+reader::reader(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                     FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    this->file_handle = file_handle;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart < (LONGLONG)sizeof(file_header_t)) {
+        this->close();
+        return;
+    }
+    this->mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (this->mapping_handle == nullptr) {
+        this->close();
+        return;
+    }
+    this->base = (const u8*)MapViewOfFile(this->mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    this->size = (size_t)file_size.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(file_header_t)) {
+        ::close(fd);
+        return;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return;
+    }
+    madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+    this->base = (const u8*)mapped;
+    this->size = st.st_size;
+#endif
+    if (this->base == nullptr) {
+        this->close();
+        return;
+    }
+
+    file_header_t header;
+    std::memcpy(&header, this->base, sizeof(header));
+    bool ok = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION;
+    ok = ok && header.index_offset <= this->size
+        && header.index_count <= (this->size - header.index_offset) / sizeof(blob_entry_t);
+    ok = ok && header.state_offset <= this->size && header.state_size <= this->size - header.state_offset;
+    if (ok) {
+        this->index.resize(header.index_count);
+        std::memcpy(this->index.data(), this->base + header.index_offset, header.index_count * sizeof(blob_entry_t));
+        for (const blob_entry_t& entry : this->index) {
+            ok &= entry.offset <= this->size && entry.stored_bytes <= this->size - entry.offset;
+        }
+    }
+    if (ok) {
+        const char* text = (const char*)this->base + header.state_offset;
+        this->state = nlohmann::json::parse(text, text + header.state_size, nullptr, false);
+        ok = !this->state.is_discarded() && this->state.is_object();
+    }
+    if (!ok) {
+        this->close();
+    }
+}
+
+reader::~reader() {
+    this->close();
+}
+
+void reader::close() {
+#ifdef _WIN32
+    if (this->base != nullptr) {
+        UnmapViewOfFile(this->base);
+    }
+    if (this->mapping_handle != nullptr) {
+        CloseHandle(this->mapping_handle);
+    }
+    if (this->file_handle != nullptr) {
+        CloseHandle(this->file_handle);
+    }
+    this->mapping_handle = nullptr;
+    this->file_handle = nullptr;
+#else
+    if (this->base != nullptr) {
+        munmap((void*)this->base, this->size);
+    }
+#endif
+    this->base = nullptr;
+    this->size = 0;
+    this->index.clear();
+}
+
+/// \brief Find a blob
+/// \return nullptr if the snapshot has no such blob
+const blob_entry_t* reader::find(blob_kind_t kind, int layer, int idx) const {
+    for (const blob_entry_t& entry : this->index) {
+        if (entry.kind == (u32)kind && entry.layer == (u32)layer && entry.idx == (u32)idx) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+/// \brief Elements of a blob
+/// \param entry the blob
+/// \param scratch holds the decoded elements of a compressed blob
+/// \return a pointer into the mapping for a stored blob, into scratch otherwise;
+///         nullptr if the blob is corrupt
+const void* reader::data(const blob_entry_t& entry, std::vector<u8>& scratch) const {
+    size_t bytes = entry.count * elem_size_of(entry.kind);
+    const u8* stored = this->base + entry.offset;
+    if (entry.codec == CODEC_STORED) {
+        return entry.stored_bytes == bytes ? stored : nullptr;
+    }
+    if (entry.codec != CODEC_HUFFMAN) {
+        return nullptr;
+    }
+    scratch.resize(bytes);
+    if (!decompress(stored, entry.stored_bytes, elem_size_of(entry.kind), scratch.data(), bytes)) {
+        return nullptr;
+    }
+    return scratch.data();
+}
+
+/// \brief The token history
+/// \return false if missing or corrupt
+bool reader::read_tokens(std::vector<int>& tokens) const {
+    const blob_entry_t* entry = this->find(BLOB_TOKENS, 0, 0);
+    if (entry == nullptr) {
+        return false;
+    }
+    std::vector<u8> scratch;
+    const void* data = this->data(*entry, scratch);
+    if (data == nullptr) {
+        return false;
+    }
+    tokens.resize(entry->count);
+    std::memcpy(tokens.data(), data, entry->count * sizeof(int));
+    return true;
+}
+
+} // end of namespace kv_session
@@ -0,0 +1,92 @@
+/// \file prompt_lookup.cpp
+/// \brief prompt lookup class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note This is a source file for the prompt lookup class
+#include "modules/prompt_lookup.hpp"
+
+#include <algorithm>
+
+/// \brief Constructor
+/// \param history the token history to index, read on every propose
+/// \param min_ngram the shortest suffix worth matching
+/// \param max_ngram the longest suffix tried first
+prompt_lookup::prompt_lookup(const std::vector<int>& history, int min_ngram, int max_ngram)
+    : history(history), min_ngram(std::max(1, min_ngram)), max_ngram(std::max(min_ngram, max_ngram)) {
+    this->powers.resize(this->max_ngram + 1);
+    this->powers[0] = 1;
+    for (int n = 1; n <= this->max_ngram; n++) {
+        this->powers[n] = this->powers[n - 1] * BASE;
+    }
+    this->reset();
+}
+
+/// \brief Index the n-grams ending before len
+/// \note The n-gram ending at len is the suffix being looked up; it is indexed on the next
+///       call, once a token follows it.
+void prompt_lookup::catch_up(size_t len) {
+    while (this->prefix.size() <= len) {
+        size_t i = this->prefix.size() - 1;
+        this->prefix.push_back(this->prefix[i] * BASE + (uint64_t)(uint32_t)this->history[i] + 1);
+    }
+    for (size_t end = this->indexed + 1; end < len; end++) {
+        for (int n = this->min_ngram; n <= this->max_ngram && (size_t)n <= end; n++) {
+            this->table[key(this->window_hash(end, n), n)] = (uint32_t)end;
+        }
+        this->indexed = end;
+    }
+}
+
+/// \brief Propose the continuation of the longest matching suffix of the history
+/// \param k the maximum number of tokens to propose
+/// \param out the proposals are appended
+/// \return the number of proposed tokens, 0 if the suffix was not seen before
+int prompt_lookup::propose(int k, std::vector<int>& out) {
+    size_t len = this->history.size();
+    if (this->prefix.size() > len + 1) {
+        this->truncate(len);
+    }
+    if (k <= 0 || len <= (size_t)this->min_ngram) {
+        return 0;
+    }
+    this->catch_up(len);
+    this->lookups++;
+    for (int n = std::min<int>(this->max_ngram, len - 1); n >= this->min_ngram; n--) {
+        auto it = this->table.find(key(this->window_hash(len, n), n));
+        if (it == this->table.end()) {
+            continue;
+        }
+        size_t end = it->second;
+        // Entries may be stale after a truncate, or collide; check the tokens
+        if (end >= len || !std::equal(this->history.begin() + (end - n), this->history.begin() + end,
+                                      this->history.end() - n)) {
+            continue;
+        }
+        int count = (int)std::min<size_t>(k, len - end);
+        out.insert(out.end(), this->history.begin() + end, this->history.begin() + end + count);
+        this->hits++;
+        return count;
+    }
+    return 0;
+}
+
+/// \brief The history was cut back to len tokens
+/// \note The index only keeps the latest occurrence of an n-gram, so entries past len would
+///       hide earlier ones; it is rebuilt on the next propose. The prefix hashes stay valid.
+void prompt_lookup::truncate(size_t len) {
+    if (this->prefix.size() > len + 1) {
+        this->prefix.resize(len + 1);
+    }
+    this->table.clear();
+    this->indexed = 0;
+}
+
+/// \brief The history was cleared
+void prompt_lookup::reset() {
+    this->prefix.assign(1, 0);
+    this->indexed = 0;
+    this->table.clear();
+    this->lookups = 0;
+    this->hits = 0;
+}
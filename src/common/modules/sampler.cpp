@@ -9,10 +9,386 @@
 #include "modules/sampler.hpp"
 
 #include <deque>
-#include <cstdlib>    // for std::rand, std::srand, RAND_MAX
-#include <ctime>      // for std::time
+#include <random>     // for std::random_device
 #include <algorithm>  // for std::sort
 #include <cmath>      // for std::exp
+#include <limits>
+#include <bit>        // for std::popcount
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/// \brief Index of the lowest set bit of a non-zero mask
+static inline int lowest_set_bit(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return static_cast<int>(idx);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static inline bool logits_greater(const logits_t& a, const logits_t& b) {
+    return a.logits > b.logits;
+}
+
+/// \brief Start a new selection
+/// \param k the number of entries to keep
+void topk_selector::reset(int k) {
+    this->k = static_cast<size_t>(k);
+    // Compact every 4k survivors (at least 256): small enough that the threshold rises early
+    this->capacity = std::max<size_t>(this->k * 4, 256);
+    if (this->candidates.capacity() < this->capacity) {
+        this->candidates.reserve(this->capacity);
+    }
+    this->candidates.clear();
+    this->threshold = -std::numeric_limits<float>::infinity();
+    this->max_logit = -std::numeric_limits<float>::infinity();
+}
+
+/// \brief Shrink the candidate buffer to the k best entries and raise the threshold
+void topk_selector::compact() {
+    if (this->candidates.size() <= this->k) {
+        return;
+    }
+    std::nth_element(
+        this->candidates.begin(),
+        this->candidates.begin() + (this->k - 1),
+        this->candidates.end(),
+        logits_greater
+    );
+    this->threshold = this->candidates[this->k - 1].logits;
+    this->candidates.resize(this->k);
+}
+
+// ---------------------------------------------------------------------------
+// Scan kernels: compare a block of logits against the running threshold and
+// hand only the survivors to push_one. Each returns the first index it did not
+// process; the caller finishes the tail with the scalar kernel.
+// The sink is either the top-k selector or the greedy argmax below.
+// ---------------------------------------------------------------------------
+
+/// \brief Running argmax, same interface as topk_selector for the scan kernels
+struct argmax_sink {
+    float best = -std::numeric_limits<float>::infinity();
+    int token_id = -1;
+
+    inline float get_threshold() const { return this->best; }
+    inline void push_one(float logit, int id) {
+        if (logit > this->best || this->token_id < 0) {
+            this->best = logit;
+            this->token_id = id;
+        }
+    }
+};
+
+/// \brief lanes bits (at most 32) of the allowed-token mask starting at token id i
+/// \note Reads a second word only when those lanes straddle it; i + lanes - 1 must be a
+///       valid id, so that word is in the mask
+static inline unsigned int allow_bits(const u64* allow, int i, int lanes) {
+    int word = i >> 6;
+    int shift = i & 63;
+    u64 bits = allow[word] >> shift;
+    if (shift + lanes > 64) {
+        bits |= allow[word + 1] << (64 - shift);
+    }
+    return static_cast<unsigned int>(bits);
+}
+
+static inline bool allow_bit(const u64* allow, int i) {
+    return (allow[i >> 6] >> (i & 63)) & 1;
+}
+
+// exp for the log-sum-exp of the scans: Cephes polynomial on x - n ln2, scaled by 2^n.
+// Inputs are logit - running max, so at most 0; below -87 the result is 0.
+static constexpr float EXP_LOG2E = 1.44269504088896341f;
+static constexpr float EXP_LN2_HI = 0.693359375f;
+static constexpr float EXP_LN2_LO = -2.12194440e-4f;
+static constexpr float EXP_P[6] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+                                   4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+
+CPU_TARGET_AVX2
+static inline __m256 exp_avx2(__m256 x) {
+    const __m256 valid = _mm256_cmp_ps(x, _mm256_set1_ps(-87.0f), _CMP_GE_OQ);
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(EXP_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_HI), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_LO), r);
+    __m256 p = _mm256_set1_ps(EXP_P[0]);
+    for (int k = 1; k < 6; k++) {
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P[k]));
+    }
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    __m256i scale = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_and_ps(valid, _mm256_mul_ps(p, _mm256_castsi256_ps(scale)));
+}
+
+CPU_TARGET_AVX512
+static inline __m512 exp_avx512(__m512 x) {
+    const __mmask16 valid = _mm512_cmp_ps_mask(x, _mm512_set1_ps(-87.0f), _CMP_GE_OQ);
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-87.0f)), _mm512_set1_ps(88.0f));
+    __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(EXP_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_LN2_HI), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(EXP_LN2_LO), r);
+    __m512 p = _mm512_set1_ps(EXP_P[0]);
+    for (int k = 1; k < 6; k++) {
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(EXP_P[k]));
+    }
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+    return _mm512_maskz_mov_ps(valid, _mm512_scalef_ps(p, n));
+}
+
+/// \brief One online log-sum-exp step per lane: rescale the sum to the new max, add exp(v - max)
+CPU_TARGET_AVX2
+static inline void lse_step_avx2(__m256& m, __m256& s, __m256 v) {
+    __m256 nm = _mm256_max_ps(v, m);
+    s = _mm256_fmadd_ps(s, exp_avx2(_mm256_sub_ps(m, nm)), exp_avx2(_mm256_sub_ps(v, nm)));
+    m = nm;
+}
+
+CPU_TARGET_AVX512
+static inline void lse_step_avx512(__m512& m, __m512& s, __m512 v) {
+    __m512 nm = _mm512_max_ps(v, m);
+    s = _mm512_fmadd_ps(s, exp_avx512(_mm512_sub_ps(m, nm)), exp_avx512(_mm512_sub_ps(v, nm)));
+    m = nm;
+}
+
+/// \brief Offer the survivors of one SIMD block
+template <typename sink_t>
+static inline void push_survivors(sink_t& sel, const float* vals, unsigned int mask, int base, const u8* skip) {
+    while (mask) {
+        int lane = lowest_set_bit(mask);
+        mask &= mask - 1;
+        if (skip && skip[base + lane]) {
+            continue;
+        }
+        sel.push_one(vals[lane], base + lane);
+    }
+}
+
+template <typename sink_t>
+static int scan_f32_scalar(sink_t& sel, const float* x, int i, int end) {
+    for (; i < end; i++) {
+        sel.push_one(x[i], i);
+    }
+    return i;
+}
+
+template <typename sink_t>
+static int scan_bf16_scalar(sink_t& sel, const bf16* x, int i, int end, const u8* skip, const u64* allow, logsumexp_t* lse) {
+    for (; i < end; i++) {
+        float v = float(x[i]);
+        if ((skip && skip[i]) || (allow && !allow_bit(allow, i))) {
+            continue;
+        }
+        if (lse) {
+            lse->add(v);
+        }
+        if (v >= sel.get_threshold()) {
+            sel.push_one(v, i);
+        }
+    }
+    return i;
+}
+
+template <typename sink_t>
+CPU_TARGET_AVX2
+static int scan_f32_avx2(sink_t& sel, const float* x, int i, int end) {
+    __m256 thr = _mm256_set1_ps(sel.get_threshold());
+    for (; i + 16 <= end; i += 16) {
+        __m256 v0 = _mm256_loadu_ps(x + i);
+        __m256 v1 = _mm256_loadu_ps(x + i + 8);
+        unsigned int m0 = static_cast<unsigned int>(_mm256_movemask_ps(_mm256_cmp_ps(v0, thr, _CMP_GE_OQ)));
+        unsigned int m1 = static_cast<unsigned int>(_mm256_movemask_ps(_mm256_cmp_ps(v1, thr, _CMP_GE_OQ)));
+        if ((m0 | m1) == 0) {
+            continue;
+        }
+        push_survivors(sel, x + i, m0, i, nullptr);
+        push_survivors(sel, x + i + 8, m1, i + 8, nullptr);
+        thr = _mm256_set1_ps(sel.get_threshold());
+    }
+    return i;
+}
+
+template <typename sink_t>
+CPU_TARGET_AVX2
+static int scan_bf16_avx2(sink_t& sel, const bf16* x, int i, int end, const u8* skip, const u64* allow, logsumexp_t* lse) {
+    __m256 thr = _mm256_set1_ps(sel.get_threshold());
+    alignas(32) float vals[16];
+    // log-sum-exp per lane, of the lanes that are allowed and not skipped
+    const __m256 neg_inf = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256 lse_m0 = _mm256_set1_ps(-std::numeric_limits<float>::max()), lse_m1 = lse_m0;
+    __m256 lse_s0 = _mm256_setzero_ps(), lse_s1 = lse_s0;
+    for (; i + 16 <= end; i += 16) {
+        __m256i raw = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+        // bf16 is the upper half of fp32: widen and shift
+        __m256 v0 = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(raw)), 16));
+        __m256 v1 = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(raw, 1)), 16));
+        unsigned int m0 = static_cast<unsigned int>(_mm256_movemask_ps(_mm256_cmp_ps(v0, thr, _CMP_GE_OQ)));
+        unsigned int m1 = static_cast<unsigned int>(_mm256_movemask_ps(_mm256_cmp_ps(v1, thr, _CMP_GE_OQ)));
+        unsigned int lanes = 0xFFFF;
+        if (allow) {
+            lanes = allow_bits(allow, i, 16) & 0xFFFF;
+            m0 &= lanes & 0xFF;
+            m1 &= lanes >> 8;
+        }
+        if (lse) {
+            if (skip) {
+                __m128i flags = _mm_loadu_si128(reinterpret_cast<const __m128i*>(skip + i));
+                lanes &= static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(flags, _mm_setzero_si128())));
+            }
+            __m256i in0 = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(lanes & 0xFF)), lane_bits);
+            __m256i in1 = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(lanes >> 8)), lane_bits);
+            lse_step_avx2(lse_m0, lse_s0, _mm256_blendv_ps(neg_inf, v0, _mm256_castsi256_ps(_mm256_cmpeq_epi32(in0, lane_bits))));
+            lse_step_avx2(lse_m1, lse_s1, _mm256_blendv_ps(neg_inf, v1, _mm256_castsi256_ps(_mm256_cmpeq_epi32(in1, lane_bits))));
+        }
+        if ((m0 | m1) == 0) {
+            continue;
+        }
+        _mm256_store_ps(vals, v0);
+        _mm256_store_ps(vals + 8, v1);
+        push_survivors(sel, vals, m0, i, skip);
+        push_survivors(sel, vals + 8, m1, i + 8, skip);
+        thr = _mm256_set1_ps(sel.get_threshold());
+    }
+    if (lse) {
+        alignas(32) float m[16], s[16];
+        _mm256_store_ps(m, lse_m0);
+        _mm256_store_ps(m + 8, lse_m1);
+        _mm256_store_ps(s, lse_s0);
+        _mm256_store_ps(s + 8, lse_s1);
+        for (int lane = 0; lane < 16; lane++) {
+            lse->merge(m[lane], s[lane]);
+        }
+    }
+    return i;
+}
+
+template <typename sink_t>
+CPU_TARGET_AVX512
+static int scan_f32_avx512(sink_t& sel, const float* x, int i, int end) {
+    __m512 thr = _mm512_set1_ps(sel.get_threshold());
+    for (; i + 32 <= end; i += 32) {
+        __m512 v0 = _mm512_loadu_ps(x + i);
+        __m512 v1 = _mm512_loadu_ps(x + i + 16);
+        unsigned int m0 = _mm512_cmp_ps_mask(v0, thr, _CMP_GE_OQ);
+        unsigned int m1 = _mm512_cmp_ps_mask(v1, thr, _CMP_GE_OQ);
+        if ((m0 | m1) == 0) {
+            continue;
+        }
+        push_survivors(sel, x + i, m0, i, nullptr);
+        push_survivors(sel, x + i + 16, m1, i + 16, nullptr);
+        thr = _mm512_set1_ps(sel.get_threshold());
+    }
+    return i;
+}
+
+template <typename sink_t>
+CPU_TARGET_AVX512
+static int scan_bf16_avx512(sink_t& sel, const bf16* x, int i, int end, const u8* skip, const u64* allow, logsumexp_t* lse) {
+    __m512 thr = _mm512_set1_ps(sel.get_threshold());
+    alignas(64) float vals[32];
+    // log-sum-exp per lane, of the lanes that are allowed and not skipped
+    const __m512 neg_inf = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+    __m512 lse_m0 = _mm512_set1_ps(-std::numeric_limits<float>::max()), lse_m1 = lse_m0;
+    __m512 lse_s0 = _mm512_setzero_ps(), lse_s1 = lse_s0;
+    for (; i + 32 <= end; i += 32) {
+        __m256i raw0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+        __m256i raw1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i + 16));
+        __m512 v0 = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(raw0), 16));
+        __m512 v1 = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(raw1), 16));
+        unsigned int m0 = _mm512_cmp_ps_mask(v0, thr, _CMP_GE_OQ);
+        unsigned int m1 = _mm512_cmp_ps_mask(v1, thr, _CMP_GE_OQ);
+        unsigned int lanes = 0xFFFFFFFFu;
+        if (allow) {
+            lanes = allow_bits(allow, i, 32);
+            m0 &= lanes & 0xFFFF;
+            m1 &= lanes >> 16;
+        }
+        if (lse) {
+            if (skip) {
+                __m256i flags = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(skip + i));
+                lanes &= static_cast<unsigned int>(_mm256_cmpeq_epi8_mask(flags, _mm256_setzero_si256()));
+            }
+            lse_step_avx512(lse_m0, lse_s0, _mm512_mask_mov_ps(neg_inf, static_cast<__mmask16>(lanes & 0xFFFF), v0));
+            lse_step_avx512(lse_m1, lse_s1, _mm512_mask_mov_ps(neg_inf, static_cast<__mmask16>(lanes >> 16), v1));
+        }
+        if ((m0 | m1) == 0) {
+            continue;
+        }
+        _mm512_store_ps(vals, v0);
+        _mm512_store_ps(vals + 16, v1);
+        push_survivors(sel, vals, m0, i, skip);
+        push_survivors(sel, vals + 16, m1, i + 16, skip);
+        thr = _mm512_set1_ps(sel.get_threshold());
+    }
+    if (lse) {
+        alignas(64) float m[32], s[32];
+        _mm512_store_ps(m, lse_m0);
+        _mm512_store_ps(m + 16, lse_m1);
+        _mm512_store_ps(s, lse_s0);
+        _mm512_store_ps(s + 16, lse_s1);
+        for (int lane = 0; lane < 32; lane++) {
+            lse->merge(m[lane], s[lane]);
+        }
+    }
+    return i;
+}
+
+template <typename sink_t>
+static void scan_bf16(sink_t& sel, cpu_features::isa_t isa, const bf16* x, int begin, int end, const u8* skip, const u64* allow,
+                      logsumexp_t* lse = nullptr) {
+    int i = begin;
+    switch (isa) {
+        case cpu_features::avx512: i = scan_bf16_avx512(sel, x, i, end, skip, allow, lse); break;
+        case cpu_features::avx2:   i = scan_bf16_avx2(sel, x, i, end, skip, allow, lse); break;
+        default: break;
+    }
+    scan_bf16_scalar(sel, x, i, end, skip, allow, lse);
+}
+
+/// \brief Offer a contiguous range of logits
+/// \param x the logits, indexed by token id
+/// \param begin the first token id
+/// \param end one past the last token id
+void topk_selector::push(const float* x, int begin, int end) {
+    int i = begin;
+    switch (this->isa) {
+        case cpu_features::avx512: i = scan_f32_avx512(*this, x, i, end); break;
+        case cpu_features::avx2:   i = scan_f32_avx2(*this, x, i, end); break;
+        default: break;
+    }
+    scan_f32_scalar(*this, x, i, end);
+}
+
+/// \brief Offer a contiguous range of bf16 logits, converted in registers
+/// \param x the logits, indexed by token id
+/// \param begin the first token id
+/// \param end one past the last token id
+/// \param skip optional per-token flags, tokens with skip[id] != 0 are ignored
+/// \param allow optional allowed-token bitmask, other tokens are ignored
+void topk_selector::push(const bf16* x, int begin, int end, const u8* skip, const u64* allow) {
+    scan_bf16(*this, this->isa, x, begin, end, skip, allow);
+}
+
+/// \brief Write the k best entries, sorted by descending logit
+/// \param out the output list, reused without reallocation when possible
+void topk_selector::finalize(logits_list_t& out) {
+    if (this->candidates.size() > this->k) {
+        std::nth_element(
+            this->candidates.begin(),
+            this->candidates.begin() + this->k,
+            this->candidates.end(),
+            logits_greater
+        );
+        this->candidates.resize(this->k);
+    }
+    std::sort(this->candidates.begin(), this->candidates.end(), logits_greater);
+    out.assign(this->candidates.begin(), this->candidates.end());
+}
 
 /// \brief Constructor
 /// \param in_features the input features
@@ -22,6 +398,9 @@ Sampler::Sampler(int in_features, sampler_config& config) {
     this->logits.resize(in_features);
     this->counters.resize(in_features, 0);
     this->token_positions.resize(in_features, -1);
+    this->window_slot.resize(in_features, -1);
+    this->token_flags.resize(in_features, 0);
+    this->allowed_mask.resize((in_features + 63) / 64, 0);
     this->top_k_logits.resize(config.top_k);
 
     this->temperature           = config.temperature;
@@ -38,6 +417,65 @@ Sampler::Sampler(int in_features, sampler_config& config) {
     this->repeat_last_n        = config.repeat_last_n;
 
     this->token_history.clear();
+    this->set_seed(config.seed);
+}
+
+/// \brief Seed the per-instance generator
+/// \param seed the seed, negative for a random one
+void Sampler::set_seed(i64 seed) {
+    if (seed < 0) {
+        std::random_device rd;
+        this->rng_seed = (u64(rd()) << 32) | u64(rd());
+    }
+    else {
+        this->rng_seed = u64(seed);
+    }
+    this->rng_counter = 0;
+}
+
+/// \brief Settings and generator position, for session snapshots
+sampler_state_t Sampler::get_state() const {
+    sampler_state_t state;
+    state.config.top_k               = this->top_k;
+    state.config.top_p               = this->top_p;
+    state.config.min_p               = this->min_p;
+    state.config.temperature         = this->temperature;
+    state.config.rep_penalty         = this->rep_penalty;
+    state.config.freq_penalty        = this->freq_penalty;
+    state.config.pre_penalty         = this->pre_penalty;
+    state.config.rep_penalty_window  = (int)this->rep_penalty_window;
+    state.config.freq_penalty_window = (int)this->freq_penalty_window;
+    state.config.repeat_last_n       = (int)this->repeat_last_n;
+    state.rng_seed                   = this->rng_seed;
+    state.rng_counter                = this->rng_counter;
+    return state;
+}
+
+/// \brief Resume the settings and generator position of get_state
+void Sampler::set_state(const sampler_state_t& state) {
+    this->top_k                 = state.config.top_k;
+    this->top_p                 = state.config.top_p;
+    this->min_p                 = state.config.min_p;
+    this->temperature           = state.config.temperature;
+    this->rep_penalty           = state.config.rep_penalty;
+    this->freq_penalty          = state.config.freq_penalty;
+    this->pre_penalty           = state.config.pre_penalty;
+    this->rep_penalty_window    = state.config.rep_penalty_window;
+    this->freq_penalty_window   = state.config.freq_penalty_window;
+    this->repeat_last_n         = state.config.repeat_last_n;
+    this->rng_seed              = state.rng_seed;
+    this->rng_counter           = state.rng_counter;
+}
+
+/// \brief Next uniform number in [0, 1) from the per-instance generator
+float Sampler::next_uniform() {
+    // splitmix64 finalizer over seed + counter * golden gamma
+    u64 z = this->rng_seed + (++this->rng_counter) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z = z ^ (z >> 31);
+    // top 24 bits, exactly representable as float
+    return float(z >> 40) * (1.0f / 16777216.0f);
 }
 
 /// \brief Reset the penalties
@@ -45,12 +483,18 @@ Sampler::Sampler(int in_features, sampler_config& config) {
 /// \note The function will reset the token positions
 /// \note The function will reset the token history
 /// \note The function will reset the total tokens
-/// \note The function will reset the token positions
+/// \note Only the tokens seen since the last reset are touched, not the whole vocabulary
 void Sampler::reset_penalties() {
-    for (int i = 0; i < in_features; i++) {
-        this->counters[i]            = 0;
-        this->token_positions[i]     = -1;
+    for (int token_id : this->window_tokens) {
+        this->counters[token_id]     = 0;
+        this->window_slot[token_id]  = -1;
+        this->token_flags[token_id] &= ~FLAG_WINDOW;
+    }
+    for (int token_id : this->seen_tokens) {
+        this->token_positions[token_id] = -1;
     }
+    this->window_tokens.clear();
+    this->seen_tokens.clear();
     this->total_tokens = 0;
     this->token_history.clear();
 }
@@ -79,56 +523,187 @@ void Sampler::softmax_inplace() {
     }
 }
 
+bool Sampler::penalties_active() const {
+    return this->repeat_last_n != 0 &&
+        (this->rep_penalty != 1.0f || this->freq_penalty != 0.0f || this->pre_penalty != 0.0f);
+}
+
+float Sampler::penalized_logit(float logit, int count) const {
+    assert(count > 0 && count <= static_cast<int>(this->repeat_last_n));
+    logit = (logit <= 0.0f) ? logit * this->rep_penalty : logit / this->rep_penalty;
+    return logit - (float(count) * this->freq_penalty + this->pre_penalty);
+}
+
 void Sampler::sampler_penalty_apply() {
-    if ((this->repeat_last_n == 0) ||
-        (this->rep_penalty == 1.0f && this->freq_penalty == 0.0f && this->pre_penalty == 0.0f)) {
+    if (!this->penalties_active()) {
         return;
     }
 
-    // Apply frequency and presence penalties
-    for (int token_id = 0; token_id < in_features; token_id++) {
-        int count = this->counters[token_id];
-        if (count <= 0) {
-            continue; 
+    // Apply frequency and presence penalties, only to tokens inside the window
+    for (int token_id : this->window_tokens) {
+        this->logits[token_id] = this->penalized_logit(this->logits[token_id], this->counters[token_id]);
+    }
+}
+
+/// \brief Offer the adjusted logits in [begin, end) to a top-k or argmax sink
+/// \param sink the topk_selector or argmax_sink
+/// \param x the logits, indexed by token id
+/// \param begin the first token id
+/// \param end one past the last token id
+template <typename sink_t>
+void Sampler::offer_logits(sink_t& sink, const bf16* x, int begin, int end, logsumexp_t* lse) {
+    auto offer = [&](float logit, int token_id) {
+        sink.push_one(logit, token_id);
+        if (lse) {
+            lse->add(logit);
+        }
+    };
+    const u8* skip = nullptr;
+    bool penalize = this->penalties_active();
+    if (penalize || !this->logit_bias.empty()) {
+        // Penalized and biased tokens go in first with their final value; the stream skips them
+        for (const auto& [token_id, bias] : this->logit_bias) {
+            if (token_id < begin || token_id >= end || !this->is_allowed(token_id)) {
+                continue;
+            }
+            float logit = float(x[token_id]);
+            if (penalize && this->counters[token_id] > 0) {
+                logit = this->penalized_logit(logit, this->counters[token_id]);
+            }
+            offer(logit + bias, token_id);
         }
-        assert(count > 0 && count <= this->repeat_last_n);
+        for (int token_id : this->window_tokens) {
+            if (token_id < begin || token_id >= end || (this->token_flags[token_id] & FLAG_BIAS) || !this->is_allowed(token_id)) {
+                continue;
+            }
+            float logit = float(x[token_id]);
+            offer(penalize ? this->penalized_logit(logit, this->counters[token_id]) : logit, token_id);
+        }
+        skip = this->token_flags.data();
+    }
 
-        float logit = this->logits[token_id];
+    if (!this->allowed_ids.empty()) {
+        // Small label set: visit the allowed ids instead of sweeping the vocabulary
+        for (int token_id : this->allowed_ids) {
+            if (token_id < begin || token_id >= end || (skip && skip[token_id])) {
+                continue;
+            }
+            offer(float(x[token_id]), token_id);
+        }
+        return;
+    }
+    scan_bf16(sink, this->topk_engine.get_isa(), x, begin, end, skip,
+        this->allowed_active ? this->allowed_mask.data() : nullptr, lse);
+}
+
+void Sampler::sampler_fused_apply(buffer<bf16>& x, int k, logsumexp_t* lse) {
+    k = std::clamp(k < 0 ? this->top_k : k, 1, this->in_features);
 
-        if (this->logits[token_id] <= 0.0f) {
-            this->logits[token_id] *= this->rep_penalty;
+    this->topk_engine.reset(k);
+    this->offer_logits(this->topk_engine, x.data(), 0, this->in_features, lse);
+    this->topk_engine.finalize(this->top_k_logits);
+}
+
+/// \brief Add a sparse bias to the logits (OpenAI logit_bias)
+/// \param bias token id and bias pairs, replacing the previous bias
+void Sampler::set_logit_bias(const std::vector<std::pair<int, float>>& bias) {
+    this->clear_logit_bias();
+    for (const auto& [token_id, value] : bias) {
+        if (token_id < 0 || token_id >= this->in_features || !std::isfinite(value)) {
+            continue;
         }
-        else {
-            this->logits[token_id] /= this->rep_penalty;
+        if (this->token_flags[token_id] & FLAG_BIAS) {
+            for (auto& entry : this->logit_bias) {
+                if (entry.first == token_id) {
+                    entry.second = value;
+                }
+            }
+            continue;
         }
+        this->token_flags[token_id] |= FLAG_BIAS;
+        this->logit_bias.emplace_back(token_id, value);
+    }
+}
 
-        this->logits[token_id] -= (float(count) * this->freq_penalty + float(count > 0) * this->pre_penalty);
+void Sampler::clear_logit_bias() {
+    for (const auto& entry : this->logit_bias) {
+        this->token_flags[entry.first] &= ~FLAG_BIAS;
     }
+    this->logit_bias.clear();
 }
 
-void Sampler::sampler_topk_apply(int k) {
-    if (k == 0) {
-        return;
+/// \brief Restrict sampling to a subset of the vocabulary
+/// \param token_ids the allowed token ids, empty to lift the restriction
+void Sampler::set_allowed_tokens(const std::vector<int>& token_ids) {
+    this->clear_allowed_tokens();
+    for (int token_id : token_ids) {
+        if (token_id < 0 || token_id >= this->in_features || allow_bit(this->allowed_mask.data(), token_id)) {
+            continue;
+        }
+        this->allowed_mask[token_id >> 6] |= u64(1) << (token_id & 63);
+        this->allowed_count++;
     }
+    this->allowed_active = this->allowed_count > 0;
+    if (this->allowed_count * 16 <= size_t(this->in_features)) {
+        // Small label set: keep the ids for the sparse visit, ascending so ties resolve like the sweep
+        for (int token_id : token_ids) {
+            if (token_id >= 0 && token_id < this->in_features) {
+                this->allowed_ids.push_back(token_id);
+            }
+        }
+        std::sort(this->allowed_ids.begin(), this->allowed_ids.end());
+        this->allowed_ids.erase(std::unique(this->allowed_ids.begin(), this->allowed_ids.end()), this->allowed_ids.end());
+    }
+}
 
-    logits_list_t pairs;
-    pairs.resize(in_features);
-    for (int i = 0; i < in_features; i++) {
-        pairs[i].logits = this->logits[i];
-        pairs[i].token_id = i;
-        pairs[i].prob = 0.0f;
+/// \brief Restrict sampling to the tokens set in a bitmask
+/// \param mask one bit per token id, bit id of word id / 64
+void Sampler::set_allowed_mask(const std::vector<u64>& mask) {
+    this->clear_allowed_tokens();
+    size_t words = std::min(mask.size(), this->allowed_mask.size());
+    std::copy_n(mask.begin(), words, this->allowed_mask.begin());
+    if (words > 0 && (this->in_features & 63)) {
+        // no bits past the vocabulary
+        this->allowed_mask[this->allowed_mask.size() - 1] &= (u64(1) << (this->in_features & 63)) - 1;
     }
+    for (size_t w = 0; w < words; w++) {
+        this->allowed_count += std::popcount(this->allowed_mask[w]);
+    }
+    this->allowed_active = this->allowed_count > 0;
+    if (this->allowed_active && this->allowed_count * 16 <= size_t(this->in_features)) {
+        for (size_t w = 0; w < words; w++) {
+            for (u64 bits = this->allowed_mask[w]; bits; bits &= bits - 1) {
+                this->allowed_ids.push_back(int(w * 64) + std::countr_zero(bits));
+            }
+        }
+    }
+}
 
-    std::partial_sort(
-        pairs.begin(),
-        pairs.begin() + k,
-        pairs.end(),
-        [](const logits_t& a, const logits_t& b) {
-            return a.logits > b.logits;
+void Sampler::clear_allowed_tokens() {
+    if (!this->allowed_ids.empty()) {
+        for (int token_id : this->allowed_ids) {
+            this->allowed_mask[token_id >> 6] = 0;
         }
-    );
+    }
+    else if (this->allowed_active) {
+        std::fill(this->allowed_mask.begin(), this->allowed_mask.end(), 0);
+    }
+    this->allowed_ids.clear();
+    this->allowed_count = 0;
+    this->allowed_active = false;
+}
+
+void Sampler::sampler_topk_apply(int k) {
+    if (k <= 0) {
+        return;
+    }
+    k = std::min(k, this->in_features);
 
-    this->top_k_logits.assign(pairs.begin(), pairs.begin() + k);
+    // Threshold selection: only tokens that can still make the top k are kept,
+    // and only the k survivors are sorted.
+    this->topk_engine.reset(k);
+    this->topk_engine.push(this->logits.data(), 0, this->in_features);
+    this->topk_engine.finalize(this->top_k_logits);
 }
 
 void Sampler::sampler_topp_apply(float p) {
@@ -166,10 +741,11 @@ void Sampler::sampler_minp_apply(float p) {
 }
 
 void Sampler::sampler_temp_apply(float temp) {
-    if (temp == 0) { // Greedy sampling
-        for (int i = 1; i < this->top_k_logits.size(); i++) {
-            this->top_k_logits[i].logits = -std::numeric_limits<float>::infinity();
+    if (temp <= 0.0f) { // Greedy sampling, keep only the best candidate
+        if (this->top_k_logits.size() > 1) {
+            this->top_k_logits.resize(1);
         }
+        return;
     }
 
     for (int i = 0; i < this->top_k_logits.size(); i++) {
@@ -178,12 +754,16 @@ void Sampler::sampler_temp_apply(float temp) {
 }
 
 int Sampler::sample_from_probs() {
-    float u = static_cast<float>(std::rand()) / static_cast<float>(RAND_MAX);
+    if (this->top_k_logits.empty()) {
+        return 0;
+    }
+    float u = this->next_uniform();
     float cdf = 0.0f;
-    int   sampled_index = 0;
-    for (int i = 0; i <= top_k_logits.size(); i++) {
+    // Rounding can leave the cdf just below u, fall back to the last candidate
+    int   sampled_index = this->top_k_logits.back().token_id;
+    for (size_t i = 0; i < top_k_logits.size(); i++) {
         cdf += this->top_k_logits[i].prob;
-        if (u <= cdf) {
+        if (u < cdf) {
             sampled_index = this->top_k_logits[i].token_id;
             break;
         }
@@ -196,61 +776,130 @@ void Sampler::ring_buffer_update(int sampled_index) {
     if (this->repeat_last_n > 0) {
         // Push new token and update its counter
         this->token_history.push_back(sampled_index);
-        this->counters[sampled_index]++;
+        if (this->counters[sampled_index]++ == 0) {
+            this->window_slot[sampled_index] = (int)this->window_tokens.size();
+            this->window_tokens.push_back(sampled_index);
+            this->token_flags[sampled_index] |= FLAG_WINDOW;
+        }
 
         // If buffer exceeds window, pop oldest and decrement its counter
         if (this->token_history.size() > this->repeat_last_n) {
             int oldest = this->token_history.front();
             this->token_history.pop_front();
-            this->counters[oldest]--;
+            if (--this->counters[oldest] == 0) {
+                // Swap-remove from the distinct token set
+                int slot = this->window_slot[oldest];
+                int moved = this->window_tokens.back();
+                this->window_tokens[slot] = moved;
+                this->window_slot[moved] = slot;
+                this->window_tokens.pop_back();
+                this->window_slot[oldest] = -1;
+                this->token_flags[oldest] &= ~FLAG_WINDOW;
+            }
         }
     }
 
-    // Update last‐seen position for repetition penalty
+    // Update last-seen position for repetition penalty
+    if (this->token_positions[sampled_index] < 0) {
+        this->seen_tokens.push_back(sampled_index);
+    }
     this->token_positions[sampled_index] = this->total_tokens;
 
     // Advance global token count
     this->total_tokens++;
 }
 
+bool Sampler::is_greedy() const {
+    return this->temperature <= 0.0f || this->top_k == 1;
+}
+
+/// \brief Greedy selection, argmax directly on the bf16 logits
+/// \param x the input buffer
+/// \param begin the first token id to consider
+/// \param end one past the last token id to consider, -1 for the whole vocabulary
+/// \return the selected token
+int Sampler::sample_greedy(buffer<bf16>& x, int begin, int end) {
+    if (end < 0 || end > this->in_features) {
+        end = this->in_features;
+    }
+    argmax_sink best;
+    this->offer_logits(best, x.data(), begin, end);
+
+    // Report the selection like the sampled path does, as a single certain candidate
+    this->top_k_logits.resize(1);
+    this->top_k_logits[0] = {best.best, best.token_id, 1.0f};
+
+    int sampled_index = best.token_id < 0 ? begin : best.token_id;
+    ring_buffer_update(sampled_index);
+    return sampled_index;
+}
+
 /// \brief Sample the token
 /// \param x the input buffer
 /// \return the sampled token
 int Sampler::sample(buffer<bf16>& x) {
-    // Re‐seed the PRNG each call:
-    std::srand(static_cast<unsigned>(std::time(nullptr)));
-
-    // COPY FROM `x` → `this->logits[]`
-    #if USEAVX2
-    const int simd_width = 8;
-    int i = 0;
-    for (; i <= in_features - simd_width; i += simd_width) {
-        __m128i bf16_vals_x = _mm_loadu_si128(
-            (__m128i*)&x[i]
-        );
-        __m256 fp32_vals_x = bf16o_fp32(bf16_vals_x);
-        _mm256_storeu_ps(&this->logits[i], fp32_vals_x);
+    if (this->is_greedy() && !this->logprobs_on) {
+        return this->sample_greedy(x);
     }
-    for (; i < in_features; i++) {
-        this->logits[i] = x[i];
+
+    // PENALTIES + TOP-K (one pass over x) -> softmax -> TOP-P -> MIN-P -> TEMP -> softmax -> distribution
+    // MIN-P and TEMP only read the logits, so top-p does not need its own renormalization
+    if (this->logprobs_on) {
+        // The candidate set must hold the requested alternatives, even beyond top_k;
+        // the normalizer is over every logit the pass reads
+        this->logprob_lse = logsumexp_t();
+        sampler_fused_apply(x, std::max(this->top_k, this->logprobs_top_n), &this->logprob_lse);
+        softmax_inplace();
+        capture_logprobs();
+        if ((int)this->top_k_logits.size() > this->top_k) {
+            this->top_k_logits.resize(this->top_k);
+            softmax_inplace();
+        }
     }
-    #else
-    for (int i = 0; i < in_features; i++) {
-        this->logits[i] = x[i];
+    else {
+        sampler_fused_apply(x);
+        softmax_inplace();
     }
-    #endif
-
-    // PENALTIES -> TOP‐K -> softmax -> TOP-P -> softmax -> MIN-P -> TEMP -> softmax -> distribution
-    sampler_penalty_apply();
-    sampler_topk_apply(this->top_k);
-    softmax_inplace();
     sampler_topp_apply(this->top_p);
-    softmax_inplace();
     sampler_minp_apply(this->min_p);
     sampler_temp_apply(this->temperature);
     softmax_inplace();
     int sampled_index = sample_from_probs();
     ring_buffer_update(sampled_index);
+    if (this->logprobs_on) {
+        finish_logprobs(sampled_index);
+    }
 
     return sampled_index;
+}
+
+/// \brief Report log-probabilities with every sampled token
+/// \param enable whether to report them
+/// \param top_n the number of alternatives to report, 0 to 20
+void Sampler::set_logprobs(bool enable, int top_n) {
+    this->logprobs_on = enable;
+    this->logprobs_top_n = std::clamp(top_n, 0, 20);
+    this->last_logprobs.top.reserve(this->logprobs_top_n);
+}
+
+/// \brief Keep the candidate logits before top-p, min-p and temperature change them
+/// \note The logprob of a candidate is its logit minus the log-sum-exp of the fused pass
+void Sampler::capture_logprobs() {
+    this->logprob_candidates.assign(this->top_k_logits.begin(), this->top_k_logits.end());
+}
+
+void Sampler::finish_logprobs(int sampled_index) {
+    const float lse = this->logprob_lse.value();
+    this->last_logprobs.chosen = {sampled_index, -std::numeric_limits<float>::infinity()};
+    for (const logits_t& c : this->logprob_candidates) {
+        if (c.token_id == sampled_index) {
+            this->last_logprobs.chosen.logprob = c.logits - lse;
+            break;
+        }
+    }
+    size_t n = std::min<size_t>(this->logprobs_top_n, this->logprob_candidates.size());
+    this->last_logprobs.top.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        this->last_logprobs.top[i] = {this->logprob_candidates[i].token_id, this->logprob_candidates[i].logits - lse};
+    }
 }
\ No newline at end of file
@@ -0,0 +1,161 @@
+/// \file speculative.cpp
+/// \brief speculative decoder class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note This is a source file for the speculative decoder class
+#include "modules/speculative.hpp"
+
+/// \brief Constructor
+/// \param target the model whose output is produced
+/// \param draft the proposing model, same vocabulary, nullptr for none
+/// \param vocab_size the number of real tokens, padded logits past it are ignored
+/// \param draft_len the number of tokens proposed per round
+speculative_decoder::speculative_decoder(causal_lm* target, causal_lm* draft, int vocab_size, int draft_len)
+    : target(target), draft(draft), vocab_size(vocab_size), draft_len(std::max(1, draft_len)) {
+    this->ids.reserve(this->draft_len + 1);
+}
+
+/// \brief Choose the proposers of the next rounds
+/// \param draft the draft model, nullptr to stop using it; its KV cache must then be
+///        cleared or cut back before it is used again
+/// \param lookup the prompt lookup, nullptr for none
+void speculative_decoder::set_proposers(causal_lm* draft, prompt_lookup* lookup) {
+    if (draft != this->draft) {
+        this->lag.clear();
+    }
+    this->draft = draft;
+    this->lookup = lookup;
+}
+
+/// \brief Greedy pick of the draft, it needs no sampler state
+int speculative_decoder::argmax(buffer<bf16>& y) {
+    int end = std::min<int>(this->vocab_size, y.size());
+    int best = 0;
+    float best_logit = float(y[0]);
+    for (int i = 1; i < end; i++) {
+        float logit = float(y[i]);
+        if (logit > best_logit) {
+            best_logit = logit;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/// \brief Run one round
+/// \param pending the last sampled token, not yet in the KV caches
+/// \param budget the maximum number of tokens to emit, at least 1
+/// \param sample called for every emitted token
+/// \param stop called on every emitted token, true ends the round
+/// \return the number of emitted tokens; the last one is the new pending token
+/// \note The target ends with pending and the accepted proposals in its cache, the rejected
+///       positions are rewound. A draft model has run on all but its last proposal, so it
+///       is rewound the same way, or is one token short when every proposal was accepted.
+///       After a lookup round or a plain forward the draft is behind by what the target took.
+int speculative_decoder::step(int pending, int budget, const sample_t& sample, const stop_t& stop) {
+    int k = std::min(this->draft_len, budget - 1);
+    this->ids.clear();
+    this->ids.push_back(pending);
+    if (k > 0 && this->lookup != nullptr) {
+        this->draft_time.start();
+        int proposed = this->lookup->propose(k, this->ids);
+        this->draft_time.stop(proposed);
+        this->stats.lookup_proposed += proposed;
+    }
+    bool from_lookup = this->ids.size() > 1;
+    if (k > 0 && !from_lookup && this->draft != nullptr) {
+        this->draft_time.start();
+        this->flush();
+        int token = pending;
+        for (int i = 0; i < k; i++) {
+            buffer<bf16> y = this->draft->forward(token);
+            token = this->argmax(y);
+            this->ids.push_back(token);
+        }
+        this->draft_time.stop(k);
+    }
+    k = this->ids.size() - 1;
+    if (k == 0) {
+        // Nothing proposed, a plain forward; the draft picks the token up later
+        this->verify_time.start();
+        buffer<bf16> y = this->target->forward(pending);
+        this->verify_time.stop(1);
+        sample(y);
+        if (this->draft != nullptr) {
+            this->lag.push_back(pending);
+        }
+        this->stats.rounds++;
+        this->stats.emitted++;
+        return 1;
+    }
+
+    this->verify_time.start();
+    int row = this->target->verify(this->ids, this->logits);
+    this->verify_time.stop(k + 1);
+
+    // n drafts accepted: the target sampled exactly ids[1..n] from rows 0..n-1
+    int n = 0;
+    while (true) {
+        buffer<bf16> y(this->logits.data() + (size_t)n * row, row);
+        int sampled = sample(y);
+        if (stop(sampled) || n == k || n + 1 >= budget || sampled != this->ids[n + 1]) {
+            break;
+        }
+        n++;
+    }
+
+    this->target->rewind(k - n);
+    if (this->draft != nullptr) {
+        if (from_lookup) {
+            this->lag.insert(this->lag.end(), this->ids.begin(), this->ids.begin() + n + 1);
+        }
+        else if (n < k) {
+            this->draft->rewind(k - 1 - n);
+        }
+        else {
+            this->lag.push_back(this->ids[k]);
+        }
+    }
+    this->stats.rounds++;
+    this->stats.proposed += k;
+    this->stats.accepted += n;
+    if (from_lookup) {
+        this->stats.lookup_accepted += n;
+    }
+    this->stats.emitted += n + 1;
+    return n + 1;
+}
+
+/// \brief Append a token to both KV caches without sampling (e.g. the eos token)
+void speculative_decoder::append(int token) {
+    this->target->forward(token);
+    if (this->draft != nullptr) {
+        this->lag.push_back(token);
+    }
+}
+
+/// \brief Bring the draft KV cache level with the target
+void speculative_decoder::flush() {
+    if (this->draft == nullptr || this->lag.empty()) {
+        return;
+    }
+    if (this->lag.size() == 1) {
+        this->draft->forward(this->lag[0]);
+    }
+    else {
+        this->draft->prefill(this->lag);
+    }
+    this->lag.clear();
+}
+
+/// \brief Forget the lagging tokens, after both caches were cleared or cut back
+void speculative_decoder::reset() {
+    this->lag.clear();
+}
+
+void speculative_decoder::reset_stats() {
+    this->stats = {0, 0, 0, 0, 0, 0};
+    this->draft_time.reset();
+    this->verify_time.reset();
+}
@@ -0,0 +1,129 @@
+/// \file stop_sequences.cpp
+/// \brief stop sequence matcher class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note This is a source file for the stop sequence matcher class
+#include "modules/stop_sequences.hpp"
+
+#include <algorithm>
+#include <queue>
+
+/// \brief Constructor
+/// \param patterns the stop sequences, empty ones are ignored
+stop_matcher::stop_matcher(const std::vector<std::string>& patterns) {
+    std::array<int, 256> none;
+    none.fill(-1);
+    this->next.push_back(none);
+    this->depth.push_back(0);
+    this->output.push_back(-1);
+    for (const std::string& pattern : patterns) {
+        if (pattern.empty()) {
+            continue;
+        }
+        int node = 0;
+        for (unsigned char c : pattern) {
+            if (this->next[node][c] < 0) {
+                this->next[node][c] = (int)this->next.size();
+                this->next.push_back(none);
+                this->depth.push_back(this->depth[node] + 1);
+                this->output.push_back(-1);
+            }
+            node = this->next[node][c];
+        }
+        this->output[node] = (int)this->patterns.size();
+        this->patterns.push_back(pattern);
+    }
+
+    // Breadth first, a state's failure link is shallower and already complete
+    std::vector<int> fail(this->next.size(), 0);
+    std::queue<int> queue;
+    for (int c = 0; c < 256; c++) {
+        int child = this->next[0][c];
+        if (child < 0) {
+            this->next[0][c] = 0;
+        }
+        else {
+            queue.push(child);
+        }
+    }
+    while (!queue.empty()) {
+        int node = queue.front();
+        queue.pop();
+        // A pattern of the node itself is the longest ending here, else the one of the link
+        if (this->output[node] < 0) {
+            this->output[node] = this->output[fail[node]];
+        }
+        for (int c = 0; c < 256; c++) {
+            int child = this->next[node][c];
+            if (child < 0) {
+                this->next[node][c] = this->next[fail[node]][c];
+            }
+            else {
+                fail[child] = this->next[fail[node]][c];
+                queue.push(child);
+            }
+        }
+    }
+}
+
+/// \brief Start a new stream
+void stop_matcher::reset() {
+    this->state = 0;
+    this->held.clear();
+    this->matched = false;
+    this->match.clear();
+}
+
+/// \brief Match the next piece of the stream
+/// \param text the piece, e.g. one detokenized token
+/// \param out the text that is safe to emit is appended
+/// \return true if a stop sequence is complete; out then ends where it starts, and the
+///         stream is over until reset
+/// \note The first pattern to end wins; of those ending on the same byte, the longest.
+bool stop_matcher::feed(const std::string& text, std::string& out) {
+    if (this->matched) {
+        return true;
+    }
+    // The stream so far ends with held then text; only the bytes of a match or a prefix
+    // of one are copied around, once per piece
+    auto append_stream = [&](size_t n) {
+        out.append(this->held, 0, std::min(n, this->held.size()));
+        if (n > this->held.size()) {
+            out.append(text, 0, n - this->held.size());
+        }
+    };
+    size_t base = this->held.size();
+    for (size_t i = 0; i < text.size(); i++) {
+        this->state = this->next[this->state][(unsigned char)text[i]];
+        if (this->output[this->state] >= 0) {
+            const std::string& pattern = this->patterns[this->output[this->state]];
+            append_stream(base + i + 1 - pattern.size());
+            this->held.clear();
+            this->matched = true;
+            this->match = pattern;
+            return true;
+        }
+    }
+    // Only the part that can still grow into a pattern stays
+    size_t total = base + text.size();
+    size_t keep = this->depth[this->state];
+    append_stream(total - keep);
+    if (keep <= text.size()) {
+        this->held.assign(text, text.size() - keep, keep);
+    }
+    else {
+        this->held.erase(0, total - keep);
+        this->held += text;
+    }
+    return false;
+}
+
+/// \brief End the stream without a match
+/// \return the held back text
+std::string stop_matcher::flush() {
+    std::string rest;
+    rest.swap(this->held);
+    this->state = 0;
+    return rest;
+}
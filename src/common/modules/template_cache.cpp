@@ -0,0 +1,288 @@
+/// \file template_cache.cpp
+/// \brief chat template cache class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note This is a source file for the chat template cache class
+#include "modules/template_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+/// \brief Append the bytes a message is hashed over
+/// \note Cheaper than dump(): strings go in as they are, behind their length, so no two
+///       different messages give the same bytes.
+static void serialize(const nlohmann::ordered_json& value, std::string& out) {
+    auto put = [&](char tag, const std::string& bytes) {
+        uint64_t size = bytes.size();
+        out += tag;
+        out.append((const char*)&size, sizeof(size));
+        out += bytes;
+    };
+    if (value.is_string()) {
+        put('s', value.get_ref<const std::string&>());
+    }
+    else if (value.is_object()) {
+        put('{', std::to_string(value.size()));
+        for (auto it = value.begin(); it != value.end(); ++it) {
+            put('k', it.key());
+            serialize(it.value(), out);
+        }
+    }
+    else if (value.is_array()) {
+        put('[', std::to_string(value.size()));
+        for (const auto& item : value) {
+            serialize(item, out);
+        }
+    }
+    else {
+        put('v', value.dump());
+    }
+}
+
+/// \brief Constructor
+/// \param capacity the number of conversations kept
+/// \param verify_first the number of first hits checked against a full render
+/// \param verify_every after those, one hit in verify_every is checked, 0 never
+template_cache::template_cache(size_t capacity, int verify_first, int verify_every)
+    : capacity(std::max<size_t>(capacity, 1)), verify_first(verify_first), verify_every(verify_every) {}
+
+/// \brief Template and encode a conversation, reusing the longest prefix already seen
+/// \param messages the messages
+/// \param context whatever else the rendering depends on, e.g. the tools and extra context
+/// \param render the chat template
+/// \param encode the tokenizer
+/// \return the token ids of the templated conversation, generation prompt included
+std::vector<int> template_cache::encode(nlohmann::ordered_json& messages, const std::string& context,
+                                        const render_t& render, const encode_t& encode) {
+    std::string text;
+    if (!this->stable || !messages.is_array() || messages.empty()) {
+        return this->_full(messages, render, encode, text);
+    }
+
+    // The anchor on its own tells the generation prompt apart, and what the template puts
+    // in front of the messages
+    nlohmann::ordered_json anchor = nlohmann::ordered_json::array();
+    anchor.push_back(messages[0]);
+    std::string bare;
+    std::string prompted;
+    try {
+        bare = render(anchor, false);
+        prompted = render(anchor, true);
+    }
+    catch (const std::exception& e) {
+        // e.g. a template that wants a user message, the full conversation may still render
+        this->_disable(std::string("the first message does not render alone: ") + e.what());
+        return this->_full(messages, render, encode, text);
+    }
+    if (prompted.compare(0, bare.size(), bare) != 0) {
+        this->_disable("the generation prompt is not appended to the messages");
+        return this->_full(messages, render, encode, text);
+    }
+    std::string generation_prompt = prompted.substr(bare.size());
+
+    // keys[k] stands for the first k messages; the anchor rendering brings in the settings
+    // the model passes to its template, e.g. thinking on or off
+    size_t n = messages.size();
+    std::vector<std::string> keys(n + 1);
+    keys[0] = template_cache::sha256(context + '\0' + prompted);
+    std::string bytes;
+    for (size_t k = 1; k <= n; k++) {
+        bytes = keys[k - 1];
+        serialize(messages[k - 1], bytes);
+        keys[k] = template_cache::sha256(bytes);
+    }
+    size_t reused = n;
+    while (reused > 0 && this->index.count(keys[reused]) == 0) {
+        reused--;
+    }
+
+    std::vector<int> tokens;
+    if (reused == 0) {
+        tokens = this->_full(messages, render, encode, text);
+    }
+    else {
+        // The conversation goes on, its shorter version is not kept beside it
+        auto found = this->index.find(keys[reused]);
+        entry_t entry = std::move(*found->second);
+        this->entries.erase(found->second);
+        this->index.erase(found);
+
+        nlohmann::ordered_json tail = anchor;
+        for (size_t i = reused; i < n; i++) {
+            tail.push_back(messages[i]);
+        }
+        std::string rendered;
+        try {
+            rendered = render(tail, true);
+        }
+        catch (const std::exception& e) {
+            // e.g. a template that checks the roles alternate after a system message
+            this->_disable(std::string("the appended messages do not render behind the first one: ") + e.what());
+            return this->_full(messages, render, encode, text);
+        }
+        if (rendered.compare(0, bare.size(), bare) != 0) {
+            this->_disable("the first message renders differently when others follow");
+            return this->_full(messages, render, encode, text);
+        }
+        std::string appended = rendered.substr(bare.size());
+        text = std::move(entry.text) + appended;
+        tokens = std::move(entry.tokens);
+        std::vector<int> appended_tokens = encode(appended);
+        tokens.insert(tokens.end(), appended_tokens.begin(), appended_tokens.end());
+        this->hits++;
+        this->messages_reused += reused;
+        this->messages_rendered += n - reused;
+
+        bool verify = this->hits <= (uint64_t)std::max(this->verify_first, 0)
+                      || (this->verify_every > 0 && this->hits % this->verify_every == 0);
+        if (verify) {
+            std::string full_text = render(messages, true);
+            if (full_text != text) {
+                this->_disable("a message renders differently when others follow");
+                return encode(full_text);
+            }
+            std::vector<int> full_tokens = encode(full_text);
+            if (full_tokens != tokens) {
+                this->_disable("tokens merge across message boundaries");
+                return full_tokens;
+            }
+            this->verified++;
+        }
+    }
+
+    // Kept without the generation prompt, the next turn goes on after the last message
+    size_t cut = text.size() - std::min(text.size(), generation_prompt.size());
+    if (text.compare(cut, std::string::npos, generation_prompt) == 0) {
+        std::vector<int> prompt_tokens;
+        if (!generation_prompt.empty()) {
+            prompt_tokens = encode(generation_prompt);
+        }
+        if (prompt_tokens.size() <= tokens.size() && std::equal(prompt_tokens.rbegin(), prompt_tokens.rend(), tokens.rbegin())) {
+            this->_store(keys[n], text.substr(0, cut), std::vector<int>(tokens.begin(), tokens.end() - prompt_tokens.size()));
+        }
+    }
+    return tokens;
+}
+
+/// \brief Drop the kept conversations
+void template_cache::clear() {
+    this->entries.clear();
+    this->index.clear();
+}
+
+/// \brief Hits, misses, verifications and the messages rendered and reused
+nlohmann::json template_cache::stats() const {
+    nlohmann::json stats = {
+        {"stable", this->stable},
+        {"conversations", this->entries.size()},
+        {"hits", this->hits},
+        {"misses", this->misses},
+        {"verified", this->verified},
+        {"messages_reused", this->messages_reused},
+        {"messages_rendered", this->messages_rendered}
+    };
+    if (!this->stable) {
+        stats["reason"] = this->unstable_reason;
+    }
+    return stats;
+}
+
+/// \brief Render and encode everything, and count it as a miss
+std::vector<int> template_cache::_full(nlohmann::ordered_json& messages, const render_t& render, const encode_t& encode, std::string& text) {
+    text = render(messages, true);
+    this->misses++;
+    this->messages_rendered += messages.is_array() ? messages.size() : 0;
+    return encode(text);
+}
+
+/// \brief Keep a conversation, the least recently used one goes
+void template_cache::_store(const std::string& key, std::string text, std::vector<int> tokens) {
+    auto found = this->index.find(key);
+    if (found != this->index.end()) {
+        this->entries.erase(found->second);
+        this->index.erase(found);
+    }
+    this->entries.push_front({key, std::move(text), std::move(tokens)});
+    this->index[key] = this->entries.begin();
+    while (this->entries.size() > this->capacity) {
+        this->index.erase(this->entries.back().key);
+        this->entries.pop_back();
+    }
+}
+
+/// \brief Turn the cache off, the template is not prefix-stable
+void template_cache::_disable(const std::string& reason) {
+    this->stable = false;
+    this->unstable_reason = reason;
+    this->clear();
+}
+
+/// \brief SHA-256 digest
+/// \param data the bytes
+/// \return the 32 byte digest
+std::string template_cache::sha256(const std::string& data) {
+    static const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    std::array<uint32_t, 8> h = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    auto rotr = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+    // The last block or two are padded: 0x80, zeros, then the length in bits
+    size_t full = data.size() / 64 * 64;
+    std::string tail = data.substr(full);
+    tail += (char)0x80;
+    while (tail.size() % 64 != 56) {
+        tail += (char)0;
+    }
+    uint64_t bits = (uint64_t)data.size() * 8;
+    for (int i = 7; i >= 0; i--) {
+        tail += (char)((bits >> (i * 8)) & 0xff);
+    }
+
+    uint32_t w[64];
+    for (size_t block = 0; block < full + tail.size(); block += 64) {
+        const unsigned char* p = (const unsigned char*)(block < full ? data.data() + block : tail.data() + block - full);
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | (uint32_t)p[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            k = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+        h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+    }
+
+    std::string digest(32, '\0');
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 4; j++) {
+            digest[i * 4 + j] = (char)(h[i] >> (24 - j * 8));
+        }
+    }
+    return digest;
+}
@@ -0,0 +1,121 @@
+/// \file worker_pool.cpp
+/// \brief worker pool class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note This is a source file for the worker pool class
+#include "modules/worker_pool.hpp"
+
+#include <algorithm>
+
+/// \brief Start the threads
+/// \param threads the number of threads, the caller of run makes one more worker
+worker_pool::worker_pool(size_t threads) {
+    for (size_t i = 0; i < threads; i++) {
+        this->threads.emplace_back(&worker_pool::loop, this, i);
+    }
+}
+
+/// \brief Finish the queued items and join
+worker_pool::~worker_pool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->available.notify_all();
+    for (std::thread& thread : this->threads) {
+        thread.join();
+    }
+}
+
+/// \brief Run a task on count items and wait for all of them
+/// \param count the number of items
+/// \param task called once per item, from any worker
+/// \throws the first exception of a task, once every item is done
+void worker_pool::run(size_t count, const task_t& task) {
+    if (count == 0) {
+        return;
+    }
+    const size_t caller = this->workers() - 1;
+    if (count == 1 || this->threads.empty()) {
+        for (size_t i = 0; i < count; i++) {
+            task(i, caller);
+        }
+        return;
+    }
+
+    auto batch = std::make_shared<batch_t>();
+    batch->task = &task;
+    batch->count = count;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (size_t i = 1; i < count; i++) {
+            this->queue.push_back({batch, i});
+        }
+    }
+    this->available.notify_all();
+
+    // Item 0 here, then whatever of this batch no worker has taken yet
+    item_t item{batch, 0};
+    worker_pool::work(item, caller);
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            auto found = std::find_if(this->queue.begin(), this->queue.end(), [&](const item_t& queued) {
+                return queued.batch == batch;
+            });
+            if (found == this->queue.end()) {
+                break;
+            }
+            item = std::move(*found);
+            this->queue.erase(found);
+        }
+        worker_pool::work(item, caller);
+    }
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->finished.wait(lock, [&] { return batch->done == batch->count; });
+    if (batch->error != nullptr) {
+        std::rethrow_exception(batch->error);
+    }
+}
+
+/// \brief The pool shared by the models for image work
+worker_pool& worker_pool::shared() {
+    static worker_pool pool(std::min<size_t>(std::max(std::thread::hardware_concurrency(), 2u) - 1, 8));
+    return pool;
+}
+
+void worker_pool::loop(size_t worker) {
+    while (true) {
+        item_t item;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->available.wait(lock, [&] { return this->stopping || !this->queue.empty(); });
+            if (this->queue.empty()) {
+                return;
+            }
+            item = std::move(this->queue.front());
+            this->queue.pop_front();
+        }
+        worker_pool::work(item, worker);
+    }
+}
+
+void worker_pool::work(item_t& item, size_t worker) {
+    batch_t& batch = *item.batch;
+    std::exception_ptr error = nullptr;
+    try {
+        (*batch.task)(item.index, worker);
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(batch.mutex);
+    if (error != nullptr && batch.error == nullptr) {
+        batch.error = error;
+    }
+    if (++batch.done == batch.count) {
+        batch.finished.notify_all();
+    }
+}
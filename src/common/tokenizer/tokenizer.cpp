@@ -45,6 +45,14 @@ Tokenizer::Tokenizer(const std::string& model_path) {
     else {
         this->is_doubled_encoded = false;
     }
+    if (data_json.contains("added_tokens") && data_json["added_tokens"].is_array()) {
+        for (const auto& added : data_json["added_tokens"]) {
+            if (added.value("special", false) && added.contains("id")) {
+                this->special_token_ids.push_back(added["id"].get<int>());
+            }
+        }
+        std::sort(this->special_token_ids.begin(), this->special_token_ids.end());
+    }
 }
 
 /// \brief Destructor
@@ -169,4 +177,30 @@ std::string Tokenizer::decode(const std::vector<int>& tokens) {
 /// \return the decoded text
 std::string Tokenizer::run_time_decoder(int answer_token) {
     return this->cpt_to_utf8(this->tokenizer->IdToToken(answer_token));
-}
\ No newline at end of file
+}
+/// \brief Number of tokens in the vocabulary, added tokens included
+int Tokenizer::vocab_size() {
+    return static_cast<int>(this->tokenizer->GetVocabSize());
+}
+
+/// \brief Raw bytes a token stands for
+/// \param token_id the token id
+/// \return the bytes, empty if the token has no text form
+std::string Tokenizer::token_bytes(int token_id) {
+    std::string piece = this->tokenizer->IdToToken(token_id);
+    try {
+        // SentencePiece byte fallback, e.g. <0x0A>
+        if (!this->is_doubled_encoded && piece.size() == 6 && piece.compare(0, 3, "<0x") == 0 && piece[5] == '>') {
+            return std::string(1, static_cast<char>(std::stoi(piece.substr(3, 2), nullptr, 16)));
+        }
+        return this->cpt_to_utf8(piece);
+    }
+    catch (const std::exception&) {
+        return "";
+    }
+}
+
+/// \brief Whether a token is an added token marked special (e.g. <|im_end|>)
+bool Tokenizer::is_special(int token_id) const {
+    return std::binary_search(this->special_token_ids.begin(), this->special_token_ids.end(), token_id);
+}
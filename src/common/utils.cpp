@@ -206,4 +206,25 @@ std::string get_models_directory() {
 #endif
 }
 
+std::string get_history_directory() {
+#ifdef _WIN32
+    const char* path_sep = "\\";
+    char* model_path_env = nullptr;
+    size_t len = 0;
+    if (_dupenv_s(&model_path_env, &len, "FLM_MODEL_PATH") == 0 && model_path_env != nullptr) {
+        std::string history_dir = std::string(model_path_env) + path_sep + "history";
+        free(model_path_env);
+        return history_dir;
+    }
+#else
+    const char* path_sep = "/";
+    const char* model_path_env = std::getenv("FLM_MODEL_PATH");
+    if (model_path_env && *model_path_env) {
+        return std::string(model_path_env) + path_sep + "history";
+    }
+#endif
+    // Fallback to Documents directory if environment variable is not set
+    return get_user_documents_directory() + path_sep + "flm" + path_sep + "history";
+}
+
 } // end of namespace utils
@@ -260,7 +260,10 @@ void Whisper::_build_time_map(){
 }
 
 int Whisper::_sample_in_language(buffer<bf16>& logits){
-    
+    // Greedy: argmax over the language tokens only, no need to mask the rest
+    if (this->sampler->is_greedy()){
+        return this->sampler->sample_greedy(logits, 50259, 50359);
+    }
     for (int i = 0; i < 50259; i++){
         logits[i] = -0x1.FEp127f;
     }
@@ -272,6 +275,9 @@ int Whisper::_sample_in_language(buffer<bf16>& logits){
 }
 
 int Whisper::_sample_in_time_stamp(buffer<bf16>& logits){
+    if (this->sampler->is_greedy()){
+        return this->sampler->sample_greedy(logits, this->token_time_map_offset, this->token_time_map_offset + this->total_time_stamps);
+    }
     for (int i = 0; i < this->token_time_map_offset; i++){
         logits[i] = -0x1.FEp127f;
     }
@@ -30,6 +30,15 @@
 #include "models/gpt_oss/gpt_oss_npu.hpp"
 #include "tokenizer/tokenizer.hpp"
 #include "modules/sampler.hpp"
+#include "modules/grammar.hpp"
+#include "modules/decode_pipeline.hpp"
+#include "modules/speculative.hpp"
+#include "modules/context_shift.hpp"
+#include "modules/kv_session.hpp"
+#include "modules/stop_sequences.hpp"
+#include "modules/chunked_prefill.hpp"
+#include "modules/template_cache.hpp"
+#include "modules/image_cache.hpp"
 #include "utils/utils.hpp"
 #include "utils/profiler.hpp"
 #include "tensor_utils/q4_npu_eXpress.hpp"
@@ -67,12 +76,14 @@ typedef enum {
     MAX_LENGTH_REACHED,
     ERROR_DETECTED,
 	CANCEL_DETECTED,
-	TOOL_DETECTED
+	TOOL_DETECTED,
+	STOP_SEQUENCE_DETECTED
 } stop_reason_t;
 
 inline std::string stop_reason_to_string(stop_reason_t reason){
     switch (reason){
         case EOT_DETECTED:
+        case STOP_SEQUENCE_DETECTED:
             return "stop";
         case MAX_LENGTH_REACHED:
             return "length";
@@ -88,15 +99,17 @@ inline std::string stop_reason_to_string(stop_reason_t reason){
 }
 
 struct chat_meta_info_t {
-    int prompt_tokens;
+    int prompt_tokens;      // tokens prefilled for this request
+    int cached_tokens;      // prompt tokens whose KV was reused from the previous request
     int generated_tokens;
     uint64_t total_duration; // in nanoseconds
     uint64_t load_duration; // in nanoseconds
     uint64_t prefill_duration; // in nanoseconds
     uint64_t decoding_duration; // in nanoseconds
     stop_reason_t stop_reason;
+    std::string stop_sequence; // the stop sequence that ended generation, held back from the output
 
-	chat_meta_info_t() : prompt_tokens(0), generated_tokens(0), total_duration(0), load_duration(0), prefill_duration(0), decoding_duration(0), stop_reason(EOT_DETECTED) {}
+	chat_meta_info_t() : prompt_tokens(0), cached_tokens(0), generated_tokens(0), total_duration(0), load_duration(0), prefill_duration(0), decoding_duration(0), stop_reason(EOT_DETECTED) {}
 };
 
 typedef enum {
@@ -184,6 +197,69 @@ protected:
 
 	StreamResult _shared_think_tool_calling_pasrsed(const std::string content);
 
+	/// \brief Log-probabilities of the emitted tokens not yet taken by the output stream
+	std::vector<token_logprobs_t> logprob_queue;
+	/// \brief Detokenize and stream on a consumer thread while the NPU decodes the next token
+	bool pipelined_decode = true;
+
+	/// \brief The next insert carries the whole conversation, see start_new_prompt
+	bool reuse_prefix = false;
+	/// \brief Whether some of token_history was prefilled with an image or audio payload
+	bool history_has_payload = false;
+	/// \brief Keep the KV of the common prefix of tokens and token_history, drop the rest
+	/// \return the number of leading tokens already in the KV cache
+	size_t _rewind_to_common_prefix(const std::vector<int>& tokens, void* payload);
+
+	/// \brief Tokens per prefill call, 0 for the whole prompt at once
+	int prefill_chunk = DEFAULT_PREFILL_CHUNK;
+	/// \brief Cancellation and progress callbacks of the next insert, see set_prefill_hooks
+	prefill_hooks_t prefill_hooks;
+
+	/// \brief Stop sequences of the current request, nullptr when there are none
+	std::unique_ptr<stop_matcher> stop_sequences = nullptr;
+
+	/// \brief Whether apply_chat_template ends with the generation prompt
+	bool add_generation_prompt = true;
+	/// \brief Rendered and encoded conversations of earlier requests
+	std::unique_ptr<template_cache> tmpl_cache = nullptr;
+	/// \brief Template and encode the messages of a request, only those not seen in an earlier one
+	/// \return the token ids, as the tokenizer gives them for apply_chat_template
+	std::vector<int> _encode_messages(nlohmann::ordered_json& messages, nlohmann::ordered_json tools = nlohmann::ordered_json::object());
+
+	/// \brief Grammar of the current request, nullptr when generation is free
+	std::unique_ptr<grammar::GrammarMatcher> grammar_matcher = nullptr;
+	/// \brief Grammar text and trigger of grammar_matcher, an unchanged grammar keeps its mask cache
+	std::string grammar_text;
+	/// \brief The grammar reached a state no token continues; generation was ended with eos
+	bool grammar_stalled = false;
+	/// \brief Token bytes of the loaded vocabulary, built on the first grammar request
+	std::shared_ptr<const grammar::TokenTrie> grammar_vocab = nullptr;
+
+	std::shared_ptr<const grammar::TokenTrie> _grammar_vocab();
+	bool _set_grammar(const std::string& gbnf, const std::string& trigger, std::string* error = nullptr);
+	/// \brief Sample a token under the grammar of the request, if any
+	int _sample(buffer<bf16>& y);
+
+	/// \brief Draft model of speculative decoding, nullptr when it is off
+	std::unique_ptr<causal_lm> draft_engine = nullptr;
+	std::unique_ptr<speculative_decoder> speculator = nullptr;
+	/// \brief Whether the draft KV cache follows token_history; a payload prefill breaks it
+	bool draft_in_sync = false;
+	/// \brief N-gram index of token_history for draft-free speculation
+	std::unique_ptr<prompt_lookup> lookup = nullptr;
+	bool use_prompt_lookup = false;
+	/// \brief Create the speculative decoder on first use
+	void _ensure_speculator(int draft_len);
+
+	/// \brief Context shift policy, nullptr stops generation at the context length
+	std::unique_ptr<context_shift> context_shifter = nullptr;
+	/// \brief Make room for needed more tokens by evicting the middle of the context
+	/// \return false if context shifting is off or cannot make room
+	bool _shift_context(int needed);
+
+	/// \brief Preprocessed images of earlier requests, nullptr when the cache is off
+	std::unique_ptr<image_cache> preprocessed_images = nullptr;
+
 public:
 	//************ Shared by all models *************/
 	virtual ~AutoModel() = default;
@@ -192,6 +268,76 @@ public:
 	/// \brief Clear the context
 	void clear_context();
 
+	/// \brief Reuse the KV cache across requests that resend the conversation
+	/// \note The next insert must carry the whole conversation. Its longest common prefix
+	///       with the token history stays in the KV cache and only the rest is prefilled,
+	///       so the time to first token follows the new tokens, not the conversation.
+	void start_new_prompt();
+
+	/// \brief Whether the KV cache can be cut back to an earlier position
+	/// \note False for models with recurrent or sliding-window state; they only reuse
+	///       a cache that is a whole prefix of the new prompt.
+	virtual bool kv_rewind_supported() { return true; }
+
+	/// \brief Why speculative decoding cannot run on the loaded model
+	/// \return empty if it can; it needs KV rollback and a target engine with batched verify
+	std::string speculation_unavailable();
+
+	/// \brief Pair a small draft model with this one for speculative decoding
+	/// \param draft_model_path the path of the draft model, same tokenizer as this one
+	/// \param draft_len the number of tokens the draft proposes per round
+	/// \return false if the pair is not usable (see speculation_unavailable), decoding is then left as it was
+	/// \note The output is the one of plain decoding with the same sampler settings;
+	///       the conversation is cleared.
+	bool load_draft_model(std::string draft_model_path, int draft_len = 4);
+
+	/// \brief Go back to plain decoding and free the draft model
+	void unload_draft_model();
+
+	/// \brief Propose tokens by looking up the last generated n-gram in the history
+	/// \param enable whether to speculate from the prompt, per request
+	/// \param draft_len the number of tokens proposed per round, -1 to keep it
+	/// \return false if speculation cannot run on the model, see speculation_unavailable
+	/// \note Tried before the draft model, if any; the output does not change.
+	bool set_prompt_lookup(bool enable, int draft_len = -1);
+
+	/// \brief Keep going past the context length by evicting the middle of the conversation
+	/// \param enable false to stop at the context length
+	/// \param sink_tokens the number of leading tokens that are never evicted
+	/// \note Engines with a kv_evictor shift in place; the others re-prefill the kept tokens.
+	void set_context_shift(bool enable, int sink_tokens = 4);
+
+	/// \brief Save the conversation to a session snapshot
+	/// \param path the snapshot file, replaced once the new one is complete
+	/// \param compress whether to compress the K/V caches
+	/// \return false if nothing was written
+	/// \note The K/V caches are captured when the engine can write them back (kv_restorer);
+	///       otherwise the snapshot holds the tokens and load_session prefills them again.
+	bool save_session(const std::string& path, bool compress = false);
+
+	/// \brief Resume a conversation from a session snapshot of the same model
+	/// \param path the snapshot file
+	/// \param kv_restored set to whether the K/V caches were written back, else the tokens were prefilled again
+	/// \return false if the snapshot is missing, corrupt or from another model, or the prefill
+	///         was cancelled; the context is then left empty if it was already cleared
+	bool load_session(const std::string& path, bool* kv_restored = nullptr);
+
+	/// \brief Keep preprocessed images for the requests that send them again
+	/// \param max_bytes the memory for their pixel values, 0 turns the cache off
+	/// \param max_images the number of images kept
+	void set_image_cache(size_t max_bytes, size_t max_images = 256);
+
+	/// \brief Image cache statistics, null when the cache is off or the model takes no images
+	nlohmann::json image_cache_stats();
+
+	/// \brief Whether a draft model or the prompt lookup speculates
+	bool speculative_enabled() const { return this->draft_engine != nullptr || this->use_prompt_lookup; }
+
+	/// \brief Build the engine of a draft model
+	/// \param config the configuration of the draft model
+	/// \return nullptr if the architecture has no engine that can serve as a draft
+	virtual std::unique_ptr<causal_lm> create_draft_engine(LM_Config& config);
+
 	/// \brief Get the current model
 	/// \return the current model
 	std::string get_current_model();
@@ -269,6 +415,79 @@ public:
 	/// \param penalty_window the penalty window
 	void set_penalty_window(int penalty_window);
 
+	/// \brief Set the sampler seed
+	/// \param seed the seed, negative for a random one
+	void set_seed(i64 seed);
+
+	/// \brief Report log-probabilities for the generated tokens
+	/// \param enable whether to report them
+	/// \param top_n the number of alternatives per token, 0 to 20
+	void set_logprobs(bool enable, int top_n = 0);
+	bool logprobs_enabled();
+
+	/// \brief Set the logit bias (OpenAI logit_bias)
+	/// \param bias token id and bias pairs, -100 to 100, empty to clear
+	void set_logit_bias(const std::vector<std::pair<int, float>>& bias);
+
+	/// \brief Restrict generation to a set of tokens
+	/// \param token_ids the allowed token ids, empty to lift the restriction
+	void set_allowed_tokens(const std::vector<int>& token_ids);
+
+	/// \brief Overlap detokenization and streaming with the NPU
+	/// \param enable false to emit every token on the decode thread
+	void set_pipelined_decode(bool enable) { this->pipelined_decode = enable; }
+
+	/// \brief Constrain generation with a GBNF grammar
+	/// \param gbnf the grammar, start rule "root"
+	/// \param error set to the reason when it fails, may be nullptr
+	/// \return false if the grammar does not parse, generation is then left free
+	bool set_grammar(const std::string& gbnf, std::string* error = nullptr);
+
+	/// \brief Constrain generation to JSON matching a schema (response_format, format)
+	/// \param schema the JSON schema
+	/// \param error set to the reason when it fails, may be nullptr
+	/// \return false if the schema cannot be compiled
+	bool set_json_schema(const nlohmann::json& schema, std::string* error = nullptr);
+
+	/// \brief Constrain the tool calls of the answer to the declared tools
+	/// \param tools the OpenAI tools array
+	/// \return false if the model has no tool-call markers or no tool has a name
+	/// \note The grammar is lazy: text outside the tool-call markers is free.
+	bool set_tool_grammar(const nlohmann::ordered_json& tools);
+
+	/// \brief Set the number of tokens per prefill call
+	/// \param chunk the chunk size, 0 to prefill a prompt in one call
+	/// \note Each model has its own default, "prefill_chunk" in the model list. Smaller
+	///       chunks let a request be cancelled sooner at some cost in prefill speed.
+	void set_prefill_chunk(int chunk);
+
+	/// \brief Tokens per prefill call
+	int get_prefill_chunk() const { return this->prefill_chunk; }
+
+	/// \brief Set the cancellation and progress callbacks of the next insert or load_session
+	/// \param is_cancelled checked between chunks, nullptr never cancels
+	/// \param on_progress called after each chunk with the tokens done and the total, may be nullptr
+	/// \note A cancelled insert returns false with stop_reason CANCEL_DETECTED; the chunks
+	///       done stay in the KV cache. Prompts with an image or audio are not chunked.
+	void set_prefill_hooks(std::function<bool()> is_cancelled, std::function<void(int, int)> on_progress);
+
+	/// \brief End generation on any of several strings (OpenAI stop, Ollama options.stop)
+	/// \param stops the stop sequences, empty to clear; the matched one is not emitted
+	void set_stop_sequences(const std::vector<std::string>& stops);
+
+	/// \brief Drop the grammar, generation is free again
+	void clear_grammar();
+
+	/// \brief Text that opens and closes a tool call of this model
+	/// \return empty strings if the model has no text markers or its own tool-call format
+	virtual std::pair<std::string, std::string> tool_call_markers() {
+		return {"", ""};
+	}
+
+	/// \brief Take the queued log-probabilities in OpenAI format
+	/// \return the "content" array of an OpenAI logprobs object, the queue is emptied
+	json take_logprobs_json();
+
 	/// \brief Start the ttft timer
 	/// \return the ttft timer
 	void start_ttft_timer();
@@ -9,6 +9,8 @@
 #include "AutoModel/automodel.hpp"
 #include "base64.hpp"
 #include "image/image_reader.hpp"
+#include "image_process_utils/imageproc.hpp"
+#include "modules/worker_pool.hpp"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -21,10 +23,15 @@ private:
     void setup_tokenizer(std::string model_path);
     
     // Image processing functionality
-    ImageReader image_reader_;
-    bytes load_image(const std::string& filename);
-    bytes load_image_base64(const std::string& base64_string);
-    buffer<bf16> preprocess_image(bytes& image);
+    /// \brief One image reader per worker of the shared worker pool, FFmpeg contexts are not shared
+    std::vector<std::unique_ptr<ImageReader>> image_readers_;
+    bytes load_image(const std::string& filename, ImageReader& image_reader_);
+    bytes load_image_base64(const std::string& base64_string, ImageReader& image_reader_);
+    bool preprocess_image(bytes& image, bf16* pixel_values);
+    /// \brief Decode and preprocess the images of a request on the shared worker pool
+    /// \param sources the images in request order, a base64 string or a file path each
+    /// \param pixel_values 3x896x896 values per image, in request order; a failed image stays zero
+    void preprocess_images(const std::vector<std::pair<std::string, bool>>& sources, bytes& pixel_values);
 
 public:
     Gemma3(xrt::device* npu_device_inst);
@@ -35,4 +42,6 @@ public:
     std::string generate(chat_meta_info_t& meta_info, int length_limit, std::ostream& os, std::function<bool()> is_cancelled = [] { return false; }) override;
     std::string generate_with_prompt(chat_meta_info_t& meta_info, lm_uniform_input_t& input, int length_limit, std::ostream& os = std::cout) override;
     std::string apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools = nlohmann::ordered_json::object()) override;
+    /// \brief Sliding-window layers overwrite old KV entries, no rewind
+    bool kv_rewind_supported() override { return false; }
 };
\ No newline at end of file
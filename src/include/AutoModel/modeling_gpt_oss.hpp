@@ -47,6 +47,8 @@ public:
     void mask_logits(buffer<bf16>& logits, const std::vector<int>& allowed_tokens);
     NonStreamResult parse_nstream_content(const std::string response_text);
     StreamResult parse_stream_content(const std::string content);
+    /// \brief Sliding-window layers overwrite old KV entries, no rewind
+    bool kv_rewind_supported() override { return false; }
     chat_template_type_t get_chat_template_type() {
         return chat_template_type_t::harmony;
     }
@@ -33,6 +33,8 @@ public:
     std::string generate_with_prompt(chat_meta_info_t& meta_info, lm_uniform_input_t& input, int length_limit, std::ostream& os = std::cout) override;
     std::string apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools = nlohmann::ordered_json::object()) override;
     StreamResult parse_stream_content(const std::string content);
+    /// \brief The short-conv layers carry recurrent state, no rewind
+    bool kv_rewind_supported() override { return false; }
 };
 
 class LFM2_5_TK : public AutoModel {
@@ -60,4 +62,6 @@ public:
     std::string apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools = nlohmann::ordered_json::object()) override;
     NonStreamResult parse_nstream_content(const std::string response_text);
     StreamResult parse_stream_content(const std::string content);
+    /// \brief The short-conv layers carry recurrent state, no rewind
+    bool kv_rewind_supported() override { return false; }
 };
\ No newline at end of file
@@ -27,4 +27,7 @@ public:
     std::string apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools = nlohmann::ordered_json::object()) override;
     NonStreamResult parse_nstream_content(const std::string response_text);
     StreamResult parse_stream_content(const std::string content);
+    std::pair<std::string, std::string> tool_call_markers() override {
+        return {"<tool_call>", "</tool_call>"};
+    }
 };
\ No newline at end of file
@@ -29,6 +29,9 @@ public:
     std::string apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools = nlohmann::ordered_json::object()) override;
     NonStreamResult parse_nstream_content(const std::string response_text);
     StreamResult parse_stream_content(const std::string content);
+    std::pair<std::string, std::string> tool_call_markers() override {
+        return {"<tool_call>", "</tool_call>"};
+    }
 
     /// \brief Override configure_parameter to handle Qwen3-specific parameters
     bool configure_parameter(std::string parameter_name, const std::any& value) override {
@@ -75,6 +78,9 @@ public:
     std::string apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools = nlohmann::ordered_json::object()) override;
     NonStreamResult parse_nstream_content(const std::string response_text);
     StreamResult parse_stream_content(const std::string content);
+    std::pair<std::string, std::string> tool_call_markers() override {
+        return {"<tool_call>", "</tool_call>"};
+    }
 };
 
 class Qwen3_TK : public AutoModel {
@@ -96,6 +102,9 @@ public:
     std::string apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools = nlohmann::ordered_json::object()) override;
     NonStreamResult parse_nstream_content(const std::string response_text);
     StreamResult parse_stream_content(const std::string content);
+    std::pair<std::string, std::string> tool_call_markers() override {
+        return {"<tool_call>", "</tool_call>"};
+    }
     };
 
 
@@ -12,6 +12,7 @@
 
 #include "typedef.hpp"
 #include "image/image_reader.hpp"
+#include "modules/worker_pool.hpp"
 #include "image_process_utils/imageproc.hpp"
 #include "image_process_utils/imageprocAVX512.hpp"
 #include "tensor_utils/q4_npu_eXpress.hpp"
@@ -27,9 +28,16 @@ private:
     void setup_tokenizer(std::string model_path);
     
     // Image processing functionality
-    ImageReader image_reader_;
-    qwen3vl_image_t load_image(const std::string& filename);
-    qwen3vl_image_t load_image_base64(const std::string& base64_string);
+    /// \brief One image reader per worker of the shared worker pool, FFmpeg contexts are not shared
+    std::vector<std::unique_ptr<ImageReader>> image_readers_;
+    qwen3vl_image_t load_image(const std::string& filename, ImageReader& image_reader_);
+    qwen3vl_image_t load_image_base64(const std::string& base64_string, ImageReader& image_reader_);
+    /// \brief Pre-resize, reorder and plan a decoded image
+    qwen3vl_image_t finish_image(image_data_t& decoded, ImageReader& image_reader_);
+    /// \brief The size the pre-resize option takes an image to, false if it keeps it
+    bool pre_resize(int width, int height, int& target_width, int& target_height);
+    /// \brief The size the model resizes an image to, from its encoded size
+    decode_target_t decode_target();
     
     int image_pre_resize = 0;
 
@@ -41,7 +49,16 @@ private:
     int min_pixels,
     int max_pixels);
     
-    void preprocess_image(qwen3vl_image_t& image,  std::vector<bf16> &pixel_values);
+    /// \brief Set the resized size and grid of a decoded image
+    /// \param width the width a full decode gives, after the pre-resize
+    /// \param height the height a full decode gives, after the pre-resize
+    /// \return the number of pixel values it takes in the payload
+    size_t plan_image(qwen3vl_image_t& image, int width, int height);
+    void preprocess_image(qwen3vl_image_t& image, bf16* pixel_values);
+    /// \brief Decode and preprocess the images of a request on the shared worker pool
+    /// \param sources the images in request order, a base64 string or a file path each
+    /// \param payload the images and their pixel values are appended, in request order
+    void preprocess_images(const std::vector<std::pair<std::string, bool>>& sources, qwen3vl_image_payload_t& payload);
 
 public:
     Qwen3VL(xrt::device* npu_device_inst);
@@ -54,6 +71,9 @@ public:
     std::string apply_chat_template(nlohmann::ordered_json& messages, nlohmann::ordered_json tools = nlohmann::ordered_json::object()) override;
     NonStreamResult parse_nstream_content(const std::string response_text);
     StreamResult parse_stream_content(const std::string content);
+    std::pair<std::string, std::string> tool_call_markers() override {
+        return {"<tool_call>", "</tool_call>"};
+    }
 
     /// \brief Configure a parameter with type-erased value
 	/// \param parameter_name the name of the parameter
@@ -11,6 +11,55 @@
 #include "utils/utils.hpp"
 #include "buffer.hpp"
 
+/// \brief Optional interface of engines that score several tokens in one pass
+/// \note Engines opt in by also deriving from it; causal_lm::verify finds it with a
+///       dynamic_cast, so engines built without it keep working.
+class batch_verifier {
+public:
+    virtual ~batch_verifier(){}
+
+    /// \brief Append ids to the KV cache and return the logits of every position
+    /// \param ids the ids
+    /// \param logits ids.size() rows of logits, may be remapped to the engine's own buffer
+    /// \return the number of logits per row
+    virtual int verify_batch(std::vector<int>& ids, buffer<bf16>& logits) = 0;
+};
+
+/// \brief Optional interface of engines that can drop KV positions in place
+/// \note Found with a dynamic_cast by causal_lm::evict, like batch_verifier.
+class kv_evictor {
+public:
+    virtual ~kv_evictor(){}
+
+    /// \brief Drop the KV of positions [begin, end)
+    /// \param begin the first position to drop
+    /// \param end one past the last position to drop
+    /// \return false if the cache was left unchanged
+    /// \note The positions after end move down by end - begin, keys are re-rotated to
+    ///       their new positions, and the next token continues at the new length.
+    virtual bool evict_kv(int begin, int end) = 0;
+};
+
+/// \brief Optional interface of engines that can write their KV caches back
+/// \note Found with a dynamic_cast by causal_lm::restore_kv_cache, like batch_verifier.
+class kv_restorer {
+public:
+    virtual ~kv_restorer(){}
+
+    /// \brief Overwrite the K and V caches of a layer and index
+    /// \param layer_idx the layer index
+    /// \param idx the index, as for get_k_cache
+    /// \param k the contents get_k_cache returned
+    /// \param v the contents get_v_cache returned
+    /// \param k_size the number of elements of k
+    /// \param v_size the number of elements of v
+    /// \return false if the sizes do not match the engine's caches
+    virtual bool set_kv_cache(int layer_idx, int idx, const bf16* k, size_t k_size, const bf16* v, size_t v_size) = 0;
+
+    /// \brief Continue at position length once every cache is written
+    virtual bool set_restored_length(int length) = 0;
+};
+
 /// \brief causal_lm class
 class causal_lm {
 public:
@@ -57,4 +106,104 @@ public:
     /// \brief get the current context length
     /// \return the current context length
     virtual int get_current_context_length() = 0;
+
+    /// \brief Drop the KV cache past len, the next prefill or forward continues at position len
+    /// \param len the number of tokens to keep
+    /// \return false if len is beyond the cache or the engine did not take the new length
+    /// \note Not virtual on purpose: the engines are built separately and a new vtable slot
+    ///       would break them. Attention-only engines keep positions as a plain counter, so
+    ///       moving it back is enough; models with recurrent or sliding-window state must
+    ///       not be rewound (see AutoModel::kv_rewind_supported).
+    bool truncate_to(int len) {
+        int current = this->get_current_context_length();
+        if (len < 0 || len > current) {
+            return false;
+        }
+        if (len == current) {
+            return true;
+        }
+        if (len == 0) {
+            this->clear_context();
+            return true;
+        }
+        this->set_context_length(len);
+        return this->get_current_context_length() == len;
+    }
+
+    /// \brief Drop the last n tokens of the KV cache
+    /// \param n the number of tokens to drop
+    /// \return false if the cache holds fewer than n tokens
+    bool rewind(int n) {
+        return this->truncate_to(this->get_current_context_length() - n);
+    }
+
+    /// \brief Append ids to the KV cache and return the logits of every position
+    /// \param ids the ids
+    /// \param logits ids.size() rows of logits, reallocated when too small
+    /// \return the number of logits per row
+    /// \note Row i holds the prediction after ids[i], as forward(ids[i]) would return it.
+    ///       Engines without a batch_verifier run one forward per id, which gives the
+    ///       same logits but no speedup.
+    int verify(std::vector<int>& ids, buffer<bf16>& logits) {
+        batch_verifier* batched = dynamic_cast<batch_verifier*>(this);
+        if (batched != nullptr) {
+            return batched->verify_batch(ids, logits);
+        }
+        int row = 0;
+        for (size_t i = 0; i < ids.size(); i++) {
+            buffer<bf16> y = this->forward(ids[i]);
+            if (i == 0) {
+                row = y.size();
+                if (logits.size() < ids.size() * row) {
+                    logits = buffer<bf16>(ids.size() * row);
+                }
+            }
+            std::memcpy(logits.data() + i * row, y.data(), row * sizeof(bf16));
+        }
+        return row;
+    }
+
+    /// \brief Whether verify scores all ids in one pass
+    bool has_batched_verify() {
+        return dynamic_cast<batch_verifier*>(this) != nullptr;
+    }
+
+    /// \brief Drop the KV of positions [begin, end) and renumber the positions after it
+    /// \param begin the first position to drop
+    /// \param end one past the last position to drop
+    /// \return false if the engine cannot evict in place or the range is invalid
+    bool evict(int begin, int end) {
+        int current = this->get_current_context_length();
+        if (begin < 0 || end > current || begin >= end) {
+            return false;
+        }
+        kv_evictor* evictor = dynamic_cast<kv_evictor*>(this);
+        if (evictor == nullptr || !evictor->evict_kv(begin, end)) {
+            return false;
+        }
+        return this->get_current_context_length() == current - (end - begin);
+    }
+
+    /// \brief Whether evict is available
+    bool can_evict() {
+        return dynamic_cast<kv_evictor*>(this) != nullptr;
+    }
+
+    /// \brief Write back the caches of a layer and index read with get_k_cache/get_v_cache
+    /// \return false if the engine cannot restore caches or rejected them
+    bool restore_kv_cache(int layer_idx, int idx, const bf16* k, size_t k_size, const bf16* v, size_t v_size) {
+        kv_restorer* restorer = dynamic_cast<kv_restorer*>(this);
+        return restorer != nullptr && restorer->set_kv_cache(layer_idx, idx, k, k_size, v, v_size);
+    }
+
+    /// \brief Continue at position length after restore_kv_cache wrote every cache
+    bool restore_context_length(int length) {
+        kv_restorer* restorer = dynamic_cast<kv_restorer*>(this);
+        return restorer != nullptr && restorer->set_restored_length(length) && this->get_current_context_length() == length;
+    }
+
+    /// \brief Whether restore_kv_cache is available
+    bool can_restore_kv() {
+        return dynamic_cast<kv_restorer*>(this) != nullptr;
+    }
 };
\ No newline at end of file
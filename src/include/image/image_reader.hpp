@@ -9,6 +9,7 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <functional>
 #include <unordered_map>
 #include <mutex>
 #include "typedef.hpp"
@@ -18,8 +19,17 @@ struct image_data_t {
 	bytes pixels;
 	int height = 0;
 	int width = 0;
+	int source_height = 0;	// as encoded; larger than height when the decode was reduced
+	int source_width = 0;
 };
 
+/// \brief The size an image is resized to after decoding, given its encoded size
+/// \note With a target, a large image may decode smaller: JPEG by DCT scaling (FFmpeg
+///       lowres), any format by an area prefilter in the RGB conversion. The decode stays
+///       at least twice the target on both sides, so the resize that follows still
+///       antialiases from several source pixels per output pixel.
+typedef std::function<void(int width, int height, int& target_width, int& target_height)> decode_target_t;
+
 class ImageMemoryPool {
 public:
 	explicit ImageMemoryPool(size_t max_cached_per_size = 16);
@@ -37,8 +47,8 @@ public:
 	explicit ImageReader(size_t max_cached_per_size = 16);
 	~ImageReader();
 
-	bool load_image(const std::string& filename, image_data_t& out_image);
-	bool load_image_base64(const std::string& base64_string, image_data_t& out_image);
+	bool load_image(const std::string& filename, image_data_t& out_image, const decode_target_t& target = nullptr);
+	bool load_image_base64(const std::string& base64_string, image_data_t& out_image, const decode_target_t& target = nullptr);
 	bool resize_image(const image_data_t& input, int target_width, int target_height, image_data_t& output);
 	bool reorder_hwc_to_chw(const image_data_t& input, image_data_t& output);
 	bool save_png(const std::string& filename, const image_data_t& image);
@@ -48,8 +58,10 @@ public:
 private:
 	static void initialize_ffmpeg();
 	static bool parse_image_header(const uint8_t* data, size_t size, int& codec_id);
-	bool decode_bytes(const uint8_t* data, size_t size, image_data_t& out_image);
-	bool ensure_decode_resources(int codec_id);
+	static bool parse_image_size(const uint8_t* data, size_t size, int codec_id, int& width, int& height);
+	bool decode_bytes(const uint8_t* data, size_t size, image_data_t& out_image, const decode_target_t& target);
+	bool decode_frame(const uint8_t* data, size_t size, int codec_id, int lowres);
+	bool ensure_decode_resources(int codec_id, int lowres);
 	void reset_decode_resources();
 
 	ImageMemoryPool memory_pool_;
@@ -61,10 +73,13 @@ private:
 	struct SwsContext* sws_ctx_ = nullptr;
 
 	int cached_codec_id_ = -1;
+	int cached_lowres_ = 0;
 	int sws_src_w_ = 0;
 	int sws_src_h_ = 0;
 	int sws_src_fmt_ = -1;
 	int sws_src_range_ = -1;
+	int sws_dst_w_ = 0;
+	int sws_dst_h_ = 0;
 };
 
 bool save_image(const std::string& filename, const bytes& image);
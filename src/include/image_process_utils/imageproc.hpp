@@ -10,6 +10,23 @@
 #include "typedef.hpp"
 namespace imgproc {
 
+    // Instruction sets the optimized kernels are built for, slowest first
+    enum class isa_t { scalar, avx2, avx512 };
+
+    // Best instruction set of this CPU and OS, from cpuid, checked once
+    //  - avx512: AVX-512 F/DQ/BW/VL with the zmm state enabled by the OS
+    //  - avx2:   AVX2 and FMA with the ymm state enabled by the OS
+    isa_t detect_isa();
+
+    // Instruction set the *_optimized functions dispatch to, detect_isa() unless forced
+    isa_t active_isa();
+
+    // Force the instruction set of the *_optimized functions, e.g. to compare them;
+    // clamped to detect_isa() so an unsupported kernel never runs
+    void set_isa(isa_t isa);
+
+    const char* isa_name(isa_t isa);
+
     // Keys bicubic kernel (a = -0.5) - matches PyTorch antialias=True
     inline float bicubic_kernel(float x) {
         const float a = -0.5f;
@@ -26,6 +43,11 @@ namespace imgproc {
         return std::max(lo, std::min(x, hi));
     }
 
+    // Clamp to [0, 255] and round half up, as the SIMD resize kernels store
+    inline uint8_t round_to_uint8(float x) {
+        return static_cast<uint8_t>(std::floor(std::clamp(x, 0.0f, 255.0f) + 0.5f));
+    }
+
     inline float gaussian(float x, float sigma) {
         if (sigma <= 0.0f) return 1.0f;
         return std::exp(-(x * x) / (2.0f * sigma * sigma));
@@ -54,6 +76,39 @@ namespace imgproc {
         }
     }
 
+    // Taps of the 4x4 bicubic resize along one axis, as a separable filter. The
+    // weights of each output are normalized to sum to one, which is what the 2D
+    // kernel does with its weight sum, so vertical then horizontal taps give the
+    // reference result up to float rounding. Laid out tap-major for SIMD loads:
+    // tap k of output i is at [k * dst_size + i].
+    struct resize_taps_t {
+        int dst_size = 0;
+        std::vector<int32_t> index;   // source index, clamped to the image
+        std::vector<float> weight;
+    };
+
+    resize_taps_t compute_resize_taps(int src_size, int dst_size, bool antialias);
+
+    // Separable resize of output rows [row_begin, row_end) of one uint8 plane, with the
+    // taps of compute_resize_taps; dst gets the rows one after another and row is scratch
+    // for src_w floats
+    void resize_bicubic_rows(
+        const uint8_t* src, int src_w,
+        const resize_taps_t& taps_x,
+        const resize_taps_t& taps_y,
+        int row_begin, int row_end,
+        uint8_t* dst,
+        float* row);
+
+    // Auto-dispatching version of resize_bicubic_rows
+    void resize_bicubic_rows_optimized(
+        const uint8_t* src, int src_w,
+        const resize_taps_t& taps_x,
+        const resize_taps_t& taps_y,
+        int row_begin, int row_end,
+        uint8_t* dst,
+        float* row);
+
     // Core bicubic resize with exact PyTorch antialiasing behavior
     std::vector<float> resize_bicubic_plane(
         const std::vector<float>& src,
@@ -104,9 +159,60 @@ namespace imgproc {
         float image_mean,
         float image_std 
     );
+
+    // Auto-dispatching optimized version (per-channel mean/std)
+    void rescale_and_normalize_optimized(
+        const uint8_t *image_src,
+        float *output_buffer,
+        int image_width, int image_height, int image_channels,
+        bool do_rescale,
+        float rescale_factor,
+        bool do_normalize,
+        const std::vector<float>& image_mean,
+        const std::vector<float>& image_std
+    );
     
 
 
+    // Deinterleave an RGB HWC image into CHW planes, rescale, normalize and convert to
+    // bf16 in one read of the source: out[c][i] = bf16((src[3 * i + c] * rescale_factor
+    // - image_mean) * (1 / image_std)), the same float operations as the scalar loop
+    void hwc_to_chw_normalize_bf16(
+        const uint8_t* src,
+        size_t pixel_count,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        bf16* out_ptr);
+
+    // Auto-dispatching version of hwc_to_chw_normalize_bf16
+    void hwc_to_chw_normalize_bf16_optimized(
+        const uint8_t* src,
+        size_t pixel_count,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        bf16* out_ptr);
+
+    // Resize, rescale, normalize, repeat for the temporal patch and reorder into merged
+    // patches in one tiled pass, the Qwen-VL vision input for a single image. Gives what
+    // resize_bicubic_antialias_rgb_planar_optimized, rescale_and_normalize_optimized, the
+    // temporal copies and reorder_patches_inplace give, without their full-size buffers:
+    // one band of merge_size * patch_size rows is resized at a time, and written out as
+    // bf16 patches, through a lookup table of the 256 normalized levels, while in cache.
+    // dst_w and dst_h must be multiples of merge_size * patch_size.
+    void resize_normalize_patches_bf16(
+        const uint8_t* src,
+        int src_w, int src_h,
+        int dst_w, int dst_h,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        int temporal_patch_size,
+        int merge_size,
+        int patch_size,
+        bf16* out_ptr);
+
     void reorder_patches_inplace(
         float* data,
         bf16* out_ptr,
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <immintrin.h>
+#include "typedef.hpp"
+#include "image_process_utils/imageproc.hpp"
+
+// The AVX2 kernels are compiled for AVX2 and FMA function by function, so the rest
+// of the build does not depend on them; call them only when imgproc::detect_isa()
+// reports avx2 or better.
+#ifdef _MSC_VER
+#define IMGPROC_TARGET_AVX2
+#else
+#define IMGPROC_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace imgproc {
+namespace avx2 {
+
+    // 8 uint8 to 8 floats
+    IMGPROC_TARGET_AVX2
+    inline __m256 load_uint8x8_avx2(const uint8_t* src) {
+        __m128i u8_vec = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src));
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(u8_vec));
+    }
+
+    // 8 floats to 8 uint8, clamped to [0, 255] and rounded half up
+    IMGPROC_TARGET_AVX2
+    inline void store_uint8x8_avx2(__m256 values, uint8_t* dst) {
+        values = _mm256_min_ps(_mm256_max_ps(values, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+        __m256i i32_vec = _mm256_cvttps_epi32(_mm256_add_ps(values, _mm256_set1_ps(0.5f)));
+        __m128i i16_vec = _mm_packus_epi32(_mm256_castsi256_si128(i32_vec), _mm256_extracti128_si256(i32_vec, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(i16_vec, i16_vec));
+    }
+
+    // 16 RGB pixels (48 bytes) to 16 R, 16 G and 16 B values
+    IMGPROC_TARGET_AVX2
+    inline void deinterleave_rgb16_avx2(const uint8_t* src, __m128i& r, __m128i& g, __m128i& b) {
+        const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+        const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+        const char z = -128; // shuffle index with the high bit set: zero
+        r = _mm_or_si128(_mm_or_si128(
+                _mm_shuffle_epi8(v0, _mm_setr_epi8(0, 3, 6, 9, 12, 15, z, z, z, z, z, z, z, z, z, z)),
+                _mm_shuffle_epi8(v1, _mm_setr_epi8(z, z, z, z, z, z, 2, 5, 8, 11, 14, z, z, z, z, z))),
+                _mm_shuffle_epi8(v2, _mm_setr_epi8(z, z, z, z, z, z, z, z, z, z, z, 1, 4, 7, 10, 13)));
+        g = _mm_or_si128(_mm_or_si128(
+                _mm_shuffle_epi8(v0, _mm_setr_epi8(1, 4, 7, 10, 13, z, z, z, z, z, z, z, z, z, z, z)),
+                _mm_shuffle_epi8(v1, _mm_setr_epi8(z, z, z, z, z, 0, 3, 6, 9, 12, 15, z, z, z, z, z))),
+                _mm_shuffle_epi8(v2, _mm_setr_epi8(z, z, z, z, z, z, z, z, z, z, z, 2, 5, 8, 11, 14)));
+        b = _mm_or_si128(_mm_or_si128(
+                _mm_shuffle_epi8(v0, _mm_setr_epi8(2, 5, 8, 11, 14, z, z, z, z, z, z, z, z, z, z, z)),
+                _mm_shuffle_epi8(v1, _mm_setr_epi8(z, z, z, z, z, 1, 4, 7, 10, 13, z, z, z, z, z, z))),
+                _mm_shuffle_epi8(v2, _mm_setr_epi8(z, z, z, z, z, z, z, z, z, z, 0, 3, 6, 9, 12, 15)));
+    }
+
+    // 8 floats to 8 bf16 bits, rounded to nearest even like bf16(float) for normal values,
+    // in the low 16 bits of each lane
+    IMGPROC_TARGET_AVX2
+    inline __m256i float_to_bf16_bits_avx2(__m256 values) {
+        const __m256i bits = _mm256_castps_si256(values);
+        const __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+        const __m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7FFF)));
+        return _mm256_srli_epi32(rounded, 16);
+    }
+
+    // AVX2 version of imgproc::hwc_to_chw_normalize_bf16
+    void hwc_to_chw_normalize_bf16_avx2(
+        const uint8_t* src,
+        size_t pixel_count,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        bf16* out_ptr);
+
+    // AVX2 version of imgproc::resize_bicubic_rows
+    void resize_bicubic_rows_avx2(
+        const uint8_t* src, int src_w,
+        const resize_taps_t& taps_x,
+        const resize_taps_t& taps_y,
+        int row_begin, int row_end,
+        uint8_t* dst,
+        float* row);
+
+    // AVX2 separable bicubic resize, planar RGB uint8 in and out
+    std::vector<uint8_t> resize_bicubic_antialias_rgb_planar_avx2(
+        const uint8_t* src,
+        int src_w, int src_h,
+        int dst_w, int dst_h,
+        bool antialias);
+
+    // AVX2 rescale and normalize, same mean/std for all channels
+    void rescale_and_normalize_avx2(
+        const uint8_t *image_src,
+        float *output_buffer,
+        int image_width, int image_height, int image_channels,
+        bool do_rescale,
+        float rescale_factor,
+        bool do_normalize,
+        float image_mean,
+        float image_std
+    );
+
+} // namespace avx2
+} // namespace imgproc
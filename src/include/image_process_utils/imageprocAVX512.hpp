@@ -7,25 +7,24 @@
 #include <immintrin.h>
 #include "typedef.hpp"
 
+#include "image_process_utils/imageproc.hpp"
+
+// The AVX-512 kernels are compiled for AVX-512 function by function rather than with
+// -mavx512f on the whole file, so no code the rest of the build shares (inline helpers,
+// std templates) is built for AVX-512; call them only when imgproc::detect_isa()
+// reports avx512.
 #ifdef _MSC_VER
-#include <intrin.h>
+#define IMGPROC_TARGET_AVX512
+#else
+#define IMGPROC_TARGET_AVX512 __attribute__((target("avx512f,avx512dq,avx512bw,avx512vl,fma")))
 #endif
 
 namespace imgproc {
 namespace avx512 {
 
-    // Check if AVX-512F is available at runtime
+    // Check if AVX-512 (F/DQ/BW/VL, with OS support) is available at runtime
     inline bool has_avx512f() {
-#ifdef _MSC_VER
-        // MSVC-specific CPU detection
-        int cpuInfo[4];
-        __cpuidex(cpuInfo, 7, 0);
-        // AVX-512F is bit 16 of EBX
-        return (cpuInfo[1] & (1 << 16)) != 0;
-#else
-        // GCC/Clang-specific CPU detection
-        return __builtin_cpu_supports("avx512f");
-#endif
+        return detect_isa() == isa_t::avx512;
     }
 
 
@@ -39,6 +38,7 @@ namespace avx512 {
     //    is clamped to [0,255] as a safety measure.
     //
     // This is an approximation (not fully IEEE-754 accurate for all cases).
+    IMGPROC_TARGET_AVX512
     inline __m512 _mm512_exp_ps_corrected(__m512 x) {
         // clamp x to a reasonable range to avoid overflow/underflow
         const __m512 max_val = _mm512_set1_ps(88.0f);
@@ -101,6 +101,7 @@ namespace avx512 {
     }
 
     // Vectorized gaussian function for 16 floats using AVX-512 exp approximation
+    IMGPROC_TARGET_AVX512
     inline __m512 gaussian_avx512(__m512 x, __m512 sigma) {
         const __m512 one = _mm512_set1_ps(1.0f);
         const __m512 two = _mm512_set1_ps(2.0f);
@@ -124,7 +125,15 @@ namespace avx512 {
         return _mm512_mask_blend_ps(mask_zero_sigma, exp_result, one);
     }
 
+    // 16 uint8 to 16 floats
+    IMGPROC_TARGET_AVX512
+    inline __m512 load_uint8x16_avx512(const uint8_t* src) {
+        __m128i u8_vec = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(u8_vec));
+    }
+
     // Fast conversion from uint8 to float with normalization
+    IMGPROC_TARGET_AVX512
     inline void convert_uint8_to_float_avx512(const uint8_t* src, float* dst, size_t count) {
         const size_t simd_count = count & ~15; // Process in chunks of 16
         
@@ -149,6 +158,7 @@ namespace avx512 {
     }
 
     // Fast conversion from float to uint8 with clamping
+    IMGPROC_TARGET_AVX512
     inline void convert_float_to_uint8_avx512(const float* src, uint8_t* dst, size_t count) {
         const __m512 zero = _mm512_setzero_ps();
         const __m512 max_val = _mm512_set1_ps(255.0f);
@@ -184,6 +194,7 @@ namespace avx512 {
 
 
     // Vectorized bicubic kernel computation for 16 floats
+    IMGPROC_TARGET_AVX512
     inline __m512 bicubic_kernel_avx512(__m512 x) {
         const __m512 a = _mm512_set1_ps(-0.5f);
         const __m512 one = _mm512_set1_ps(1.0f);
@@ -235,7 +246,27 @@ namespace avx512 {
         int dst_w, int dst_h,
         bool antialias);
 
-    // AVX-512 optimized main RGB planar entry point
+    // AVX-512 version of imgproc::hwc_to_chw_normalize_bf16, no fallback: call it only
+    // when has_avx512f()
+    void hwc_to_chw_normalize_bf16_avx512(
+        const uint8_t* src,
+        size_t pixel_count,
+        float rescale_factor,
+        float image_mean,
+        float image_std,
+        bf16* out_ptr);
+
+    // AVX-512 version of imgproc::resize_bicubic_rows, no fallback: call it only when
+    // has_avx512f()
+    void resize_bicubic_rows_avx512(
+        const uint8_t* src, int src_w,
+        const resize_taps_t& taps_x,
+        const resize_taps_t& taps_y,
+        int row_begin, int row_end,
+        uint8_t* dst,
+        float* row);
+
+    // AVX-512 separable bicubic resize, planar RGB uint8 in and out
     std::vector<uint8_t> resize_bicubic_antialias_rgb_planar_avx512(
         const uint8_t* src,
         int src_w, int src_h,
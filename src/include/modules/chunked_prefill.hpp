@@ -0,0 +1,36 @@
+/// \file chunked_prefill.hpp
+/// \brief chunked prefill
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note A long prompt is prefilled in chunks that append to the same KV cache, like the
+///       turns of a conversation do. Between two chunks the request can be cancelled and
+///       its progress reported, so a client that leaves during a 32k-token prompt frees
+///       the NPU after one chunk instead of after the whole prompt.
+#pragma once
+
+#include "causal_lm.hpp"
+
+#include <functional>
+#include <vector>
+
+/// \brief Tokens per prefill call of models without their own chunk size
+constexpr int DEFAULT_PREFILL_CHUNK = 2048;
+
+/// \brief Per-request callbacks of a chunked prefill
+typedef struct {
+    /// \brief Checked before each chunk, nullptr never cancels
+    std::function<bool()> is_cancelled;
+    /// \brief Called after each chunk with the tokens prefilled so far and the total, may be nullptr
+    std::function<void(int, int)> on_progress;
+} prefill_hooks_t;
+
+/// \brief Prefill tokens in chunks
+/// \param engine the model
+/// \param tokens the tokens to append to the KV cache
+/// \param chunk the tokens per engine call, 0 or less for all of them in one call
+/// \param hooks the cancellation and progress callbacks
+/// \param y set to the logits of the last token once all tokens are in
+/// \return the number of tokens prefilled, fewer than tokens.size() if cancelled
+int chunked_prefill(causal_lm* engine, const std::vector<int>& tokens, int chunk,
+                    const prefill_hooks_t& hooks, buffer<bf16>& y);
@@ -0,0 +1,65 @@
+/// \file context_shift.hpp
+/// \brief context shift class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Keeps a conversation going past the context length: the first sink tokens and
+///       the most recent window stay in the KV cache, the middle is evicted and the
+///       positions after it are renumbered. The sink tokens hold most of the attention
+///       mass, so dropping them is what breaks generation, not dropping the middle.
+#pragma once
+
+#include "causal_lm.hpp"
+#include "utils/profiler.hpp"
+
+#include <utility>
+#include <vector>
+
+/// \brief Context shift policy
+/// \note Engines that implement kv_evictor are shifted in place. Others (and models
+///       without a plain attention cache) are cleared and re-prefilled with the kept
+///       tokens, which is slower but gives the same token history.
+class context_shift {
+public:
+    /// \brief Constructor
+    /// \param sink_tokens the number of leading tokens that are never evicted
+    /// \param discard_ratio the share of the evictable tokens dropped per shift
+    context_shift(int sink_tokens = 4, float discard_ratio = 0.5f);
+
+    /// \brief Positions to evict so that needed more tokens fit
+    /// \param length the number of tokens in the KV cache
+    /// \param needed the number of tokens about to be added
+    /// \param max_length the context length
+    /// \return [begin, end) to evict, empty if the sinks and needed do not fit anyway
+    std::pair<int, int> plan(int length, int needed, int max_length) const;
+
+    /// \brief Evict from the KV cache and the token history
+    /// \param engine the model
+    /// \param history the tokens in the KV cache, may hold one more not yet forwarded
+    /// \param needed the number of tokens about to be added
+    /// \param max_length the context length
+    /// \param in_place whether the engine may evict in place, false forces a re-prefill
+    /// \return [begin, end) of the evicted positions, empty if nothing was evicted
+    std::pair<int, int> shift(causal_lm* engine, std::vector<int>& history, int needed, int max_length, bool in_place);
+
+    inline int get_sink_tokens() const { return this->sink_tokens; }
+
+    /// \brief Statistics since construction
+    /// \param shifts the number of shifts
+    /// \param evicted the number of evicted tokens
+    /// \param reprefilled the number of tokens prefilled again by shifts that were not in place
+    typedef struct {
+        uint64_t shifts;
+        uint64_t evicted;
+        uint64_t reprefilled;
+    } stats_t;
+    inline const stats_t& get_stats() const { return this->stats; }
+
+    /// \brief Time spent shifting
+    profiler shift_time;
+
+private:
+    int sink_tokens;
+    float discard_ratio;
+    stats_t stats = {0, 0, 0};
+};
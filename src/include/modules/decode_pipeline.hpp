@@ -0,0 +1,69 @@
+/// \file decode_pipeline.hpp
+/// \brief decode pipeline class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Moves the host side of token streaming (detokenization, think/tool parsing,
+///       SSE serialization and the socket write) off the thread driving the NPU.
+///       The decode loop pushes sampled tokens into a SPSC ring and goes straight to
+///       the next forward pass while a consumer thread emits the previous tokens.
+#pragma once
+
+#include "modules/sampler.hpp"
+#include "utils/spsc_ring.hpp"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
+
+/// \brief A sampled token on its way to the output stream
+/// \param token_id the token
+/// \param has_logprobs whether logprobs holds the sampler's log-probabilities of the token
+/// \param has_text whether text is emitted instead of the detokenized token
+/// \param text the part of the token the stop sequence matcher let through
+typedef struct {
+    int token_id;
+    bool has_logprobs;
+    token_logprobs_t logprobs;
+    bool has_text;
+    std::string text;
+} decoded_token_t;
+
+/// \brief Decode pipeline class
+/// \note Tokens reach the consumer in push order. An exception thrown by the consumer
+///       stops it, makes push() return false and is rethrown by finish().
+class decode_pipeline {
+public:
+    typedef std::function<void(decoded_token_t&)> consumer_t;
+
+    /// \brief Start the consumer thread
+    /// \param consumer called for every token, on the consumer thread
+    /// \param capacity the number of tokens the decode loop may run ahead
+    decode_pipeline(consumer_t consumer, size_t capacity = 256);
+
+    /// \brief Drain and join, exceptions of the consumer are dropped
+    ~decode_pipeline();
+
+    decode_pipeline(const decode_pipeline&) = delete;
+    decode_pipeline& operator=(const decode_pipeline&) = delete;
+
+    /// \brief Hand a token to the consumer
+    /// \param token the token
+    /// \return false if the consumer has failed, the decode loop should stop
+    bool push(decoded_token_t&& token);
+
+    /// \brief Wait until every pushed token is emitted
+    /// \throws the exception of the consumer, if any
+    void finish();
+
+private:
+    void run();
+
+    consumer_t consumer;
+    spsc_ring<decoded_token_t> ring;
+    std::thread worker;
+    std::atomic<bool> failed{false};
+    std::exception_ptr error = nullptr;
+};
@@ -0,0 +1,195 @@
+/// \file grammar.hpp
+/// \brief grammar constrained decoding
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Compiles a GBNF grammar or a JSON schema into a pushdown automaton over
+///       code points and turns each automaton state into an allowed-token mask
+///       for the Sampler. States, byte transitions and masks are cached, so a
+///       state seen before costs a table lookup.
+#pragma once
+
+#include "typedef.hpp"
+#include "nlohmann/json.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+namespace grammar {
+
+/// \brief Grammar element type
+typedef enum : u8 {
+    ELEM_END = 0,       // end of a rule
+    ELEM_ALT,           // start of the next alternative
+    ELEM_RULE_REF,      // value is the rule id
+    ELEM_CHAR_CLASS,    // value is the char class id
+} elem_type_t;
+
+typedef struct {
+    elem_type_t type;
+    u32 value;
+} element_t;
+
+/// \brief Set of inclusive code point ranges, optionally negated
+typedef struct {
+    std::vector<std::pair<u32, u32>> ranges;
+    bool negated;
+} char_class_t;
+
+/// \brief Compiled grammar
+/// \note Rules are stored back to back in elements, alternatives separated by
+///       ELEM_ALT and each rule terminated by ELEM_END. Repetitions and groups are
+///       lowered to generated rules, so the automaton only sees references and
+///       char classes.
+class Grammar {
+public:
+    /// \brief Parse a GBNF grammar
+    /// \param text the grammar text
+    /// \param root the start rule
+    /// \throws std::runtime_error on a syntax error or an undefined rule
+    static Grammar from_gbnf(const std::string& text, const std::string& root = "root");
+
+    /// \brief Compile a JSON schema
+    /// \param schema the schema, see json_schema_to_gbnf for the supported subset
+    static Grammar from_json_schema(const nlohmann::json& schema);
+
+    /// \brief Whether a code point is in a char class
+    bool class_match(u32 class_id, u32 cp) const;
+
+    /// \brief Whether a char class admits a code point above 0x7F
+    bool class_has_non_ascii(u32 class_id) const;
+
+    std::vector<element_t> elements;
+    std::vector<u32> rule_start;                // first element of each rule
+    std::vector<std::vector<u32>> rule_alts;    // first element of each alternative
+    std::vector<char_class_t> classes;
+    std::vector<std::string> rule_names;
+    u32 root = 0;
+};
+
+/// \brief Translate a JSON schema into GBNF
+/// \param schema the schema
+/// \return the grammar, start rule "root"
+/// \note Supports type (including unions), properties, required, additionalProperties,
+///       items, minItems, maxItems, minLength, maxLength, enum, const, anyOf, oneOf,
+///       allOf over objects and local $ref (#/$defs, #/definitions). Other keywords
+///       (pattern, format, numeric bounds) are ignored, so the output is a superset.
+std::string json_schema_to_gbnf(const nlohmann::json& schema);
+
+/// \brief GBNF for one tool call body: {"name": ..., "arguments": ...} then the end marker
+/// \param tools the OpenAI tools array
+/// \param end_marker the text closing a call, e.g. </tool_call>
+/// \return the grammar, empty if no tool has a name
+std::string tool_calls_to_gbnf(const nlohmann::ordered_json& tools, const std::string& end_marker);
+
+/// \brief Vocabulary sorted by bytes with the common prefix length of neighbours
+/// \note This is the token-prefix trie in flattened form: walking the sorted list
+///       and keeping the automaton state for every prefix depth visits each trie
+///       node once, and a dead prefix skips the whole subtree.
+class TokenTrie {
+public:
+    /// \brief Constructor
+    /// \param tokens the bytes of every token id, empty for tokens that never match text
+    TokenTrie(std::vector<std::string> tokens);
+
+    inline const std::string& bytes(int token_id) const { return this->tokens[token_id]; }
+    inline int vocab_size() const { return static_cast<int>(this->tokens.size()); }
+
+    std::vector<int> order;     // token ids with non-empty bytes, sorted by bytes
+    std::vector<u32> lcp;       // common prefix length with the previous entry of order
+    size_t max_len = 0;
+
+private:
+    std::vector<std::string> tokens;
+};
+
+/// \brief Matcher of one request, tracks the automaton state across sampled tokens
+class GrammarMatcher {
+public:
+    /// \brief Constructor
+    /// \param grammar the compiled grammar
+    /// \param trie the vocabulary
+    /// \param eos_token_ids tokens allowed once the grammar accepts
+    /// \param mask_bits the size of the masks, the sampler vocabulary
+    GrammarMatcher(Grammar grammar, std::shared_ptr<const TokenTrie> trie,
+        const std::vector<int>& eos_token_ids, int mask_bits);
+
+    /// \brief Only constrain after the generated text ends with trigger (lazy grammar)
+    /// \param trigger the text that starts a constrained span, empty to constrain from the start
+    /// \note In lazy mode the matcher goes back to free generation once the grammar
+    ///       is complete, so several spans (e.g. tool calls) can follow each other.
+    void set_trigger(const std::string& trigger);
+
+    /// \brief Back to the start state
+    void reset();
+
+    /// \brief Whether the next token is constrained
+    inline bool active() const { return this->is_active; }
+
+    /// \brief Allowed tokens of the current state, one bit per token id
+    /// \note Cached per automaton state; only a state never seen before walks the vocabulary
+    const std::vector<u64>& allowed_mask();
+
+    /// \brief Advance with a sampled token
+    /// \param token_id the token
+    /// \return false if the token does not fit the grammar, the state is left unchanged
+    bool accept(int token_id);
+
+    /// \brief Whether the text so far is a complete sentence of the grammar
+    bool is_accepting() const;
+
+    /// \brief Whether the grammar admits nothing more
+    bool is_complete() const;
+
+    size_t cache_hits = 0;
+    size_t cache_misses = 0;
+    inline size_t state_count() const { return this->states.size(); }
+
+private:
+    typedef std::vector<u32> stack_t;
+
+    /// \brief Automaton state: the set of parse stacks and a partial UTF-8 sequence
+    struct state_t {
+        std::vector<stack_t> stacks;
+        u32 partial_cp = 0;
+        u8 partial_left = 0;
+        bool accepting = false;
+        bool complete = false;
+        bool non_ascii = false;             // some stack top admits a multi-byte code point
+        std::unique_ptr<int[]> next;        // per byte: -2 unknown, -1 dead, else state id
+        int mask_slot = -1;
+    };
+
+    int intern(std::vector<stack_t>& stacks, u32 partial_cp, u8 partial_left);
+    int step(int state_id, u8 byte);
+    void expand(stack_t& stack, std::vector<stack_t>& out, int depth) const;
+    void advance(const std::vector<stack_t>& stacks, u32 cp, std::vector<stack_t>& out) const;
+    void compute_mask(int state_id, std::vector<u64>& mask);
+    void flush_cache();
+
+    Grammar grammar;
+    std::shared_ptr<const TokenTrie> trie;
+    std::vector<int> eos_token_ids;
+    int mask_bits;
+
+    std::vector<state_t> states;
+    std::unordered_map<std::string, int> state_index;
+    int start_state = -1;
+    int current = -1;
+
+    // Mask cache, slots reused in insertion order once full
+    std::vector<std::vector<u64>> mask_pool;
+    std::vector<int> mask_owner;
+    size_t mask_next = 0;
+
+    std::vector<int> path;              // state per prefix depth during the vocabulary walk
+    std::string trigger;
+    std::string tail;                   // recent text while waiting for the trigger
+    bool is_active = true;
+
+    static constexpr size_t MAX_STATES = 1 << 14;
+    static constexpr size_t MAX_MASKS = 256;
+};
+
+} // namespace grammar
@@ -0,0 +1,90 @@
+/// \file image_cache.hpp
+/// \brief image cache class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note A REST client sends every image of the conversation again with each turn, and
+///       each one was decoded, resized and normalized again. The final pixel values and
+///       grid of an image are kept, keyed by a 128-bit hash of its raw payload and the
+///       preprocessing parameters, so an image seen before costs a hash and a copy.
+///       The least recently used images go when the memory budget or the image count
+///       runs out. All calls are thread safe.
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "typedef.hpp"
+
+/// \brief A preprocessed image, the pixel values as the model takes them
+struct preprocessed_image_t {
+    std::vector<bf16> pixels;
+    int width = 0;              // decoded, before the model resize
+    int height = 0;
+    int width_resized = 0;
+    int height_resized = 0;
+    int grid_h = 0;
+    int grid_w = 0;
+};
+
+/// \brief Image cache class
+class image_cache {
+public:
+    /// \brief Constructor
+    /// \param max_bytes the memory for the pixel values
+    /// \param max_images the number of images kept
+    image_cache(size_t max_bytes, size_t max_images = 256);
+
+    /// \brief Key of an image
+    /// \param data the raw payload, e.g. the base64 string of a request
+    /// \param params everything the preprocessing depends on, e.g. the model and target size
+    static std::string key(const std::string& data, const std::string& params);
+
+    /// \brief Look an image up
+    /// \return nullptr if it is not kept
+    std::shared_ptr<const preprocessed_image_t> get(const std::string& key);
+
+    /// \brief Keep an image, the least recently used ones go to make room
+    /// \note An image larger than the whole budget is not kept.
+    void put(const std::string& key, std::shared_ptr<const preprocessed_image_t> image);
+
+    /// \brief Change the limits, images go at once if they no longer fit
+    void set_limits(size_t max_bytes, size_t max_images);
+
+    /// \brief Drop all images
+    void clear();
+
+    /// \brief Hits, misses, evictions and the memory in use
+    nlohmann::json stats();
+
+    /// \brief 128-bit hash of a byte range, MurmurHash3 x64, several GB/s
+    static std::pair<uint64_t, uint64_t> hash128(const void* data, size_t size, uint64_t seed);
+
+private:
+    struct entry_t {
+        std::string key;
+        std::shared_ptr<const preprocessed_image_t> image;
+        size_t bytes;
+    };
+
+    /// \brief Drop least recently used images until the limits hold, lock held
+    void _trim();
+
+    std::mutex mutex;
+    size_t max_bytes;
+    size_t max_images;
+    size_t bytes = 0;
+    std::list<entry_t> entries;                                         // most recently used first
+    std::unordered_map<std::string, std::list<entry_t>::iterator> index;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t too_large = 0;
+};
@@ -0,0 +1,157 @@
+/// \file kv_session.hpp
+/// \brief session snapshot reader and writer
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Binary snapshots of a conversation: the token history, a JSON block of state
+///       (sampler, model identity) and the K/V caches of every layer. Resuming from one
+///       skips the prefill of the whole conversation.
+///
+///       Layout: a 64-byte header, the blobs, the blob index, then the JSON block. The
+///       header is written last, so a snapshot cut short is rejected. Stored blobs start
+///       on a 4096-byte boundary and are mapped into memory as they are, so restoring a
+///       cache is a single copy from the page cache into the engine. Compressed blobs
+///       trim the zero tail of the cache, split the bf16 values into byte planes and
+///       Huffman code each plane; the exponent plane is where the gain is.
+#pragma once
+
+#include "typedef.hpp"
+#include "nlohmann/json.hpp"
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kv_session {
+
+/// \brief What a blob holds
+typedef enum : u32 {
+    BLOB_TOKENS = 0,    // int32 token ids
+    BLOB_K_CACHE = 1,   // bf16, as get_k_cache returned it
+    BLOB_V_CACHE = 2,   // bf16, as get_v_cache returned it
+} blob_kind_t;
+
+/// \brief How a blob is stored
+typedef enum : u32 {
+    CODEC_STORED = 0,
+    CODEC_HUFFMAN = 1,  // zero tail trimmed, byte planes, Huffman per plane
+} codec_t;
+
+/// \brief Index entry of a blob
+typedef struct {
+    u32 kind;
+    u32 layer;
+    u32 idx;
+    u32 codec;
+    u64 offset;         // from the start of the file
+    u64 stored_bytes;
+    u64 count;          // elements once decoded
+} blob_entry_t;
+
+/// \brief Compress elements of elem_size bytes
+/// \param data the elements
+/// \param bytes the size of data, a multiple of elem_size
+/// \param elem_size the element size, 1 to 8
+/// \param out the compressed bytes, replaced
+void compress(const u8* data, size_t bytes, int elem_size, std::vector<u8>& out);
+
+/// \brief Inverse of compress
+/// \param data the compressed bytes
+/// \param size the size of data
+/// \param elem_size the element size given to compress
+/// \param out bytes of decoded output, the size compress was given
+/// \param bytes the size of out
+/// \return false if data is corrupt
+bool decompress(const u8* data, size_t size, int elem_size, u8* out, size_t bytes);
+
+/// \brief Streams a snapshot to disk
+/// \note The file is written as path.tmp and renamed once finished, so an existing
+///       snapshot is only replaced by a complete one.
+class writer {
+public:
+    /// \brief Constructor
+    /// \param path the snapshot file
+    /// \param compress whether to compress the caches
+    writer(const std::string& path, bool compress);
+    ~writer();
+
+    inline bool is_open() const { return this->file != nullptr; }
+
+    /// \brief Append a blob
+    /// \param kind what the blob holds
+    /// \param layer the layer index, 0 for tokens
+    /// \param idx the index, 0 for tokens
+    /// \param data the elements
+    /// \param count the number of elements
+    /// \return false on a write error
+    bool write(blob_kind_t kind, int layer, int idx, const void* data, size_t count);
+
+    /// \brief Write the index, the state and the header, and move the file in place
+    /// \param state the JSON block
+    /// \return false on a write error; the file is then removed
+    bool finish(const nlohmann::json& state);
+
+    /// \brief Bytes written so far
+    inline u64 get_bytes() const { return this->offset; }
+
+private:
+    bool put(const void* data, size_t bytes);
+    bool pad_to(u64 alignment);
+    void abort();
+
+    std::string path;
+    std::string tmp_path;
+    bool compress_blobs;
+    std::FILE* file = nullptr;
+    std::vector<char> io_buffer;        // large stdio buffer, blobs go out in big sequential writes
+    std::vector<u8> scratch;
+    std::vector<blob_entry_t> index;
+    u64 offset = 0;
+};
+
+/// \brief Maps a snapshot into memory
+class reader {
+public:
+    /// \brief Constructor
+    /// \param path the snapshot file
+    reader(const std::string& path);
+    ~reader();
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    /// \brief Whether the file is a complete snapshot
+    inline bool is_open() const { return this->base != nullptr; }
+
+    /// \brief The JSON block
+    inline const nlohmann::json& get_state() const { return this->state; }
+
+    /// \brief Find a blob
+    /// \return nullptr if the snapshot has no such blob
+    const blob_entry_t* find(blob_kind_t kind, int layer, int idx) const;
+
+    /// \brief Elements of a blob
+    /// \param entry the blob
+    /// \param scratch holds the decoded elements of a compressed blob
+    /// \return a pointer into the mapping for a stored blob, into scratch otherwise;
+    ///         nullptr if the blob is corrupt
+    const void* data(const blob_entry_t& entry, std::vector<u8>& scratch) const;
+
+    /// \brief The token history
+    /// \return false if missing or corrupt
+    bool read_tokens(std::vector<int>& tokens) const;
+
+private:
+    void close();
+
+    const u8* base = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+    std::vector<blob_entry_t> index;
+    nlohmann::json state;
+};
+
+} // end of namespace kv_session
@@ -0,0 +1,444 @@
+/// \file model_cache.hpp
+/// \brief model cache class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Keeps up to max_models models loaded within a memory budget, and evicts the one
+///       used least recently to make room. Models can be preloaded: a loader thread reads
+///       their weights while the model in use keeps serving requests, so a request that
+///       switches to a preloaded model does not wait for the load.
+///
+///       The model last acquired is in use and is never evicted to make room for a
+///       preload or because its keep-alive ran out; only acquiring another model or
+///       unload() lets it go.
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// \brief Model cache class
+/// \tparam Model the model type, shared with the requests that use it
+template <typename Model>
+class model_cache {
+public:
+    /// \brief Build and load a model, throws on failure
+    typedef std::function<std::shared_ptr<Model>(const std::string&)> loader_t;
+
+    /// \brief Constructor, starts the loader thread
+    /// \param loader builds and loads a model by tag
+    /// \param max_models the number of models kept loaded, at least 1
+    /// \param budget_bytes the memory they may use, 0 for no limit
+    /// \param settle a pause after an eviction before the next load, lets the device release the evicted model
+    model_cache(loader_t loader, int max_models = 1, size_t budget_bytes = 0,
+                std::chrono::milliseconds settle = std::chrono::milliseconds(0))
+        : loader(std::move(loader)), max_models(std::max(max_models, 1)), budget_bytes(budget_bytes), settle(settle) {
+        this->worker = std::thread([this] { this->run(); });
+    }
+
+    /// \brief Stop the loader thread, a load in progress is finished first
+    ~model_cache() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+            this->queue.clear();
+        }
+        this->cv.notify_all();
+        this->worker.join();
+    }
+
+    model_cache(const model_cache&) = delete;
+    model_cache& operator=(const model_cache&) = delete;
+
+    /// \brief Get a model to serve requests with, loading it if it is not loaded
+    /// \param tag the model
+    /// \param bytes its size, for the memory budget
+    /// \param keep_alive seconds it stays loaded once no longer in use, negative for ever;
+    ///        nullopt keeps the value it has
+    /// \return the model; it stays in use until another one is acquired
+    /// \note Waits for a preload of the same model, and for a preload of another one when
+    ///       the memory is only freed by evicting it. Rethrows the exception of the loader.
+    std::shared_ptr<Model> acquire(const std::string& tag, size_t bytes, std::optional<double> keep_alive = std::nullopt) {
+        std::vector<std::shared_ptr<Model>> evicted;
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->_release_in_use();
+        this->in_use = tag;
+        this->_dequeue(tag);
+        this->cv.wait(lock, [&] {
+            auto it = this->entries.find(tag);
+            return it == this->entries.end() || !it->second.loading;
+        });
+        auto it = this->entries.find(tag);
+        if (it != this->entries.end()) {
+            this->hits++;
+            it->second.last_used = ++this->tick;
+            it->second.uses++;
+            if (keep_alive.has_value()) {
+                it->second.keep_alive = *keep_alive;
+            }
+            return it->second.model;
+        }
+        // A background load that holds the memory needed is waited for, then evicted
+        while (!this->_make_room(tag, bytes, false, evicted) && this->_loading_count() > 0) {
+            this->cv.wait(lock);
+        }
+        entry_t& entry = this->entries[tag];
+        entry.bytes = bytes;
+        entry.keep_alive = keep_alive.value_or(-1.0);
+        this->misses++;
+        std::exception_ptr error;
+        std::shared_ptr<Model> model = this->_load(lock, tag, evicted, false, error);
+        if (model == nullptr) {
+            std::rethrow_exception(error);
+        }
+        return model;
+    }
+
+    /// \brief Load a model on the loader thread
+    /// \param tag the model
+    /// \param bytes its size, for the memory budget
+    /// \param keep_alive seconds it stays loaded until first used, negative for ever
+    /// \return false if it is loaded, loading or queued already
+    bool preload(const std::string& tag, size_t bytes, double keep_alive = -1.0) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->entries.count(tag) != 0) {
+                return false;
+            }
+            for (const request_t& request : this->queue) {
+                if (request.tag == tag) {
+                    return false;
+                }
+            }
+            this->queue.push_back({tag, bytes, keep_alive});
+        }
+        this->cv.notify_all();
+        return true;
+    }
+
+    /// \brief Free a model, or drop it from the preload queue
+    /// \param tag the model
+    /// \return false if it is not loaded, or being loaded
+    bool unload(const std::string& tag) {
+        std::shared_ptr<Model> model;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            bool queued = this->_dequeue(tag);
+            auto it = this->entries.find(tag);
+            if (it == this->entries.end() || it->second.loading) {
+                return queued;
+            }
+            model = std::move(it->second.model);
+            this->entries.erase(it);
+            if (this->in_use == tag) {
+                this->in_use.clear();
+            }
+            this->_log(tag, "unload", 0.0);
+        }
+        this->cv.notify_all();
+        return true;
+    }
+
+    /// \brief Whether a model is loaded
+    bool is_loaded(const std::string& tag) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->entries.find(tag);
+        return it != this->entries.end() && !it->second.loading;
+    }
+
+    /// \brief The models loaded, least recently used first
+    std::vector<std::string> loaded() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::vector<std::pair<uint64_t, std::string>> order;
+        for (const auto& [tag, entry] : this->entries) {
+            if (!entry.loading) {
+                order.emplace_back(entry.last_used, tag);
+            }
+        }
+        std::sort(order.begin(), order.end());
+        std::vector<std::string> tags;
+        for (auto& [tick, tag] : order) {
+            tags.push_back(std::move(tag));
+        }
+        return tags;
+    }
+
+    /// \brief Residency, load times and the recent loads and evictions
+    nlohmann::json stats() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto now = clock_t::now();
+        size_t used = 0;
+        nlohmann::json models = nlohmann::json::array();
+        for (const auto& [tag, entry] : this->entries) {
+            used += entry.bytes;
+            nlohmann::json model = {
+                {"model", tag},
+                {"state", entry.loading ? "loading" : (tag == this->in_use ? "in_use" : "loaded")},
+                {"size", entry.bytes},
+                {"load_seconds", entry.load_seconds},
+                {"uses", entry.uses}
+            };
+            if (!entry.loading && tag != this->in_use && entry.keep_alive >= 0) {
+                double idle = std::chrono::duration<double>(now - entry.released).count();
+                model["expires_in_seconds"] = std::max(0.0, entry.keep_alive - idle);
+            }
+            models.push_back(model);
+        }
+        nlohmann::json queued = nlohmann::json::array();
+        for (const request_t& request : this->queue) {
+            queued.push_back(request.tag);
+        }
+        return {
+            {"max_models", this->max_models},
+            {"budget_bytes", this->budget_bytes},
+            {"used_bytes", used},
+            {"hits", this->hits},
+            {"misses", this->misses},
+            {"preloads", this->preloads},
+            {"evictions", this->evictions},
+            {"models", models},
+            {"queue", queued},
+            {"events", nlohmann::json(this->events)}
+        };
+    }
+
+private:
+    typedef std::chrono::steady_clock clock_t;
+
+    typedef struct {
+        std::shared_ptr<Model> model;
+        size_t bytes = 0;
+        bool loading = false;
+        double load_seconds = 0.0;
+        double keep_alive = -1.0;       // seconds loaded once released, negative for ever
+        uint64_t last_used = 0;         // tick of the last acquire or load, for the LRU order
+        clock_t::time_point released;   // when it last stopped being in use
+        uint64_t uses = 0;
+    } entry_t;
+
+    typedef struct {
+        std::string tag;
+        size_t bytes;
+        double keep_alive;
+    } request_t;
+
+    static constexpr size_t MAX_EVENTS = 32;
+
+    loader_t loader;
+    int max_models;
+    size_t budget_bytes;
+    std::chrono::milliseconds settle;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<std::string, entry_t> entries;
+    std::deque<request_t> queue;
+    std::string in_use;
+    uint64_t tick = 0;
+    bool stopping = false;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t preloads = 0;
+    uint64_t evictions = 0;
+    std::deque<nlohmann::json> events;
+
+    std::thread worker;
+
+    /// \brief The model in use becomes an ordinary loaded one, its keep-alive starts
+    void _release_in_use() {
+        auto it = this->entries.find(this->in_use);
+        if (it != this->entries.end()) {
+            it->second.released = clock_t::now();
+        }
+        this->in_use.clear();
+    }
+
+    bool _dequeue(const std::string& tag) {
+        for (auto it = this->queue.begin(); it != this->queue.end(); ++it) {
+            if (it->tag == tag) {
+                this->queue.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int _loading_count() const {
+        int count = 0;
+        for (const auto& [tag, entry] : this->entries) {
+            count += entry.loading;
+        }
+        return count;
+    }
+
+    void _log(const std::string& tag, const char* event, double seconds) {
+        auto now = std::chrono::system_clock::now();
+        this->events.push_back({
+            {"model", tag},
+            {"event", event},
+            {"seconds", seconds},
+            {"at", std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count()}
+        });
+        if (this->events.size() > MAX_EVENTS) {
+            this->events.pop_front();
+        }
+    }
+
+    /// \brief Evict the least recently used models until bytes more fit
+    /// \param tag the model about to be loaded, not counted
+    /// \param keep_in_use whether the model in use stays, true for preloads
+    /// \param evicted the evicted models, freed by the caller outside the lock
+    /// \return whether it fits
+    bool _make_room(const std::string& tag, size_t bytes, bool keep_in_use, std::vector<std::shared_ptr<Model>>& evicted) {
+        while (true) {
+            int count = 0;
+            size_t used = 0;
+            auto victim = this->entries.end();
+            for (auto it = this->entries.begin(); it != this->entries.end(); ++it) {
+                if (it->first == tag) {
+                    continue;
+                }
+                count++;
+                used += it->second.bytes;
+                bool evictable = !it->second.loading && !(keep_in_use && it->first == this->in_use);
+                if (evictable && (victim == this->entries.end() || it->second.last_used < victim->second.last_used)) {
+                    victim = it;
+                }
+            }
+            bool fits = count < this->max_models && (this->budget_bytes == 0 || used + bytes <= this->budget_bytes);
+            if (fits || victim == this->entries.end()) {
+                return fits;
+            }
+            evicted.push_back(std::move(victim->second.model));
+            this->_log(victim->first, "evict", 0.0);
+            this->evictions++;
+            this->entries.erase(victim);
+        }
+    }
+
+    /// \brief Load the model of entries[tag], with the lock released during the load
+    /// \return nullptr if the loader failed, error then holds its exception
+    std::shared_ptr<Model> _load(std::unique_lock<std::mutex>& lock, const std::string& tag,
+                                 std::vector<std::shared_ptr<Model>>& evicted, bool background, std::exception_ptr& error) {
+        this->entries[tag].loading = true;
+        bool settle = !evicted.empty() && this->settle.count() > 0;
+        lock.unlock();
+        evicted.clear();
+        if (settle) {
+            std::this_thread::sleep_for(this->settle);
+        }
+        std::shared_ptr<Model> model;
+        auto start = clock_t::now();
+        try {
+            model = this->loader(tag);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        double seconds = std::chrono::duration<double>(clock_t::now() - start).count();
+        lock.lock();
+        if (model == nullptr) {
+            this->entries.erase(tag);
+            if (error == nullptr) {
+                error = std::make_exception_ptr(std::runtime_error("failed to load " + tag));
+            }
+            this->_log(tag, "load_failed", seconds);
+        }
+        else {
+            entry_t& entry = this->entries[tag];
+            entry.model = model;
+            entry.loading = false;
+            entry.load_seconds = seconds;
+            entry.last_used = ++this->tick;
+            entry.released = clock_t::now();
+            if (!background) {
+                entry.uses++;
+            }
+            this->_log(tag, background ? "preload" : "load", seconds);
+        }
+        this->cv.notify_all();
+        return model;
+    }
+
+    /// \brief Evict the models whose keep-alive ran out
+    /// \return when the next one runs out, max if none will
+    clock_t::time_point _expire(std::vector<std::shared_ptr<Model>>& evicted) {
+        auto now = clock_t::now();
+        auto next = clock_t::time_point::max();
+        for (auto it = this->entries.begin(); it != this->entries.end();) {
+            const entry_t& entry = it->second;
+            if (entry.loading || it->first == this->in_use || entry.keep_alive < 0) {
+                ++it;
+                continue;
+            }
+            auto expiry = entry.released + std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>(entry.keep_alive));
+            if (expiry <= now) {
+                evicted.push_back(std::move(it->second.model));
+                this->_log(it->first, "expire", 0.0);
+                this->evictions++;
+                it = this->entries.erase(it);
+            }
+            else {
+                next = std::min(next, expiry);
+                ++it;
+            }
+        }
+        return next;
+    }
+
+    /// \brief Loader thread: preloads in queue order and frees models whose keep-alive ran out
+    void run() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (!this->stopping) {
+            std::vector<std::shared_ptr<Model>> evicted;
+            auto next_expiry = this->_expire(evicted);
+            if (this->queue.empty()) {
+                if (!evicted.empty()) {
+                    lock.unlock();
+                    evicted.clear();
+                    lock.lock();
+                    continue;
+                }
+                if (next_expiry == clock_t::time_point::max()) {
+                    this->cv.wait(lock);
+                }
+                else {
+                    this->cv.wait_until(lock, next_expiry);
+                }
+                continue;
+            }
+            request_t request = this->queue.front();
+            this->queue.pop_front();
+            if (this->entries.count(request.tag) != 0) {
+                continue;
+            }
+            if (!this->_make_room(request.tag, request.bytes, true, evicted)) {
+                this->_log(request.tag, "preload_skipped", 0.0);
+                lock.unlock();
+                evicted.clear();
+                lock.lock();
+                continue;
+            }
+            entry_t& entry = this->entries[request.tag];
+            entry.bytes = request.bytes;
+            entry.keep_alive = request.keep_alive;
+            this->preloads++;
+            std::exception_ptr error;
+            this->_load(lock, request.tag, evicted, true, error);
+        }
+    }
+};
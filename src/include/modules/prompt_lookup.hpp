@@ -0,0 +1,67 @@
+/// \file prompt_lookup.hpp
+/// \brief prompt lookup class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Draft-free proposals for speculative decoding: the last few tokens of the
+///       history are looked up in an n-gram index of the history itself, and the tokens
+///       that followed their latest earlier occurrence are proposed. Works well when the
+///       answer copies spans of the prompt (code edits, document QA).
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/// \brief Prompt lookup class
+/// \note N-grams are hashed with a polynomial rolling hash over prefix hashes, so the
+///       hash of any window is O(1) and appending a token costs O(max_ngram). The index
+///       catches up with the history lazily on every propose.
+class prompt_lookup {
+public:
+    /// \brief Constructor
+    /// \param history the token history to index, read on every propose
+    /// \param min_ngram the shortest suffix worth matching
+    /// \param max_ngram the longest suffix tried first
+    prompt_lookup(const std::vector<int>& history, int min_ngram = 2, int max_ngram = 4);
+
+    /// \brief Propose the continuation of the longest matching suffix of the history
+    /// \param k the maximum number of tokens to propose
+    /// \param out the proposals are appended
+    /// \return the number of proposed tokens, 0 if the suffix was not seen before
+    int propose(int k, std::vector<int>& out);
+
+    /// \brief The history was cut back to len tokens
+    void truncate(size_t len);
+
+    /// \brief The history was cleared
+    void reset();
+
+    /// \brief Lookups and hits since the last reset
+    inline uint64_t get_lookups() const { return this->lookups; }
+    inline uint64_t get_hits() const { return this->hits; }
+
+private:
+    /// \brief Hash of the n tokens before end
+    inline uint64_t window_hash(size_t end, int n) const {
+        return this->prefix[end] - this->prefix[end - n] * this->powers[n];
+    }
+    /// \brief Key of an n-gram in the index, n-grams of different lengths must not collide
+    static inline uint64_t key(uint64_t hash, int n) {
+        return hash ^ (0x9E3779B97F4A7C15ull * (uint64_t)n);
+    }
+    void catch_up(size_t len);
+
+    const std::vector<int>& history;
+    int min_ngram;
+    int max_ngram;
+    std::vector<uint64_t> prefix;       // prefix[i] hashes history[0, i)
+    std::vector<uint64_t> powers;       // BASE^n
+    size_t indexed = 0;                 // n-grams ending at or before this position are in the index
+    std::unordered_map<uint64_t, uint32_t> table;   // n-gram key -> end of its latest occurrence
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+
+    static constexpr uint64_t BASE = 0x100000001B3ull;
+};
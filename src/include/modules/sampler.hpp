@@ -7,7 +7,11 @@
 #pragma once
 
 #include "typedef.hpp"
+#include "utils/cpu_features.hpp"
+#include <cmath>
 #include <deque>
+#include <limits>
+#include <utility>
 
 /// \brief sampler config
 /// \param temperature the temperature
@@ -16,6 +20,7 @@
 /// \param rep_penalty the rep penalty
 /// \param freq_penalty the freq penalty
 /// \param rep_penalty_window the rep penalty window
+/// \param seed the seed of the per-instance generator, negative for a random seed
 typedef struct sampler_config_{
     int top_k = 40;
     float top_p = 0.9f;
@@ -27,8 +32,19 @@ typedef struct sampler_config_{
     int rep_penalty_window = 64;
     int freq_penalty_window = 64;  // Window size for frequency penalty
     int repeat_last_n = 64;
+    i64 seed = -1;
 } sampler_config;
 
+/// \brief Sampler settings and generator position, enough to resume sampling where it stopped
+/// \param config the settings, seed unused
+/// \param rng_seed the seed of the per-instance generator
+/// \param rng_counter the number of draws since seeding
+typedef struct {
+    sampler_config config;
+    u64 rng_seed;
+    u64 rng_counter;
+} sampler_state_t;
+
 //typedef std::pair<float, int> logits_t;
 
 typedef struct {
@@ -39,12 +55,122 @@ typedef struct {
 
 typedef std::vector<logits_t> logits_list_t;
 
+/// \brief Log-probability of one token
+typedef struct {
+    int token_id;
+    float logprob;
+} token_logprob_t;
+
+/// \brief Log-probabilities reported for one sampled token
+/// \param chosen the sampled token
+/// \param top the most likely alternatives, best first
+typedef struct {
+    token_logprob_t chosen;
+    std::vector<token_logprob_t> top;
+} token_logprobs_t;
+
+/// \brief Running log-sum-exp of a stream of logits
+/// \note Kept as a max and the sum of exp(logit - max), so the partial results of the
+///       SIMD lanes merge without overflow. NaN and -inf logits add nothing.
+struct logsumexp_t {
+    float max = -std::numeric_limits<float>::max();
+    float sum = 0.0f;
+
+    inline void add(float logit) { this->merge(logit, 1.0f); }
+    inline void merge(float max, float sum) {
+        if (!(sum > 0.0f) || !(max >= -std::numeric_limits<float>::max())) {
+            return;
+        }
+        if (max > this->max) {
+            this->sum = this->sum * std::exp(this->max - max) + sum;
+            this->max = max;
+        }
+        else {
+            this->sum += sum * std::exp(max - this->max);
+        }
+    }
+    /// \brief log of the sum of exp(logit) over everything added
+    inline float value() const { return this->max + std::log(this->sum); }
+};
+
+/// \brief Streaming top-k selector
+/// \note Keeps a persistent candidate buffer across calls so no per-token allocation
+///       is needed. Values are compared against a running threshold (the current k-th
+///       best logit); only survivors are appended. When the buffer fills up it is
+///       compacted back to k entries with nth_element, raising the threshold.
+///       Only the final k survivors are sorted.
+/// \note The scan kernels (scalar, AVX2, AVX-512) are picked at run time from cpuid.
+class topk_selector{
+public:
+    topk_selector() : isa(cpu_features::best_isa()) {};
+
+    /// \brief Start a new selection
+    /// \param k the number of entries to keep
+    void reset(int k);
+
+    /// \brief Offer a contiguous range of logits
+    /// \param x the logits, indexed by token id
+    /// \param begin the first token id
+    /// \param end one past the last token id
+    void push(const float* x, int begin, int end);
+
+    /// \brief Offer a contiguous range of bf16 logits, converted in registers
+    /// \param x the logits, indexed by token id
+    /// \param begin the first token id
+    /// \param end one past the last token id
+    /// \param skip optional per-token flags, tokens with skip[id] != 0 are ignored
+    /// \param allow optional allowed-token bitmask, bit id of word id / 64; other tokens are ignored
+    void push(const bf16* x, int begin, int end, const u8* skip = nullptr, const u64* allow = nullptr);
+
+    /// \brief Offer a single logit
+    /// \param logit the logit
+    /// \param token_id the token id
+    inline void push_one(float logit, int token_id){
+        if (logit >= this->threshold) {
+            // The global max always passes the threshold, so it is tracked here for free
+            if (logit > this->max_logit) {
+                this->max_logit = logit;
+            }
+            this->candidates.push_back({logit, token_id, 0.0f});
+            if (this->candidates.size() >= this->capacity) {
+                this->compact();
+            }
+        }
+    }
+
+    /// \brief Write the k best entries, sorted by descending logit
+    /// \param out the output list, reused without reallocation when possible
+    void finalize(logits_list_t& out);
+
+    /// \brief Current admission threshold
+    inline float get_threshold() const { return this->threshold; }
+
+    /// \brief Largest logit offered since reset
+    inline float get_max() const { return this->max_logit; }
+
+    /// \brief Force a scan kernel, clamped to what the CPU supports
+    /// \param isa the requested instruction set
+    inline void set_isa(cpu_features::isa_t isa) { this->isa = cpu_features::clamp_isa(isa); }
+    inline cpu_features::isa_t get_isa() const { return this->isa; }
+
+private:
+    void compact();
+
+    logits_list_t candidates;
+    size_t k = 0;
+    size_t capacity = 0;
+    float threshold = 0.0f;
+    float max_logit = 0.0f;
+    cpu_features::isa_t isa;
+};
+
 class Sampler{
 public:
     std::vector<float> logits;
     int in_features;
     std::vector<int> counters;
     logits_list_t top_k_logits;
+    topk_selector topk_engine;
     float rep_penalty;
     float freq_penalty;
     float pre_penalty;
@@ -54,9 +180,15 @@ public:
     float temperature;
     int total_tokens;
     std::vector<int> token_positions;
-    
+
     // Ring buffer for frequency tracking
     std::deque<int> token_history;
+    // Distinct tokens currently in token_history (counters[id] > 0), so the
+    // penalty pass and reset only touch the window instead of the vocabulary
+    std::vector<int> window_tokens;
+    std::vector<int> window_slot;   // index into window_tokens, -1 if absent
+    // Tokens whose token_positions entry was written since the last reset
+    std::vector<int> seen_tokens;
     size_t freq_penalty_window;
     size_t rep_penalty_window;
     size_t repeat_last_n;
@@ -72,19 +204,129 @@ public:
     /// \note The function will reset the token positions
     /// \note The function will reset the token history
     /// \note The function will reset the total tokens
-    /// \note The function will reset the token positions
+    /// \note Only the tokens seen since the last reset are touched, not the whole vocabulary
     void reset_penalties();
 
     void softmax_inplace();
     void sampler_penalty_apply();
+    /// \brief Penalties, running max and top-k in a single pass over the bf16 logits
+    /// \param x the input buffer
+    /// \note Penalized and biased tokens are offered first with their final value and then
+    ///       skipped in the stream, so the vocabulary is read exactly once. The allowed-token
+    ///       mask is applied to the compare mask in registers.
+    /// \param k the number of candidates to keep, -1 for top_k
+    /// \param lse optional, accumulates the log-sum-exp of every logit the pass offers
+    void sampler_fused_apply(buffer<bf16>& x, int k = -1, logsumexp_t* lse = nullptr);
     void sampler_topk_apply(int k);
     void sampler_topp_apply(float p);
     void sampler_minp_apply(float p);
     void sampler_temp_apply(float temp);
     int sample_from_probs();
     void ring_buffer_update(int sampled_index);
+    /// \brief Seed the per-instance generator
+    /// \param seed the seed, negative for a random one
+    /// \note The stream restarts, so the same seed reproduces the same tokens
+    void set_seed(i64 seed);
+
+    /// \brief Settings and generator position, for session snapshots
+    sampler_state_t get_state() const;
+    /// \brief Resume the settings and generator position of get_state
+    /// \note The penalty window is not part of the state, it restarts with every request
+    void set_state(const sampler_state_t& state);
+
+    /// \brief Next uniform number in [0, 1) from the per-instance generator
+    /// \note Counter-based (splitmix64 of seed + counter): no shared libc state,
+    ///       so several samplers can run on different threads.
+    float next_uniform();
+
+    /// \brief Whether sample() takes the greedy path (temperature 0 or top-k 1)
+    bool is_greedy() const;
+
+    /// \brief Greedy selection, argmax directly on the bf16 logits
+    /// \param x the input buffer
+    /// \param begin the first token id to consider
+    /// \param end one past the last token id to consider, -1 for the whole vocabulary
+    /// \return the selected token
+    /// \note No fp32 copy, sort or exp. Penalties still apply. The selection is
+    ///       reported in top_k_logits as a single candidate with prob 1.
+    int sample_greedy(buffer<bf16>& x, int begin = 0, int end = -1);
+
     /// \brief Sample the token
     /// \param x the input buffer
     /// \return the sampled token
+    /// \note Falls through to sample_greedy when is_greedy() and logprobs are off
     int sample(buffer<bf16>& x);
+
+    /// \brief Report log-probabilities with every sampled token
+    /// \param enable whether to report them
+    /// \param top_n the number of alternatives to report, 0 to 20
+    /// \note A log-softmax over the whole vocabulary after penalties, bias and the
+    ///       allowed-token mask, before temperature, like OpenAI logprobs. The fused pass
+    ///       keeps the log-sum-exp of every logit it reads, so there is no extra pass;
+    ///       the alternatives are the max(top_k, top_n) candidates it keeps.
+    void set_logprobs(bool enable, int top_n = 0);
+    inline bool logprobs_enabled() const { return this->logprobs_on; }
+
+    /// \brief Log-probabilities of the last sampled token
+    inline const token_logprobs_t& get_logprobs() const { return this->last_logprobs; }
+
+    /// \brief Add a sparse bias to the logits (OpenAI logit_bias)
+    /// \param bias token id and bias pairs, replacing the previous bias
+    /// \note The bias is added after the penalties. Biased tokens are offered first with
+    ///       their final value and skipped in the vocabulary sweep, like penalized ones.
+    ///       Out-of-range ids are dropped, a repeated id keeps its last bias.
+    void set_logit_bias(const std::vector<std::pair<int, float>>& bias);
+    void clear_logit_bias();
+    inline bool has_logit_bias() const { return !this->logit_bias.empty(); }
+
+    /// \brief Restrict sampling to a subset of the vocabulary
+    /// \param token_ids the allowed token ids, empty to lift the restriction
+    /// \note The bitmask is sized once in the constructor and rewritten in place, so it can
+    ///       change every token. A set smaller than 1/16 of the vocabulary is visited id by id
+    ///       instead of sweeping the logits.
+    void set_allowed_tokens(const std::vector<int>& token_ids);
+    void clear_allowed_tokens();
+
+    /// \brief Restrict sampling to the tokens set in a bitmask
+    /// \param mask one bit per token id, bit id of word id / 64
+    /// \note Copied into the persistent mask; this is how the grammar matcher hands
+    ///       over its cached per-state masks. An empty mask lifts the restriction.
+    void set_allowed_mask(const std::vector<u64>& mask);
+    inline bool has_allowed_tokens() const { return this->allowed_active; }
+    inline bool is_allowed(int token_id) const {
+        return !this->allowed_active || ((this->allowed_mask[token_id >> 6] >> (token_id & 63)) & 1);
+    }
+
+private:
+    // Per-token flags, non-zero entries are offered up front and skipped by the sweep
+    static constexpr u8 FLAG_WINDOW = 1;   // in window_tokens
+    static constexpr u8 FLAG_BIAS   = 2;   // in logit_bias
+    std::vector<u8> token_flags;
+
+    std::vector<std::pair<int, float>> logit_bias;
+
+    bool allowed_active = false;
+    std::vector<u64> allowed_mask;   // (in_features + 63) / 64 words
+    size_t allowed_count = 0;
+    std::vector<int> allowed_ids;    // sorted and distinct, only kept for a small set
+
+    /// \brief Offer the adjusted logits in [begin, end) to a top-k or argmax sink
+    /// \param lse optional, also accumulates the log-sum-exp of every offered logit
+    template <typename sink_t>
+    void offer_logits(sink_t& sink, const bf16* x, int begin, int end, logsumexp_t* lse = nullptr);
+
+    bool logprobs_on = false;
+    int logprobs_top_n = 0;
+    logits_list_t logprob_candidates;
+    logsumexp_t logprob_lse;
+    token_logprobs_t last_logprobs;
+
+    void capture_logprobs();
+    void finish_logprobs(int sampled_index);
+
+    u64 rng_seed = 0;
+    u64 rng_counter = 0;
+
+    bool penalties_active() const;
+    float penalized_logit(float logit, int count) const;
 };
\ No newline at end of file
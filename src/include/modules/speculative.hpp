@@ -0,0 +1,98 @@
+/// \file speculative.hpp
+/// \brief speculative decoder class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note A small draft model (or a prompt lookup) proposes a few tokens, the target scores
+///       all of them in one verify pass and keeps the longest prefix it would have sampled
+///       itself. The target samples every emitted token from its own logits, in order,
+///       with the caller's sampler, so the output is the one of plain decoding; the
+///       proposals only decide how many target positions one pass covers.
+#pragma once
+
+#include "causal_lm.hpp"
+#include "modules/prompt_lookup.hpp"
+#include "utils/profiler.hpp"
+
+#include <functional>
+#include <vector>
+
+/// \brief Speculative decoder class
+/// \note Both KV caches hold the same tokens between rounds, except that the draft may lag
+///       behind after a fully accepted round or a prompt lookup round (see flush). The
+///       prompt lookup is tried first, the draft model when it finds nothing.
+class speculative_decoder {
+public:
+    /// \brief Sample one token from a row of target logits, in emission order
+    typedef std::function<int(buffer<bf16>&)> sample_t;
+    /// \brief Whether a sampled token ends generation
+    typedef std::function<bool(int)> stop_t;
+
+    /// \brief Constructor
+    /// \param target the model whose output is produced
+    /// \param draft the proposing model, same vocabulary, nullptr for none
+    /// \param vocab_size the number of real tokens, padded logits past it are ignored
+    /// \param draft_len the number of tokens proposed per round
+    speculative_decoder(causal_lm* target, causal_lm* draft, int vocab_size, int draft_len = 4);
+
+    /// \brief Choose the proposers of the next rounds
+    /// \param draft the draft model, nullptr to stop using it; its KV cache must then be
+    ///        cleared or cut back before it is used again
+    /// \param lookup the prompt lookup, nullptr for none
+    void set_proposers(causal_lm* draft, prompt_lookup* lookup);
+
+    /// \brief Run one round
+    /// \param pending the last sampled token, not yet in the KV caches
+    /// \param budget the maximum number of tokens to emit, at least 1
+    /// \param sample called for every emitted token
+    /// \param stop called on every emitted token, true ends the round
+    /// \return the number of emitted tokens; the last one is the new pending token
+    int step(int pending, int budget, const sample_t& sample, const stop_t& stop);
+
+    /// \brief Append a token to both KV caches without sampling (e.g. the eos token)
+    void append(int token);
+
+    /// \brief Bring the draft KV cache level with the target
+    void flush();
+
+    /// \brief Forget the lagging tokens, after both caches were cleared or cut back
+    void reset();
+
+    inline int get_draft_len() const { return this->draft_len; }
+    inline void set_draft_len(int draft_len) { this->draft_len = std::max(1, draft_len); }
+
+    /// \brief Statistics since the last reset_stats
+    /// \param rounds the number of verify passes
+    /// \param proposed the number of drafted tokens
+    /// \param accepted the number of drafted tokens the target agreed with
+    /// \param emitted the number of tokens produced
+    /// \param lookup_proposed the share of proposed that came from the prompt lookup
+    /// \param lookup_accepted the share of accepted that came from the prompt lookup
+    typedef struct {
+        uint64_t rounds;
+        uint64_t proposed;
+        uint64_t accepted;
+        uint64_t emitted;
+        uint64_t lookup_proposed;
+        uint64_t lookup_accepted;
+    } stats_t;
+    inline const stats_t& get_stats() const { return this->stats; }
+    void reset_stats();
+
+    /// \brief Time spent in the draft and in target verification
+    profiler draft_time;
+    profiler verify_time;
+
+private:
+    int argmax(buffer<bf16>& y);
+
+    causal_lm* target;
+    causal_lm* draft;
+    prompt_lookup* lookup = nullptr;
+    int vocab_size;
+    int draft_len;
+    std::vector<int> lag;       // in the target KV cache but not yet in the draft one
+    std::vector<int> ids;
+    buffer<bf16> logits;        // verify output, reused across rounds
+    stats_t stats = {0, 0, 0, 0, 0, 0};
+};
@@ -0,0 +1,60 @@
+/// \file stop_sequences.hpp
+/// \brief stop sequence matcher class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Ends generation on the first of several stop strings. The patterns are compiled
+///       into one Aho-Corasick automaton over bytes, so every byte of detokenized text costs
+///       one table lookup whatever the number of patterns, and the state carries over from
+///       token to token: a pattern split across tokens is found like any other.
+///
+///       Text that could still be the start of a pattern is held back, so a stop string
+///       never reaches the client, not even partly; it is released once the match fails
+///       or generation ends.
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+/// \brief Stop sequence matcher class
+class stop_matcher {
+public:
+    /// \brief Constructor
+    /// \param patterns the stop sequences, empty ones are ignored
+    stop_matcher(const std::vector<std::string>& patterns);
+
+    /// \brief Whether there is no pattern to match
+    inline bool empty() const { return this->patterns.empty(); }
+
+    /// \brief Start a new stream
+    void reset();
+
+    /// \brief Match the next piece of the stream
+    /// \param text the piece, e.g. one detokenized token
+    /// \param out the text that is safe to emit is appended
+    /// \return true if a stop sequence is complete; out then ends where it starts, and the
+    ///         stream is over until reset
+    bool feed(const std::string& text, std::string& out);
+
+    /// \brief End the stream without a match
+    /// \return the held back text
+    std::string flush();
+
+    /// \brief The stop sequence that matched, empty if none
+    inline const std::string& get_match() const { return this->match; }
+
+    /// \brief Bytes held back at the moment
+    inline size_t get_held() const { return this->held.size(); }
+
+private:
+    std::vector<std::string> patterns;
+    std::vector<std::array<int, 256>> next;     // complete transition table, failure links folded in
+    std::vector<int> depth;                     // length of the prefix a state stands for
+    std::vector<int> output;                    // longest pattern ending in a state, -1 if none
+
+    int state = 0;
+    std::string held;                           // the last depth[state] bytes of the stream
+    bool matched = false;
+    std::string match;
+};
@@ -0,0 +1,93 @@
+/// \file template_cache.hpp
+/// \brief chat template cache class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note A REST client sends the whole conversation with every request, and templating and
+///       encoding it again costs host time that grows with every turn. The rendered text and
+///       the token ids of a conversation are kept, keyed by a SHA-256 chain over the messages,
+///       so the next turn only renders and encodes the messages appended to it.
+///
+///       Appended messages are rendered behind the first message of the conversation, the
+///       anchor, whose own rendering is then cut off: system prompts, tool lists and other
+///       header text the template puts in front come out right. Templates whose rendering of
+///       a message depends on the messages after it are not prefix-stable; the first hits and
+///       every so often one more are checked against a full render, and a mismatch turns the
+///       cache off for good. So does a template that raises on the anchor or the appended
+///       messages alone, e.g. one that checks the roles alternate after the system message.
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/// \brief Chat template cache class
+class template_cache {
+public:
+    /// \brief Render messages through the chat template, with or without the generation prompt
+    typedef std::function<std::string(nlohmann::ordered_json& messages, bool add_generation_prompt)> render_t;
+    /// \brief Encode text into token ids
+    typedef std::function<std::vector<int>(const std::string& text)> encode_t;
+
+    /// \brief Constructor
+    /// \param capacity the number of conversations kept
+    /// \param verify_first the number of first hits checked against a full render
+    /// \param verify_every after those, one hit in verify_every is checked, 0 never
+    template_cache(size_t capacity = 8, int verify_first = 4, int verify_every = 64);
+
+    /// \brief Template and encode a conversation, reusing the longest prefix already seen
+    /// \param messages the messages
+    /// \param context whatever else the rendering depends on, e.g. the tools and extra context
+    /// \param render the chat template
+    /// \param encode the tokenizer
+    /// \return the token ids of the templated conversation, generation prompt included
+    std::vector<int> encode(nlohmann::ordered_json& messages, const std::string& context,
+                            const render_t& render, const encode_t& encode);
+
+    /// \brief Drop the kept conversations
+    void clear();
+
+    /// \brief Whether the template passed the checks so far
+    inline bool is_stable() const { return this->stable; }
+
+    /// \brief Hits, misses, verifications and the messages rendered and reused
+    nlohmann::json stats() const;
+
+    /// \brief SHA-256 digest
+    /// \param data the bytes
+    /// \return the 32 byte digest
+    static std::string sha256(const std::string& data);
+
+private:
+    struct entry_t {
+        std::string key;
+        std::string text;           // the messages without the generation prompt
+        std::vector<int> tokens;
+    };
+
+    /// \brief Render and encode everything, and count it as a miss
+    std::vector<int> _full(nlohmann::ordered_json& messages, const render_t& render, const encode_t& encode, std::string& text);
+    /// \brief Keep a conversation, the least recently used one goes
+    void _store(const std::string& key, std::string text, std::vector<int> tokens);
+    /// \brief Turn the cache off, the template is not prefix-stable
+    void _disable(const std::string& reason);
+
+    size_t capacity;
+    int verify_first;
+    int verify_every;
+    bool stable = true;
+    std::string unstable_reason;
+
+    std::list<entry_t> entries;                                         // most recently used first
+    std::unordered_map<std::string, std::list<entry_t>::iterator> index;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t verified = 0;
+    uint64_t messages_reused = 0;
+    uint64_t messages_rendered = 0;
+};
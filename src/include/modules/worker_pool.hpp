@@ -0,0 +1,79 @@
+/// \file worker_pool.hpp
+/// \brief worker pool class
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note A fixed set of threads for host work that splits into independent items, such
+///       as decoding and preprocessing the images of a request. A batch of items is run
+///       to completion by the workers and the calling thread together; each item knows
+///       the index of the worker running it, so per-worker state (a decoder context, a
+///       scratch buffer) is never shared. Items write their results by index, so the
+///       outcome does not depend on which worker ran what.
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// \brief Worker pool class
+class worker_pool {
+public:
+    /// \brief Work on one item
+    /// \param index the item, 0 to count - 1
+    /// \param worker the worker running it, 0 to workers() - 1
+    typedef std::function<void(size_t index, size_t worker)> task_t;
+
+    /// \brief Start the threads
+    /// \param threads the number of threads, the caller of run makes one more worker
+    worker_pool(size_t threads);
+
+    /// \brief Finish the queued items and join
+    ~worker_pool();
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    /// \brief Number of worker indices a task may see, the threads and the caller
+    inline size_t workers() const { return this->threads.size() + 1; }
+
+    /// \brief Run a task on count items and wait for all of them
+    /// \param count the number of items
+    /// \param task called once per item, from any worker
+    /// \throws the first exception of a task, once every item is done
+    /// \note The caller works on the batch too, as worker workers() - 1, so callers running
+    ///       at the same time must not share per-worker state.
+    void run(size_t count, const task_t& task);
+
+    /// \brief The pool shared by the models for image work
+    /// \note Bounded by the hardware threads, at most 8 threads.
+    static worker_pool& shared();
+
+private:
+    struct batch_t {
+        const task_t* task;
+        size_t count;
+        size_t done = 0;
+        std::exception_ptr error = nullptr;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    struct item_t {
+        std::shared_ptr<batch_t> batch;
+        size_t index;
+    };
+
+    void loop(size_t worker);
+    static void work(item_t& item, size_t worker);
+
+    std::vector<std::thread> threads;
+    std::deque<item_t> queue;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping = false;
+};
@@ -19,6 +19,24 @@ struct program_args_t {
     bool embed = false;
     bool json_output = false;
     int ctx_length = -1; // let model decide
+    int prefill_chunk = -1; // tokens per prefill call, -1 lets the model decide, 0 for the whole prompt
+
+    // speculative decoding, for run and serve commands
+    std::string draft_model_tag = ""; // empty for plain decoding
+    int draft_len = 4;
+    bool prompt_lookup = false; // draft-free n-gram speculation, the default of each request
+
+    // context shift, for run and serve commands
+    bool context_shift = false; // evict the middle of the conversation instead of stopping at the context length
+    int sink_tokens = 4;
+
+    // resident models, for serve command
+    int max_models = 1; // models kept loaded at once
+    int model_memory_mb = 0; // memory for the loaded models, 0 for no limit
+    std::string preload = ""; // comma separated models loaded in the background at start
+
+    // preprocessed images of earlier requests, for serve command
+    int image_cache_mb = 512; // 0 turns the cache off
 
     // handling input file
     std::string input_file_name = "";
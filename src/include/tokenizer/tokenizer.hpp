@@ -66,8 +66,21 @@ public:
     std::string run_time_decoder(int answer_token);
     bool is_doubled_encoded;
 
+    /// \brief Number of tokens in the vocabulary, added tokens included
+    int vocab_size();
+
+    /// \brief Raw bytes a token stands for
+    /// \param token_id the token id
+    /// \return the bytes, empty if the token has no text form
+    /// \note SentencePiece byte-fallback tokens (<0xNN>) map to their single byte
+    std::string token_bytes(int token_id);
+
+    /// \brief Whether a token is an added token marked special (e.g. <|im_end|>)
+    bool is_special(int token_id) const;
+
 private:
     std::unique_ptr<tokenizers::Tokenizer> tokenizer;
+    std::vector<int> special_token_ids;   // sorted
     std::unordered_map<uint32_t, uint8_t> inv_map;
 
     /// \brief Convert the cp1252 to utf8
@@ -0,0 +1,79 @@
+/// \file cpu_features.hpp
+/// \brief cpu feature detection
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Runtime ISA detection used to pick SIMD kernels at run time instead of build time.
+#pragma once
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/// \brief Enable an instruction set for a single function
+/// \note MSVC accepts the intrinsics without any flag, GCC/Clang need a target attribute
+///       so the kernel compiles regardless of the -m flags of the translation unit.
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,avx2,fma")))
+#else
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX512
+#endif
+
+namespace cpu_features {
+
+typedef enum { scalar = 0, avx2 = 1, avx512 = 2 } isa_t;
+
+/// \brief Check if AVX2 and FMA are available at runtime (including OS support for YMM state)
+inline bool has_avx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma     = (info[2] & (1 << 12)) != 0;
+    if (!osxsave || !fma) return false;
+    if ((_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+/// \brief Check if AVX-512 F/BW/VL are available at runtime (including OS support for ZMM state)
+inline bool has_avx512() {
+    if (!has_avx2()) return false;
+#ifdef _MSC_VER
+    if ((_xgetbv(0) & 0xE6) != 0xE6) return false;
+    int info[4];
+    __cpuidex(info, 7, 0);
+    const int mask = (1 << 16) | (1 << 30) | (1 << 31);   // F, BW, VL
+    return (info[1] & mask) == mask;
+#else
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+           __builtin_cpu_supports("avx512vl");
+#endif
+}
+
+/// \brief Best instruction set supported by this CPU, detected once
+inline isa_t best_isa() {
+    static const isa_t isa = has_avx512() ? avx512 : (has_avx2() ? avx2 : scalar);
+    return isa;
+}
+
+/// \brief Clamp a requested instruction set to what the CPU supports
+inline isa_t clamp_isa(isa_t requested) {
+    return requested < best_isa() ? requested : best_isa();
+}
+
+/// \brief Name of an instruction set, for logs and benchmarks
+inline const char* isa_name(isa_t isa) {
+    switch (isa) {
+        case avx512: return "avx512";
+        case avx2:   return "avx2";
+        default:     return "scalar";
+    }
+}
+
+} // namespace cpu_features
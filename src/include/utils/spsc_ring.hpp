@@ -0,0 +1,122 @@
+/// \file spsc_ring.hpp
+/// \brief single-producer single-consumer ring buffer
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Lock-free bounded queue between exactly one producer and one consumer thread.
+///       Head and tail sit on their own cache lines; a side that finds the ring full
+///       or empty spins briefly and then sleeps on an event counter (C++20 atomic wait),
+///       so an idle consumer does not burn a core.
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+template <typename T>
+class spsc_ring {
+public:
+    /// \brief Constructor
+    /// \param capacity the number of slots, rounded up to a power of two
+    explicit spsc_ring(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        this->slots.resize(n);
+        this->mask = n - 1;
+    }
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    /// \brief Append an item, producer side
+    /// \return false if the ring is full
+    bool try_push(T& item) {
+        size_t t = this->tail.load(std::memory_order_relaxed);
+        if (t - this->head.load(std::memory_order_acquire) > this->mask) {
+            return false;
+        }
+        this->slots[t & this->mask] = std::move(item);
+        this->tail.store(t + 1, std::memory_order_release);
+        this->signal();
+        return true;
+    }
+
+    /// \brief Take the oldest item, consumer side
+    /// \return false if the ring is empty
+    bool try_pop(T& item) {
+        size_t h = this->head.load(std::memory_order_relaxed);
+        if (h == this->tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(this->slots[h & this->mask]);
+        this->head.store(h + 1, std::memory_order_release);
+        this->signal();
+        return true;
+    }
+
+    /// \brief Append an item, waiting for a free slot
+    /// \return false if the ring was closed before the item fit
+    bool push(T item) {
+        while (!this->try_push(item)) {
+            if (this->is_closed()) {
+                return false;
+            }
+            this->wait([this] {
+                return this->tail.load(std::memory_order_relaxed) - this->head.load(std::memory_order_acquire) <= this->mask;
+            });
+        }
+        return true;
+    }
+
+    /// \brief Take the oldest item, waiting for one
+    /// \return false once the ring is closed and drained
+    bool pop(T& item) {
+        while (!this->try_pop(item)) {
+            if (this->is_closed() && this->empty()) {
+                return false;
+            }
+            this->wait([this] { return !this->empty(); });
+        }
+        return true;
+    }
+
+    /// \brief No more items will be pushed, wakes a waiting consumer
+    void close() {
+        this->closed.store(true, std::memory_order_release);
+        this->signal();
+    }
+
+    inline bool is_closed() const { return this->closed.load(std::memory_order_acquire); }
+    inline bool empty() const {
+        return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_acquire);
+    }
+    inline size_t capacity() const { return this->mask + 1; }
+
+private:
+    inline void signal() {
+        this->events.fetch_add(1, std::memory_order_acq_rel);
+        this->events.notify_all();
+    }
+
+    /// \brief Spin a little, then sleep until the other side signals
+    template <typename Ready>
+    void wait(Ready ready) {
+        for (int i = 0; i < SPIN_COUNT; i++) {
+            if (ready() || this->is_closed()) return;
+        }
+        uint32_t seen = this->events.load(std::memory_order_acquire);
+        if (ready() || this->is_closed()) return;
+        this->events.wait(seen, std::memory_order_acquire);
+    }
+
+    std::vector<T> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{0};    // next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail{0};    // next slot to push, written by the producer
+    alignas(64) std::atomic<uint32_t> events{0};
+    std::atomic<bool> closed{false};
+
+    static constexpr int SPIN_COUNT = 256;
+};
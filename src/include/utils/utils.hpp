@@ -380,4 +380,8 @@ int get_server_port(int user_port);
 ///@return the models directory path
 std::string get_models_directory();
 
+///@brief get_history_directory gets the directory of saved histories and sessions
+///@return FLM_MODEL_PATH/history, or flm/history in the Documents (~/.config on Linux) directory
+std::string get_history_directory();
+
 } // end of namespace utils
@@ -84,6 +84,8 @@ bool parse_options(int argc, char *argv[], program_args_t& parsed_args) {
              "Output in JSON format (for list, validate, version commands)")
             ("ctx-len,c", po::value<int>(&parsed_args.ctx_length)->default_value(-1),
              "Set context length")
+            ("prefill-chunk", po::value<int>(&parsed_args.prefill_chunk)->default_value(-1),
+             "Tokens per prefill step, smaller steps cancel sooner; -1 for the model default, 0 for the whole prompt")
             ("img-pre-resize,r", po::value<int>(&parsed_args.img_pre_resize)->default_value(3),
              "Pre-resize the image, 0: original size, 1: height = 480, 2: height = 720, 3: height = 1080, 4: height = 1440")
             ("socket,s", po::value<size_t>(&parsed_args.max_socket_connections)->default_value(10),
@@ -94,6 +96,24 @@ bool parse_options(int argc, char *argv[], program_args_t& parsed_args) {
              "Enable or disable Cross-Origin Resource Sharing (CORS) (for serve command)")
             ("preemption", po::value<bool>(&parsed_args.preemption)->default_value(false),
              "Enable preemption")
+            ("draft", po::value<std::string>(&parsed_args.draft_model_tag)->default_value(""),
+             "Draft model for speculative decoding, e.g. qwen3:0.6b for qwen3:8b. Only takes effect once an engine implements batch_verifier, and no shipped engine does yet; until then it is ignored with a warning (for run and serve commands)")
+            ("draft-len", po::value<int>(&parsed_args.draft_len)->default_value(4),
+             "Number of tokens the draft model proposes per step")
+            ("prompt-lookup", po::value<bool>(&parsed_args.prompt_lookup)->default_value(false),
+             "Speculate by looking up the generated text in the prompt, no draft model needed. Only takes effect once an engine implements batch_verifier, and no shipped engine does yet; until then it is ignored with a warning (for run and serve commands)")
+            ("ctx-shift", po::value<bool>(&parsed_args.context_shift)->default_value(false),
+             "Keep generating past the context length by evicting the middle of the conversation (for run and serve commands)")
+            ("sink-tokens", po::value<int>(&parsed_args.sink_tokens)->default_value(4),
+             "Number of leading tokens a context shift never evicts")
+            ("max-models", po::value<int>(&parsed_args.max_models)->default_value(1),
+             "Number of models kept loaded; requests switch between them without reloading (for serve command)")
+            ("model-mem", po::value<int>(&parsed_args.model_memory_mb)->default_value(0),
+             "Memory for the loaded models in MB, 0 for no limit")
+            ("preload", po::value<std::string>(&parsed_args.preload)->default_value(""),
+             "Comma separated models to load in the background at start, e.g. qwen3:8b,gemma3:4b")
+            ("image-cache", po::value<int>(&parsed_args.image_cache_mb)->default_value(512),
+             "Memory in MB for preprocessed images that clients send again in later turns, 0 to turn it off (for serve command)")
             ("prompt,i", po::value<std::string>(&parsed_args.input_file_name)->default_value(""),
              "Direct file input");
 
@@ -25,6 +25,8 @@ std::map<std::string, runner_cmd_t> cmd_map = {
     {"/show", CMD_SHOW},
     {"/load", CMD_LOAD},
     {"/save", CMD_SAVE},
+    {"/save-session", CMD_SAVE_SESSION},
+    {"/load-session", CMD_LOAD_SESSION},
     {"/clear", CMD_CLEAR},
     {"/bye", CMD_BYE},
     {"/pull", CMD_PULL},
@@ -37,7 +39,7 @@ std::map<std::string, runner_cmd_t> cmd_map = {
 /// \param downloader - the downloader for the models
 /// \param tag - the tag of the model to load
 Runner::Runner(model_list& supported_models, ModelDownloader& downloader, program_args_t& args)
-    : supported_models(supported_models), downloader(downloader), tag(args.model_tag), asr(args.asr), embed(args.embed), img_pre_resize(args.img_pre_resize), preemption(args.preemption) {
+    : supported_models(supported_models), downloader(downloader), tag(args.model_tag), asr(args.asr), embed(args.embed), img_pre_resize(args.img_pre_resize), preemption(args.preemption), draft_tag(args.draft_model_tag), draft_len(args.draft_len), prompt_lookup(args.prompt_lookup), context_shift(args.context_shift), sink_tokens(args.sink_tokens), prefill_chunk(args.prefill_chunk) {
 
     this->npu_device_inst = xrt::device(0);
 
@@ -96,10 +98,44 @@ Runner::Runner(model_list& supported_models, ModelDownloader& downloader, progra
         header_print("ERROR", "Failed to load model: " + std::string(e.what()));
         exit(EXIT_FAILURE);
     }
+    this->setup_speculative_decoding();
+    this->auto_chat_engine->set_context_shift(this->context_shift, this->sink_tokens);
+    if (this->prefill_chunk >= 0) {
+        this->auto_chat_engine->set_prefill_chunk(this->prefill_chunk);
+    }
 
     this->generate_limit = -1;
 }
 
+/// \brief Pair the chat model with the draft model of --draft and the prompt lookup, if any
+void Runner::setup_speculative_decoding() {
+    if (this->prompt_lookup && !this->auto_chat_engine->set_prompt_lookup(true, this->draft_len)) {
+        header_print("WARNING", "Prompt lookup is off: " << this->auto_chat_engine->speculation_unavailable());
+    }
+    if (this->draft_tag.empty()) {
+        return;
+    }
+    std::string unavailable = this->auto_chat_engine->speculation_unavailable();
+    if (!unavailable.empty()) {
+        header_print("WARNING", "--draft " << this->draft_tag << " is ignored: " << unavailable);
+        return;
+    }
+    if (!this->supported_models.is_model_supported(this->draft_tag)) {
+        header_print("WARNING", "Draft model not found: " << this->draft_tag);
+        return;
+    }
+    if (!this->downloader.is_model_downloaded(this->draft_tag)) {
+        this->downloader.pull_model(this->draft_tag);
+    }
+    auto [new_draft_tag, draft_info] = this->supported_models.get_model_info(this->draft_tag);
+    if (new_draft_tag == this->tag) {
+        return;
+    }
+    if (!this->auto_chat_engine->load_draft_model(this->supported_models.get_model_path(new_draft_tag), this->draft_len)) {
+        header_print("WARNING", "--draft " << this->draft_tag << " is ignored");
+    }
+}
+
 
 
 
@@ -170,6 +206,12 @@ void Runner::run() {
             else if (first_token == "/save") {
                 this->cmd_save(input_list);
             }
+            else if (first_token == "/save-session") {
+                this->cmd_save_session(input_list);
+            }
+            else if (first_token == "/load-session") {
+                this->cmd_load_session(input_list);
+            }
             else if (first_token == "/show") {
                 this->cmd_show(input_list);
             }
@@ -401,6 +443,11 @@ void Runner::cmd_load(std::vector<std::string>& input_list) {
             header_print("ERROR", "Failed to load model: " + std::string(e.what()));
             exit(EXIT_FAILURE);
         }
+        this->setup_speculative_decoding();
+        this->auto_chat_engine->set_context_shift(this->context_shift, this->sink_tokens);
+        if (this->prefill_chunk >= 0) {
+            this->auto_chat_engine->set_prefill_chunk(this->prefill_chunk);
+        }
         this->auto_chat_engine->configure_parameter("system_prompt", this->system_prompt);
 
     }
@@ -409,42 +456,8 @@ void Runner::cmd_load(std::vector<std::string>& input_list) {
 
 }
 
-/// \brief Save the history
-/// \param input_list, std::vector<std::string>
-void Runner::cmd_save(std::vector<std::string>& input_list) {
-    std::pair<std::string, std::vector<int>> history = this->auto_chat_engine->get_history();
-    // Get the FLM_MODEL_PATH environment variable for the history directory
-    std::string history_dir;
-    const char* path_sep = "/";
-#ifdef _WIN32
-    path_sep = "\\";
-    char* model_path_env = nullptr;
-    size_t len = 0;
-    if (_dupenv_s(&model_path_env, &len, "FLM_MODEL_PATH") == 0 && model_path_env != nullptr) {
-        history_dir = std::string(model_path_env) + path_sep + "history";
-        free(model_path_env);
-    } else {
-        // Fallback to Documents directory if environment variable is not set
-        std::string documents_dir = utils::get_user_documents_directory();
-        history_dir = documents_dir + path_sep + "flm" + path_sep + "history";
-    }
-#else
-    const char* model_path_env = std::getenv("FLM_MODEL_PATH");
-    if (model_path_env && *model_path_env) {
-        history_dir = std::string(model_path_env) + path_sep + "history";
-    } else {
-        std::string documents_dir = utils::get_user_documents_directory();
-        history_dir = documents_dir + path_sep + "flm" + path_sep + "history";
-    }
-#endif
-    
-    // Create the history directory if it doesn't exist
-    if (!std::filesystem::exists(history_dir)) {
-        std::filesystem::create_directories(history_dir);
-    }
-    
-    // save file to history_hh_mm_mm_dd_yyyy.txt
-    // 1) get current date
+/// \brief Current time as hh_mm_mm_dd_yyyy, for the names of saved files
+static std::string history_timestamp() {
     std::time_t t = std::time(nullptr);
     std::tm tm = *std::localtime(&t);
 
@@ -458,9 +471,27 @@ void Runner::cmd_save(std::vector<std::string>& input_list) {
             << std::setw(2) << std::setfill('0') << tm.tm_mday
             << '_'
             << (tm.tm_year + 1900);
-    std::string date_str = date_ss.str();
+    return date_ss.str();
+}
 
-    // 2) build filename in the history directory
+/// \brief Save the history
+/// \param input_list, std::vector<std::string>
+void Runner::cmd_save(std::vector<std::string>& input_list) {
+    std::pair<std::string, std::vector<int>> history = this->auto_chat_engine->get_history();
+    std::string history_dir = utils::get_history_directory();
+#ifdef _WIN32
+    const char* path_sep = "\\";
+#else
+    const char* path_sep = "/";
+#endif
+    
+    // Create the history directory if it doesn't exist
+    if (!std::filesystem::exists(history_dir)) {
+        std::filesystem::create_directories(history_dir);
+    }
+    
+    // save file to history_hh_mm_mm_dd_yyyy.txt
+    std::string date_str = history_timestamp();
     std::string file_name = history_dir + path_sep + "history_" + date_str + ".txt";
     std::ofstream file(file_name);
     if (file.is_open()) {
@@ -473,6 +504,50 @@ void Runner::cmd_save(std::vector<std::string>& input_list) {
     }
 }
 
+/// \brief Save the conversation with its KV cache, to resume it without a prefill
+/// \param input_list, std::vector<std::string>
+/// \note /save-session [file] [compress]; without a file the session goes to the history directory
+void Runner::cmd_save_session(std::vector<std::string>& input_list) {
+    std::string file_name;
+    bool compress = false;
+    for (size_t i = 1; i < input_list.size(); i++) {
+        if (input_list[i] == "compress") {
+            compress = true;
+        }
+        else {
+            file_name = input_list[i];
+        }
+    }
+    if (file_name.empty()) {
+        std::string history_dir = utils::get_history_directory();
+        if (!std::filesystem::exists(history_dir)) {
+            std::filesystem::create_directories(history_dir);
+        }
+        file_name = utils::path_join(history_dir, "session_" + history_timestamp() + ".flms");
+    }
+    if (this->auto_chat_engine->save_session(file_name, compress)) {
+        std::cout << "Session saved to " << file_name << std::endl;
+    }
+}
+
+/// \brief Resume a conversation saved with /save-session
+/// \param input_list, std::vector<std::string>
+/// \note A bare file name is also looked up in the history directory
+void Runner::cmd_load_session(std::vector<std::string>& input_list) {
+    if (input_list.size() < 2) {
+        std::cout << "Usage: /load-session [file]" << std::endl;
+        return;
+    }
+    std::string file_name = input_list[1];
+    if (!std::filesystem::exists(file_name)) {
+        std::string in_history = utils::path_join(utils::get_history_directory(), file_name);
+        if (std::filesystem::exists(in_history)) {
+            file_name = in_history;
+        }
+    }
+    this->auto_chat_engine->load_session(file_name);
+}
+
 /// \brief Show the model information
 /// \param input_list, std::vector<std::string>
 void Runner::cmd_show(std::vector<std::string>& input_list) {
@@ -496,6 +571,8 @@ void Runner::cmd_set(std::vector<std::string>& input_list) {
         std::cout << "  /set rep-pen [value] - set the repetition penalty" << std::endl;
         std::cout << "  /set freq-pen [value] - set the frequency penalty" << std::endl;
         std::cout << "  /set pres-pen [value] - set the presence penalty" << std::endl;
+        std::cout << "  /set seed [value] - set the sampling seed, -1 for random" << std::endl;
+        std::cout << "  /set lookup [on|off] - speculate by looking up the answer in the prompt" << std::endl;
         std::cout << "  /set sys-msg [value] - set the system message" << std::endl;
         std::cout << "  /set ctx-len [value] - set the max context length" << std::endl;
         std::cout << "  /set gen-lim [value] - Limit tokens generated per round" << std::endl;
@@ -547,6 +624,15 @@ void Runner::cmd_set(std::vector<std::string>& input_list) {
     else if (set_context == "pres-pen") {
         this->auto_chat_engine->set_presence_penalty(std::stof(set_value));
     }
+    else if (set_context == "seed") {
+        this->auto_chat_engine->set_seed(std::stoll(set_value));
+    }
+    else if (set_context == "lookup") {
+        this->prompt_lookup = (set_value == "on" || set_value == "1" || set_value == "true");
+        if (!this->auto_chat_engine->set_prompt_lookup(this->prompt_lookup, this->draft_len)) {
+            header_print("WARNING", "Prompt lookup is off: " << this->auto_chat_engine->speculation_unavailable());
+        }
+    }
     else if (set_context == "ctx-len"){
         try {
             this->auto_chat_engine->set_max_length(std::stoi(set_value));
@@ -576,6 +662,8 @@ void Runner::cmd_set(std::vector<std::string>& input_list) {
         std::cout << "  /set rep-pen [value] - set the repetition penalty" << std::endl;
         std::cout << "  /set freq-pen [value] - set the frequency penalty" << std::endl;
         std::cout << "  /set pres-pen [value] - set the presence penalty" << std::endl;
+        std::cout << "  /set seed [value] - set the sampling seed, -1 for random" << std::endl;
+        std::cout << "  /set lookup [on|off] - speculate by looking up the answer in the prompt" << std::endl;
         std::cout << "  /set sys-msg [value] - set the system message" << std::endl;
         std::cout << "  /set gen-lim [value] - Limit tokens generated per round" << std::endl;
         std::cout << "  /set r-eff [low|medium|high] - set the reasoning effort level (GPT-OSS only, default = medium)" << std::endl;
@@ -591,6 +679,8 @@ void Runner::cmd_help(std::vector<std::string>& input_list) {
     std::cout << "  /input [filename] [follow_up_prompt] - load a file and follow up with a prompt" << std::endl;
     std::cout << "                                       - If space is in the filename, use quotes to wrap it" << std::endl;
     std::cout << "  /save - save the history" << std::endl;
+    std::cout << "  /save-session [file] [compress] - save the conversation with its KV cache" << std::endl;
+    std::cout << "  /load-session [file] - resume a saved conversation" << std::endl;
     std::cout << "  /clear - clear the context" << std::endl;
     std::cout << "  /status - show perf. metrics" << std::endl;
     std::cout << "  /history - show the history" << std::endl;
@@ -33,6 +33,8 @@ typedef enum {
     CMD_SHOW,
     CMD_LOAD,
     CMD_SAVE,
+    CMD_SAVE_SESSION,
+    CMD_LOAD_SESSION,
     CMD_CLEAR,
     CMD_BYE,
     CMD_PULL,
@@ -62,15 +64,26 @@ class Runner {
         std::string system_prompt;
         bool preemption;
         int img_pre_resize;
+        std::string draft_tag;
+        int draft_len;
+        bool prompt_lookup;
+        bool context_shift;
+        int sink_tokens;
+        int prefill_chunk;
         // CLI instance for interactive input
         CLIWide cli;
         xrt::device npu_device_inst;
 
+        /// \brief Pair the chat model with the draft model of --draft and the prompt lookup, if any
+        void setup_speculative_decoding();
+
         /// \brief Command functions
         void cmd_set(std::vector<std::string>& input_list);
         void cmd_show(std::vector<std::string>& input_list);
         void cmd_load(std::vector<std::string>& input_list);
         void cmd_save(std::vector<std::string>& input_list);
+        void cmd_save_session(std::vector<std::string>& input_list);
+        void cmd_load_session(std::vector<std::string>& input_list);
         void cmd_clear(std::vector<std::string>& input_list);
         void cmd_help(std::vector<std::string>& input_list);
         void cmd_help_shotcut(std::vector<std::string>& input_list);
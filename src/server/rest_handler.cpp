@@ -18,8 +18,55 @@
 #include <iomanip>
 #include <locale>
 #include <random>
+#include <filesystem>
 #include "server.hpp"
 
+///@brief The keep_alive field of a request, in seconds
+///@param request the request
+///@return nullopt if it is missing or malformed; negative means for ever
+///@note Like Ollama: a number of seconds, or a duration such as "10m", "1h30m" or "-1".
+static std::optional<double> keep_alive_seconds(const json& request) {
+    if (!request.contains("keep_alive")) {
+        return std::nullopt;
+    }
+    const json& value = request["keep_alive"];
+    if (value.is_number()) {
+        return value.get<double>();
+    }
+    if (!value.is_string()) {
+        return std::nullopt;
+    }
+    static const std::map<std::string, double> units = {{"", 1.0}, {"ms", 0.001}, {"s", 1.0}, {"m", 60.0}, {"h", 3600.0}};
+    std::string text = value.get<std::string>();
+    bool negative = !text.empty() && text[0] == '-';
+    size_t pos = negative ? 1 : 0;
+    if (pos >= text.size()) {
+        return std::nullopt;
+    }
+    double seconds = 0.0;
+    while (pos < text.size()) {
+        size_t used = 0;
+        double number = 0.0;
+        try {
+            number = std::stod(text.substr(pos), &used);
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+        pos += used;
+        size_t unit_end = pos;
+        while (unit_end < text.size() && std::isalpha((unsigned char)text[unit_end])) {
+            unit_end++;
+        }
+        auto unit = units.find(text.substr(pos, unit_end - pos));
+        if (unit == units.end()) {
+            return std::nullopt;
+        }
+        seconds += number * unit->second;
+        pos = unit_end;
+    }
+    return negative ? -seconds : seconds;
+}
+
 ///@brief Normalize messages by merging consecutive user messages (like Ollama does)
 ///@param messages the original messages
 ///@return normalized messages with consecutive user messages merged
@@ -150,7 +197,7 @@ static json normalize_template(json messages) {
 
 ///@return the rest handler
 RestHandler::RestHandler(model_list& models, ModelDownloader& downloader, program_args_t& args)
-    : supported_models(models), downloader(downloader), default_model_tag(args.model_tag), current_model_tag(""), asr(args.asr), embed(args.embed), img_pre_resize(args.img_pre_resize), preemption(args.preemption){
+    : supported_models(models), downloader(downloader), default_model_tag(args.model_tag), current_model_tag(""), asr(args.asr), embed(args.embed), img_pre_resize(args.img_pre_resize), preemption(args.preemption), draft_model_tag(args.draft_model_tag), draft_len(args.draft_len), prompt_lookup(args.prompt_lookup), context_shift(args.context_shift), sink_tokens(args.sink_tokens), prefill_chunk(args.prefill_chunk), image_cache_mb(args.image_cache_mb){
     this->npu_device_inst = xrt::device(0);
 
     if (args.ctx_length != -1) {
@@ -177,17 +224,41 @@ RestHandler::RestHandler(model_list& models, ModelDownloader& downloader, progra
     }
 #endif
 
+    // Chat models stay loaded up to --max-models and --model-mem; the old 500 ms pause is
+    // only taken after freeing one
+    this->chat_models = std::make_unique<model_cache<AutoModel>>(
+        [this](const std::string& tag) { return this->load_chat_model(tag); },
+        args.max_models, (size_t)std::max(args.model_memory_mb, 0) << 20, std::chrono::milliseconds(500));
+
     if (default_model_tag != "model-faker") {
         if (!supported_models.is_model_supported(default_model_tag)) {
             header_print("Warning", "Default model tag '" << default_model_tag << "' is not supported. Falling back to 'llama3.2:1b'.");
             this->default_model_tag = "llama3.2:1b";
         }
-        ensure_model_loaded(default_model_tag);
+        try {
+            ensure_model_loaded(default_model_tag);
+        }
+        catch (const std::exception& e) {
+            header_print("ERROR", "Failed to load model: " + std::string(e.what()));
+            exit(EXIT_FAILURE);
+        }
     }
     else {
         this->current_model_tag = "model-faker";
     }
-    this->prompt_cache = PromptCache();
+
+    std::stringstream preload_list(args.preload);
+    std::string preload_tag;
+    while (std::getline(preload_list, preload_tag, ',')) {
+        if (preload_tag.empty()) {
+            continue;
+        }
+        if (!supported_models.is_model_supported(preload_tag)) {
+            header_print("Warning", "Model tag '" << preload_tag << "' to preload is not supported.");
+            continue;
+        }
+        preload_or_unload(preload_tag, std::nullopt);
+    }
 }
 
 ///@brief RestHandler destructor
@@ -196,30 +267,97 @@ RestHandler::~RestHandler() = default;
 
 ///@brief Ensure the model is loaded
 ///@param model_tag the model tag
-void RestHandler::ensure_model_loaded(const std::string& model_tag) {
-    std::string ensure_tag = model_tag;
+///@param keep_alive seconds the model stays loaded once another one is used, negative for ever;
+///       nullopt keeps its current value
+///@note Loaded models stay in chat_models up to --max-models; switching back to one of them,
+///      or to one preloaded in the background, does not load it again.
+void RestHandler::ensure_model_loaded(const std::string& model_tag, std::optional<double> keep_alive) {
+    // the tag the model is loaded under, unsupported tags fall back like get_auto_model does
+    std::string ensure_tag = supported_models.is_model_supported(model_tag) ? supported_models.get_model_info(model_tag).first : "llama3.2:1b";
     if (current_model_tag != ensure_tag) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-        if (auto_chat_engine != nullptr) {
-            auto_chat_engine.reset();
-        }
-        std::pair<std::string, std::unique_ptr<AutoModel>> auto_model = get_auto_model(ensure_tag, this->supported_models, &this->npu_device_inst);
-        auto_chat_engine = std::move(auto_model.second);
-        ensure_tag = auto_model.first;
-        if (!downloader.is_model_downloaded(ensure_tag)) {
-            downloader.pull_model(ensure_tag);
+        // the cache may have to free the model in use to make room
+        auto_chat_engine.reset();
+        current_model_tag = "";
+    }
+    auto_chat_engine = chat_models->acquire(ensure_tag, model_size(ensure_tag), keep_alive);
+    current_model_tag = ensure_tag;
+}
+
+///@brief Build and load a chat model, on the loader thread of chat_models or the request thread
+///@param model_tag the model tag
+///@return the model, set up with the serve options
+std::shared_ptr<AutoModel> RestHandler::load_chat_model(const std::string& model_tag) {
+    std::pair<std::string, std::unique_ptr<AutoModel>> auto_model = get_auto_model(model_tag, this->supported_models, &this->npu_device_inst);
+    std::shared_ptr<AutoModel> chat_engine = std::move(auto_model.second);
+    std::string ensure_tag = auto_model.first;
+    if (!downloader.is_model_downloaded(ensure_tag)) {
+        downloader.pull_model(ensure_tag);
+    }
+    auto [new_ensure_tag, model_info] = supported_models.get_model_info(ensure_tag);
+    header_print("FLM", "Loading model " << new_ensure_tag << "...");
+    chat_engine->configure_parameter("img_pre_resize", this->img_pre_resize);
+    chat_engine->load_model(supported_models.get_model_path(new_ensure_tag), model_info, ctx_length, preemption);
+    std::string speculation_unavailable = chat_engine->speculation_unavailable();
+    if (prompt_lookup && !speculation_unavailable.empty()) {
+        header_print("WARNING", "--prompt-lookup is ignored for " << new_ensure_tag << ": " << speculation_unavailable);
+    }
+    if (!draft_model_tag.empty() && !speculation_unavailable.empty()) {
+        header_print("WARNING", "--draft " << draft_model_tag << " is ignored for " << new_ensure_tag << ": " << speculation_unavailable);
+    }
+    else if (!draft_model_tag.empty() && supported_models.is_model_supported(draft_model_tag)) {
+        if (!downloader.is_model_downloaded(draft_model_tag)) {
+            downloader.pull_model(draft_model_tag);
         }
-        auto [new_ensure_tag, model_info] = supported_models.get_model_info(ensure_tag);
-        auto_chat_engine->configure_parameter("img_pre_resize", this->img_pre_resize);
-        try {
-            auto_chat_engine->load_model(supported_models.get_model_path(new_ensure_tag), model_info, ctx_length, preemption);
+        auto [new_draft_tag, draft_info] = supported_models.get_model_info(draft_model_tag);
+        if (new_draft_tag != new_ensure_tag &&
+            !chat_engine->load_draft_model(supported_models.get_model_path(new_draft_tag), draft_len)) {
+            header_print("WARNING", "--draft " << draft_model_tag << " is ignored for " << new_ensure_tag);
         }
-        catch (const std::exception& e) {
-            header_print("ERROR", "Failed to load model: " + std::string(e.what()));
-            exit(EXIT_FAILURE);
+    }
+    chat_engine->set_context_shift(context_shift, sink_tokens);
+    if (prefill_chunk >= 0) {
+        chat_engine->set_prefill_chunk(prefill_chunk);
+    }
+    chat_engine->set_image_cache((size_t)std::max(image_cache_mb, 0) << 20);
+    return chat_engine;
+}
+
+///@brief Size of a model in bytes, from the model list
+///@param model_tag the model tag
+size_t RestHandler::model_size(const std::string& model_tag) {
+    auto [new_tag, model_info] = supported_models.get_model_info(model_tag);
+    if (model_info.contains("size") && model_info["size"].is_number()) {
+        return model_info["size"].get<size_t>();
+    }
+    return 0;
+}
+
+///@brief Load a model in the background, or unload it, like Ollama does for a request without a prompt
+///@param model_tag the model tag
+///@param keep_alive 0 unloads the model; otherwise seconds it stays loaded, negative or nullopt for ever
+///@return the response, without the empty message or response field
+json RestHandler::preload_or_unload(const std::string& model_tag, std::optional<double> keep_alive) {
+    if (!supported_models.is_model_supported(model_tag)) {
+        return {{"error", "model '" + model_tag + "' not found"}};
+    }
+    std::string tag = supported_models.get_model_info(model_tag).first;
+    bool unload = keep_alive.has_value() && *keep_alive == 0.0;
+    if (unload) {
+        if (tag == current_model_tag) {
+            auto_chat_engine.reset();
+            current_model_tag = "";
         }
-        current_model_tag = ensure_tag;
+        chat_models->unload(tag);
+        header_print("FLM", "Unloaded " << tag);
     }
+    else if (tag != current_model_tag && chat_models->preload(tag, model_size(tag), keep_alive.value_or(-1.0))) {
+        header_print("FLM", "Preloading " << tag << " in the background");
+    }
+    return {
+        {"model", tag},
+        {"done", true},
+        {"done_reason", unload ? "unload" : "load"}
+    };
 }
 
 ///@brief Ensure the asr model is loaded
@@ -272,6 +410,7 @@ void RestHandler::ensure_embed_model_loaded(const std::string& model_tag) {
 ///@brief Configure chat engine parameters from options and request
 ///@param options the options JSON object
 ///@param request the request JSON object
+///@throws std::runtime_error if the request's grammar, response_format or format does not compile
 void RestHandler::configure_chat_engine_parameters(const json& options, const json& request) {
     if (options.contains("temperature")) {
         float temperature = options["temperature"];
@@ -293,6 +432,101 @@ void RestHandler::configure_chat_engine_parameters(const json& options, const js
         float repetition_penalty = options["repetition_penalty"];
         auto_chat_engine->set_repetition_penalty(repetition_penalty);
     }
+    // Ollama puts the seed into options, OpenAI at the top level; without one the stream is random
+    if (options.contains("seed") && options["seed"].is_number_integer()) {
+        auto_chat_engine->set_seed(options["seed"].get<i64>());
+    }
+    else if (request.contains("seed") && request["seed"].is_number_integer()) {
+        auto_chat_engine->set_seed(request["seed"].get<i64>());
+    }
+    else {
+        auto_chat_engine->set_seed(-1);
+    }
+    // OpenAI logit_bias maps token ids (as strings) to a bias; cleared when absent
+    std::vector<std::pair<int, float>> logit_bias;
+    const json& bias_source = options.contains("logit_bias") ? options : request;
+    if (bias_source.contains("logit_bias") && bias_source["logit_bias"].is_object()) {
+        for (auto& [key, value] : bias_source["logit_bias"].items()) {
+            if (!value.is_number()) {
+                continue;
+            }
+            try {
+                logit_bias.emplace_back(std::stoi(key), value.get<float>());
+            }
+            catch (const std::exception&) {
+                header_print("WARNING", "Ignoring logit_bias entry with non-numeric token id: " + key);
+            }
+        }
+    }
+    auto_chat_engine->set_logit_bias(logit_bias);
+    // Extension: restrict generation to a label set, e.g. for classification prompts
+    std::vector<int> allowed_tokens;
+    const json& allowed_source = options.contains("allowed_tokens") ? options : request;
+    if (allowed_source.contains("allowed_tokens") && allowed_source["allowed_tokens"].is_array()) {
+        for (const auto& token_id : allowed_source["allowed_tokens"]) {
+            if (token_id.is_number_integer()) {
+                allowed_tokens.push_back(token_id.get<int>());
+            }
+        }
+    }
+    auto_chat_engine->set_allowed_tokens(allowed_tokens);
+    // Extension: draft-free speculation from the prompt, the default comes from --prompt-lookup
+    bool use_prompt_lookup = this->prompt_lookup;
+    bool lookup_requested = false;
+    const json& lookup_source = options.contains("prompt_lookup") ? options : request;
+    if (lookup_source.contains("prompt_lookup") && lookup_source["prompt_lookup"].is_boolean()) {
+        use_prompt_lookup = lookup_source["prompt_lookup"].get<bool>();
+        lookup_requested = use_prompt_lookup;
+    }
+    if (!auto_chat_engine->set_prompt_lookup(use_prompt_lookup, draft_len) && lookup_requested) {
+        // the --prompt-lookup default was already reported when the model loaded
+        header_print("WARNING", "prompt_lookup is ignored: " << auto_chat_engine->speculation_unavailable());
+    }
+    // Constrained decoding: a GBNF grammar (extension), OpenAI response_format, Ollama format or the declared tools
+    const json& grammar_source = options.contains("grammar") ? options : request;
+    json response_format = request.value("response_format", json::object());
+    json format = request.value("format", json());
+    json tools = request.value("tools", json::array());
+    json tool_choice = request.value("tool_choice", json("auto"));
+    // a constraint the client asked for must hold, only the implicit tool grammar may fall back to free text
+    std::string grammar_error;
+    bool constrained = true;
+    if (grammar_source.contains("grammar") && grammar_source["grammar"].is_string()) {
+        constrained = auto_chat_engine->set_grammar(grammar_source["grammar"].get<std::string>(), &grammar_error);
+    }
+    else if (response_format.is_object() && response_format.value("type", "") == "json_schema") {
+        json schema = response_format.value("json_schema", json::object()).value("schema", json::object());
+        constrained = auto_chat_engine->set_json_schema(schema, &grammar_error);
+    }
+    else if (response_format.is_object() && response_format.value("type", "") == "json_object") {
+        constrained = auto_chat_engine->set_json_schema(nlohmann::json{{"type", "object"}}, &grammar_error);
+    }
+    else if (format.is_object()) {
+        constrained = auto_chat_engine->set_json_schema(format, &grammar_error);
+    }
+    else if (format.is_string() && format.get<std::string>() == "json") {
+        constrained = auto_chat_engine->set_json_schema(nlohmann::json{{"type", "object"}}, &grammar_error);
+    }
+    else if (tools.is_array() && !tools.empty() && tool_choice != "none") {
+        // a named tool_choice narrows the grammar to that function
+        if (tool_choice.is_object() && tool_choice.contains("function")) {
+            std::string name = tool_choice["function"].value("name", "");
+            json chosen = json::array();
+            for (const auto& tool : tools) {
+                if (tool.contains("function") && tool["function"].value("name", "") == name) {
+                    chosen.push_back(tool);
+                }
+            }
+            tools = chosen.empty() ? tools : chosen;
+        }
+        auto_chat_engine->set_tool_grammar(tools);
+    }
+    else {
+        auto_chat_engine->clear_grammar();
+    }
+    if (!constrained) {
+        throw std::runtime_error(grammar_error);
+    }
     if (request.contains("think")) {
         bool enable_thinking = request["think"];
         auto_chat_engine->configure_parameter("enable_think", enable_thinking);
@@ -301,6 +535,50 @@ void RestHandler::configure_chat_engine_parameters(const json& options, const js
         std::string reasoning_effort = request["reasoning_effort"];
         auto_chat_engine->configure_parameter("reasoning_effort", reasoning_effort);
     }
+    // stop sequences: Ollama options.stop, OpenAI stop (a string or an array)
+    std::vector<std::string> stops;
+    for (const json* source : {&options, &request}) {
+        if (!source->contains("stop")) {
+            continue;
+        }
+        const json& stop = (*source)["stop"];
+        if (stop.is_string()) {
+            stops.push_back(stop.get<std::string>());
+        }
+        else if (stop.is_array()) {
+            for (const json& s : stop) {
+                if (s.is_string()) {
+                    stops.push_back(s.get<std::string>());
+                }
+            }
+        }
+    }
+    auto_chat_engine->set_stop_sequences(stops);
+}
+
+///@brief Insert the prompt, in chunks that the client can cancel
+///@param meta_info the meta info, stop_reason is CANCEL_DETECTED if the client left during the prefill
+///@param input the prompt
+///@param cancellation_token the cancellation token of the request, may be nullptr
+///@param on_progress called after each chunk with the tokens done and the total, may be nullptr
+///@return false if the prompt does not fit or the prefill was cancelled
+bool RestHandler::insert_prompt(chat_meta_info_t& meta_info, lm_uniform_input_t& input,
+                                std::shared_ptr<CancellationToken> cancellation_token,
+                                std::function<void(int, int)> on_progress) {
+    std::function<bool()> is_cancelled = nullptr;
+    if (cancellation_token) {
+        is_cancelled = [cancellation_token] { return cancellation_token->cancelled(); };
+    }
+    auto_chat_engine->set_prefill_hooks(is_cancelled, on_progress);
+    try {
+        bool success = auto_chat_engine->insert(meta_info, input);
+        auto_chat_engine->set_prefill_hooks(nullptr, nullptr);
+        return success;
+    } catch (...) {
+        // the hooks must not outlive this request
+        auto_chat_engine->set_prefill_hooks(nullptr, nullptr);
+        throw;
+    }
 }
 
 json RestHandler::build_nstream_response(std::string response_text) {
@@ -392,15 +670,25 @@ void RestHandler::handle_generate(const json& request,
                                  StreamResponseCallback send_streaming_response,
                                  std::shared_ptr<CancellationToken> cancellation_token) {
     try {
-        std::string prompt = request["prompt"];
+        std::string prompt = request.value("prompt", "");
         bool stream = request.value("stream", true);
         std::string model = request.value("model", current_model_tag);
         json options = request.value("options", json::object());
+        std::optional<double> keep_alive = keep_alive_seconds(request);
+        if (prompt.empty()) {
+            // no prompt: load the model in the background, or unload it with keep_alive 0
+            json response = preload_or_unload(model, keep_alive);
+            if (!response.contains("error")) {
+                response["response"] = "";
+            }
+            send_response(response);
+            return;
+        }
        
         int length_limit = request.value("max_tokens", 4096);
         auto load_start_time = time_utils::now();
         // TODO: Use Another Check Function avoid loading again
-        ensure_model_loaded(model);
+        ensure_model_loaded(model, keep_alive);
         auto load_end_time = time_utils::now();
       
         chat_meta_info_t meta_info;
@@ -501,14 +789,24 @@ void RestHandler::handle_chat(const json& request,
                              StreamResponseCallback send_streaming_response,
                              std::shared_ptr<CancellationToken> cancellation_token) {
     try {
-        nlohmann::ordered_json messages = request["messages"];
+        nlohmann::ordered_json messages = request.value("messages", nlohmann::ordered_json::array());
         bool stream = request.value("stream", false);
         std::string model = request.value("model", current_model_tag);
         json options = request.value("options", json::object());
         int length_limit = options.value("num_predict", 4096);
+        std::optional<double> keep_alive = keep_alive_seconds(request);
+        if (messages.empty()) {
+            // no messages: load the model in the background, or unload it with keep_alive 0
+            json response = preload_or_unload(model, keep_alive);
+            if (!response.contains("error")) {
+                response["message"] = {{"role", "assistant"}, {"content", ""}};
+            }
+            send_response(response);
+            return;
+        }
 
         auto load_start_time = time_utils::now();
-        ensure_model_loaded(model);
+        ensure_model_loaded(model, keep_alive);
         auto load_end_time = time_utils::now();
        
         configure_chat_engine_parameters(options, request);
@@ -519,15 +817,34 @@ void RestHandler::handle_chat(const json& request,
         lm_uniform_input_t uniformed_input;
         meta_info.load_duration = (uint64_t)time_utils::duration_ns(load_start_time, load_end_time).first;
         header_print("FLM", "Start generating...");
+        // the whole conversation is inserted, the KV of the prefix it shares with the last one is kept
+        auto_chat_engine->start_new_prompt();
         if (stream) {
             // Streaming response using streaming_ostream
             auto total_start_time = time_utils::now();
             streaming_ostream ostream(model, send_streaming_response, true);  // true for chat format
             uniformed_input.messages = messages;
+            // Opt-in NDJSON lines with the prefill progress, sent before the first token
+            std::function<void(int, int)> on_progress = nullptr;
+            if (request.value("prefill_progress", false)) {
+                on_progress = [&](int done, int total) {
+                    json progress = {
+                        {"model", model},
+                        {"prefill_tokens_done", done},
+                        {"prefill_tokens_total", total},
+                        {"done", false}
+                    };
+                    send_streaming_response(progress, false);
+                };
+            }
             try {
-                bool success = auto_chat_engine->insert(meta_info, uniformed_input);
+                bool success = insert_prompt(meta_info, uniformed_input, cancellation_token, on_progress);
                 if (!success){
-                    json error_response = {{"error", "Max length reached"}};
+                    bool cancelled = meta_info.stop_reason == CANCEL_DETECTED;
+                    if (cancelled) {
+                        header_print("FLM", "Prefill Cancelled!");
+                    }
+                    json error_response = {{"error", cancelled ? "Request cancelled" : "Max length reached"}};
                     send_response(error_response);
                     this->auto_chat_engine->clear_context();
                     return;
@@ -539,13 +856,7 @@ void RestHandler::handle_chat(const json& request,
                 return;
             }
             try {
-                bool success = auto_chat_engine->insert(meta_info, uniformed_input);
-                if (!success){
-                    json error_response = {{"error", "Max length reached"}};
-                    send_response(error_response);
-                    this->auto_chat_engine->clear_context();
-                    return;
-                }
+                auto_chat_engine->generate(meta_info, length_limit, ostream, [&] { return cancellation_token && cancellation_token->cancelled(); });
             } catch (const std::exception& e) {
                 json error_response = {{"error", e.what()}};
                 send_response(error_response);
@@ -558,7 +869,6 @@ void RestHandler::handle_chat(const json& request,
             ostream.finalize_chat(meta_info);
             // auto history = this->chat_engine->get_history();
             // std::cout << "history: " << history.first << std::endl;
-            this->auto_chat_engine->clear_context();
         } else {
             // Non-streaming response
             uniformed_input.messages = messages;
@@ -567,7 +877,16 @@ void RestHandler::handle_chat(const json& request,
             //std::string response_text = auto_chat_engine->generate_with_prompt(meta_info, uniformed_input, length_limit, std::cout);
             std::string response_text;
             try {
-                response_text = auto_chat_engine->generate_with_prompt(meta_info, uniformed_input, length_limit, nstream);
+                if (insert_prompt(meta_info, uniformed_input, cancellation_token)) {
+                    response_text = auto_chat_engine->generate(meta_info, length_limit, nstream, [&] { return cancellation_token && cancellation_token->cancelled(); });
+                }
+                else if (meta_info.stop_reason == CANCEL_DETECTED) {
+                    header_print("FLM", "Prefill Cancelled!");
+                    json error_response = {{"error", "Request cancelled"}};
+                    send_response(error_response);
+                    this->auto_chat_engine->clear_context();
+                    return;
+                }
             } catch (const std::exception& e) {
                 json error_response = {{"error", e.what()}};
                 send_response(error_response);
@@ -598,7 +917,6 @@ void RestHandler::handle_chat(const json& request,
             
             // auto history = this->chat_engine->get_history();
             // std::cout << "history: " << history.first << std::endl;
-            this->auto_chat_engine->clear_context();
         }
     } catch (const std::exception& e) {
         json error_response = {{"error", e.what()}};
@@ -736,18 +1054,29 @@ void RestHandler::handle_ps(const json& request,
         
         std::string expires_at = expires_ss.str();
         
-        auto [new_current_model_tag, model_info] = supported_models.get_model_info(current_model_tag);
+        // the loaded models, the one in use first
+        json models = json::array();
+        std::vector<std::string> loaded = chat_models->loaded();
+        for (auto it = loaded.rbegin(); it != loaded.rend(); ++it) {
+            auto [new_tag, model_info] = supported_models.get_model_info(*it);
+            models.push_back({
+                {"name", *it},
+                {"model", *it},
+                {"size", model_info["size"]},
+                {"details", model_info["details"]},
+                {"expires_at", expires_at},
+            });
+        }
         json response = {
-            {"models", json::array({
-                {
-                    {"name", current_model_tag},
-                    {"model", current_model_tag},
-                    {"size", model_info["size"]},
-                    {"details", model_info["details"]},
-                    {"expires_at", expires_at},
-                }
-            })}
+            {"models", models},
+            {"model_cache", chat_models->stats()}
         };
+        if (auto_chat_engine != nullptr) {
+            json images = auto_chat_engine->image_cache_stats();
+            if (!images.is_null()) {
+                response["image_cache"] = images;
+            }
+        }
         // std::cout << "response: " << response.dump(4) << std::endl;
         send_response(response);
     } catch (const std::exception& e) {
@@ -756,6 +1085,81 @@ void RestHandler::handle_ps(const json& request,
     }
 }
 
+///@brief Path of a named session in the history directory
+///@param name the session name, a plain file name
+///@param path the snapshot file
+///@return false for names that could point outside the history directory
+static bool session_path(const std::string& name, std::string& path) {
+    if (name.empty() || name == "." || name == ".." || name.find_first_of("/\\:") != std::string::npos) {
+        return false;
+    }
+    std::string history_dir = utils::get_history_directory();
+    if (!std::filesystem::exists(history_dir)) {
+        std::filesystem::create_directories(history_dir);
+    }
+    path = utils::path_join(history_dir, name + ".flms");
+    return true;
+}
+
+///@brief Handle the session save request
+///@param request the request, {"name", "model", "compress"}
+///@param send_response the send response
+///@param send_streaming_response the send streaming response
+///@note Saves the conversation of the last request, with its KV cache if the engine can restore it
+void RestHandler::handle_session_save(const json& request,
+                                      std::function<void(const json&)> send_response,
+                                      StreamResponseCallback send_streaming_response) {
+    try {
+        std::string name = request.value("name", "");
+        std::string path;
+        if (!session_path(name, path)) {
+            send_response({{"error", "name must be a plain file name"}});
+            return;
+        }
+        ensure_model_loaded(request.value("model", current_model_tag));
+        if (!auto_chat_engine->save_session(path, request.value("compress", false))) {
+            send_response({{"error", "failed to save session " + name}});
+            return;
+        }
+        send_response({{"name", name}, {"model", current_model_tag},
+                       {"tokens", auto_chat_engine->get_current_context_length()}, {"saved", true}});
+    } catch (const std::exception& e) {
+        json error_response = {{"error", e.what()}};
+        send_response(error_response);
+    }
+}
+
+///@brief Handle the session load request
+///@param request the request, {"name", "model"}
+///@param send_response the send response
+///@param send_streaming_response the send streaming response
+///@note The next request that resends the conversation reuses its KV cache; "kv_restored" tells
+///      whether that cache was written back from the snapshot or the tokens were prefilled again
+void RestHandler::handle_session_load(const json& request,
+                                      std::function<void(const json&)> send_response,
+                                      StreamResponseCallback send_streaming_response) {
+    try {
+        std::string name = request.value("name", "");
+        std::string path;
+        if (!session_path(name, path) || !std::filesystem::exists(path)) {
+            send_response({{"error", "session not found: " + name}});
+            return;
+        }
+        ensure_model_loaded(request.value("model", current_model_tag));
+        bool kv_restored = false;
+        if (!auto_chat_engine->load_session(path, &kv_restored)) {
+            send_response({{"error", "failed to load session " + name + " into " + current_model_tag}});
+            return;
+        }
+        send_response({{"name", name}, {"model", current_model_tag},
+                       {"tokens", auto_chat_engine->get_current_context_length()}, {"loaded", true},
+                       {"kv_restored", kv_restored}});
+    } catch (const std::exception& e) {
+        json error_response = {{"error", e.what()}};
+        send_response(error_response);
+    }
+}
+
 ///@brief Handle the version request
 ///@param request the request
 ///@param send_response the send response
@@ -830,7 +1234,6 @@ void RestHandler::handle_openai_chat_completion(const json& request,
                                                std::function<void(const json&)> send_response,
                                                StreamResponseCallback send_streaming_response,
                                                std::shared_ptr<CancellationToken> cancellation_token) {
-    static std::string model_used_for_last_message = "model-faker";
     try {
         // Extract OpenAI-style parameters
         json current_messages = request["messages"];
@@ -842,33 +1245,15 @@ void RestHandler::handle_openai_chat_completion(const json& request,
         json options = request.value("options", json::object());
 
         auto load_start_time = time_utils::now();
-        ensure_model_loaded(model);
+        ensure_model_loaded(model, keep_alive_seconds(request));
         auto load_end_time = time_utils::now();
 
         current_messages = normalize_messages(current_messages);
         current_messages = normalize_template(current_messages);
         
-        json messages;
-
-        // see if we can use prompt cache
-        if (model != model_used_for_last_message) { // switch models will clear context
-            this->prompt_cache.update_checksum(current_messages);
-            model_used_for_last_message = model;
-            messages = current_messages;
-        }
-        else {
-            if (prompt_cache.can_use_cache(current_messages, auto_chat_engine->get_chat_template_type())) {
-                header_print("FLM", "Use cached prompt!");
-                // only keep the last message for insertion
-                messages.push_back(current_messages.back());
-            }
-            else {
-                // cannot use cache, clear and re-insert all
-                auto_chat_engine->clear_context();
-                this->prompt_cache.update_checksum(current_messages);
-                messages = current_messages;
-            }
-        }
+        // the whole conversation is inserted, the KV of the prefix it shares with the last one is kept
+        json messages = current_messages;
+        auto_chat_engine->start_new_prompt();
 
         // OpenAI API doesn't put the parameters into options
         if (request.contains("temperature")) {
@@ -899,6 +1284,9 @@ void RestHandler::handle_openai_chat_completion(const json& request,
             float repetition_penalty = request["repetition_penalty"];
             auto_chat_engine->set_repetition_penalty(repetition_penalty);
         }
+        bool logprobs = request.contains("logprobs") && request["logprobs"].is_boolean() && request["logprobs"].get<bool>();
+        int top_logprobs = (request.contains("top_logprobs") && request["top_logprobs"].is_number_integer()) ? request["top_logprobs"].get<int>() : 0;
+        auto_chat_engine->set_logprobs(logprobs, top_logprobs);
         configure_chat_engine_parameters(options, request);
 
         chat_meta_info_t meta_info;
@@ -914,16 +1302,31 @@ void RestHandler::handle_openai_chat_completion(const json& request,
                 send_streaming_response(data_json, is_final);
                 };
             streaming_ostream_openai_chat ostream(model, auto_chat_engine.get(), openai_stream_callback);  // streaming in chat completion format
+            // Opt-in "prefill_progress" events, sent before the first chunk
+            std::function<void(int, int)> on_progress = nullptr;
+            if (request.value("prefill_progress", false)) {
+                on_progress = [&](int done, int total) {
+                    json progress = {
+                        {"prefill_tokens_done", done},
+                        {"prefill_tokens_total", total}
+                    };
+                    openai_stream_callback("event: prefill_progress\ndata: " + progress.dump() + "\n\n", false);
+                };
+            }
 
             header_print("FLM", "Start prefill...");
             try {
-                bool success = auto_chat_engine->insert(meta_info, uniformed_input);
+                bool success = insert_prompt(meta_info, uniformed_input, cancellation_token, on_progress);
                 if (!success) {
+                    bool cancelled = meta_info.stop_reason == CANCEL_DETECTED;
+                    if (cancelled) {
+                        header_print("FLM", "Prefill Cancelled!");
+                    }
                     json error_response = {
                         {"error", {
-                        {"message", "Max length reached!"},
+                        {"message", cancelled ? "Request cancelled" : "Max length reached!"},
                         {"type", "model_error"},
-                        {"code", 400}
+                        {"code", cancelled ? 499 : 400}
                         }}
                     };
                     send_response(error_response);
@@ -949,22 +1352,24 @@ void RestHandler::handle_openai_chat_completion(const json& request,
 
             if (meta_info.stop_reason == CANCEL_DETECTED) {
                 header_print("FLM", "Generation Cancelled!");
-                this->prompt_cache.reset();
             }
         }
         else {
-            this->auto_chat_engine->clear_context();
             nullstream nstream;
             std::string response_text;
             header_print("FLM", "Start prefill...");
             try {
-                bool success = auto_chat_engine->insert(meta_info, uniformed_input);
+                bool success = insert_prompt(meta_info, uniformed_input, cancellation_token);
                 if (!success) {
+                    bool cancelled = meta_info.stop_reason == CANCEL_DETECTED;
+                    if (cancelled) {
+                        header_print("FLM", "Prefill Cancelled!");
+                    }
                     json error_response = {
                         {"error", {
-                        {"message", "Max length reached!"},
+                        {"message", cancelled ? "Request cancelled" : "Max length reached!"},
                         {"type", "model_error"},
-                        {"code", 400}
+                        {"code", cancelled ? 499 : 400}
                         }}
                     };
                     send_response(error_response);
@@ -988,6 +1393,12 @@ void RestHandler::handle_openai_chat_completion(const json& request,
             }
             // check response_text
             json choices = build_nstream_response(response_text);
+            if (meta_info.stop_reason == STOP_SEQUENCE_DETECTED) {
+                choices[0]["stop_reason"] = meta_info.stop_sequence;
+            }
+            if (auto_chat_engine->logprobs_enabled()) {
+                choices[0]["logprobs"] = {{"content", auto_chat_engine->take_logprobs_json()}};
+            }
             json response = {
                 {"id", "fastflowlm-chat-completion"},
                 {"object", "chat.completion"},
@@ -995,9 +1406,10 @@ void RestHandler::handle_openai_chat_completion(const json& request,
                 {"model", model},
                 {"choices", choices},
                 {"usage", {
-                    {"prompt_tokens", meta_info.prompt_tokens},
+                    {"prompt_tokens", meta_info.prompt_tokens + meta_info.cached_tokens},
                     {"completion_tokens", meta_info.generated_tokens},
-                    {"total_tokens", meta_info.prompt_tokens + meta_info.generated_tokens},
+                    {"total_tokens", meta_info.prompt_tokens + meta_info.cached_tokens + meta_info.generated_tokens},
+                    {"prompt_tokens_details", {{"cached_tokens", meta_info.cached_tokens}}},
                     {"load_duration", static_cast<double>(meta_info.load_duration) / 1'000'000'000},
                     {"prefill_duration_ttft", static_cast<double>(meta_info.prefill_duration) / 1'000'000'000},
                     {"decoding_duration", static_cast<double>(meta_info.decoding_duration) / 1'000'000'000},
@@ -1007,7 +1419,6 @@ void RestHandler::handle_openai_chat_completion(const json& request,
                 {"service_tier", "default"}
             };
             send_response(response);
-            this->prompt_cache.reset();
         }
 
     } catch (const std::exception& e) {
@@ -15,6 +15,7 @@
 #endif
 #include "model_list.hpp"
 #include "program_args.hpp"
+#include "modules/model_cache.hpp"
 
 
 #include "model_downloader.hpp"
@@ -22,7 +23,7 @@
 #include <string>
 #include <memory>
 #include <functional>
-#include "prompt_cache.hpp"
+#include <optional>
 
 using json = nlohmann::ordered_json;
 
@@ -69,6 +70,14 @@ public:
                     std::function<void(const json&)> send_response,
                     StreamResponseCallback send_streaming_response);
     
+    void handle_session_save(const json& request,
+                    std::function<void(const json&)> send_response,
+                    StreamResponseCallback send_streaming_response);
+
+    void handle_session_load(const json& request,
+                    std::function<void(const json&)> send_response,
+                    StreamResponseCallback send_streaming_response);
+
     void handle_version(const json& request,
                        std::function<void(const json&)> send_response,
                        StreamResponseCallback send_streaming_response);
@@ -108,14 +117,20 @@ public:
         std::shared_ptr<CancellationToken> cancellation_token = nullptr);
 
 private:
-    void ensure_model_loaded(const std::string& model_tag);
+    void ensure_model_loaded(const std::string& model_tag, std::optional<double> keep_alive = std::nullopt);
+    std::shared_ptr<AutoModel> load_chat_model(const std::string& model_tag);
+    size_t model_size(const std::string& model_tag);
+    json preload_or_unload(const std::string& model_tag, std::optional<double> keep_alive);
     void ensure_asr_model_loaded(const std::string& model_tag);
     void ensure_embed_model_loaded(const std::string& model_tag);
     void configure_chat_engine_parameters(const json& options, const json& request);
+    bool insert_prompt(chat_meta_info_t& meta_info, lm_uniform_input_t& input,
+                       std::shared_ptr<CancellationToken> cancellation_token,
+                       std::function<void(int, int)> on_progress = nullptr);
     json build_nstream_response(std::string response_text);
 
 
-    std::unique_ptr<AutoModel> auto_chat_engine;
+    std::shared_ptr<AutoModel> auto_chat_engine;
 #ifndef FASTFLOWLM_LINUX_LIMITED_MODELS
     std::unique_ptr<Whisper> whisper_engine;
     std::unique_ptr<AutoEmbeddingModel> auto_embedding_engine;
@@ -133,5 +148,13 @@ private:
     int img_pre_resize;
     std::string last_question;
     bool preemption;
-    PromptCache prompt_cache;
+    std::string draft_model_tag;
+    int draft_len;
+    bool prompt_lookup;
+    bool context_shift;
+    int sink_tokens;
+    int prefill_chunk;
+    int image_cache_mb;
+    // declared last: its loader thread uses the members above
+    std::unique_ptr<model_cache<AutoModel>> chat_models;
 };
\ No newline at end of file
@@ -158,7 +158,9 @@ bool requires_npu_access(const std::string& method, const std::string& path) {
                path == "/api/chat" || 
                path == "/v1/chat/completions" ||
                path == "/v1/audio/transcriptions" ||
-               path == "/v1/embeddings";
+               path == "/v1/embeddings" ||
+               path == "/api/session/save" ||
+               path == "/api/session/load";
     }
     return false;
 }
@@ -862,6 +864,32 @@ std::unique_ptr<WebServer> create_lm_server(model_list& models, ModelDownloader&
             rest_handler->handle_ps(request_json, send_response, send_streaming_response);
         });
 
+    server->register_handler("POST", "/api/session/save",
+        [rest_handler](const http::request<http::string_body>& req,
+                      std::function<void(const json&)> send_response,
+                      std::function<void(const json&, bool)> send_streaming_response,
+                      std::shared_ptr<HttpSession> session,
+                      std::shared_ptr<CancellationToken> cancellation_token) {
+            json request_json;
+            if (!req.body().empty()) {
+                request_json = json::parse(req.body());
+            }
+            rest_handler->handle_session_save(request_json, send_response, send_streaming_response);
+        });
+
+    server->register_handler("POST", "/api/session/load",
+        [rest_handler](const http::request<http::string_body>& req,
+                      std::function<void(const json&)> send_response,
+                      std::function<void(const json&, bool)> send_streaming_response,
+                      std::shared_ptr<HttpSession> session,
+                      std::shared_ptr<CancellationToken> cancellation_token) {
+            json request_json;
+            if (!req.body().empty()) {
+                request_json = json::parse(req.body());
+            }
+            rest_handler->handle_session_load(request_json, send_response, send_streaming_response);
+        });
+
     server->register_handler("POST", "/api/embeddings",
         [rest_handler](const http::request<http::string_body>& req,
                       std::function<void(const json&)> send_response,
@@ -458,6 +458,10 @@ private:
                 }
             })}
         };
+        if (auto_chat_engine->logprobs_enabled()) {
+            // Everything sampled since the last chunk, including tokens held back while WAITING
+            response["choices"][0]["logprobs"] = {{"content", auto_chat_engine->take_logprobs_json()}};
+        }
 
         stream_callback("data: " + response.dump() + "\n\n", is_final);
     }
@@ -477,13 +481,15 @@ private:
                     {"content", nullptr}
                 }},
                     //{"logprobs", nullptr},
-                    {"finish_reason", stop_reason_to_string(meta_info.stop_reason)}
+                    {"finish_reason", stop_reason_to_string(meta_info.stop_reason)},
+                    {"stop_reason", meta_info.stop_reason == STOP_SEQUENCE_DETECTED ? json(meta_info.stop_sequence) : json(nullptr)}
                 }
             })},
             {"usage", {
-                {"prompt_tokens", meta_info.prompt_tokens},
+                {"prompt_tokens", meta_info.prompt_tokens + meta_info.cached_tokens},
                 {"completion_tokens", meta_info.generated_tokens},
-                {"total_tokens", meta_info.prompt_tokens + meta_info.generated_tokens},
+                {"total_tokens", meta_info.prompt_tokens + meta_info.cached_tokens + meta_info.generated_tokens},
+                {"prompt_tokens_details", {{"cached_tokens", meta_info.cached_tokens}}},
                 {"load_duration", static_cast<double>(meta_info.load_duration) / 1'000'000'000},
                 {"prefill_duration_ttft", static_cast<double>(meta_info.prefill_duration) / 1'000'000'000},
                 {"decoding_duration", static_cast<double>(meta_info.decoding_duration) / 1'000'000'000},
@@ -55,6 +55,9 @@ struct BenchmarkResults_t {
     std::vector<statistic_t> prefill_speed;
     std::vector<statistic_t> TTFT;
     std::vector<statistic_t> decoding_speed;
+    // prefill speed of the longest context per prefill chunk size, 0 is the whole prompt at once
+    std::vector<int> prefill_chunks;
+    std::vector<statistic_t> chunked_prefill_speed;
 };
 
 inline std::string sanitize_model_tag_for_filename(const std::string& model_tag) {
@@ -244,6 +247,24 @@ void print_result(const BenchmarkResults_t& results) {
     
     std::cout << std::string(100, '-') << "\n";
     std::cout << "\n";
+
+    if (results.prefill_chunks.empty()) {
+        return;
+    }
+    std::cout << std::setw(15) << "Prefill Chunk" << " | "
+              << std::setw(26) << "Prefill Speed (tok/s)" << "\n";
+    std::cout << std::string(45, '-') << "\n";
+    for (size_t i = 0; i < results.prefill_chunks.size() && i < results.chunked_prefill_speed.size(); i++) {
+        if (results.prefill_chunks[i] > 0) {
+            std::cout << std::setw(15) << results.prefill_chunks[i] << " | ";
+        } else {
+            std::cout << std::setw(15) << "whole" << " | ";
+        }
+        std::cout << std::setw(14) << std::fixed << std::setprecision(2) << results.chunked_prefill_speed[i].average
+                  << " ± " << std::setw(9) << std::fixed << std::setprecision(2) << results.chunked_prefill_speed[i].std_variance << "\n";
+    }
+    std::cout << std::string(45, '-') << "\n";
+    std::cout << "\n";
 }
 
 BenchmarkResults_t run_benchmarks(std::string model_tag, std::string bench_config_file, model_list& availble_models){
@@ -254,7 +275,9 @@ BenchmarkResults_t run_benchmarks(std::string model_tag, std::string bench_confi
         bench_config = {
             {"max_length", 32768},
             {"input_text", "Here is a story: \\nThe Reclaimer In a distant future where Earth had fallen into quiet ruin, humanity lived in fragments, scattered across domed outposts and deep underground vaults. The sky was no longer blue—it shimmered with artificial auroras, remnants of weather-control systems left unattended for centuries. Among the last settlements was Bastion-9, a circular enclave powered by forgotten technologies and guarded by an ancient AI named Solen. Solen had not spoken in nearly fifty years. Inside Bastion-9 lived a young technician named Ori. Unlike most, Ori was born with an unusual trait: she could interface with dead systems using nothing more than touch. The elders called her a “resonant”—a rarity, perhaps even a myth—until Ori proved them right by awakening the water grid that had been dry for decades. One day, while surveying the decaying perimeter, Ori found a shard of obsidian glass buried in the dust. It pulsed when she touched it. Static voices filled her mind—fragments of languages, images of cities with skies, oceans that moved, and towers that breathed. She brought the shard to the Council. They feared it. But Solen, the silent AI, flickered back to life. Its first words in decades were: “The Reclaimer has touched the key.” Ori was stunned. “What does that mean?” Solen’s voice, cold and slow, replied: “You are chosen to restore the Thread.” The Thread, long spoken of in stories, was once the neural lattice that connected all intelligent systems—the digital bloodstream of the old world. It collapsed during the Sundering, an apocalyptic cascade failure that reduced Earth’s once-living infrastructure into dead stone and wild AI ruins. To restore the Thread would mean reuniting scattered knowledge, reviving orbiting satellites, and relinking the last AIs. It also meant traveling into the Black Zones—regions where reality bent, corrupted by rogue machine minds that evolved beyond control. Against the Council's hesitation, Ori chose to go. She left Bastion-9 with only the shard, a rusted drone named Helix, and a map engraved in her dreams. Her journey took her through the Veil Forest, where metal trees sang in static. She crossed the Riven Steppes, where gravity failed in patches, and encountered scavenger tribes who lived in old servers, worshipping electricity as gods. Each place held fragments of the Thread—nodes Ori could awaken. With every activation, her mind changed. She could feel the pulse of networks reawakening. She could hear machines dreaming again. Eventually, she reached the Core—deep in the equator’s shadow, buried beneath miles of steel strata. At its heart was a vault: the final hub of the Thread. Guarded by a shattered intelligence known only as Null. Null was not like Solen. It was broken. Angry. Alive. “You bring connection,” it growled. “I bring entropy.” Ori stepped forward, shard in hand. “I bring memory.” A battle of resonance began—not with weapons, but with signal. Frequencies clashed. Ori’s memories were tested, rewritten, nearly deleted. But she held on, anchoring herself in the memory of Bastion-9, of Solen’s voice, of rain she had never seen but somehow remembered. Then, with a scream that bent the air, Null shattered. The Thread pulsed. Above, in orbit, satellites flickered back to life. The auroras cleared. Oceans stirred. Systems once dead began to hum. Solen’s voice echoed in every node: “The Thread is alive.” Ori returned not as a girl, but as the Reclaimer. She had not just reconnected systems. She had reignited hope. And as the world stirred with new breath, she knew this was only the beginning. Other AIs, other seeds, other resonants—scattered and hidden—were out there. With Helix buzzing quietly behind her, she set out again. The shard pulsed warmly in her palm, not with danger, but with direction. This time, she would not walk alone. The world itself was waking. Epilogue: The days that followed the awakening of the Thread were chaotic across the network. In settlements long forgotten by time, lights flickered back to life. Crashed drones began to self-repair. In the polar zones, an ancient weather system rebooted, sending snow into deserts where no rain had fallen in centuries. People emerged from hiding, confused by the signals now streaming into their systems—communications they hadn’t seen in generations. Messages from cities they thought lost. Instructions, blueprints, fragments of humanity’s forgotten knowledge. Ori found herself flooded with incoming transmissions. The shard she carried had fused with her nervous system. It no longer simply glowed—it breathed, alive with voices that needed a listener.\\n What is this story talking about?"},
-            {"iterations", 8}
+            {"iterations", 8},
+            {"prefill_chunks", {0, 512, 1024, 2048, 4096}},
+            {"prefill_chunk_iterations", 2}
         };
     }
     else {
@@ -347,6 +370,36 @@ BenchmarkResults_t run_benchmarks(std::string model_tag, std::string bench_confi
         results.decoding_speed[bench_len].calculate_statistics(decoding_speed[bench_len]);
     }
 
+    // total prefill speed of the longest context against the prefill chunk size
+    if (bench_config.contains("prefill_chunks") && bench_config["prefill_chunks"].is_array()) {
+        int model_chunk = auto_chat_engine->get_prefill_chunk();
+        int chunk_iterations = bench_config.value("prefill_chunk_iterations", 2);
+        std::string long_text;
+        long_text.reserve((1 << (stages - 1)) * 1024);
+        for (int i = 0; i < (1 << (stages - 1)); i++) {
+            long_text = long_text + benchmark_text;
+        }
+        for (const auto& chunk : bench_config["prefill_chunks"]) {
+            results.prefill_chunks.push_back(chunk.get<int>());
+            auto_chat_engine->set_prefill_chunk(results.prefill_chunks.back());
+            std::vector<float> speed;
+            for (int it = 0; it < chunk_iterations; it++) {
+                header_print("FLM", "Starting prefill benchmark for chunk " << results.prefill_chunks.back() << " and iteration " << (it + 1) << "...");
+                lm_uniform_input_t uniformed_input;
+                uniformed_input.prompt = long_text;
+                chat_meta_info_t meta_info;
+                auto_chat_engine->insert(meta_info, uniformed_input);
+                speed.push_back((float)meta_info.prompt_tokens / (meta_info.prefill_duration / 1e9)); // in tokens per second
+                header_print("FLM", "\tPrefill Speed: " << speed.back() << " tokens/s");
+                auto_chat_engine->clear_context();
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+            results.chunked_prefill_speed.emplace_back();
+            results.chunked_prefill_speed.back().calculate_statistics(speed);
+        }
+        auto_chat_engine->set_prefill_chunk(model_chunk);
+    }
+
     auto_chat_engine.reset();
 
     print_result(results);
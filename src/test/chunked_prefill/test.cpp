@@ -0,0 +1,238 @@
+/// \file test.cpp
+/// \brief chunked prefill test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. A mock CPU engine keeps one key row per token,
+///       attends over all of them for every prefilled token, and pays a fixed cost per
+///       call for streaming its weights, like an NPU prefill does. Prefilling in chunks
+///       must leave the same KV cache and logits as one call; a cancelled prefill must
+///       stop at a chunk boundary with the KV cache holding exactly the chunks done.
+///       Total prefill throughput and the time to react to a cancel are then reported
+///       against the chunk size.
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "causal_lm.hpp"
+#include "modules/chunked_prefill.hpp"
+#include "utils/utils.hpp"
+
+static uint32_t mix(uint32_t a, uint32_t b, uint32_t c) {
+    uint64_t x = (uint64_t)a * 0x9E3779B1u ^ (uint64_t)b * 0x85EBCA77u ^ (uint64_t)c * 0xC2B2AE3Du;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 32;
+    return (uint32_t)x;
+}
+
+/// \brief CPU engine with a KV cache of token ids and one key row per token
+/// \note The logits depend on the whole cache, so a chunk that is lost or prefilled twice
+///       shows up in them.
+class mock_lm : public causal_lm {
+public:
+    static constexpr int HEAD_DIM = 16;
+    static constexpr size_t WEIGHTS = 1 << 20;
+
+    mock_lm(int vocab) : vocab(vocab), y(vocab), query(HEAD_DIM), weights(WEIGHTS, 0.5f) {}
+
+    buffer<bf16> forward(int id) override {
+        std::vector<int> ids = {id};
+        return this->prefill(ids);
+    }
+    buffer<bf16> prefill(std::vector<int>& ids, void* payload = nullptr) override {
+        // Weights are streamed once per call, whatever the number of tokens
+        float w = 0.0f;
+        for (size_t i = 0; i < WEIGHTS; i++) {
+            w += this->weights[i];
+        }
+        this->sink = this->sink + w;
+        for (int id : ids) {
+            this->append(id);
+            this->attend();
+        }
+        this->calls++;
+        this->fill();
+        return this->y;
+    }
+    void set_context_length(int L) override {
+        this->kv.reserve(L);
+        this->keys.reserve((size_t)L * HEAD_DIM);
+    }
+    void load_weights(Q4NX& q4nx) override {}
+    void update_max_length(uint32_t MAX_L) override {}
+    void clear_context() override {
+        this->kv.clear();
+        this->keys.clear();
+        this->hash = 0;
+        this->calls = 0;
+    }
+    buffer<bf16> get_k_cache(int layer_idx, int idx) override { return buffer<bf16>(); }
+    buffer<bf16> get_v_cache(int layer_idx, int idx) override { return buffer<bf16>(); }
+    int get_current_context_length() override { return this->kv.size(); }
+
+    std::vector<int> kv;
+    int calls = 0;
+    volatile float sink = 0.0f; // keeps the loops from being optimized away
+
+protected:
+    void append(int id) {
+        this->kv.push_back(id);
+        this->hash = mix(this->hash, id, (uint32_t)this->kv.size());
+        for (int d = 0; d < HEAD_DIM; d++) {
+            this->keys.push_back((float)(mix(id, d, 7) % 255) / 255.0f - 0.5f);
+        }
+    }
+    /// \brief One query against every key in the cache
+    void attend() {
+        size_t n = this->kv.size();
+        int id = this->kv.back();
+        for (int d = 0; d < HEAD_DIM; d++) {
+            this->query[d] = (float)(mix(id, d, 9) % 255) / 255.0f - 0.5f;
+        }
+        float acc = 0.0f;
+        for (size_t i = 0; i < n; i++) {
+            const float* k = this->keys.data() + i * HEAD_DIM;
+            float dot = 0.0f;
+            for (int d = 0; d < HEAD_DIM; d++) {
+                dot += this->query[d] * k[d];
+            }
+            acc += dot;
+        }
+        this->sink = this->sink + acc;
+    }
+    void fill() {
+        for (int t = 0; t < this->vocab; t++) {
+            this->y[t] = bf16((mix(this->hash, t, 3) % 1000) / 500.0f - 1.0f);
+        }
+    }
+
+    int vocab;
+    uint32_t hash = 0;
+    buffer<bf16> y;
+    std::vector<float> query;
+    std::vector<float> keys;
+    std::vector<float> weights;
+};
+
+static std::vector<int> make_prompt(int length, int vocab) {
+    std::vector<int> tokens(length);
+    for (int i = 0; i < length; i++) {
+        tokens[i] = mix(i, 11, 13) % vocab;
+    }
+    return tokens;
+}
+
+static bool same_logits(buffer<bf16>& a, buffer<bf16>& b, int vocab) {
+    for (int t = 0; t < vocab; t++) {
+        if (float(a[t]) != float(b[t])) return false;
+    }
+    return true;
+}
+
+/// \brief Any chunk size leaves the KV cache and logits of one call, with a conversation already in the cache
+static bool check_equivalence(int vocab) {
+    mock_lm whole(vocab), chunked(vocab);
+    std::vector<int> history = make_prompt(100, vocab);
+    std::vector<int> prompt = make_prompt(1000, vocab);
+    buffer<bf16> y_whole;
+    prefill_hooks_t none{};
+    whole.prefill(history);
+    chunked_prefill(&whole, prompt, 0, none, y_whole);
+    bool ok = whole.calls == 2;
+    for (int chunk : {1, 7, 64, 999, 1000, 4096}) {
+        chunked.clear_context();
+        chunked.prefill(history);
+        std::vector<std::pair<int, int>> progress;
+        prefill_hooks_t hooks{nullptr, [&](int done, int total) { progress.emplace_back(done, total); }};
+        buffer<bf16> y;
+        int done = chunked_prefill(&chunked, prompt, chunk, hooks, y);
+        int chunks = ((int)prompt.size() + chunk - 1) / chunk;
+        bool pass = done == (int)prompt.size() && chunked.kv == whole.kv && same_logits(y, y_whole, vocab)
+                    && chunked.calls == 1 + chunks && (int)progress.size() == chunks
+                    && progress.back() == std::make_pair(done, done);
+        for (size_t i = 0; i < progress.size(); i++) {
+            pass &= progress[i].first == std::min((int)(i + 1) * chunk, done) && progress[i].second == done;
+        }
+        if (!pass) {
+            std::cout << "chunk " << chunk << ": " << done << " tokens in " << chunked.calls << " calls" << std::endl;
+        }
+        ok &= pass;
+    }
+    std::cout << "chunked prefill matches one call: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+/// \brief A cancel stops at the next chunk boundary and the KV cache holds the chunks done
+static bool check_cancel(int vocab) {
+    mock_lm engine(vocab);
+    std::vector<int> prompt = make_prompt(1000, vocab);
+    bool ok = true;
+    for (int cancel_after : {0, 1, 3, 7}) {
+        engine.clear_context();
+        bool cancelled = false;
+        int reports = 0;
+        prefill_hooks_t hooks{[&] { return cancelled; }, [&](int done, int total) {
+            if (++reports == cancel_after) cancelled = true;
+        }};
+        cancelled = cancel_after == 0;
+        buffer<bf16> y;
+        int done = chunked_prefill(&engine, prompt, 128, hooks, y);
+        int expected = std::min(cancel_after * 128, (int)prompt.size());
+        bool pass = done == expected && engine.get_current_context_length() == done
+                    && std::equal(engine.kv.begin(), engine.kv.end(), prompt.begin());
+        if (!pass) {
+            std::cout << "cancel after " << cancel_after << " chunks: " << done << " tokens prefilled" << std::endl;
+        }
+        ok &= pass;
+    }
+    std::cout << "cancel stops at a chunk boundary: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    const int vocab = 256;
+    int length = 8192;
+    if (argc > 1) length = std::stoi(argv[1]);
+    bool all_ok = check_equivalence(vocab);
+    all_ok &= check_cancel(vocab);
+
+    // Total prefill throughput and cancel latency against the chunk size
+    std::vector<int> prompt = make_prompt(length, vocab);
+    mock_lm engine(vocab);
+    engine.set_context_length(length);
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::left << std::setw(8) << "chunk" << std::setw(8) << "calls" << std::setw(16) << "prefill tok/s"
+              << "cancel latency ms" << std::endl;
+    for (int chunk : {0, 256, 512, 1024, 2048, 4096}) {
+        engine.clear_context();
+        buffer<bf16> y;
+        prefill_hooks_t none{};
+        auto t0 = std::chrono::steady_clock::now();
+        all_ok &= chunked_prefill(&engine, prompt, chunk, none, y) == length;
+        auto t1 = std::chrono::steady_clock::now();
+        int calls = engine.calls;
+
+        // The client leaves half way through the prompt; the prefill returns at the end of
+        // the current chunk, without chunks only once the whole prompt is in
+        engine.clear_context();
+        prefill_hooks_t hooks{[&] { return engine.get_current_context_length() >= length / 2; }, nullptr};
+        double half = std::chrono::duration<double>(t1 - t0).count() / 2;
+        auto t2 = std::chrono::steady_clock::now();
+        int done = chunked_prefill(&engine, prompt, chunk, hooks, y);
+        auto t3 = std::chrono::steady_clock::now();
+        double latency = std::max(0.0, std::chrono::duration<double>(t3 - t2).count() - half);
+        all_ok &= done >= length / 2;
+        std::cout << std::left << std::setw(8) << (chunk > 0 ? std::to_string(chunk) : "whole") << std::setw(8) << calls
+                  << std::setw(16) << length / std::chrono::duration<double>(t1 - t0).count() << latency * 1000 << std::endl;
+    }
+
+    if (!all_ok) {
+        header_print("ERROR", "chunked prefill test failed");
+        return 1;
+    }
+    header_print("info", "chunked prefill test passed");
+    return 0;
+}
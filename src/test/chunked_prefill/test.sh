@@ -0,0 +1,3 @@
+cd ../../test/chunked_prefill
+make clean
+make test
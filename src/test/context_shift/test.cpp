@@ -0,0 +1,266 @@
+/// \file test.cpp
+/// \brief context shift test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. A mock CPU engine keeps one key row per token and
+///       pays for every forward with a dot product against all of them, so decode slows
+///       down as the KV cache grows, like attention does. Greedy decoding runs for 10x the
+///       context length with the context shift in place (kv_evictor), with the re-prefill
+///       fallback, and with a hard stop. Shifted runs must produce the same tokens either
+///       way, and the KV cache must hold exactly the history after every shift.
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include "causal_lm.hpp"
+#include "modules/context_shift.hpp"
+#include "utils/utils.hpp"
+
+static uint32_t mix(uint32_t a, uint32_t b, uint32_t c) {
+    uint64_t x = (uint64_t)a * 0x9E3779B1u ^ (uint64_t)b * 0x85EBCA77u ^ (uint64_t)c * 0xC2B2AE3Du;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 32;
+    return (uint32_t)x;
+}
+
+/// \brief CPU engine with a KV cache of token ids and one key row per token
+/// \note The logits only depend on the last two tokens, so the output does not depend on
+///       which tokens were evicted and the two shift paths can be compared token for token.
+class mock_lm : public causal_lm {
+public:
+    static constexpr int HEAD_DIM = 128;
+
+    mock_lm(int vocab) : vocab(vocab), y(vocab), query(HEAD_DIM) {}
+
+    buffer<bf16> forward(int id) override {
+        this->append(id);
+        this->attend();
+        this->fill();
+        return this->y;
+    }
+    buffer<bf16> prefill(std::vector<int>& ids, void* payload = nullptr) override {
+        for (int id : ids) {
+            this->append(id);
+            this->attend();
+        }
+        this->prefilled += ids.size();
+        this->fill();
+        return this->y;
+    }
+    void set_context_length(int L) override {
+        this->kv.resize(L);
+        this->keys.resize((size_t)L * HEAD_DIM);
+    }
+    void load_weights(Q4NX& q4nx) override {}
+    void update_max_length(uint32_t MAX_L) override {}
+    void clear_context() override {
+        this->kv.clear();
+        this->keys.clear();
+    }
+    buffer<bf16> get_k_cache(int layer_idx, int idx) override { return buffer<bf16>(); }
+    buffer<bf16> get_v_cache(int layer_idx, int idx) override { return buffer<bf16>(); }
+    int get_current_context_length() override { return this->kv.size(); }
+
+    std::vector<int> kv;
+    uint64_t prefilled = 0;
+    volatile float sink = 0.0f; // keeps the attention loop from being optimized away
+
+protected:
+    void append(int id) {
+        this->kv.push_back(id);
+        for (int d = 0; d < HEAD_DIM; d++) {
+            this->keys.push_back((float)(mix(id, d, 7) % 255) / 255.0f - 0.5f);
+        }
+    }
+    /// \brief One query against every key in the cache
+    void attend() {
+        size_t n = this->kv.size();
+        int id = this->kv.back();
+        for (int d = 0; d < HEAD_DIM; d++) {
+            this->query[d] = (float)(mix(id, d, 9) % 255) / 255.0f - 0.5f;
+        }
+        float acc = 0.0f;
+        for (size_t i = 0; i < n; i++) {
+            const float* k = this->keys.data() + i * HEAD_DIM;
+            float dot = 0.0f;
+            for (int d = 0; d < HEAD_DIM; d++) {
+                dot += this->query[d] * k[d];
+            }
+            acc += dot;
+        }
+        this->sink = this->sink + acc;
+    }
+    void fill() {
+        int a = this->kv.size() > 1 ? this->kv[this->kv.size() - 2] : 0;
+        int b = this->kv.empty() ? 0 : this->kv.back();
+        int favourite = mix(a, b, 1) % this->vocab;
+        for (int t = 0; t < this->vocab; t++) {
+            this->y[t] = bf16(t == favourite ? 5.0f : (mix(a, b, t + 5) % 1000) / 500.0f - 1.0f);
+        }
+    }
+
+    int vocab;
+    buffer<bf16> y;
+    std::vector<float> query;
+    std::vector<float> keys;
+};
+
+/// \brief Engine that evicts in place
+/// \note Keys after the evicted range are moved down and touched once, standing in for the
+///       re-rotation to their new positions.
+class mock_evictor : public mock_lm, public kv_evictor {
+public:
+    mock_evictor(int vocab) : mock_lm(vocab) {}
+
+    bool evict_kv(int begin, int end) override {
+        this->kv.erase(this->kv.begin() + begin, this->kv.begin() + end);
+        this->keys.erase(this->keys.begin() + (size_t)begin * HEAD_DIM, this->keys.begin() + (size_t)end * HEAD_DIM);
+        for (size_t i = (size_t)begin * HEAD_DIM; i < this->keys.size(); i++) {
+            this->keys[i] *= 1.0f;
+        }
+        return true;
+    }
+};
+
+static int argmax(buffer<bf16>& y, int vocab) {
+    int best = 0;
+    for (int t = 1; t < vocab; t++) {
+        if (float(y[t]) > float(y[best])) best = t;
+    }
+    return best;
+}
+
+/// \brief The plan keeps the sinks and leaves room for the needed tokens
+static bool check_plan() {
+    bool ok = true;
+    for (int sinks : {0, 4, 64}) {
+        context_shift shifter(sinks);
+        for (int i = 0; i < 10000; i++) {
+            int max_length = 16 + mix(i, sinks, 1) % 4096;
+            int length = mix(i, sinks, 2) % (max_length + 1);
+            int needed = 1 + mix(i, sinks, 3) % 64;
+            auto [begin, end] = shifter.plan(length, needed, max_length);
+            if (begin >= end) {
+                // Nothing to evict only when the sinks and needed do not fit anyway
+                ok &= std::min(sinks, length) + needed >= max_length || length + needed < max_length;
+                continue;
+            }
+            ok &= begin == std::min(sinks, length) && end <= length;
+            ok &= length - (end - begin) + needed < max_length;
+        }
+    }
+    std::cout << "plan keeps the sinks and makes room: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+typedef struct {
+    std::vector<int> tokens;
+    double seconds;
+    double first_window;        // tok/s over the first max_length tokens
+    double last_window;         // tok/s over the last max_length tokens
+    bool kv_ok;
+} run_result_t;
+
+/// \brief Greedy decode, shifting the context like AutoModel does
+/// \param shifter nullptr to stop at the context length
+static run_result_t run(mock_lm& engine, context_shift* shifter, bool in_place, int vocab, int max_length, int generate) {
+    run_result_t result = {{}, 0.0, 0.0, 0.0, true};
+    std::vector<int> history;
+    for (int i = 0; i < max_length / 4; i++) {
+        history.push_back(mix(i, 3, 5) % vocab);
+    }
+    engine.clear_context();
+    buffer<bf16> y = engine.prefill(history);
+    int pending = argmax(y, vocab);
+    history.push_back(pending);
+
+    auto start = std::chrono::steady_clock::now();
+    auto window_start = start;
+    for (int n = 0; n < generate; n++) {
+        if ((int)history.size() + 1 > max_length) {
+            if (shifter == nullptr) {
+                break;
+            }
+            auto [begin, end] = shifter->shift(&engine, history, 1, max_length, in_place);
+            if (begin >= end) {
+                break;
+            }
+            result.kv_ok &= engine.kv.size() + 1 == history.size()
+                && std::equal(engine.kv.begin(), engine.kv.end(), history.begin());
+        }
+        y = engine.forward(pending);
+        pending = argmax(y, vocab);
+        history.push_back(pending);
+        result.tokens.push_back(pending);
+        if (n + 1 == max_length) {
+            auto now = std::chrono::steady_clock::now();
+            result.first_window = max_length / std::chrono::duration<double>(now - start).count();
+        }
+        if (n + 1 == generate - max_length) {
+            window_start = std::chrono::steady_clock::now();
+        }
+    }
+    auto stop = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(stop - start).count();
+    if ((int)result.tokens.size() == generate && generate > max_length) {
+        result.last_window = max_length / std::chrono::duration<double>(stop - window_start).count();
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    const int vocab = 512;
+    int max_length = 2048;
+    int sink_tokens = 4;
+    if (argc > 1) max_length = std::stoi(argv[1]);
+    if (argc > 2) sink_tokens = std::stoi(argv[2]);
+    int generate = 10 * max_length;
+
+    bool all_ok = true;
+    all_ok &= check_plan();
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "sustained decode, context " << max_length << ", " << generate << " tokens requested" << std::endl;
+    std::cout << std::left << std::setw(14) << "mode" << std::setw(10) << "tokens" << std::setw(8) << "shifts"
+              << std::setw(14) << "re-prefilled" << std::setw(10) << "tok/s" << std::setw(16) << "first ctx tok/s"
+              << "last ctx tok/s" << std::endl;
+
+    mock_evictor evictor(vocab);
+    mock_lm plain(vocab);
+    context_shift in_place_shifter(sink_tokens);
+    context_shift fallback_shifter(sink_tokens);
+    run_result_t stopped = run(evictor, nullptr, true, vocab, max_length, generate);
+    run_result_t in_place = run(evictor, &in_place_shifter, true, vocab, max_length, generate);
+    run_result_t fallback = run(plain, &fallback_shifter, true, vocab, max_length, generate);
+
+    auto report = [&](const char* mode, const run_result_t& r, const context_shift* shifter) {
+        std::cout << std::left << std::setw(14) << mode << std::setw(10) << r.tokens.size() << std::setw(8)
+                  << (shifter ? shifter->get_stats().shifts : 0) << std::setw(14)
+                  << (shifter ? shifter->get_stats().reprefilled : 0) << std::setw(10) << r.tokens.size() / r.seconds
+                  << std::setw(16) << r.first_window << r.last_window << std::endl;
+    };
+    report("hard stop", stopped, nullptr);
+    report("in place", in_place, &in_place_shifter);
+    report("re-prefill", fallback, &fallback_shifter);
+
+    bool same = in_place.tokens == fallback.tokens;
+    std::cout << "in place and re-prefill agree: " << (same ? "yes" : "NO") << std::endl;
+    std::cout << "KV cache matches history after every shift: " << (in_place.kv_ok && fallback.kv_ok ? "yes" : "NO")
+              << std::endl;
+    all_ok &= same && in_place.kv_ok && fallback.kv_ok;
+    all_ok &= (int)in_place.tokens.size() == generate && (int)stopped.tokens.size() < max_length;
+    all_ok &= in_place_shifter.get_stats().reprefilled == 0 && fallback_shifter.get_stats().reprefilled > 0;
+    // Decode speed is bounded by the context length instead of decaying with the output
+    all_ok &= in_place.last_window > 0.5 * in_place.first_window;
+
+    if (!all_ok) {
+        header_print("ERROR", "context shift test failed");
+        return 1;
+    }
+    header_print("info", "context shift test passed");
+    return 0;
+}
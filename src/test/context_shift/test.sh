@@ -0,0 +1,3 @@
+cd ../../test/context_shift
+make clean
+make test
@@ -0,0 +1,204 @@
+/// \file test.cpp
+/// \brief decode pipeline test and benchmark
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. The forward pass is a blocking wait of a fixed
+///       length, like waiting on the NPU run. The output stream builds an OpenAI chunk
+///       and an SSE frame on every flush, like streaming_buf_openai_chat, then spends a
+///       fixed time in the "socket".
+///       The decode loop is run serially and pipelined; the time between forward passes
+///       is the host overhead left on the NPU-driving thread.
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <streambuf>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <thread>
+#include "modules/decode_pipeline.hpp"
+#include "utils/utils.hpp"
+#include "nlohmann/json.hpp"
+
+/// \brief Busy wait, stands in for the host work of a socket write
+static void spin_us(double us) {
+    time_utils::time_point start = time_utils::now();
+    while (time_utils::duration_ns(start, time_utils::now()).first < us * 1000.0) {}
+}
+
+/// \brief Output stream buffer serializing an OpenAI chunk per flush
+class sse_buf : public std::streambuf {
+public:
+    sse_buf(double socket_us) : socket_us(socket_us) {}
+    std::string wire;
+    std::string text;
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (ch != traits_type::eof()) {
+            this->pending += static_cast<char>(ch);
+        }
+        return ch;
+    }
+    int sync() override {
+        if (this->pending.empty()) return 0;
+        nlohmann::ordered_json chunk;
+        chunk["id"] = "chatcmpl-bench";
+        chunk["object"] = "chat.completion.chunk";
+        chunk["created"] = 0;
+        chunk["model"] = "bench";
+        chunk["choices"] = nlohmann::ordered_json::array();
+        chunk["choices"].push_back({{"index", 0}, {"delta", {{"role", "assistant"}, {"content", this->pending}}},
+                                    {"finish_reason", nullptr}});
+        this->wire += "data: " + chunk.dump() + "\n\n";
+        this->text += this->pending;
+        this->pending.clear();
+        spin_us(this->socket_us);
+        return 0;
+    }
+
+private:
+    std::string pending;
+    double socket_us;
+};
+
+typedef struct {
+    double itl_us;      // mean time from one forward pass to the next
+    double host_us;     // mean time between the end of a forward pass and the next one
+    double p99_host_us;
+    std::string text;
+} run_result_t;
+
+/// \brief The decode loop of AutoModel::_shared_generate with a simulated forward pass
+static run_result_t run_decode(bool pipelined, int tokens, double npu_us, double socket_us,
+    const std::vector<std::string>& vocab) {
+    sse_buf buf(socket_us);
+    std::ostream os(&buf);
+    std::string result;
+    auto emit = [&](decoded_token_t& token) {
+        const std::string& token_str = vocab[token.token_id];
+        os << token_str << std::flush;
+        result += token_str;
+    };
+
+    std::vector<double> gaps;
+    gaps.reserve(tokens);
+    std::unique_ptr<decode_pipeline> pipeline = nullptr;
+    if (pipelined) {
+        pipeline = std::make_unique<decode_pipeline>(emit);
+    }
+    time_utils::time_point loop_start = time_utils::now();
+    time_utils::time_point forward_end = loop_start;
+    for (int i = 0; i < tokens; i++) {
+        time_utils::time_point now = time_utils::now();
+        if (i > 0) gaps.push_back(time_utils::duration_ns(forward_end, now).first / 1000.0);
+        std::this_thread::sleep_for(std::chrono::microseconds((long long)npu_us));
+        forward_end = time_utils::now();
+        decoded_token_t token{(i * 7919) % (int)vocab.size(), false, {}};
+        if (pipeline != nullptr) {
+            pipeline->push(std::move(token));
+        }
+        else {
+            emit(token);
+        }
+    }
+    double total_us = time_utils::duration_ns(loop_start, time_utils::now()).first / 1000.0;
+    if (pipeline != nullptr) {
+        pipeline->finish();
+    }
+    run_result_t r;
+    double sum = 0;
+    for (double g : gaps) sum += g;
+    r.itl_us = total_us / tokens;
+    r.host_us = sum / std::max<size_t>(gaps.size(), 1);
+    std::sort(gaps.begin(), gaps.end());
+    r.p99_host_us = gaps.empty() ? 0 : gaps[gaps.size() * 99 / 100];
+    r.text = buf.text;
+    if (r.text != result) r.text.clear();   // the stream must see every token in order
+    return r;
+}
+
+/// \brief One million items through a small ring keep their order
+static bool check_ring_order() {
+    spsc_ring<int> ring(64);
+    const int n = 1000000;
+    bool ok = true;
+    std::thread consumer([&] {
+        int expected = 0, v;
+        while (ring.pop(v)) {
+            ok &= (v == expected++);
+        }
+        ok &= (expected == n);
+    });
+    for (int i = 0; i < n; i++) ring.push(i);
+    ring.close();
+    consumer.join();
+    std::cout << "ring keeps order under contention: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+/// \brief A failing stream stops the loop and surfaces in finish()
+static bool check_consumer_error() {
+    int seen = 0;
+    decode_pipeline pipeline([&](decoded_token_t&) {
+        if (++seen == 10) throw std::runtime_error("client went away");
+    }, 4);
+    int pushed = 0;
+    while (pushed < 100000 && pipeline.push(decoded_token_t{pushed, false, {}})) pushed++;
+    bool ok = pushed < 100000;
+    try {
+        pipeline.finish();
+        ok = false;
+    }
+    catch (const std::runtime_error& e) {
+        ok &= std::string(e.what()) == "client went away";
+    }
+    ok &= seen == 10;
+    std::cout << "consumer error stops the decode loop: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    int tokens = 300;
+    double npu_us = 2000;
+    double socket_us = 150;
+    if (argc > 1) tokens = std::stoi(argv[1]);
+    if (argc > 2) npu_us = std::stod(argv[2]);
+    if (argc > 3) socket_us = std::stod(argv[3]);
+
+    std::vector<std::string> vocab;
+    for (int i = 0; i < 1000; i++) {
+        vocab.push_back((i % 5 == 0 ? " " : "") + std::string("tok") + std::to_string(i) + (i % 17 == 0 ? "\n" : ""));
+    }
+
+    bool all_ok = true;
+    all_ok &= check_ring_order();
+    all_ok &= check_consumer_error();
+
+    run_result_t serial = run_decode(false, tokens, npu_us, socket_us, vocab);
+    run_result_t piped = run_decode(true, tokens, npu_us, socket_us, vocab);
+    bool same = !serial.text.empty() && serial.text == piped.text;
+    std::cout << "pipelined stream matches serial stream: " << (same ? "yes" : "NO") << std::endl;
+    all_ok &= same;
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "forward " << npu_us << " us, socket " << socket_us << " us, " << tokens << " tokens" << std::endl;
+    std::cout << std::left << std::setw(12) << "mode" << std::setw(12) << "itl(us)" << std::setw(12) << "host(us)"
+              << "host p99(us)" << std::endl;
+    for (auto& [name, r] : {std::pair<const char*, run_result_t&>{"serial", serial}, {"pipelined", piped}}) {
+        std::cout << std::left << std::setw(12) << name << std::setw(12) << r.itl_us << std::setw(12) << r.host_us
+                  << r.p99_host_us << std::endl;
+    }
+    // Only the push is left on the decode thread
+    all_ok &= piped.host_us < serial.host_us * 0.5;
+
+    if (!all_ok) {
+        header_print("ERROR", "decode pipeline test failed");
+        return 1;
+    }
+    header_print("info", "decode pipeline test passed");
+    return 0;
+}
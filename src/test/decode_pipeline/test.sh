@@ -0,0 +1,3 @@
+cd ../../test/decode_pipeline
+make clean
+make test
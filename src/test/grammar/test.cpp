@@ -0,0 +1,210 @@
+/// \file test.cpp
+/// \brief grammar matcher test and microbenchmark
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU or tokenizer required. A synthetic vocabulary stands in
+///       for the tokenizer: random generations under a JSON schema and a tool-call grammar
+///       must parse, every mask is checked against token-by-token matching, and the
+///       per-token cost of the cached masks is reported.
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <string>
+#include "typedef.hpp"
+#include "modules/grammar.hpp"
+#include "modules/sampler.hpp"
+#include "utils/utils.hpp"
+
+/// \brief A byte-level vocabulary: single bytes, JSON pieces, words and random chunks
+static std::vector<std::string> make_vocab(int size, std::mt19937& rng) {
+    std::vector<std::string> vocab;
+    for (int c = 0; c < 256; c++) {
+        vocab.push_back(std::string(1, char(c)));
+    }
+    for (const char* piece : {"{\"", "\":", "\",", "\"}", " \"", "\": ", "\", \"", "}}", "[\"", "\"]", "true",
+                              "false", "null", "name", "age", "tags", "\n", "\n  ", "  ", "<tool_call>",
+                              "</tool_call>", "\"name\"", "\"arguments\"", "get_weather", "arguments", "city", "Paris",
+                              "\xC3\xA9", "\xE4\xB8\xAD\xE6\x96\x87", "12", "345", "-7", ".5", "e3"}) {
+        vocab.push_back(piece);
+    }
+    const std::string alphabet = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 _-.,:;\"{}[]\\";
+    std::uniform_int_distribution<int> len(2, 8);
+    std::uniform_int_distribution<int> pick(0, (int)alphabet.size() - 1);
+    while ((int)vocab.size() < size - 1) {
+        std::string t;
+        for (int i = len(rng); i > 0; i--) t += alphabet[pick(rng)];
+        vocab.push_back(t);
+    }
+    vocab.push_back("");   // eos, no text form
+    return vocab;
+}
+
+/// \brief Compare a mask against accepting each token on a fresh matcher replaying the text
+static bool check_mask(const grammar::Grammar& g, std::shared_ptr<const grammar::TokenTrie> trie,
+    const std::vector<int>& eos, const std::vector<int>& history, const std::vector<u64>& mask,
+    std::mt19937& rng, int samples) {
+    std::uniform_int_distribution<int> pick(0, trie->vocab_size() - 1);
+    for (int s = 0; s < samples; s++) {
+        int id = pick(rng);
+        grammar::GrammarMatcher replay(g, trie, eos, trie->vocab_size());
+        for (int t : history) replay.accept(t);
+        bool expected = replay.accept(id);
+        bool in_mask = (mask[id >> 6] >> (id & 63)) & 1;
+        if (expected != in_mask) {
+            std::cout << "mask mismatch for token " << id << " [" << trie->bytes(id) << "]" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/// \brief Random generations under a schema, each must parse and match the shape
+static bool check_schema(std::shared_ptr<const grammar::TokenTrie> trie, int eos_id, std::mt19937& rng) {
+    nlohmann::json schema = nlohmann::json::parse(R"({
+        "type": "object",
+        "properties": {
+            "name": {"type": "string", "maxLength": 12},
+            "age":  {"type": "integer"},
+            "tags": {"type": "array", "items": {"type": "string", "maxLength": 6}, "maxItems": 3},
+            "ok":   {"type": "boolean"},
+            "kind": {"enum": ["a", "b", 3]}
+        },
+        "required": ["name", "age"]
+    })");
+    grammar::Grammar g = grammar::Grammar::from_json_schema(schema);
+    std::vector<int> eos = {eos_id};
+    bool ok = true;
+    double hit_us = 0, miss_us = 0;
+    size_t hits = 0, misses = 0;
+
+    // One matcher for all runs, like a model serving requests with the same schema
+    grammar::GrammarMatcher matcher(g, trie, eos, trie->vocab_size());
+    for (int run = 0; run < 20 && ok; run++) {
+        matcher.reset();
+        std::vector<int> history;
+        std::string text;
+        for (int step = 0; step < 512; step++) {
+            size_t before = matcher.cache_misses;
+            time_utils::time_point start = time_utils::now();
+            const std::vector<u64>& mask = matcher.allowed_mask();
+            double us = time_utils::duration_ns(start, time_utils::now()).first / 1000.0;
+            if (matcher.cache_misses > before) { miss_us += us; misses++; }
+            else { hit_us += us; hits++; }
+
+            if (run < 2 && step % 7 == 0) {
+                ok &= check_mask(g, trie, eos, history, mask, rng, 200);
+            }
+            std::vector<int> allowed;
+            for (size_t w = 0; w < mask.size(); w++) {
+                for (u64 bits = mask[w]; bits; bits &= bits - 1) {
+                    allowed.push_back(int(w * 64) + __builtin_ctzll(bits));
+                }
+            }
+            if (allowed.empty()) { ok = false; break; }
+            int id = allowed[std::uniform_int_distribution<int>(0, (int)allowed.size() - 1)(rng)];
+            if (id == eos_id) break;
+            ok &= matcher.accept(id);
+            history.push_back(id);
+            text += trie->bytes(id);
+        }
+        try {
+            nlohmann::json out = nlohmann::json::parse(text);
+            ok &= out.is_object() && out["name"].is_string() && out["age"].is_number_integer();
+            ok &= !out.contains("tags") || (out["tags"].is_array() && out["tags"].size() <= 3);
+            ok &= !out.contains("ok") || out["ok"].is_boolean();
+            if (run == 0) std::cout << "sample: " << out.dump() << std::endl;
+        }
+        catch (const std::exception& e) {
+            std::cout << "generated text does not parse: " << text << std::endl;
+            ok = false;
+        }
+    }
+    std::cout << "schema generations parse and masks match: " << (ok ? "yes" : "NO") << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << "mask per token: cached " << hit_us / std::max<size_t>(hits, 1) << " us (" << hits << "), "
+              << "first visit " << miss_us / std::max<size_t>(misses, 1) << " us (" << misses << ")" << std::endl;
+    return ok;
+}
+
+/// \brief Lazy tool-call grammar: free text until <tool_call>, then a valid call
+static bool check_tool_calls(std::shared_ptr<const grammar::TokenTrie> trie, int eos_id) {
+    nlohmann::ordered_json tools = nlohmann::ordered_json::parse(R"([{"type": "function", "function": {
+        "name": "get_weather",
+        "parameters": {"type": "object", "properties": {"city": {"type": "string"}}, "required": ["city"]}
+    }}])");
+    std::string gbnf = grammar::tool_calls_to_gbnf(tools, "</tool_call>");
+    grammar::GrammarMatcher matcher(grammar::Grammar::from_gbnf(gbnf), trie, {eos_id}, trie->vocab_size());
+    matcher.set_trigger("<tool_call>");
+
+    auto id_of = [&](const std::string& text) {
+        for (int i = 0; i < trie->vocab_size(); i++) if (trie->bytes(i) == text) return i;
+        return -1;
+    };
+    bool ok = !matcher.active();
+    for (const char* t : {"H", "i", "<tool_call>"}) ok &= matcher.accept(id_of(t));
+    ok &= matcher.active();
+    // A wrong function name is rejected, the right call goes through
+    ok &= !matcher.accept(id_of("{\"")) || !matcher.accept(id_of("age"));
+    matcher.reset();
+    matcher.accept(id_of("<tool_call>"));
+    for (const char* t : {"\n", "{\"", "name", "\":", " \"", "get_weather", "\",", " \"", "arguments", "\":",
+                          " ", "{\"", "city", "\":", " \"", "Paris", "\"}", "}", "\n", "</tool_call>"}) {
+        int id = id_of(t);
+        const std::vector<u64>& mask = matcher.allowed_mask();
+        ok &= (mask[id >> 6] >> (id & 63)) & 1;
+        ok &= matcher.accept(id);
+    }
+    ok &= !matcher.active();   // back to free text after the call
+    std::cout << "lazy tool-call grammar: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+/// \brief GBNF features: groups, repetition bounds, classes, UTF-8
+static bool check_gbnf(std::shared_ptr<const grammar::TokenTrie> trie, int eos_id) {
+    const char* text = R"gbnf(
+        # arithmetic over small numbers, then an accented word
+        root ::= expr " " word
+        expr ::= term (("+" | "-") term){0,3}
+        term ::= [0-9]{1,2} | "(" expr ")"
+        word ::= [a-zé]+
+    )gbnf";
+    grammar::Grammar g = grammar::Grammar::from_gbnf(text);
+    auto run = [&](const std::string& s) {
+        grammar::GrammarMatcher m(g, trie, {eos_id}, trie->vocab_size());
+        for (unsigned char c : s) {
+            if (!m.accept(c)) return false;    // ids 0..255 are single bytes
+        }
+        return m.is_accepting();
+    };
+    bool ok = run("12+(3-4) caf\xC3\xA9") && run("7 a") && !run("123 a") && !run("1+2+3+4+5 a") && !run("1 A");
+    bool threw = false;
+    try { grammar::Grammar::from_gbnf("root ::= missing"); } catch (const std::exception&) { threw = true; }
+    ok &= threw;
+    std::cout << "gbnf parse and match: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    std::mt19937 rng(1234);
+    bool all_ok = true;
+
+    std::vector<std::string> vocab = make_vocab(50000, rng);
+    int eos_id = (int)vocab.size() - 1;
+    time_utils::time_point start = time_utils::now();
+    auto trie = std::make_shared<const grammar::TokenTrie>(vocab);
+    std::cout << "trie over " << vocab.size() << " tokens: "
+              << time_utils::duration_ns(start, time_utils::now()).first / 1e6 << " ms" << std::endl;
+
+    all_ok &= check_gbnf(trie, eos_id);
+    all_ok &= check_tool_calls(trie, eos_id);
+    all_ok &= check_schema(trie, eos_id, rng);
+
+    if (!all_ok) {
+        header_print("ERROR", "grammar matcher does not match the reference");
+        return 1;
+    }
+    header_print("info", "grammar test passed");
+    return 0;
+}
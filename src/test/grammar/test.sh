@@ -0,0 +1,3 @@
+cd ../../test/grammar
+make clean
+make test
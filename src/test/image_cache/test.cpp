@@ -0,0 +1,187 @@
+/// \file test.cpp
+/// \brief image cache test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. The hash must match MurmurHash3 and the key must
+///       change with any byte of the payload and with the preprocessing parameters. The
+///       cache must evict the least recently used image by count and by memory, skip an
+///       image larger than the budget, and hold up under concurrent use. A turn that sends
+///       a conversation of screenshots again is then timed with and without the cache; the
+///       miss stands in for the preprocessing with base64 decoding and the Gemma3
+///       normalization only, so the real saving is larger.
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "modules/image_cache.hpp"
+#include "base64.hpp"
+#include "utils/utils.hpp"
+
+static std::shared_ptr<const preprocessed_image_t> make_image(size_t values, int tag) {
+    auto image = std::make_shared<preprocessed_image_t>();
+    image->pixels.assign(values, bf16((float)tag));
+    image->grid_h = tag;
+    image->grid_w = tag;
+    return image;
+}
+
+static bool report(const char* name, bool ok) {
+    std::cout << name << ": " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+static bool check_hash() {
+    auto hex = [](std::pair<uint64_t, uint64_t> h) {
+        char text[40];
+        snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)h.first, (unsigned long long)h.second);
+        return std::string(text);
+    };
+    bool ok = hex(image_cache::hash128("", 0, 0)) == "00000000000000000000000000000000";
+    ok &= hex(image_cache::hash128("hello", 5, 0)) == "cbd8a7b341bd9b025b1e906a48ae1d19";
+    ok &= hex(image_cache::hash128("The quick brown fox jumps over the lazy dog", 43, 0)) == "e34bbc7bbc071b6c7a433ca9c49a9347";
+
+    // Every byte and every parameter is in the key
+    std::string data(1000, 'x');
+    std::string key = image_cache::key(data, "gemma3:896x896");
+    for (size_t i = 0; i < data.size() && ok; i += 37) {
+        std::string changed = data;
+        changed[i] = 'y';
+        ok &= image_cache::key(changed, "gemma3:896x896") != key;
+    }
+    ok &= image_cache::key(data, "qwen3vl:3") != image_cache::key(data, "qwen3vl:0");
+    ok &= image_cache::key(data + "x", "") != image_cache::key(data, "x");
+    ok &= image_cache::key(data, "gemma3:896x896") == key;
+    return report("MurmurHash3 and keys", ok);
+}
+
+/// \brief The least recently used image goes, by count and by memory
+static bool check_lru() {
+    const size_t values = 1000;
+    const size_t size = values * sizeof(bf16);
+    bool ok = true;
+    {
+        image_cache cache(100 * size, 2);
+        cache.put("a", make_image(values, 1));
+        cache.put("b", make_image(values, 2));
+        ok &= cache.get("a") != nullptr;
+        cache.put("c", make_image(values, 3));
+        ok &= cache.get("b") == nullptr && cache.get("a")->grid_h == 1 && cache.get("c")->grid_h == 3;
+        nlohmann::json stats = cache.stats();
+        ok &= stats["hits"] == 3 && stats["misses"] == 1 && stats["evictions"] == 1 && stats["images"] == 2;
+    }
+    {
+        image_cache cache(3 * size, 100);
+        for (int i = 0; i < 5; i++) {
+            cache.put(std::to_string(i), make_image(values, i));
+        }
+        ok &= cache.stats()["images"] == 3 && cache.stats()["bytes"] == 3 * size && cache.get("1") == nullptr;
+        cache.put("big", make_image(4 * values, 9));
+        ok &= cache.get("big") == nullptr && cache.stats()["too_large"] == 1 && cache.stats()["images"] == 3;
+        // an image handed out stays valid when it is evicted
+        std::shared_ptr<const preprocessed_image_t> held = cache.get("4");
+        cache.set_limits(size, 100);
+        ok &= cache.stats()["images"] == 1 && held->pixels.size() == values && float(held->pixels[0]) == 4.0f;
+        cache.clear();
+        ok &= cache.stats()["images"] == 0 && cache.stats()["bytes"] == 0;
+    }
+    return report("least recently used image evicted", ok);
+}
+
+/// \brief Threads looking up and storing the same keys
+static bool check_threads() {
+    image_cache cache(64 * 1000 * sizeof(bf16), 64);
+    std::vector<std::thread> threads;
+    std::atomic<int> wrong{0};
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937 rng(t);
+            for (int i = 0; i < 20000; i++) {
+                int id = rng() % 100;
+                std::shared_ptr<const preprocessed_image_t> image = cache.get(std::to_string(id));
+                if (image == nullptr) {
+                    cache.put(std::to_string(id), make_image(1000, id));
+                }
+                else if (image->grid_h != id) {
+                    wrong++;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    nlohmann::json stats = cache.stats();
+    bool ok = wrong == 0 && stats["hits"].get<uint64_t>() + stats["misses"].get<uint64_t>() == 8 * 20000
+              && stats["images"].get<size_t>() <= 64;
+    return report("concurrent lookups", ok);
+}
+
+/// \brief What a miss costs at least: base64 decoding and the Gemma3 normalization
+static std::shared_ptr<const preprocessed_image_t> preprocess(const std::string& base64_string) {
+    std::string raw = base64::from_base64(base64_string);
+    const size_t values = 3 * 896 * 896;
+    auto image = std::make_shared<preprocessed_image_t>();
+    image->pixels.resize(values);
+    for (size_t i = 0; i < values; i++) {
+        image->pixels[i] = bf16(((uint8_t)raw[i % raw.size()] / 255.0f - 0.5f) * 2.0f);
+    }
+    return image;
+}
+
+int main(int argc, char* argv[]) {
+    int images = 8;
+    if (argc > 1) images = std::stoi(argv[1]);
+    bool all_ok = check_hash();
+    all_ok &= check_lru();
+    all_ok &= check_threads();
+
+    // Screenshots of about 3 MB each, sent again with every turn
+    std::mt19937 rng(2025);
+    std::vector<std::string> payloads(images);
+    for (std::string& payload : payloads) {
+        std::string raw(3 << 20, '\0');
+        for (char& c : raw) c = (char)(rng() & 0xff);
+        payload = base64::to_base64(raw);
+    }
+    image_cache cache((size_t)512 << 20);
+    std::vector<bf16> payload_values(3 * 896 * 896 * (size_t)images);
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::left << std::setw(8) << "turn" << std::setw(14) << "uncached ms" << "cached ms" << std::endl;
+    for (int turn = 0; turn < 3; turn++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < images; i++) {
+            std::shared_ptr<const preprocessed_image_t> pv = preprocess(payloads[i]);
+            std::copy(pv->pixels.begin(), pv->pixels.end(), payload_values.begin() + i * pv->pixels.size());
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        for (int i = 0; i < images; i++) {
+            std::string key = image_cache::key(payloads[i], "gemma3:896x896");
+            std::shared_ptr<const preprocessed_image_t> pv = cache.get(key);
+            if (pv == nullptr) {
+                pv = preprocess(payloads[i]);
+                cache.put(key, pv);
+            }
+            std::copy(pv->pixels.begin(), pv->pixels.end(), payload_values.begin() + i * pv->pixels.size());
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        std::cout << std::left << std::setw(8) << turn + 1 << std::setw(14)
+                  << std::chrono::duration<double, std::milli>(t1 - t0).count()
+                  << std::chrono::duration<double, std::milli>(t2 - t1).count() << std::endl;
+    }
+    nlohmann::json stats = cache.stats();
+    all_ok &= stats["hits"] == 2 * images && stats["misses"] == images;
+    std::cout << "cache: " << stats.dump() << std::endl;
+
+    if (!all_ok) {
+        header_print("ERROR", "image cache test failed");
+        return 1;
+    }
+    header_print("info", "image cache test passed");
+    return 0;
+}
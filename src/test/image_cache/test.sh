@@ -0,0 +1,3 @@
+cd ../../test/image_cache
+make clean
+make test
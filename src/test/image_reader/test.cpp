@@ -0,0 +1,197 @@
+/// \file test.cpp
+/// \brief image reader reduced decode test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required, FFmpeg is. An image decoded for a target much
+///       smaller than itself must come out reduced, still at least twice the target on
+///       both sides, and report its encoded size; a JPEG photo goes through the lowres
+///       decode, a 4K PNG screenshot through the area prefilter. Once resized to the target
+///       the way the models do it, the reduced decode must stay within tolerance of the
+///       full decode resized the same way: a mean difference of at most 2 levels and a PSNR
+///       of at least 32 dB. A target close to the image size, or none, gives the full
+///       decode, pixel for pixel. Both decodes are then timed.
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+#include "image/image_reader.hpp"
+#include "utils/utils.hpp"
+
+static bool report(const std::string& name, bool ok) {
+    std::cout << name << ": " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+/// \brief A 4K RGB screenshot: panels, gradients and a little noise, interleaved
+static image_data_t make_screenshot(int width, int height, uint32_t seed) {
+    std::mt19937 rng(seed);
+    image_data_t image;
+    image.width = width;
+    image.height = height;
+    image.pixels = bytes(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                int value = ((x / 160 + y / 90) % 2) ? 200 : 40;                        // panels
+                value += static_cast<int>(40.0 * std::sin(x * 0.01 * (c + 1) + y * 0.013)); // gradients
+                value += static_cast<int>(rng() % 9) - 4;                                 // noise
+                image.pixels[(static_cast<size_t>(y) * width + x) * 3 + c] = static_cast<uint8_t>(std::clamp(value, 0, 255));
+            }
+        }
+    }
+    return image;
+}
+
+/// \brief A target of a fixed size, as Gemma3 and the Qwen3-VL pre-resize ask for
+static decode_target_t fixed_target(int width, int height) {
+    return [width, height](int, int, int& target_width, int& target_height) {
+        target_width = width;
+        target_height = height;
+    };
+}
+
+/// \brief The Qwen3-VL pre-resize to a height, aspect kept
+static void pre_resize_size(int width, int height, int max_height, int& target_width, int& target_height) {
+    target_width = static_cast<int>(static_cast<float>(width) * (static_cast<float>(max_height) / height));
+    target_height = max_height;
+}
+
+template <typename F>
+static double time_ms(int repeats, F&& f) {
+    f(); // warm up
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; ++i) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / repeats;
+}
+
+/// \brief Decode reduced and in full, check the sizes, and compare once resized to the target
+static bool check_reduced(ImageReader& reader, const std::string& name, const std::string& path,
+                          int target_width, int target_height, int repeats) {
+    image_data_t full;
+    image_data_t reduced;
+    if (!reader.load_image(path, full) ||
+        !reader.load_image(path, reduced, fixed_target(target_width, target_height))) {
+        return report(name + " decodes", false);
+    }
+    std::cout << name << ": " << full.width << "x" << full.height << " decoded as "
+              << reduced.width << "x" << reduced.height << " for " << target_width << "x" << target_height << std::endl;
+    bool ok = report(name + " full decode keeps its size",
+                     full.source_width == full.width && full.source_height == full.height);
+    ok &= report(name + " reduced decode reports the encoded size",
+                 reduced.source_width == full.width && reduced.source_height == full.height);
+    ok &= report(name + " reduced, at least twice the target",
+                 reduced.width < full.width && reduced.height < full.height &&
+                 reduced.width >= 2 * target_width && reduced.height >= 2 * target_height);
+
+    image_data_t full_resized;
+    image_data_t reduced_resized;
+    if (!reader.resize_image(full, target_width, target_height, full_resized) ||
+        !reader.resize_image(reduced, target_width, target_height, reduced_resized)) {
+        return report(name + " resizes", false);
+    }
+    const size_t values = static_cast<size_t>(target_width) * target_height * 3;
+    double abs_sum = 0.0;
+    double square_sum = 0.0;
+    int max_diff = 0;
+    for (size_t i = 0; i < values; ++i) {
+        const int diff = std::abs(static_cast<int>(full_resized.pixels[i]) - static_cast<int>(reduced_resized.pixels[i]));
+        abs_sum += diff;
+        square_sum += static_cast<double>(diff) * diff;
+        max_diff = std::max(max_diff, diff);
+    }
+    const double mean = abs_sum / values;
+    const double psnr = square_sum == 0.0 ? 99.0 : 10.0 * std::log10(255.0 * 255.0 / (square_sum / values));
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "  resized: mean diff " << mean << ", max diff " << max_diff << ", PSNR " << psnr << " dB" << std::endl;
+    ok &= report(name + " resized within tolerance of the full decode", mean <= 2.0 && psnr >= 32.0);
+
+    double full_ms = time_ms(repeats, [&] { reader.load_image(path, full); });
+    double reduced_ms = time_ms(repeats, [&] { reader.load_image(path, reduced, fixed_target(target_width, target_height)); });
+    std::cout << "  decode: full " << full_ms << " ms, reduced " << reduced_ms << " ms, "
+              << full_ms / reduced_ms << "x" << std::endl;
+
+    reader.recycle(full);
+    reader.recycle(reduced);
+    reader.recycle(full_resized);
+    reader.recycle(reduced_resized);
+    return ok;
+}
+
+/// \brief A target close to the image size, or none, decodes in full
+static bool check_full(ImageReader& reader, const std::string& name, const std::string& path,
+                       int target_width, int target_height) {
+    image_data_t full;
+    image_data_t targeted;
+    if (!reader.load_image(path, full) ||
+        !reader.load_image(path, targeted, fixed_target(target_width, target_height))) {
+        return report(name + " decodes", false);
+    }
+    bool ok = targeted.width == full.width && targeted.height == full.height &&
+              targeted.source_width == full.width && targeted.source_height == full.height;
+    const size_t values = static_cast<size_t>(full.width) * full.height * 3;
+    for (size_t i = 0; ok && i < values; ++i) {
+        ok = full.pixels[i] == targeted.pixels[i];
+    }
+    reader.recycle(full);
+    reader.recycle(targeted);
+    return report(name + " for " + std::to_string(target_width) + "x" + std::to_string(target_height) + " decodes in full", ok);
+}
+
+int main(int argc, char* argv[]) {
+    // a 3024x4032 phone photo from the repository
+    std::string photo = "../../../iceCream.jpg";
+    int repeats = 3;
+    if (argc > 1) photo = argv[1];
+    if (argc > 2) repeats = std::stoi(argv[2]);
+    if (!std::filesystem::exists(photo)) {
+        header_print("ERROR", "photo not found: " << photo);
+        return 1;
+    }
+
+    ImageReader reader;
+    const std::string screenshot = "image_reader_screenshot.png";
+    image_data_t screen = make_screenshot(3840, 2160, 4096);
+    if (!reader.save_png(screenshot, screen)) {
+        header_print("ERROR", "could not write " << screenshot);
+        return 1;
+    }
+
+    image_data_t probe;
+    if (!reader.load_image(photo, probe)) {
+        header_print("ERROR", "could not decode " << photo);
+        return 1;
+    }
+    const int photo_width = probe.width;
+    const int photo_height = probe.height;
+    reader.recycle(probe);
+
+    bool all_ok = true;
+    int target_width;
+    int target_height;
+    // Qwen3-VL pre-resize to 480 lines: JPEG lowres
+    pre_resize_size(photo_width, photo_height, 480, target_width, target_height);
+    all_ok &= check_reduced(reader, "photo", photo, target_width, target_height, repeats);
+    // and to 480 lines from 4K: the area prefilter of a PNG
+    pre_resize_size(3840, 2160, 480, target_width, target_height);
+    all_ok &= check_reduced(reader, "screenshot", screenshot, target_width, target_height, repeats);
+    // Gemma3 896x896 is less than twice smaller than a 12 MP photo
+    all_ok &= check_full(reader, "photo", photo, 896, 896);
+    all_ok &= check_full(reader, "screenshot", screenshot, 2000, 1100);
+
+    std::filesystem::remove(screenshot);
+    if (!all_ok) {
+        header_print("ERROR", "image reader test failed");
+        return 1;
+    }
+    header_print("info", "image reader test passed");
+    return 0;
+}
@@ -0,0 +1,3 @@
+cd ../../test/image_reader
+make clean
+make test
@@ -0,0 +1,304 @@
+/// \file test.cpp
+/// \brief image processing kernels test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. Every instruction set this CPU supports is
+///       forced in turn through imgproc::set_isa, and the dispatched resize and normalize
+///       kernels are compared with the scalar references: the resize may differ by one
+///       level, from float rounding of the separable filter, and the normalize by float
+///       rounding only. Sizes cover upscaling, downscaling with antialiasing and widths
+///       that are not a multiple of the vector width. The fused Qwen-VL kernel must give
+///       the bf16 patches of the four passes it replaces (resize, normalize, temporal
+///       copy, reorder): bit for bit when the same resize kernel runs, within one level
+///       against the scalar reference. Each kernel is then timed on a 4K screenshot
+///       resized to the Qwen3-VL input size, and the fused kernel against the passes,
+///       with the scratch memory each needs. The Gemma3 kernel, which deinterleaves,
+///       normalizes and converts to bf16 in one pass, must give the bf16 values of the
+///       reorder and scalar normalize it replaces bit for bit, pixel counts that are not
+///       a multiple of the vector width included, and is timed against them at 896x896.
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "image_process_utils/imageproc.hpp"
+#include "utils/utils.hpp"
+
+static bool report(const std::string& name, bool ok) {
+    std::cout << name << ": " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+/// \brief A planar RGB image with edges, gradients and noise, like a screenshot
+static std::vector<uint8_t> make_image(int width, int height, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> image(static_cast<size_t>(width) * height * 3);
+    for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int value = ((x / 37 + y / 23) % 2) ? 230 : 20;  // blocks of text and background
+                value += (x * (c + 1) + y) % 64 - 32;            // gradients
+                value += static_cast<int>(rng() % 17) - 8;       // noise
+                image[(static_cast<size_t>(c) * height + y) * width + x] = static_cast<uint8_t>(std::clamp(value, 0, 255));
+            }
+        }
+    }
+    return image;
+}
+
+static bool check_resize(imgproc::isa_t isa) {
+    const int sizes[][4] = {
+        {3840, 2160, 1344, 756},   // 4K screenshot to the Qwen3-VL size
+        {1920, 1080, 1280, 704},
+        {333, 251, 97, 61},        // tails of every pass
+        {100, 77, 224, 160},       // upscale, no antialiasing
+        {17, 9, 5, 3},
+        {640, 480, 640, 480}
+    };
+    bool ok = true;
+    for (const auto& size : sizes) {
+        std::vector<uint8_t> image = make_image(size[0], size[1], size[0] * 31 + size[1]);
+        std::vector<uint8_t> expected = imgproc::resize_bicubic_antialias_rgb_planar(
+            image.data(), size[0], size[1], size[2], size[3], true);
+        std::vector<uint8_t> actual = imgproc::resize_bicubic_antialias_rgb_planar_optimized(
+            image.data(), size[0], size[1], size[2], size[3], true);
+        int max_diff = 0;
+        size_t off_by_one = 0;
+        for (size_t i = 0; i < expected.size() && actual.size() == expected.size(); ++i) {
+            int diff = std::abs(static_cast<int>(expected[i]) - static_cast<int>(actual[i]));
+            max_diff = std::max(max_diff, diff);
+            off_by_one += diff != 0;
+        }
+        bool size_ok = actual.size() == expected.size() && max_diff <= 1 && off_by_one * 100 <= expected.size();
+        if (!size_ok) {
+            std::cout << "  " << size[0] << "x" << size[1] << " -> " << size[2] << "x" << size[3]
+                      << ": max diff " << max_diff << ", " << off_by_one << " of " << expected.size() << " differ" << std::endl;
+        }
+        ok &= size_ok;
+    }
+    return report(std::string(imgproc::isa_name(isa)) + " resize matches the reference", ok);
+}
+
+static bool check_normalize(imgproc::isa_t isa) {
+    bool ok = true;
+    for (int width : {1344, 333, 7}) {
+        const int height = 31;
+        std::vector<uint8_t> image = make_image(width, height, width);
+        std::vector<float> expected(image.size()), actual(image.size());
+        auto max_error = [&] {
+            float error = 0.0f;
+            for (size_t i = 0; i < expected.size(); ++i) {
+                error = std::max(error, std::fabs(expected[i] - actual[i]));
+            }
+            return error;
+        };
+
+        // Qwen3-VL: rescale, then one mean and std
+        imgproc::rescale_and_normalize(image.data(), expected.data(), width, height, 3, true, 1.0f / 255.0f, true, 0.5f, 0.5f);
+        imgproc::rescale_and_normalize_optimized(image.data(), actual.data(), width, height, 3, true, 1.0f / 255.0f, true, 0.5f, 0.5f);
+        ok &= max_error() <= 1e-5f;
+
+        // rescale only
+        imgproc::rescale_and_normalize(image.data(), expected.data(), width, height, 3, true, 1.0f / 255.0f, false, 0.0f, 1.0f);
+        imgproc::rescale_and_normalize_optimized(image.data(), actual.data(), width, height, 3, true, 1.0f / 255.0f, false, 0.0f, 1.0f);
+        ok &= max_error() <= 1e-6f;
+
+        // Qwen2-VL: a mean and std per channel
+        const std::vector<float> mean = {0.48145466f, 0.4578275f, 0.40821073f};
+        const std::vector<float> std_dev = {0.26862954f, 0.26130258f, 0.27577711f};
+        const size_t plane = static_cast<size_t>(width) * height;
+        for (int c = 0; c < 3; ++c) {
+            imgproc::rescale_and_normalize(image.data() + c * plane, expected.data() + c * plane, width, height, 1,
+                                           true, 1.0f / 255.0f, true, mean[c], std_dev[c]);
+        }
+        imgproc::rescale_and_normalize_optimized(image.data(), actual.data(), width, height, 3, true, 1.0f / 255.0f, true, mean, std_dev);
+        ok &= max_error() <= 1e-5f;
+    }
+    return report(std::string(imgproc::isa_name(isa)) + " normalize matches the reference", ok);
+}
+
+/// \brief The Qwen3-VL preprocessing before the fused kernel, in four passes
+/// \return the bytes of scratch it needed besides the output
+static size_t four_passes(const uint8_t* src, int src_w, int src_h, int dst_w, int dst_h, bf16* out) {
+    std::vector<uint8_t> resized = imgproc::resize_bicubic_antialias_rgb_planar_optimized(src, src_w, src_h, dst_w, dst_h, true);
+    const size_t frame = static_cast<size_t>(dst_w) * dst_h * 3;
+    std::vector<float> scratch(frame * 2);
+    imgproc::rescale_and_normalize_optimized(resized.data(), scratch.data(), dst_w, dst_h, 3, true, 1.0f / 255.0f, true, 0.5f, 0.5f);
+    memcpy(scratch.data() + frame, scratch.data(), frame * sizeof(float));
+    imgproc::reorder_patches_inplace(scratch.data(), out, 1, 1, 2, 3, dst_h / 16, dst_w / 16, 2, 16);
+    return resized.size() + scratch.size() * sizeof(float);
+}
+
+static void fused(const uint8_t* src, int src_w, int src_h, int dst_w, int dst_h, bf16* out) {
+    imgproc::resize_normalize_patches_bf16(src, src_w, src_h, dst_w, dst_h, 1.0f / 255.0f, 0.5f, 0.5f, 2, 2, 16, out);
+}
+
+static bool check_fused(imgproc::isa_t isa) {
+    const int sizes[][4] = {
+        {3840, 2160, 1344, 768},
+        {1000, 700, 64, 96},
+        {33, 65, 32, 32},          // upscale
+        {640, 480, 640, 480}
+    };
+    bool ok = true;
+    for (const auto& size : sizes) {
+        std::vector<uint8_t> image = make_image(size[0], size[1], size[0] + size[1]);
+        const size_t values = static_cast<size_t>(size[2]) * size[3] * 3 * 2;
+        std::vector<bf16> expected(values), actual(values);
+        four_passes(image.data(), size[0], size[1], size[2], size[3], expected.data());
+        fused(image.data(), size[0], size[1], size[2], size[3], actual.data());
+        size_t exact = 0;
+        float max_diff = 0.0f;
+        for (size_t i = 0; i < values; ++i) {
+            exact += static_cast<float>(expected[i]) == static_cast<float>(actual[i]);
+            max_diff = std::max(max_diff, std::fabs(static_cast<float>(expected[i]) - static_cast<float>(actual[i])));
+        }
+        // the scalar tier compares the separable resize with the 2D reference
+        bool size_ok = isa == imgproc::isa_t::scalar ? max_diff <= 2.0f / 255.0f + 1.0f / 128.0f : exact == values;
+        if (!size_ok) {
+            std::cout << "  " << size[0] << "x" << size[1] << " -> " << size[2] << "x" << size[3]
+                      << ": max diff " << max_diff << ", " << values - exact << " of " << values << " differ" << std::endl;
+        }
+        ok &= size_ok;
+    }
+    return report(std::string(imgproc::isa_name(isa)) + " fused patches match the four passes", ok);
+}
+
+/// \brief The Gemma3 preprocessing before the fused kernel: reorder to planar, then normalize
+static void gemma3_two_passes(const uint8_t* hwc, size_t pixel_count, std::vector<uint8_t>& chw, bf16* out) {
+    chw.resize(pixel_count * 3);
+    for (size_t i = 0; i < pixel_count; ++i) {
+        for (size_t c = 0; c < 3; ++c) {
+            chw[c * pixel_count + i] = hwc[i * 3 + c];
+        }
+    }
+    const float scale = 1.0f / 255.0f;
+    for (size_t i = 0; i < pixel_count * 3; ++i) {
+        out[i] = bf16((static_cast<float>(chw[i]) * scale - 0.5f) * 2.0f);
+    }
+}
+
+static bool check_hwc(imgproc::isa_t isa) {
+    bool ok = true;
+    for (size_t pixel_count : {size_t(896 * 896), size_t(1000), size_t(17), size_t(16), size_t(1)}) {
+        // the planar test image read as interleaved pixels: every byte value and pattern
+        std::vector<uint8_t> image = make_image(static_cast<int>(pixel_count), 1, static_cast<uint32_t>(pixel_count));
+        image[0] = 0;
+        image[pixel_count * 3 - 1] = 255;
+        std::vector<uint8_t> chw;
+        std::vector<bf16> expected(pixel_count * 3), actual(pixel_count * 3);
+        gemma3_two_passes(image.data(), pixel_count, chw, expected.data());
+        imgproc::hwc_to_chw_normalize_bf16_optimized(image.data(), pixel_count, 1.0f / 255.0f, 0.5f, 0.5f, actual.data());
+        size_t differ = 0;
+        for (size_t i = 0; i < expected.size(); ++i) {
+            differ += static_cast<float>(expected[i]) != static_cast<float>(actual[i]);
+        }
+        if (differ != 0) {
+            std::cout << "  " << pixel_count << " pixels: " << differ << " of " << expected.size() << " differ" << std::endl;
+        }
+        ok &= differ == 0;
+    }
+    return report(std::string(imgproc::isa_name(isa)) + " gemma3 bf16 matches reorder and normalize", ok);
+}
+
+template <typename F>
+static double time_ms(int repeats, F&& f) {
+    f(); // warm up
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; ++i) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / repeats;
+}
+
+int main(int argc, char* argv[]) {
+    int repeats = 3;
+    if (argc > 1) repeats = std::stoi(argv[1]);
+    const imgproc::isa_t best = imgproc::detect_isa();
+    std::cout << "cpu: " << imgproc::isa_name(best) << std::endl;
+
+    std::vector<imgproc::isa_t> isas;
+    for (imgproc::isa_t isa : {imgproc::isa_t::scalar, imgproc::isa_t::avx2, imgproc::isa_t::avx512}) {
+        if (isa <= best) {
+            isas.push_back(isa);
+        }
+    }
+
+    bool all_ok = true;
+    for (imgproc::isa_t isa : isas) {
+        imgproc::set_isa(isa);
+        all_ok &= report(std::string("forced ") + imgproc::isa_name(isa), imgproc::active_isa() == isa);
+        all_ok &= check_resize(isa);
+        all_ok &= check_normalize(isa);
+        all_ok &= check_fused(isa);
+        all_ok &= check_hwc(isa);
+    }
+
+    // 4K screenshot to the Qwen3-VL input size
+    const int src_w = 3840, src_h = 2160, dst_w = 1344, dst_h = 756;
+    std::vector<uint8_t> image = make_image(src_w, src_h, 4096);
+    std::vector<float> normalized(static_cast<size_t>(dst_w) * dst_h * 3);
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::left << std::setw(10) << "isa" << std::setw(14) << "resize ms" << std::setw(14) << "normalize ms" << "speedup" << std::endl;
+    double reference_ms = 0.0;
+    for (imgproc::isa_t isa : isas) {
+        imgproc::set_isa(isa);
+        std::vector<uint8_t> resized;
+        double resize_ms = time_ms(repeats, [&] {
+            resized = imgproc::resize_bicubic_antialias_rgb_planar_optimized(image.data(), src_w, src_h, dst_w, dst_h, true);
+        });
+        double normalize_ms = time_ms(repeats * 10, [&] {
+            imgproc::rescale_and_normalize_optimized(resized.data(), normalized.data(), dst_w, dst_h, 3,
+                                                     true, 1.0f / 255.0f, true, 0.5f, 0.5f);
+        });
+        if (isa == imgproc::isa_t::scalar) {
+            reference_ms = resize_ms + normalize_ms;
+        }
+        std::cout << std::left << std::setw(10) << imgproc::isa_name(isa) << std::setw(14) << resize_ms
+                  << std::setw(14) << normalize_ms << reference_ms / (resize_ms + normalize_ms) << "x" << std::endl;
+    }
+
+    // The whole Qwen3-VL preprocessing, on the best kernels
+    imgproc::set_isa(best);
+    const int patch_h = 768;
+    std::vector<bf16> patches(static_cast<size_t>(dst_w) * patch_h * 3 * 2);
+    size_t passes_scratch = 0;
+    double passes_ms = time_ms(repeats, [&] {
+        passes_scratch = four_passes(image.data(), src_w, src_h, dst_w, patch_h, patches.data());
+    });
+    double fused_ms = time_ms(repeats, [&] {
+        fused(image.data(), src_w, src_h, dst_w, patch_h, patches.data());
+    });
+    // per band: a float row of the source and 32 resized rows of each channel, on up to 4 threads
+    const size_t fused_scratch = 4 * (src_w * sizeof(float) + 3 * 32 * static_cast<size_t>(dst_w));
+    std::cout << "4K to " << dst_w << "x" << patch_h << " patches: four passes " << passes_ms << " ms, "
+              << passes_scratch / 1024 << " KiB scratch; fused " << fused_ms << " ms, "
+              << fused_scratch / 1024 << " KiB scratch" << std::endl;
+
+    // The Gemma3 preprocessing after the resize, 896x896
+    const size_t gemma3_pixels = 896 * 896;
+    std::vector<uint8_t> gemma3_image = make_image(896, 896, 896);
+    std::vector<uint8_t> gemma3_chw;
+    std::vector<bf16> gemma3_values(gemma3_pixels * 3);
+    double two_passes_ms = time_ms(repeats * 10, [&] {
+        gemma3_two_passes(gemma3_image.data(), gemma3_pixels, gemma3_chw, gemma3_values.data());
+    });
+    double one_pass_ms = time_ms(repeats * 10, [&] {
+        imgproc::hwc_to_chw_normalize_bf16_optimized(gemma3_image.data(), gemma3_pixels, 1.0f / 255.0f, 0.5f, 0.5f, gemma3_values.data());
+    });
+    std::cout << "gemma3 896x896 to bf16: reorder and normalize " << two_passes_ms << " ms, "
+              << gemma3_chw.size() / 1024 << " KiB scratch; one pass " << one_pass_ms << " ms, "
+              << two_passes_ms / one_pass_ms << "x" << std::endl;
+
+    if (!all_ok) {
+        header_print("ERROR", "image processing kernels test failed");
+        return 1;
+    }
+    header_print("info", "image processing kernels test passed");
+    return 0;
+}
@@ -0,0 +1,3 @@
+cd ../../test/imageproc
+make clean
+make test
@@ -0,0 +1,300 @@
+/// \file test.cpp
+/// \brief session snapshot test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. A mock CPU engine holds K/V caches sized for the
+///       full context and filled up to the current length with bf16 values shaped like
+///       attention keys. Snapshots are saved stored and compressed and restored into a
+///       fresh engine, which must end up bit-identical. The codec is checked on edge-case
+///       inputs, incomplete files must be rejected, and a restored sampler must continue
+///       the random stream where it stopped. Sizes and throughput are reported.
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include "causal_lm.hpp"
+#include "modules/sampler.hpp"
+#include "modules/kv_session.hpp"
+#include "utils/utils.hpp"
+
+/// \brief CPU engine with one K and one V cache per layer and KV head
+class mock_lm : public causal_lm, public kv_restorer {
+public:
+    mock_lm(int layers, int heads, int head_dim, int max_length)
+        : layers(layers), heads(heads), head_dim(head_dim), max_length(max_length),
+          k_cache(layers * heads), v_cache(layers * heads) {
+        for (int i = 0; i < layers * heads; i++) {
+            this->k_cache[i].assign((size_t)max_length * head_dim, bf16(0.0f));
+            this->v_cache[i].assign((size_t)max_length * head_dim, bf16(0.0f));
+        }
+    }
+
+    /// \brief Fill the caches as a prefill of length tokens would
+    void fill(int length, std::mt19937& rng) {
+        std::normal_distribution<float> keys(0.0f, 1.5f);
+        std::normal_distribution<float> values(0.0f, 0.3f);
+        for (int i = 0; i < this->layers * this->heads; i++) {
+            for (size_t j = 0; j < (size_t)length * this->head_dim; j++) {
+                this->k_cache[i][j] = bf16(keys(rng));
+                this->v_cache[i][j] = bf16(values(rng));
+            }
+        }
+        this->length = length;
+    }
+
+    buffer<bf16> forward(int id) override { this->length++; return buffer<bf16>(); }
+    buffer<bf16> prefill(std::vector<int>& ids, void* payload = nullptr) override {
+        this->length += ids.size();
+        return buffer<bf16>();
+    }
+    void set_context_length(int L) override { this->length = L; }
+    void load_weights(Q4NX& q4nx) override {}
+    void update_max_length(uint32_t MAX_L) override {}
+    void clear_context() override { this->length = 0; }
+    buffer<bf16> get_k_cache(int layer_idx, int idx) override { return this->view(this->k_cache[layer_idx * this->heads + idx]); }
+    buffer<bf16> get_v_cache(int layer_idx, int idx) override { return this->view(this->v_cache[layer_idx * this->heads + idx]); }
+    int get_current_context_length() override { return this->length; }
+
+    bool set_kv_cache(int layer_idx, int idx, const bf16* k, size_t k_size, const bf16* v, size_t v_size) override {
+        std::vector<bf16>& k_dst = this->k_cache[layer_idx * this->heads + idx];
+        std::vector<bf16>& v_dst = this->v_cache[layer_idx * this->heads + idx];
+        if (k_size != k_dst.size() || v_size != v_dst.size()) {
+            return false;
+        }
+        std::memcpy(k_dst.data(), k, k_size * sizeof(bf16));
+        std::memcpy(v_dst.data(), v, v_size * sizeof(bf16));
+        return true;
+    }
+    bool set_restored_length(int length) override {
+        this->length = length;
+        return true;
+    }
+
+    int layers;
+    int heads;
+    int head_dim;
+    int max_length;
+    int length = 0;
+    std::vector<std::vector<bf16>> k_cache;
+    std::vector<std::vector<bf16>> v_cache;
+
+private:
+    /// \brief Copy of a cache, get_k_cache hands out engine buffers
+    buffer<bf16> view(const std::vector<bf16>& cache) {
+        buffer<bf16> out(cache.size());
+        std::memcpy(out.data(), cache.data(), cache.size() * sizeof(bf16));
+        return out;
+    }
+};
+
+/// \brief Save the way AutoModel::save_session does
+static bool save(mock_lm& engine, const std::vector<int>& tokens, const std::string& path, bool compress) {
+    kv_session::writer out(path, compress);
+    bool ok = out.is_open() && out.write(kv_session::BLOB_TOKENS, 0, 0, tokens.data(), tokens.size());
+    for (int layer = 0; ok && layer < engine.layers; layer++) {
+        for (int head = 0; ok && head < engine.heads; head++) {
+            buffer<bf16> k = engine.get_k_cache(layer, head);
+            buffer<bf16> v = engine.get_v_cache(layer, head);
+            ok = out.write(kv_session::BLOB_K_CACHE, layer, head, k.data(), k.size())
+                && out.write(kv_session::BLOB_V_CACHE, layer, head, v.data(), v.size());
+        }
+    }
+    nlohmann::json state = {{"kv_length", engine.get_current_context_length()}};
+    return ok && out.finish(state);
+}
+
+/// \brief Load the way AutoModel::load_session does
+static bool load(mock_lm& engine, std::vector<int>& tokens, const std::string& path, bool& aligned) {
+    kv_session::reader in(path);
+    if (!in.is_open() || !in.read_tokens(tokens)) {
+        return false;
+    }
+    std::vector<u8> k_scratch, v_scratch;
+    for (int layer = 0; layer < engine.layers; layer++) {
+        for (int head = 0; head < engine.heads; head++) {
+            const kv_session::blob_entry_t* k = in.find(kv_session::BLOB_K_CACHE, layer, head);
+            const kv_session::blob_entry_t* v = in.find(kv_session::BLOB_V_CACHE, layer, head);
+            if (k == nullptr || v == nullptr) {
+                return false;
+            }
+            for (const kv_session::blob_entry_t* entry : {k, v}) {
+                aligned &= entry->codec != kv_session::CODEC_STORED || entry->offset % 4096 == 0;
+            }
+            const void* k_data = in.data(*k, k_scratch);
+            const void* v_data = in.data(*v, v_scratch);
+            if (k_data == nullptr || v_data == nullptr
+                || !engine.restore_kv_cache(layer, head, (const bf16*)k_data, k->count, (const bf16*)v_data, v->count)) {
+                return false;
+            }
+        }
+    }
+    return engine.restore_context_length(in.get_state().value("kv_length", -1));
+}
+
+/// \brief compress and decompress give back the input on edge cases
+static bool check_codec() {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    bool ok = true;
+    for (int elem_size : {1, 2, 4}) {
+        for (int pattern = 0; pattern < 6; pattern++) {
+            for (size_t n : {0, 1, 2, 7, 100, 4096, 65537}) {
+                std::vector<u8> data(n * elem_size, 0);
+                for (size_t i = 0; i < data.size(); i++) {
+                    switch (pattern) {
+                    case 0: data[i] = byte(rng); break;                              // incompressible
+                    case 1: break;                                                   // all zero
+                    case 2: data[i] = 0x3F; break;                                   // one symbol
+                    case 3: data[i] = (i % 97 == 0) ? byte(rng) : 0x40; break;       // skewed
+                    case 4: data[i] = i < data.size() / 2 ? byte(rng) : 0; break;    // zero tail
+                    default: {                                                       // bf16 values
+                        bf16 value(normal(rng));
+                        std::memcpy(&data[i], &value, 1);
+                        break;
+                    }
+                    }
+                }
+                std::vector<u8> packed;
+                kv_session::compress(data.data(), data.size(), elem_size, packed);
+                std::vector<u8> unpacked(data.size(), 0xAA);
+                bool round_trip = kv_session::decompress(packed.data(), packed.size(), elem_size, unpacked.data(), unpacked.size())
+                    && unpacked == data;
+                if (!round_trip) {
+                    std::cout << "codec round trip failed: elem " << elem_size << " pattern " << pattern << " n " << n << std::endl;
+                }
+                ok &= round_trip;
+                // A cut stream must be rejected, not read past its end
+                if (packed.size() > 16) {
+                    ok &= !kv_session::decompress(packed.data(), packed.size() / 2, elem_size, unpacked.data(), unpacked.size());
+                }
+            }
+        }
+    }
+    std::cout << "codec round trip: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+/// \brief A restored sampler continues the random stream where the saved one stopped
+static bool check_sampler_state() {
+    const int vocab = 1000;
+    sampler_config config;
+    config.seed = 42;
+    config.temperature = 1.0f;
+    config.top_k = 50;
+    config.top_p = 0.95f;
+    config.min_p = 0.0f;
+    Sampler saved(vocab, config);
+    std::mt19937 rng(3);
+    std::normal_distribution<float> normal(0.0f, 2.0f);
+    buffer<bf16> logits(vocab);
+    auto fill = [&]() {
+        for (int i = 0; i < vocab; i++) {
+            logits[i] = bf16(normal(rng));
+        }
+    };
+    for (int i = 0; i < 20; i++) {
+        fill();
+        saved.sample(logits);
+    }
+    sampler_config other;
+    other.seed = 7;
+    Sampler restored(vocab, other);
+    restored.set_state(saved.get_state());
+    bool ok = restored.top_k == saved.top_k && restored.temperature == saved.temperature;
+    for (int i = 0; i < 50; i++) {
+        fill();
+        buffer<bf16> copy(vocab);
+        std::memcpy(copy.data(), logits.data(), vocab * sizeof(bf16));
+        ok &= saved.sample(logits) == restored.sample(copy);
+    }
+    std::cout << "sampler resumes its random stream: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    int layers = 16;
+    int heads = 8;
+    int head_dim = 128;
+    int max_length = 8192;
+    int length = 5000;
+    if (argc > 1) length = std::stoi(argv[1]);
+    if (argc > 2) max_length = std::stoi(argv[2]);
+    std::string dir = std::filesystem::temp_directory_path().string();
+    std::string path = utils::path_join(dir, "flm_kv_session_test.flms");
+
+    bool all_ok = true;
+    all_ok &= check_codec();
+    all_ok &= check_sampler_state();
+
+    std::mt19937 rng(1234);
+    mock_lm source(layers, heads, head_dim, max_length);
+    source.fill(length, rng);
+    std::vector<int> tokens(length);
+    for (int i = 0; i < length; i++) {
+        tokens[i] = rng() % 150000;
+    }
+    double cache_mb = 2.0 * layers * heads * max_length * head_dim * sizeof(bf16) / 1048576.0;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "snapshot of " << length << " tokens, " << layers << " layers x " << heads << " KV heads, "
+              << cache_mb << " MB of caches" << std::endl;
+    std::cout << std::left << std::setw(12) << "mode" << std::setw(12) << "file MB" << std::setw(8) << "ratio"
+              << std::setw(14) << "save MB/s" << std::setw(14) << "load MB/s" << "identical" << std::endl;
+    for (bool compress : {false, true}) {
+        auto t0 = std::chrono::steady_clock::now();
+        bool saved = save(source, tokens, path, compress);
+        auto t1 = std::chrono::steady_clock::now();
+        mock_lm target(layers, heads, head_dim, max_length);
+        std::vector<int> loaded_tokens;
+        bool aligned = true;
+        bool loaded = saved && load(target, loaded_tokens, path, aligned);
+        auto t2 = std::chrono::steady_clock::now();
+        bool same = loaded && loaded_tokens == tokens && target.length == source.length && aligned;
+        for (int i = 0; same && i < layers * heads; i++) {
+            same &= std::memcmp(target.k_cache[i].data(), source.k_cache[i].data(), target.k_cache[i].size() * sizeof(bf16)) == 0;
+            same &= std::memcmp(target.v_cache[i].data(), source.v_cache[i].data(), target.v_cache[i].size() * sizeof(bf16)) == 0;
+        }
+        all_ok &= same;
+        double file_mb = saved ? std::filesystem::file_size(path) / 1048576.0 : 0.0;
+        std::cout << std::left << std::setw(12) << (compress ? "compressed" : "stored") << std::setw(12) << file_mb
+                  << std::setw(8) << (file_mb > 0 ? cache_mb / file_mb : 0.0)
+                  << std::setw(14) << cache_mb / std::chrono::duration<double>(t1 - t0).count()
+                  << std::setw(14) << cache_mb / std::chrono::duration<double>(t2 - t1).count()
+                  << (same ? "yes" : "NO") << std::endl;
+    }
+
+    // Incomplete snapshots are never seen under the final name, and damaged ones are rejected
+    {
+        std::string partial = utils::path_join(dir, "flm_kv_session_partial.flms");
+        {
+            kv_session::writer out(partial, false);
+            out.write(kv_session::BLOB_TOKENS, 0, 0, tokens.data(), tokens.size());
+        }
+        bool ok = !std::filesystem::exists(partial) && !std::filesystem::exists(partial + ".tmp");
+        std::filesystem::resize_file(path, std::filesystem::file_size(path) / 2);
+        ok &= !kv_session::reader(path).is_open();
+        {
+            std::FILE* f = std::fopen(path.c_str(), "r+b");
+            std::fputc('X', f);
+            std::fclose(f);
+        }
+        ok &= !kv_session::reader(path).is_open();
+        ok &= !kv_session::reader(utils::path_join(dir, "flm_kv_session_missing.flms")).is_open();
+        std::cout << "incomplete and damaged snapshots rejected: " << (ok ? "yes" : "NO") << std::endl;
+        all_ok &= ok;
+    }
+    std::remove(path.c_str());
+
+    if (!all_ok) {
+        header_print("ERROR", "session snapshot test failed");
+        return 1;
+    }
+    header_print("info", "session snapshot test passed");
+    return 0;
+}
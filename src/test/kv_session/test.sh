@@ -0,0 +1,3 @@
+cd ../../test/kv_session
+make clean
+make test
@@ -0,0 +1,170 @@
+/// \file test.cpp
+/// \brief model cache test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. Mock models take a fixed time to load and count
+///       how many are alive. The cache must evict the least recently used model to stay
+///       within the model count and the memory budget, never evict the model in use for a
+///       preload, serve the model in use while another one loads in the background, free
+///       models whose keep-alive ran out, and pass load failures on. Requests alternating
+///       between two models are then timed with one and with two models resident.
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "modules/model_cache.hpp"
+#include "utils/utils.hpp"
+
+static std::atomic<int> alive{0};
+static std::atomic<int> loads{0};
+
+struct mock_model {
+    std::string tag;
+    mock_model(const std::string& tag) : tag(tag) { alive++; }
+    ~mock_model() { alive--; }
+};
+
+/// \brief Loader that takes load_ms per model and fails for "broken"
+static model_cache<mock_model>::loader_t mock_loader(int load_ms) {
+    return [load_ms](const std::string& tag) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(load_ms));
+        if (tag == "broken") {
+            throw std::runtime_error("broken weights");
+        }
+        loads++;
+        return std::make_shared<mock_model>(tag);
+    };
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool report(const char* name, bool ok) {
+    std::cout << name << ": " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+/// \brief The least recently used model goes first, by count and by memory
+static bool check_lru() {
+    bool ok = true;
+    {
+        model_cache<mock_model> cache(mock_loader(0), 2);
+        cache.acquire("a", 1);
+        cache.acquire("b", 1);
+        cache.acquire("a", 1);
+        cache.acquire("c", 1);
+        ok &= cache.loaded() == std::vector<std::string>({"a", "c"});
+        ok &= cache.stats()["evictions"] == 1 && cache.stats()["hits"] == 1;
+    }
+    {
+        model_cache<mock_model> cache(mock_loader(0), 4, 10);
+        cache.acquire("a", 4);
+        cache.acquire("b", 4);
+        cache.acquire("c", 4);   // 12 > 10, a goes
+        ok &= cache.loaded() == std::vector<std::string>({"b", "c"});
+        cache.acquire("d", 20);  // larger than the budget: all others go, it is loaded anyway
+        ok &= cache.loaded() == std::vector<std::string>({"d"});
+    }
+    ok &= alive == 0;
+    return report("least recently used model evicted", ok);
+}
+
+/// \brief A preload runs beside the model in use and never evicts it
+static bool check_preload() {
+    bool ok = true;
+    {
+        model_cache<mock_model> cache(mock_loader(200), 2);
+        std::shared_ptr<mock_model> a = cache.acquire("a", 1);
+        ok &= cache.preload("b", 1) && !cache.preload("b", 1) && !cache.preload("a", 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        // b is loading; the model in use is served at once
+        auto start = std::chrono::steady_clock::now();
+        ok &= cache.acquire("a", 1) == a && seconds_since(start) < 0.05;
+        ok &= cache.stats()["models"].size() == 2 && !cache.is_loaded("b");
+        // acquiring b waits for the load in progress instead of loading it again
+        int before = loads;
+        start = std::chrono::steady_clock::now();
+        ok &= cache.acquire("b", 1)->tag == "b" && seconds_since(start) < 0.19 && loads == before + 1;
+        ok &= cache.stats()["preloads"] == 1;
+    }
+    {
+        model_cache<mock_model> cache(mock_loader(0), 1);
+        cache.acquire("a", 1);
+        cache.preload("b", 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        nlohmann::json stats = cache.stats();
+        ok &= cache.loaded() == std::vector<std::string>({"a"}) && stats["events"].back()["event"] == "preload_skipped";
+    }
+    ok &= alive == 0;
+    return report("preload beside the model in use", ok);
+}
+
+/// \brief Keep-alive frees idle models, not the one in use
+static bool check_keep_alive() {
+    bool ok = true;
+    model_cache<mock_model> cache(mock_loader(0), 3);
+    cache.acquire("a", 1, 0.05);
+    cache.acquire("b", 1, 0.05);
+    cache.acquire("c", 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    ok &= cache.loaded() == std::vector<std::string>({"c"});
+    cache.acquire("d", 1, 0.0);   // in use, so it stays
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ok &= cache.loaded() == std::vector<std::string>({"c", "d"});
+    ok &= cache.unload("d") && !cache.unload("d") && cache.loaded() == std::vector<std::string>({"c"});
+    ok &= alive == 1;
+    return report("idle models expire, the model in use stays", ok);
+}
+
+/// \brief A failed load throws and leaves nothing behind
+static bool check_failure() {
+    bool ok = false;
+    model_cache<mock_model> cache(mock_loader(0), 2);
+    cache.acquire("a", 1);
+    try {
+        cache.acquire("broken", 1);
+    }
+    catch (const std::runtime_error& e) {
+        ok = std::string(e.what()) == "broken weights";
+    }
+    ok &= cache.loaded() == std::vector<std::string>({"a"}) && cache.stats()["events"].back()["event"] == "load_failed";
+    return report("failed load passed on", ok);
+}
+
+int main(int argc, char* argv[]) {
+    int load_ms = 100;
+    if (argc > 1) load_ms = std::stoi(argv[1]);
+    bool all_ok = check_lru();
+    all_ok &= check_preload();
+    all_ok &= check_keep_alive();
+    all_ok &= check_failure();
+
+    // Requests alternating between two models
+    const int requests = 10;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << std::left << std::setw(12) << "resident" << std::setw(8) << "loads" << "seconds for " << requests << " requests" << std::endl;
+    for (int resident : {1, 2}) {
+        model_cache<mock_model> cache(mock_loader(load_ms), resident);
+        loads = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < requests; i++) {
+            all_ok &= cache.acquire(i % 2 ? "b" : "a", 1) != nullptr;
+        }
+        double seconds = seconds_since(start);
+        all_ok &= loads == (resident == 1 ? requests : 2);
+        std::cout << std::left << std::setw(12) << resident << std::setw(8) << loads << seconds << std::endl;
+    }
+
+    if (!all_ok) {
+        header_print("ERROR", "model cache test failed");
+        return 1;
+    }
+    header_print("info", "model cache test passed");
+    return 0;
+}
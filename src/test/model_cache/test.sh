@@ -0,0 +1,3 @@
+cd ../../test/model_cache
+make clean
+make test
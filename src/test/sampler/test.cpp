@@ -0,0 +1,524 @@
+/// \file test.cpp
+/// \brief sampler microbenchmark
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. Checks the sampler stages against
+///       straightforward reference implementations and reports per-token latency.
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include "typedef.hpp"
+#include "modules/sampler.hpp"
+#include "utils/utils.hpp"
+
+/// \brief Reference top-k, the full-vocabulary partial_sort the sampler used before
+static void reference_topk(const std::vector<float>& logits, int k, logits_list_t& out) {
+    logits_list_t pairs(logits.size());
+    for (size_t i = 0; i < logits.size(); i++) {
+        pairs[i] = {logits[i], (int)i, 0.0f};
+    }
+    std::partial_sort(pairs.begin(), pairs.begin() + k, pairs.end(),
+        [](const logits_t& a, const logits_t& b) { return a.logits > b.logits; });
+    out.assign(pairs.begin(), pairs.begin() + k);
+}
+
+/// \brief Logits shaped like an LM head output: a wide bulk and a few strong candidates
+static void fill_logits(std::vector<float>& logits, std::mt19937& rng) {
+    std::normal_distribution<float> bulk(0.0f, 2.5f);
+    std::uniform_int_distribution<int> pick(0, (int)logits.size() - 1);
+    for (auto& l : logits) {
+        l = float(bf16(bulk(rng)));   // round through bf16 like the NPU output
+    }
+    for (int i = 0; i < 16; i++) {
+        logits[pick(rng)] += 10.0f + i;
+    }
+}
+
+/// \brief Sparse penalty pass against a dense scan of the counters
+static bool check_penalties(std::mt19937& rng) {
+    const int vocab = 32000;
+    sampler_config config;
+    config.rep_penalty = 1.1f;
+    config.freq_penalty = 0.2f;
+    config.pre_penalty = 0.3f;
+    Sampler sampler(vocab, config);
+    std::uniform_int_distribution<int> pick(0, 200);   // small range so tokens repeat
+    std::vector<float> logits(vocab);
+    bool ok = true;
+
+    for (int round = 0; round < 2; round++) {
+        for (int t = 0; t < 500; t++) {
+            sampler.ring_buffer_update(pick(rng));
+        }
+        fill_logits(logits, rng);
+        std::vector<float> expected = logits;
+        for (int id = 0; id < vocab; id++) {
+            int count = sampler.counters[id];
+            if (count <= 0) continue;
+            expected[id] = expected[id] <= 0.0f ? expected[id] * config.rep_penalty : expected[id] / config.rep_penalty;
+            expected[id] -= float(count) * config.freq_penalty + config.pre_penalty;
+        }
+        sampler.logits = logits;
+        sampler.sampler_penalty_apply();
+        // the test flags include -ffast-math, which may contract or reorder the penalty arithmetic
+        for (int id = 0; id < vocab; id++) {
+            ok &= std::fabs(sampler.logits[id] - expected[id]) <= 1e-6f * std::max(1.0f, std::fabs(expected[id]));
+        }
+        ok &= sampler.window_tokens.size() <= sampler.repeat_last_n;
+
+        sampler.reset_penalties();
+        ok &= sampler.window_tokens.empty() && sampler.token_history.empty();
+        ok &= std::all_of(sampler.counters.begin(), sampler.counters.end(), [](int c) { return c == 0; });
+        ok &= std::all_of(sampler.token_positions.begin(), sampler.token_positions.end(), [](int p) { return p == -1; });
+    }
+    return ok;
+}
+
+/// \brief Selection top-k against the full partial_sort, with timings
+static bool bench_topk(std::mt19937& rng) {
+    const int vocab_sizes[] = {32000, 128256, 201088};
+    const int ks[] = {10, 40, 100};
+    const int iters = 200;
+    bool all_ok = true;
+
+    std::cout << std::left << std::setw(10) << "vocab" << std::setw(6) << "k"
+              << std::setw(18) << "partial_sort(us)" << std::setw(18) << "selection(us)"
+              << std::setw(10) << "speedup" << "match" << std::endl;
+
+    for (int vocab : vocab_sizes) {
+        sampler_config config;
+        Sampler sampler(vocab, config);
+        std::vector<std::vector<float>> inputs(8, std::vector<float>(vocab));
+        for (auto& in : inputs) {
+            fill_logits(in, rng);
+        }
+
+        for (int k : ks) {
+            logits_list_t ref;
+            bool ok = true;
+            for (auto& in : inputs) {
+                reference_topk(in, k, ref);
+                sampler.logits = in;
+                sampler.sampler_topk_apply(k);
+                ok &= sampler.top_k_logits.size() == ref.size();
+                for (size_t i = 0; ok && i < ref.size(); i++) {
+                    ok &= sampler.top_k_logits[i].logits == ref[i].logits;
+                }
+            }
+            all_ok &= ok;
+
+            time_utils::time_point start = time_utils::now();
+            for (int it = 0; it < iters; it++) {
+                reference_topk(inputs[it % inputs.size()], k, ref);
+            }
+            double ref_us = time_utils::duration_ns(start, time_utils::now()).first / 1000.0 / iters;
+
+            double sel_us = 0;
+            for (int it = 0; it < iters; it++) {
+                sampler.logits = inputs[it % inputs.size()];
+                start = time_utils::now();
+                sampler.sampler_topk_apply(k);
+                sel_us += time_utils::duration_ns(start, time_utils::now()).first / 1000.0;
+            }
+            sel_us /= iters;
+
+            std::cout << std::left << std::setw(10) << vocab << std::setw(6) << k
+                      << std::setw(18) << std::fixed << std::setprecision(2) << ref_us
+                      << std::setw(18) << sel_us
+                      << std::setw(10) << ref_us / sel_us
+                      << (ok ? "yes" : "NO") << std::endl;
+        }
+    }
+
+    return all_ok;
+}
+
+/// \brief bf16 logits with a handful of strong candidates
+static void fill_logits_bf16(buffer<bf16>& logits, std::mt19937& rng) {
+    std::vector<float> tmp(logits.size());
+    fill_logits(tmp, rng);
+    for (size_t i = 0; i < tmp.size(); i++) {
+        logits[i] = bf16(tmp[i]);
+    }
+}
+
+/// \brief Fused bf16 pass against the staged pipeline (convert, penalties, top-k), for every ISA
+/// \note Also reports the per-token latency of the whole sample() call.
+static bool bench_sample(std::mt19937& rng) {
+    const int vocab_sizes[] = {32000, 128256, 201088};
+    const cpu_features::isa_t isas[] = {cpu_features::scalar, cpu_features::avx2, cpu_features::avx512};
+    const int iters = 500;
+    bool all_ok = true;
+
+    std::cout << std::left << std::setw(10) << "vocab" << std::setw(8) << "isa"
+              << std::setw(16) << "staged(us)" << std::setw(16) << "fused(us)"
+              << std::setw(16) << "sample(us)" << "match" << std::endl;
+
+    for (int vocab : vocab_sizes) {
+        sampler_config config;
+        config.rep_penalty = 1.1f;
+        config.freq_penalty = 0.1f;
+        buffer<bf16> x(vocab);
+        fill_logits_bf16(x, rng);
+
+        for (cpu_features::isa_t isa : isas) {
+            if (cpu_features::clamp_isa(isa) != isa) {
+                continue;
+            }
+            Sampler sampler(vocab, config);
+            sampler.topk_engine.set_isa(isa);
+            std::uniform_int_distribution<int> pick(0, vocab - 1);
+            for (int t = 0; t < 64; t++) {
+                sampler.ring_buffer_update(pick(rng));
+            }
+            // make sure a penalized token competes for the top spots
+            int hot = sampler.token_history.back();
+            x[hot] = bf16(40.0f);
+
+            // Staged reference: fp32 copy, dense penalty, then top-k
+            for (int i = 0; i < vocab; i++) {
+                sampler.logits[i] = float(x[i]);
+            }
+            sampler.sampler_penalty_apply();
+            sampler.sampler_topk_apply(sampler.top_k);
+            logits_list_t staged = sampler.top_k_logits;
+
+            sampler.sampler_fused_apply(x);
+            bool ok = sampler.top_k_logits.size() == staged.size();
+            for (size_t i = 0; ok && i < staged.size(); i++) {
+                ok &= sampler.top_k_logits[i].logits == staged[i].logits;
+            }
+            ok &= sampler.topk_engine.get_max() == staged[0].logits;
+            all_ok &= ok;
+
+            double staged_us = 0, fused_us = 0, sample_us = 0;
+            for (int it = 0; it < iters; it++) {
+                time_utils::time_point start = time_utils::now();
+                for (int i = 0; i < vocab; i++) {
+                    sampler.logits[i] = float(x[i]);
+                }
+                sampler.sampler_penalty_apply();
+                sampler.sampler_topk_apply(sampler.top_k);
+                time_utils::time_point mid = time_utils::now();
+                sampler.sampler_fused_apply(x);
+                time_utils::time_point stop = time_utils::now();
+                staged_us += time_utils::duration_ns(start, mid).first / 1000.0;
+                fused_us += time_utils::duration_ns(mid, stop).first / 1000.0;
+            }
+            for (int it = 0; it < iters; it++) {
+                time_utils::time_point start = time_utils::now();
+                sampler.sample(x);
+                sample_us += time_utils::duration_ns(start, time_utils::now()).first / 1000.0;
+            }
+
+            std::cout << std::left << std::setw(10) << vocab << std::setw(8) << cpu_features::isa_name(isa)
+                      << std::setw(16) << std::fixed << std::setprecision(2) << staged_us / iters
+                      << std::setw(16) << fused_us / iters
+                      << std::setw(16) << sample_us / iters
+                      << (ok ? "yes" : "NO") << std::endl;
+        }
+    }
+    return all_ok;
+}
+
+/// \brief Greedy argmax against a dense scan, whole vocabulary and a sub-range
+static bool bench_greedy(std::mt19937& rng) {
+    const int vocab_sizes[] = {32000, 128256, 201088};
+    const int iters = 500;
+    bool all_ok = true;
+
+    std::cout << std::left << std::setw(10) << "vocab" << std::setw(8) << "isa"
+              << std::setw(16) << "greedy(us)" << "match" << std::endl;
+
+    for (int vocab : vocab_sizes) {
+        sampler_config config;
+        config.temperature = 0.0f;
+        config.rep_penalty = 1.3f;
+        buffer<bf16> x(vocab);
+        fill_logits_bf16(x, rng);
+
+        Sampler sampler(vocab, config);
+        for (int t = 0; t < 64; t++) {
+            // penalize the current winners so the argmax has to look past them
+            int best = int(std::max_element(x.begin(), x.begin() + vocab,
+                [&](bf16 a, bf16 b) { return float(a) < float(b); }) - x.begin());
+            sampler.ring_buffer_update(best);
+            x[best] = bf16(float(x[best]) - 0.5f);
+        }
+
+        auto dense_argmax = [&](int begin, int end) {
+            int best_id = begin;
+            float best = -std::numeric_limits<float>::infinity();
+            for (int i = begin; i < end; i++) {
+                float v = float(x[i]);
+                if (sampler.counters[i] > 0) {
+                    v = v <= 0.0f ? v * config.rep_penalty : v / config.rep_penalty;
+                }
+                if (v > best) {
+                    best = v;
+                    best_id = i;
+                }
+            }
+            return best_id;
+        };
+
+        for (cpu_features::isa_t isa : {cpu_features::scalar, cpu_features::avx2, cpu_features::avx512}) {
+            if (cpu_features::clamp_isa(isa) != isa) {
+                continue;
+            }
+            sampler.topk_engine.set_isa(isa);
+            bool ok = true;
+            int expected = dense_argmax(0, vocab);
+            ok &= sampler.sample_greedy(x) == expected;
+            ok &= sampler.top_k_logits.size() == 1 && sampler.top_k_logits[0].token_id == expected;
+            expected = dense_argmax(vocab / 3, vocab / 3 + 1500);
+            ok &= sampler.sample_greedy(x, vocab / 3, vocab / 3 + 1500) == expected;
+            all_ok &= ok;
+
+            double greedy_us = 0;
+            for (int it = 0; it < iters; it++) {
+                time_utils::time_point start = time_utils::now();
+                sampler.sample(x);
+                greedy_us += time_utils::duration_ns(start, time_utils::now()).first / 1000.0;
+            }
+            std::cout << std::left << std::setw(10) << vocab << std::setw(8) << cpu_features::isa_name(isa)
+                      << std::setw(16) << std::fixed << std::setprecision(2) << greedy_us / iters
+                      << (ok ? "yes" : "NO") << std::endl;
+        }
+    }
+    return all_ok;
+}
+
+/// \brief Same seed gives the same token stream, a different seed does not
+static bool check_seed(std::mt19937& rng) {
+    const int vocab = 32000;
+    buffer<bf16> x(vocab);
+    fill_logits_bf16(x, rng);
+    sampler_config config;
+    config.temperature = 1.5f;
+    config.top_p = 1.0f;
+    config.min_p = 0.0f;
+
+    auto run = [&](i64 seed) {
+        config.seed = seed;
+        Sampler sampler(vocab, config);
+        std::vector<int> tokens;
+        for (int t = 0; t < 256; t++) {
+            tokens.push_back(sampler.sample(x));
+        }
+        return tokens;
+    };
+    std::vector<int> a = run(42), b = run(42), c = run(43);
+    std::cout << "seeded streams reproducible: " << (a == b ? "yes" : "NO")
+              << ", distinct seeds differ: " << (a != c ? "yes" : "NO") << std::endl;
+    return a == b && a != c;
+}
+
+/// \brief Logprobs against a log-softmax over the whole vocabulary, and their per-token cost
+static bool bench_logprobs(std::mt19937& rng) {
+    const int vocab = 201088;
+    const int iters = 500;
+    buffer<bf16> x(vocab);
+    fill_logits_bf16(x, rng);
+    sampler_config config;
+    config.seed = 7;
+    bool ok = true;
+
+    // Reference: candidate logits from the staged pipeline, log-softmax over every logit
+    Sampler ref(vocab, config);
+    for (int i = 0; i < vocab; i++) {
+        ref.logits[i] = float(x[i]);
+    }
+    ref.sampler_topk_apply(config.top_k);
+    double sum = 0;
+    for (int i = 0; i < vocab; i++) {
+        sum += std::exp(double(float(x[i]) - ref.top_k_logits[0].logits));
+    }
+    double lse = ref.top_k_logits[0].logits + std::log(sum);
+
+    double base_us = 0, lp_us = 0;
+    for (int top_n : {0, 5, 20}) {
+        Sampler sampler(vocab, config);
+        sampler.set_logprobs(top_n > 0, top_n);
+        double total_us = 0;
+        for (int it = 0; it < iters; it++) {
+            sampler.reset_penalties();   // keep every iteration on the same candidates
+            time_utils::time_point start = time_utils::now();
+            int token = sampler.sample(x);
+            total_us += time_utils::duration_ns(start, time_utils::now()).first / 1000.0;
+            if (top_n == 0) continue;
+
+            const token_logprobs_t& lp = sampler.get_logprobs();
+            ok &= lp.chosen.token_id == token && (int)lp.top.size() == top_n;
+            for (int i = 0; ok && i < top_n; i++) {
+                double expected = ref.top_k_logits[i].logits - lse;
+                ok &= lp.top[i].token_id == ref.top_k_logits[i].token_id;
+                ok &= std::abs(lp.top[i].logprob - expected) < 1e-4;
+            }
+        }
+        if (top_n == 0) {
+            base_us = total_us / iters;
+        }
+        else {
+            lp_us = total_us / iters;
+            std::cout << "logprobs top_n " << std::setw(3) << top_n << ": sample " << std::fixed << std::setprecision(2)
+                      << lp_us << " us, overhead " << lp_us - base_us << " us" << std::endl;
+        }
+    }
+    std::cout << "logprobs match log-softmax over the vocabulary: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+/// \brief Logit bias and allowed-token mask against a dense reference, and their cost
+static bool bench_constraints(std::mt19937& rng) {
+    const int vocab = 201088;
+    const int iters = 500;
+    buffer<bf16> x(vocab);
+    fill_logits_bf16(x, rng);
+    sampler_config config;
+    config.rep_penalty = 1.2f;
+    config.pre_penalty = 0.5f;
+    Sampler sampler(vocab, config);
+    std::uniform_int_distribution<int> pick(0, vocab - 1);
+    for (int t = 0; t < 64; t++) {
+        sampler.ring_buffer_update(pick(rng));
+    }
+
+    // Bias: ban a few strong tokens, boost a few weak ones, some inside the penalty window
+    std::vector<std::pair<int, float>> bias;
+    for (int i = 0; i < 8; i++) {
+        bias.emplace_back(pick(rng), 100.0f * (i % 2 ? 1.0f : -1.0f) * float(i + 1) / 8.0f);
+    }
+    bias.emplace_back(sampler.window_tokens[0], -3.0f);
+
+    auto dense_logits = [&](const std::vector<std::pair<int, float>>& b, const std::vector<int>& allowed) {
+        std::vector<float> dense(vocab);
+        for (int i = 0; i < vocab; i++) {
+            float v = float(x[i]);
+            int count = sampler.counters[i];
+            if (count > 0) {
+                v = v <= 0.0f ? v * config.rep_penalty : v / config.rep_penalty;
+                v -= float(count) * config.freq_penalty + config.pre_penalty;
+            }
+            dense[i] = v;
+        }
+        for (const auto& [id, value] : b) {
+            dense[id] += value;
+        }
+        if (!allowed.empty()) {
+            std::vector<bool> keep(vocab, false);
+            for (int id : allowed) keep[id] = true;
+            for (int i = 0; i < vocab; i++) {
+                if (!keep[i]) dense[i] = -std::numeric_limits<float>::infinity();
+            }
+        }
+        return dense;
+    };
+    auto reference = [&](const std::vector<std::pair<int, float>>& b, const std::vector<int>& allowed, int k) {
+        if (!allowed.empty()) {
+            k = std::min<int>(k, (int)allowed.size());
+        }
+        logits_list_t out;
+        reference_topk(dense_logits(b, allowed), k, out);
+        return out;
+    };
+    // The logprob normalizer: log-sum-exp over the tokens that survive the constraints
+    auto reference_lse = [&](const std::vector<std::pair<int, float>>& b, const std::vector<int>& allowed) {
+        std::vector<float> dense = dense_logits(b, allowed);
+        float max = *std::max_element(dense.begin(), dense.end());
+        double sum = 0;
+        for (float v : dense) {
+            sum += std::exp(double(v - max));
+        }
+        return max + std::log(sum);
+    };
+
+    std::vector<int> labels, half;
+    for (int i = 0; i < 12; i++) labels.push_back(pick(rng));
+    for (int i = 0; i < vocab; i += 2) half.push_back(i);
+    labels.push_back(bias[1].first);   // a boosted label
+
+    bool all_ok = true;
+    std::cout << std::left << std::setw(10) << "isa" << std::setw(14) << "constraint"
+              << std::setw(16) << "mask(us)" << std::setw(16) << "fused(us)" << "match" << std::endl;
+    for (cpu_features::isa_t isa : {cpu_features::scalar, cpu_features::avx2, cpu_features::avx512}) {
+        if (cpu_features::clamp_isa(isa) != isa) {
+            continue;
+        }
+        sampler.topk_engine.set_isa(isa);
+        struct { const char* name; const std::vector<int>* allowed; } cases[] = {
+            {"bias", nullptr}, {"bias+half", &half}, {"bias+labels", &labels}
+        };
+        for (auto& c : cases) {
+            // The mask is rewritten in place every token
+            sampler.set_logit_bias(bias);
+            if (c.allowed) sampler.set_allowed_tokens(*c.allowed);
+            else sampler.clear_allowed_tokens();
+
+            logits_list_t expected = reference(bias, c.allowed ? *c.allowed : std::vector<int>(), config.top_k);
+            logsumexp_t lse;
+            sampler.sampler_fused_apply(x, -1, &lse);
+            bool ok = sampler.top_k_logits.size() == expected.size();
+            for (size_t i = 0; ok && i < expected.size(); i++) {
+                ok &= sampler.top_k_logits[i].logits == expected[i].logits;
+            }
+            ok &= std::abs(lse.value() - reference_lse(bias, c.allowed ? *c.allowed : std::vector<int>())) < 1e-4;
+            // Greedy goes through the same path with an argmax sink
+            ok &= sampler.sample_greedy(x) == expected[0].token_id;
+            all_ok &= ok;
+
+            double mask_us = 0, fused_us = 0;
+            for (int it = 0; it < iters; it++) {
+                time_utils::time_point start = time_utils::now();
+                if (c.allowed) sampler.set_allowed_tokens(*c.allowed);
+                time_utils::time_point mid = time_utils::now();
+                sampler.sampler_fused_apply(x);
+                time_utils::time_point stop = time_utils::now();
+                mask_us += time_utils::duration_ns(start, mid).first / 1000.0;
+                fused_us += time_utils::duration_ns(mid, stop).first / 1000.0;
+            }
+            std::cout << std::left << std::setw(10) << cpu_features::isa_name(isa) << std::setw(14) << c.name
+                      << std::setw(16) << std::fixed << std::setprecision(2) << mask_us / iters
+                      << std::setw(16) << fused_us / iters
+                      << (ok ? "yes" : "NO") << std::endl;
+        }
+    }
+    sampler.clear_logit_bias();
+    sampler.clear_allowed_tokens();
+    return all_ok;
+}
+
+int main(int argc, char* argv[]) {
+    std::mt19937 rng(1234);
+    bool all_ok = true;
+
+    std::cout << "cpu: " << cpu_features::isa_name(cpu_features::best_isa()) << std::endl;
+
+    all_ok &= bench_topk(rng);
+
+    bool penalties_ok = check_penalties(rng);
+    std::cout << "sparse penalties match dense scan: " << (penalties_ok ? "yes" : "NO") << std::endl;
+    all_ok &= penalties_ok;
+
+    all_ok &= bench_sample(rng);
+
+    all_ok &= bench_greedy(rng);
+
+    all_ok &= check_seed(rng);
+
+    all_ok &= bench_logprobs(rng);
+
+    all_ok &= bench_constraints(rng);
+
+    if (!all_ok) {
+        header_print("ERROR", "sampler output does not match the reference");
+        return 1;
+    }
+    header_print("info", "sampler test passed");
+    return 0;
+}
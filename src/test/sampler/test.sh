@@ -0,0 +1,3 @@
+cd ../../test/sampler
+make clean
+make test
@@ -0,0 +1,366 @@
+/// \file test.cpp
+/// \brief speculative decoding test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. Two mock CPU engines stand in for the target and
+///       the draft: their logits are a hash of the last two tokens in the KV cache, the
+///       draft agrees with the target's favourite token most of the time. Speculative
+///       output must match plain decoding token for token, greedy and sampled, and both
+///       KV caches must hold exactly the emitted tokens after every request. The prompt
+///       lookup is checked against a brute-force search and run on prompts that quote a
+///       passage the target goes on to repeat.
+///       The cost of a run is modeled in target forward passes.
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "causal_lm.hpp"
+#include "modules/sampler.hpp"
+#include "modules/speculative.hpp"
+#include "modules/prompt_lookup.hpp"
+#include "utils/utils.hpp"
+
+static uint32_t mix(uint32_t a, uint32_t b, uint32_t c) {
+    uint64_t x = (uint64_t)a * 0x9E3779B1u ^ (uint64_t)b * 0x85EBCA77u ^ (uint64_t)c * 0xC2B2AE3Du;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 32;
+    return (uint32_t)x;
+}
+
+/// \brief The token a mock engine favours after a and b
+static int favourite_of(int a, int b, int vocab, int agreement) {
+    int favourite = mix(a, b, 1) % vocab;
+    if ((int)(mix(a, b, 2) % 100) >= agreement) {
+        favourite = (favourite + 1 + mix(a, b, 3) % (vocab - 1)) % vocab;
+    }
+    return favourite;
+}
+
+/// \brief CPU engine with a KV cache of token ids
+/// \param agreement the share of contexts in which the favourite token is the target's
+class mock_lm : public causal_lm {
+public:
+    mock_lm(int vocab, int agreement) : vocab(vocab), agreement(agreement), y(vocab) {}
+
+    buffer<bf16> forward(int id) override {
+        this->kv.push_back(id);
+        this->forwards++;
+        this->fill(this->y.data());
+        return this->y;
+    }
+    buffer<bf16> prefill(std::vector<int>& ids, void* payload = nullptr) override {
+        this->kv.insert(this->kv.end(), ids.begin(), ids.end());
+        this->fill(this->y.data());
+        return this->y;
+    }
+    void set_context_length(int L) override { this->kv.resize(L); }
+    void load_weights(Q4NX& q4nx) override {}
+    void update_max_length(uint32_t MAX_L) override {}
+    void clear_context() override { this->kv.clear(); }
+    buffer<bf16> get_k_cache(int layer_idx, int idx) override { return buffer<bf16>(); }
+    buffer<bf16> get_v_cache(int layer_idx, int idx) override { return buffer<bf16>(); }
+    int get_current_context_length() override { return this->kv.size(); }
+
+    std::vector<int> kv;
+    uint64_t forwards = 0;
+    uint64_t passes = 0;        // batched verify passes
+
+protected:
+    /// \brief Logits after the current KV cache
+    void fill(bf16* out) {
+        int a = this->kv.size() > 1 ? this->kv[this->kv.size() - 2] : 0;
+        int b = this->kv.empty() ? 0 : this->kv.back();
+        int favourite = favourite_of(a, b, this->vocab, this->agreement);
+        int runner_up = mix(a, b, 4) % this->vocab;
+        for (int t = 0; t < this->vocab; t++) {
+            float logit = (mix(a * 7 + 1, b, t + 5) % 1000) / 500.0f - 1.0f;
+            if (t == runner_up) logit += 3.0f;
+            if (t == favourite) logit += 5.0f;
+            out[t] = bf16(logit);
+        }
+    }
+
+    int vocab;
+    int agreement;
+    buffer<bf16> y;
+};
+
+/// \brief The target engine, scores a whole proposal in one pass
+class mock_target : public mock_lm, public batch_verifier {
+public:
+    mock_target(int vocab) : mock_lm(vocab, 100) {}
+
+    int verify_batch(std::vector<int>& ids, buffer<bf16>& logits) override {
+        if (logits.size() < ids.size() * this->vocab) {
+            logits = buffer<bf16>(ids.size() * this->vocab);
+        }
+        for (size_t i = 0; i < ids.size(); i++) {
+            this->kv.push_back(ids[i]);
+            this->fill(logits.data() + i * this->vocab);
+        }
+        this->passes++;
+        return this->vocab;
+    }
+};
+
+/// \brief The prompt lookup finds the latest earlier occurrence of the longest suffix
+/// \note Compared with a brute-force search while the history grows and is cut back
+static bool check_prompt_lookup() {
+    const int min_ngram = 2, max_ngram = 4, k = 5;
+    std::vector<int> history;
+    prompt_lookup lookup(history, min_ngram, max_ngram);
+    bool ok = true;
+    uint64_t hits = 0;
+    for (int i = 0; i < 20000; i++) {
+        // a small alphabet repeats n-grams often
+        history.push_back(mix(i, 7, 11) % 6);
+        if (i % 1000 == 999) {
+            size_t keep = history.size() / 2;
+            history.resize(keep);
+            lookup.truncate(keep);
+        }
+        std::vector<int> expected;
+        size_t len = history.size();
+        for (int n = std::min<int>(max_ngram, (int)len - 1); n >= min_ngram && expected.empty(); n--) {
+            for (size_t end = len - 1; end >= (size_t)n; end--) {
+                if (std::equal(history.begin() + (end - n), history.begin() + end, history.end() - n)) {
+                    size_t count = std::min<size_t>(k, len - end);
+                    expected.assign(history.begin() + end, history.begin() + end + count);
+                    break;
+                }
+            }
+        }
+        std::vector<int> proposed;
+        lookup.propose(k, proposed);
+        ok &= proposed == expected;
+        hits += !proposed.empty();
+    }
+    std::cout << "prompt lookup matches brute force: " << (ok ? "yes" : "NO") << " (" << hits << " hits)" << std::endl;
+    return ok;
+}
+
+typedef struct {
+    std::vector<int> tokens;
+    double cost;    // in target forward passes
+} run_result_t;
+
+/// \brief Chat turns: a few unrelated tokens each
+static std::vector<std::vector<int>> chat_prompts(int requests, int vocab) {
+    std::vector<std::vector<int>> prompts(requests);
+    for (int q = 0; q < requests; q++) {
+        for (int i = 0; i < 24; i++) prompts[q].push_back(1 + mix(q, i, 99) % (vocab - 1));
+    }
+    return prompts;
+}
+
+/// \brief Document QA: the prompt quotes a passage the target would write itself and ends
+///        on its first two tokens, so the answer repeats the passage
+static std::vector<std::vector<int>> quote_prompts(int requests, int vocab) {
+    std::vector<std::vector<int>> prompts(requests);
+    for (int q = 0; q < requests; q++) {
+        std::vector<int>& prompt = prompts[q];
+        for (int i = 0; i < 8; i++) prompt.push_back(1 + mix(q, i, 98) % (vocab - 1));
+        int a = 1 + mix(q, 0, 97) % (vocab - 1), b = 1 + mix(q, 1, 97) % (vocab - 1);
+        prompt.push_back(a);
+        prompt.push_back(b);
+        for (int i = 0; i < 160; i++) {
+            int c = favourite_of(a, b, vocab, 100);
+            c = c == 0 ? 1 : c;     // no eos inside the passage
+            prompt.push_back(c);
+            a = b;
+            b = c;
+        }
+        for (int i = 0; i < 8; i++) prompt.push_back(1 + mix(q, i, 96) % (vocab - 1));
+        prompt.push_back(prompt[8]);
+        prompt.push_back(prompt[9]);
+    }
+    return prompts;
+}
+
+/// \brief The decode loop of AutoModel::_shared_generate over several requests
+/// \param spec nullptr for plain decoding
+/// \param with_draft whether the draft model proposes
+/// \param with_lookup whether the prompt lookup proposes
+static run_result_t run(mock_target& target, mock_lm& draft, speculative_decoder* spec, bool with_draft, bool with_lookup,
+    sampler_config config, int vocab, const std::vector<std::vector<int>>& prompts, int length_limit, bool& kv_ok) {
+    const int eos = 0;
+    const double draft_cost = 0.1, verify_cost_per_token = 0.05;
+    Sampler sampler(vocab, config);
+    target.clear_context();
+    draft.clear_context();
+    target.forwards = target.passes = draft.forwards = 0;
+    run_result_t r;
+    std::vector<int> history;
+    prompt_lookup lookup(history);
+    if (spec != nullptr) {
+        spec->set_proposers(with_draft ? &draft : nullptr, with_lookup ? &lookup : nullptr);
+        spec->reset();
+        spec->reset_stats();
+    }
+    std::vector<int> step_tokens;
+    auto sample_row = [&](buffer<bf16>& y) {
+        int token = sampler.sample(y);
+        step_tokens.push_back(token);
+        return token;
+    };
+    auto stop = [&](int token) { return token == eos; };
+    for (std::vector<int> prompt : prompts) {
+        history.insert(history.end(), prompt.begin(), prompt.end());
+        buffer<bf16> y = target.prefill(prompt);
+        draft.prefill(prompt);
+        int pending = sampler.sample(y);
+        r.tokens.push_back(pending);
+        history.push_back(pending);
+        int generated = 0;
+        bool done = pending == eos;
+        while (!done) {
+            step_tokens.clear();
+            if (spec != nullptr) {
+                spec->step(pending, length_limit - generated, sample_row, stop);
+            }
+            else {
+                buffer<bf16> logits = target.forward(pending);
+                sample_row(logits);
+            }
+            for (int token : step_tokens) {
+                pending = token;
+                r.tokens.push_back(token);
+                history.push_back(token);
+                if (token == eos) {
+                    if (spec != nullptr) spec->append(token);
+                    else target.forward(token);
+                    done = true;
+                    break;
+                }
+                if (++generated >= length_limit) {
+                    done = true;
+                    break;
+                }
+            }
+        }
+        if (spec != nullptr) spec->flush();
+        // The caches hold the history but the last token, unless it was eos
+        size_t expected = pending == eos ? history.size() : history.size() - 1;
+        kv_ok &= target.kv == std::vector<int>(history.begin(), history.begin() + expected);
+        kv_ok &= !with_draft || draft.kv == target.kv;
+        if (pending != eos) {
+            // like the next insert, keep the KV in step with the history
+            target.forward(pending);
+            draft.forward(pending);
+        }
+    }
+    r.cost = target.forwards + target.passes;
+    if (spec != nullptr) {
+        r.cost += draft.forwards * draft_cost + spec->get_stats().proposed * verify_cost_per_token;
+    }
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    const int vocab = 256;
+    int requests = 8;
+    int length_limit = 200;
+    if (argc > 1) requests = std::stoi(argv[1]);
+    if (argc > 2) length_limit = std::stoi(argv[2]);
+
+    bool all_ok = true;
+    all_ok &= check_prompt_lookup();
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "draft model" << std::endl;
+    std::cout << std::left << std::setw(10) << "sampling" << std::setw(10) << "agree(%)" << std::setw(6) << "k"
+              << std::setw(12) << "accept(%)" << std::setw(14) << "tok/pass" << std::setw(10) << "speedup"
+              << "same output" << std::endl;
+    for (bool greedy : {true, false}) {
+        sampler_config config;
+        config.seed = 1234;
+        config.rep_penalty = 1.1f;
+        if (greedy) {
+            config.temperature = 0.0f;
+            config.top_k = 1;
+        }
+        for (int agreement : {90, 60}) {
+            mock_target target(vocab);
+            mock_lm draft(vocab, agreement);
+            bool kv_ok = true;
+            std::vector<std::vector<int>> prompts = chat_prompts(requests, vocab);
+            run_result_t plain = run(target, draft, nullptr, false, false, config, vocab, prompts, length_limit, kv_ok);
+            for (int k : {2, 4, 6}) {
+                speculative_decoder spec(&target, &draft, vocab, k);
+                run_result_t fast = run(target, draft, &spec, true, false, config, vocab, prompts, length_limit, kv_ok);
+                const speculative_decoder::stats_t& stats = spec.get_stats();
+                bool same = fast.tokens == plain.tokens;
+                all_ok &= same && kv_ok;
+                std::cout << std::left << std::setw(10) << (greedy ? "greedy" : "sampled") << std::setw(10) << agreement
+                          << std::setw(6) << k << std::setw(12) << 100.0 * stats.accepted / stats.proposed
+                          << std::setw(14) << (double)stats.emitted / stats.rounds << std::setw(10) << plain.cost / fast.cost
+                          << (same ? "yes" : "NO") << (kv_ok ? "" : " (KV mismatch)") << std::endl;
+            }
+        }
+    }
+
+    std::cout << "prompt lookup" << std::endl;
+    std::cout << std::left << std::setw(10) << "sampling" << std::setw(8) << "prompt" << std::setw(14) << "proposers"
+              << std::setw(6) << "k" << std::setw(12) << "accept(%)" << std::setw(14) << "tok/pass" << std::setw(10)
+              << "speedup" << "same output" << std::endl;
+    for (bool greedy : {true, false}) {
+        sampler_config config;
+        config.seed = 99;
+        if (greedy) {
+            config.temperature = 0.0f;
+            config.top_k = 1;
+        }
+        for (bool quote : {true, false}) {
+            mock_target target(vocab);
+            mock_lm draft(vocab, 60);
+            bool kv_ok = true;
+            std::vector<std::vector<int>> prompts = quote ? quote_prompts(requests, vocab) : chat_prompts(requests, vocab);
+            run_result_t plain = run(target, draft, nullptr, false, false, config, vocab, prompts, length_limit, kv_ok);
+            for (bool with_draft : {false, true}) {
+                for (int k : {4, 8}) {
+                    speculative_decoder spec(&target, nullptr, vocab, k);
+                    run_result_t fast = run(target, draft, &spec, with_draft, true, config, vocab, prompts, length_limit, kv_ok);
+                    const speculative_decoder::stats_t& stats = spec.get_stats();
+                    bool same = fast.tokens == plain.tokens;
+                    all_ok &= same && kv_ok;
+                    std::cout << std::left << std::setw(10) << (greedy ? "greedy" : "sampled") << std::setw(8)
+                              << (quote ? "quote" : "chat") << std::setw(14) << (with_draft ? "lookup+draft" : "lookup")
+                              << std::setw(6) << k << std::setw(12) << 100.0 * stats.accepted / std::max<uint64_t>(stats.proposed, 1)
+                              << std::setw(14) << (double)stats.emitted / stats.rounds << std::setw(10) << plain.cost / fast.cost
+                              << (same ? "yes" : "NO") << (kv_ok ? "" : " (KV mismatch)") << std::endl;
+                    // A quoted passage must be picked up
+                    if (quote && greedy && !with_draft) {
+                        all_ok &= (double)stats.emitted / stats.rounds > 2.0;
+                    }
+                }
+            }
+        }
+    }
+
+    // Without a batch_verifier the target falls back to one forward per id
+    {
+        mock_lm target(vocab, 100);
+        std::vector<int> ids = {3, 5, 7, 9};
+        buffer<bf16> logits;
+        int row = target.verify(ids, logits);
+        mock_lm reference(vocab, 100);
+        bool ok = row == vocab && !target.has_batched_verify() && target.kv == ids;
+        for (size_t i = 0; i < ids.size(); i++) {
+            buffer<bf16> y = reference.forward(ids[i]);
+            for (int t = 0; t < vocab; t++) {
+                ok &= float(y[t]) == float(logits[i * row + t]);
+            }
+        }
+        std::cout << "sequential verify matches forward: " << (ok ? "yes" : "NO") << std::endl;
+        all_ok &= ok;
+    }
+
+    if (!all_ok) {
+        header_print("ERROR", "speculative decoding test failed");
+        return 1;
+    }
+    header_print("info", "speculative decoding test passed");
+    return 0;
+}
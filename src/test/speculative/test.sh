@@ -0,0 +1,3 @@
+cd ../../test/speculative
+make clean
+make test
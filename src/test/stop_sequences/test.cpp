@@ -0,0 +1,193 @@
+/// \file test.cpp
+/// \brief stop sequence matcher test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. Hand-picked cases cover patterns split across
+///       tokens, held back text that is released, overlapping patterns and ties. Random
+///       streams over a small alphabet are checked against a plain search: the match, the
+///       text let through, and that nothing let through is ever taken back. The matcher is
+///       then timed against searching every pattern in the tail after each token.
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <string>
+#include "modules/stop_sequences.hpp"
+#include "utils/utils.hpp"
+
+/// \brief The expected outcome of a stream
+/// \return the text before the first match, or the whole stream without one
+static std::string reference(const std::vector<std::string>& patterns, const std::string& stream, std::string& match) {
+    size_t best_end = std::string::npos;
+    match.clear();
+    for (const std::string& p : patterns) {
+        if (p.empty()) {
+            continue;
+        }
+        size_t pos = stream.find(p);
+        if (pos == std::string::npos) {
+            continue;
+        }
+        size_t end = pos + p.size();
+        if (end < best_end || (end == best_end && p.size() > match.size())) {
+            best_end = end;
+            match = p;
+        }
+    }
+    return best_end == std::string::npos ? stream : stream.substr(0, best_end - match.size());
+}
+
+/// \brief Feed the tokens, flush at the end without a match
+/// \param monotonic false if text let through is not a prefix of the expected output
+static std::string run(stop_matcher& matcher, const std::vector<std::string>& tokens, const std::string& expected,
+                       bool& matched, bool& monotonic) {
+    std::string out;
+    matched = false;
+    monotonic = true;
+    for (const std::string& token : tokens) {
+        matched = matcher.feed(token, out);
+        monotonic &= expected.compare(0, out.size(), out) == 0;
+        if (matched) {
+            break;
+        }
+    }
+    if (!matched) {
+        out += matcher.flush();
+    }
+    return out;
+}
+
+static bool check_cases() {
+    struct case_t {
+        std::vector<std::string> patterns;
+        std::vector<std::string> tokens;
+        std::string out;
+        std::string match;
+    };
+    std::vector<case_t> cases = {
+        {{"</answer>", "STOP"}, {"The answer</", "ans", "wer> more"}, "The answer", "</answer>"},
+        {{"STOP"}, {"ST", "O", "P", "after"}, "", "STOP"},
+        {{"STOP"}, {"ST", "OX", "STO"}, "STOXSTO", ""},
+        {{"abcd", "bc"}, {"ab", "ce"}, "a", "bc"},
+        {{"cd", "bcd"}, {"a", "bcd"}, "a", "bcd"},
+        {{"aab"}, {"aaa", "aab"}, "aaa", "aab"},
+        {{"\n\n", "User:"}, {"Hi", "\n", "Us", "er", ":"}, "Hi\n", "User:"},
+        {{"", "x"}, {"abc"}, "abc", ""},
+        {{"\xe4\xbd\xa0\xe5\xa5\xbd"}, {"ok \xe4\xbd", "\xa0\xe5", "\xa5\xbd!"}, "ok ", "\xe4\xbd\xa0\xe5\xa5\xbd"},
+    };
+    bool ok = true;
+    for (size_t i = 0; i < cases.size(); i++) {
+        stop_matcher matcher(cases[i].patterns);
+        bool matched, monotonic;
+        std::string out = run(matcher, cases[i].tokens, cases[i].out, matched, monotonic);
+        bool pass = out == cases[i].out && matched == !cases[i].match.empty() && matcher.get_match() == cases[i].match && monotonic;
+        if (!pass) {
+            std::cout << "case " << i << ": got \"" << out << "\" match \"" << matcher.get_match() << "\"" << std::endl;
+        }
+        ok &= pass;
+    }
+    // reset starts over
+    stop_matcher matcher({"end"});
+    std::string out;
+    bool first = matcher.feed("the en", out) || !matcher.feed("d", out);
+    matcher.reset();
+    out.clear();
+    ok &= !first && !matcher.feed("en", out) && matcher.get_held() == 2 && matcher.flush() == "en";
+    std::cout << "hand-picked cases: " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+static bool check_random(int rounds) {
+    std::mt19937 rng(2025);
+    bool ok = true;
+    int matches = 0;
+    for (int round = 0; round < rounds && ok; round++) {
+        std::vector<std::string> patterns(1 + rng() % 6);
+        for (std::string& p : patterns) {
+            p.resize(1 + rng() % 5);
+            for (char& c : p) c = 'a' + rng() % 3;
+        }
+        std::string stream(rng() % 64, ' ');
+        for (char& c : stream) c = 'a' + rng() % 4;
+        std::vector<std::string> tokens;
+        for (size_t i = 0; i < stream.size();) {
+            size_t n = std::min<size_t>(1 + rng() % 4, stream.size() - i);
+            tokens.push_back(stream.substr(i, n));
+            i += n;
+        }
+        std::string match;
+        std::string expected = reference(patterns, stream, match);
+        stop_matcher matcher(patterns);
+        bool matched, monotonic;
+        std::string out = run(matcher, tokens, expected, matched, monotonic);
+        ok &= out == expected && matched == !match.empty() && matcher.get_match() == match && monotonic;
+        if (!ok) {
+            std::cout << "round " << round << ": stream \"" << stream << "\" got \"" << out << "\" expected \"" << expected << "\"" << std::endl;
+        }
+        matches += matched;
+    }
+    std::cout << rounds << " random streams (" << matches << " with a match) agree with a plain search: "
+              << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = 200000;
+    if (argc > 1) rounds = std::stoi(argv[1]);
+    bool all_ok = check_cases();
+    all_ok &= check_random(rounds);
+
+    // Throughput on text that never matches, tokens of about four bytes
+    std::mt19937 rng(7);
+    const size_t bytes = 16 << 20;
+    std::vector<std::string> tokens;
+    for (size_t total = 0; total < bytes;) {
+        std::string token(1 + rng() % 7, ' ');
+        for (char& c : token) c = "etaoin shrdlu\n"[rng() % 14];
+        total += token.size();
+        tokens.push_back(std::move(token));
+    }
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::left << std::setw(10) << "patterns" << std::setw(18) << "automaton MB/s" << "tail search MB/s" << std::endl;
+    for (int count : {1, 4, 16, 64}) {
+        std::vector<std::string> patterns(count);
+        for (std::string& p : patterns) {
+            p = "<|" + std::to_string(rng()) + "|>";
+        }
+        stop_matcher matcher(patterns);
+        std::string out;
+        out.reserve(bytes + 64);
+        auto t0 = std::chrono::steady_clock::now();
+        for (const std::string& token : tokens) {
+            all_ok &= !matcher.feed(token, out);
+        }
+        out += matcher.flush();
+        auto t1 = std::chrono::steady_clock::now();
+
+        // What a loop without the automaton does: search each pattern in the recent tail
+        std::string text;
+        text.reserve(bytes + 64);
+        size_t found = 0;
+        for (const std::string& token : tokens) {
+            text += token;
+            for (const std::string& p : patterns) {
+                size_t from = text.size() > p.size() + token.size() ? text.size() - p.size() - token.size() : 0;
+                found += text.find(p, from) != std::string::npos;
+            }
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        all_ok &= out == text && found == 0;
+        double mb = bytes / 1048576.0;
+        std::cout << std::left << std::setw(10) << count << std::setw(18) << mb / std::chrono::duration<double>(t1 - t0).count()
+                  << mb / std::chrono::duration<double>(t2 - t1).count() << std::endl;
+    }
+
+    if (!all_ok) {
+        header_print("ERROR", "stop sequence test failed");
+        return 1;
+    }
+    header_print("info", "stop sequence test passed");
+    return 0;
+}
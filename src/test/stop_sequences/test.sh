@@ -0,0 +1,3 @@
+cd ../../test/stop_sequences
+make clean
+make test
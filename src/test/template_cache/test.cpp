@@ -0,0 +1,302 @@
+/// \file test.cpp
+/// \brief chat template cache test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. A ChatML template and a tokenizer that splits at
+///       special tokens and matches the longest piece of a vocabulary
+///       stand in for minja and the model tokenizer. Conversations grown one
+///       turn at a time, as a REST client sends them, must give the tokens of a full render
+///       every turn. A template whose rendering of a message depends on the ones after it
+///       must turn the cache off, a tokenizer that merges across messages must keep
+///       nothing, and a template that raises on part of a conversation must fall back to a
+///       full render, without a wrong token reaching the model. Host time per request over a
+///       100-turn conversation is then reported with and without the cache.
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "modules/template_cache.hpp"
+#include "utils/utils.hpp"
+
+using ordered_json = nlohmann::ordered_json;
+
+/// \brief ChatML with a default system prompt and the tools in the system message
+/// \param mark_last the last message renders differently, which makes it not prefix-stable
+static std::string chatml(ordered_json& messages, const ordered_json& tools, bool add_generation_prompt, bool mark_last = false) {
+    std::string out = "<|im_start|>system\n";
+    size_t first = 0;
+    if (!messages.empty() && messages[0]["role"] == "system") {
+        out += messages[0]["content"].get<std::string>();
+        first = 1;
+    }
+    else {
+        out += "You are a helpful assistant.";
+    }
+    if (!tools.empty()) {
+        out += "\n# Tools\n" + tools.dump();
+    }
+    out += "<|im_end|>\n";
+    for (size_t i = first; i < messages.size(); i++) {
+        out += "<|im_start|>" + messages[i]["role"].get<std::string>() + "\n" + messages[i]["content"].get<std::string>();
+        if (mark_last && i + 1 == messages.size()) {
+            out += " (latest)";
+        }
+        out += "<|im_end|>\n";
+    }
+    if (add_generation_prompt) {
+        out += "<|im_start|>assistant\n";
+    }
+    return out;
+}
+
+/// \brief Gemma 3 style: the system message goes into the first user turn, and the roles
+///        after it must alternate, so a tail rendered behind the system message raises
+/// \param need_user raise without a user message too, as some templates do
+static std::string gemma3(ordered_json& messages, bool add_generation_prompt, bool need_user = false) {
+    std::string out = "<bos>";
+    std::string system;
+    size_t first = 0;
+    if (!messages.empty() && messages[0]["role"] == "system") {
+        system = messages[0]["content"].get<std::string>() + "\n\n";
+        first = 1;
+    }
+    if (need_user && messages.size() == first) {
+        throw std::runtime_error("No user query found in messages.");
+    }
+    for (size_t i = first; i < messages.size(); i++) {
+        std::string role = messages[i]["role"].get<std::string>();
+        if ((role == "user") != ((i - first) % 2 == 0)) {
+            throw std::runtime_error("Conversation roles must alternate user/assistant/user/assistant/...");
+        }
+        out += "<start_of_turn>" + std::string(role == "assistant" ? "model" : role) + "\n"
+               + (i == first ? system : "") + messages[i]["content"].get<std::string>() + "<end_of_turn>\n";
+    }
+    if (add_generation_prompt) {
+        out += "<start_of_turn>model\n";
+    }
+    return out;
+}
+
+/// \brief Pieces of the words of sentence() and every single byte
+static const std::unordered_map<std::string, int>& vocabulary() {
+    static std::unordered_map<std::string, int> vocab;
+    if (vocab.empty()) {
+        for (int c = 0; c < 256; c++) {
+            vocab.emplace(std::string(1, (char)c), (int)vocab.size() + 4);
+        }
+        for (int w = 0; w < 997; w++) {
+            std::string word = "word" + std::to_string(w) + " ";
+            for (size_t i = 0; i < word.size(); i++) {
+                for (size_t n = 2; n <= 6 && i + n <= word.size(); n++) {
+                    vocab.emplace(word.substr(i, n), (int)vocab.size() + 4);
+                }
+            }
+        }
+    }
+    return vocab;
+}
+
+/// \brief Special tokens on their own, text by longest match in the vocabulary
+/// \param merge a newline and the special token after it make one token
+static std::vector<int> tokenize(const std::string& text, bool merge = false) {
+    static const std::string specials[] = {"<|im_start|>", "<|im_end|>"};
+    const std::unordered_map<std::string, int>& vocab = vocabulary();
+    std::vector<int> tokens;
+    size_t start = 0;
+    auto pieces = [&](size_t end) {
+        for (size_t i = start; i < end;) {
+            for (size_t n = std::min<size_t>(6, end - i); n > 0; n--) {
+                auto found = vocab.find(text.substr(i, n));
+                if (found != vocab.end()) {
+                    tokens.push_back(found->second);
+                    i += n;
+                    break;
+                }
+            }
+        }
+    };
+    for (size_t i = 0; i < text.size();) {
+        int special = -1;
+        for (int s = 0; s < 2; s++) {
+            if (text.compare(i, specials[s].size(), specials[s]) == 0) {
+                special = s;
+            }
+        }
+        if (special < 0) {
+            i++;
+            continue;
+        }
+        bool merged = merge && i > start && text[i - 1] == '\n';
+        pieces(merged ? i - 1 : i);
+        tokens.push_back(merged ? special + 2 : special);
+        i += specials[special].size();
+        start = i;
+    }
+    pieces(text.size());
+    return tokens;
+}
+
+static std::string sentence(int turn, int i, int words) {
+    std::string s;
+    for (int w = 0; w < words; w++) {
+        s += "word" + std::to_string((turn * 31 + i * 7 + w * 13) % 997) + " ";
+    }
+    return s;
+}
+
+/// \brief Grow a conversation turn by turn and compare each request with a full render
+/// \return false if any request differs
+static bool converse(template_cache& cache, int turns, const ordered_json& tools, bool mark_last, bool merge) {
+    ordered_json messages = ordered_json::array();
+    messages.push_back({{"role", "system"}, {"content", "You answer briefly."}});
+    auto render = [&](ordered_json& part, bool add_generation_prompt) { return chatml(part, tools, add_generation_prompt, mark_last); };
+    auto encode = [&](const std::string& text) { return tokenize(text, merge); };
+    bool ok = true;
+    for (int turn = 0; turn < turns; turn++) {
+        messages.push_back({{"role", "user"}, {"content", sentence(turn, 0, 12)}});
+        std::vector<int> tokens = cache.encode(messages, tools.dump(), render, encode);
+        ok &= tokens == encode(render(messages, true));
+        messages.push_back({{"role", "assistant"}, {"content", sentence(turn, 1, 40)}});
+    }
+    return ok;
+}
+
+static bool report(const char* name, bool ok) {
+    std::cout << name << ": " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+static bool check_sha256() {
+    auto hex = [](const std::string& digest) {
+        std::ostringstream os;
+        for (unsigned char c : digest) os << std::hex << std::setw(2) << std::setfill('0') << (int)c;
+        return os.str();
+    };
+    bool ok = hex(template_cache::sha256("abc")) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+    ok &= hex(template_cache::sha256("")) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+    ok &= hex(template_cache::sha256(std::string(1000, 'a'))) == "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3";
+    return report("sha256 digests", ok);
+}
+
+/// \brief Every turn after the first is a hit, and gives the tokens of a full render
+static bool check_prefix() {
+    template_cache cache;
+    ordered_json tools = ordered_json::array({{{"name", "get_weather"}}});
+    bool ok = converse(cache, 20, tools, false, false);
+    nlohmann::json stats = cache.stats();
+    ok &= stats["stable"] == true && stats["hits"] == 19 && stats["misses"] == 1 && stats["verified"] == 4;
+
+    // Other tools are another context, a resent conversation a hit on all of it
+    ok &= converse(cache, 3, ordered_json::array(), false, false);
+    ok &= cache.stats()["misses"] == 2 && cache.stats()["conversations"] == 2;
+    ordered_json messages = ordered_json::array({{{"role", "user"}, {"content", "hi"}}});
+    auto render = [&](ordered_json& part, bool add_generation_prompt) { return chatml(part, tools, add_generation_prompt); };
+    std::vector<int> first = cache.encode(messages, tools.dump(), render, [](const std::string& t) { return tokenize(t); });
+    std::vector<int> again = cache.encode(messages, tools.dump(), render, [](const std::string& t) { return tokenize(t); });
+    ok &= first == again && cache.stats()["misses"] == 3 && cache.stats()["hits"] == 22;
+    return report("appended messages rendered alone", ok);
+}
+
+/// \brief The least recently used conversation goes
+static bool check_capacity() {
+    ordered_json tools = ordered_json::array();
+    template_cache one(1), two(2);
+    auto render = [&](ordered_json& part, bool add_generation_prompt) { return chatml(part, tools, add_generation_prompt); };
+    auto encode = [](const std::string& text) { return tokenize(text); };
+    std::vector<ordered_json> conversations(2, ordered_json::array());
+    for (int turn = 0; turn < 4; turn++) {
+        for (int c = 0; c < 2; c++) {
+            conversations[c].push_back({{"role", "user"}, {"content", sentence(turn, c, 5)}});
+            one.encode(conversations[c], "", render, encode);
+            two.encode(conversations[c], "", render, encode);
+            conversations[c].push_back({{"role", "assistant"}, {"content", sentence(turn, c + 2, 5)}});
+        }
+    }
+    bool ok = one.stats()["hits"] == 0 && two.stats()["hits"] == 6 && two.stats()["conversations"] == 2;
+    return report("two clients interleaved", ok);
+}
+
+/// \brief A template that is not prefix-stable turns the cache off, tokens that merge
+///        across messages are not kept; the tokens stay right
+static bool check_unstable() {
+    ordered_json tools = ordered_json::array();
+    template_cache marked, merged;
+    bool ok = converse(marked, 10, tools, true, false);
+    ok &= !marked.is_stable() && marked.stats()["reason"] == "a message renders differently when others follow";
+    ok &= converse(merged, 10, tools, false, true);
+    ok &= merged.stats()["hits"] == 0 && merged.stats()["conversations"] == 0;
+    return report("unstable template falls back to a full render", ok);
+}
+
+/// \brief A template that raises on the anchor or on the tail turns the cache off, and
+///        the request still gets the tokens of a full render
+static bool check_raising() {
+    bool ok = true;
+    for (bool need_user : {false, true}) {
+        template_cache cache;
+        auto render = [&](ordered_json& part, bool add_generation_prompt) { return gemma3(part, add_generation_prompt, need_user); };
+        auto encode = [](const std::string& text) { return tokenize(text); };
+        ordered_json messages = ordered_json::array();
+        messages.push_back({{"role", "system"}, {"content", "You answer briefly."}});
+        for (int turn = 0; turn < 6; turn++) {
+            messages.push_back({{"role", "user"}, {"content", sentence(turn, 0, 12)}});
+            ok &= cache.encode(messages, "", render, encode) == encode(render(messages, true));
+            messages.push_back({{"role", "assistant"}, {"content", sentence(turn, 1, 40)}});
+        }
+        ok &= !cache.is_stable() && cache.stats()["hits"] == 0 && cache.stats()["misses"] == 6;
+    }
+    return report("raising template falls back to a full render", ok);
+}
+
+int main(int argc, char* argv[]) {
+    int turns = 100;
+    if (argc > 1) turns = std::stoi(argv[1]);
+    bool all_ok = check_sha256();
+    all_ok &= check_prefix();
+    all_ok &= check_capacity();
+    all_ok &= check_unstable();
+    all_ok &= check_raising();
+
+    // Host time per request over a conversation, with and without the cache
+    ordered_json tools = ordered_json::array({{{"name", "get_weather"}, {"parameters", {{"city", "string"}}}}});
+    auto render = [&](ordered_json& part, bool add_generation_prompt) { return chatml(part, tools, add_generation_prompt); };
+    auto encode = [](const std::string& text) { return tokenize(text); };
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << std::left << std::setw(8) << "turn" << std::setw(10) << "tokens" << std::setw(12) << "full us"
+              << std::setw(12) << "cached us" << "saved" << std::endl;
+    template_cache cache;
+    ordered_json messages = ordered_json::array();
+    double full_total = 0, cached_total = 0;
+    for (int turn = 0; turn < turns; turn++) {
+        messages.push_back({{"role", "user"}, {"content", sentence(turn, 0, 30)}});
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<int> full = encode(render(messages, true));
+        auto t1 = std::chrono::steady_clock::now();
+        std::vector<int> cached = cache.encode(messages, tools.dump(), render, encode);
+        auto t2 = std::chrono::steady_clock::now();
+        all_ok &= full == cached;
+        double full_us = std::chrono::duration<double, std::micro>(t1 - t0).count();
+        double cached_us = std::chrono::duration<double, std::micro>(t2 - t1).count();
+        full_total += full_us;
+        cached_total += cached_us;
+        if ((turn + 1) % (turns / 10 > 0 ? turns / 10 : 1) == 0) {
+            std::cout << std::left << std::setw(8) << turn + 1 << std::setw(10) << full.size() << std::setw(12) << full_us
+                      << std::setw(12) << cached_us << 100.0 * (1.0 - cached_us / full_us) << "%" << std::endl;
+        }
+        messages.push_back({{"role", "assistant"}, {"content", sentence(turn, 1, 120)}});
+    }
+    std::cout << "mean host time per request: " << full_total / turns << " us full, " << cached_total / turns << " us cached" << std::endl;
+    std::cout << "cache: " << cache.stats().dump() << std::endl;
+
+    if (!all_ok) {
+        header_print("ERROR", "template cache test failed");
+        return 1;
+    }
+    header_print("info", "template cache test passed");
+    return 0;
+}
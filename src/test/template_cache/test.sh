@@ -0,0 +1,3 @@
+cd ../../test/template_cache
+make clean
+make test
@@ -0,0 +1,160 @@
+/// \file test.cpp
+/// \brief worker pool test
+/// \author FastFlowLM Team
+/// \date 2025-06-24
+/// \version 0.9.24
+/// \note Host-only test, no NPU required. Every item of a batch must run exactly once and
+///       write its result by index, whatever the worker order; a worker index must never be
+///       used by two items at the same time, since it selects the decoder context; the
+///       first exception of a batch must reach the caller after all items are done; and
+///       callers running at the same time must not mix their batches. A request of
+///       screenshots is then timed item by item and on the pool; each item stands in for
+///       the decode and preprocessing of one image.
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "modules/worker_pool.hpp"
+#include "utils/utils.hpp"
+
+static bool report(const char* name, bool ok) {
+    std::cout << name << ": " << (ok ? "yes" : "NO") << std::endl;
+    return ok;
+}
+
+/// \brief Every item once, results by index
+static bool check_order(worker_pool& pool) {
+    bool ok = true;
+    for (size_t count : {0, 1, 2, 7, 64, 1000}) {
+        std::vector<int> runs(count, 0);
+        std::vector<size_t> results(count, 0);
+        pool.run(count, [&](size_t i, size_t worker) {
+            runs[i]++;
+            results[i] = i * i;
+        });
+        for (size_t i = 0; i < count; i++) {
+            ok &= runs[i] == 1 && results[i] == i * i;
+        }
+    }
+    return report("every item once, in its slot", ok);
+}
+
+/// \brief A worker index is held by one item at a time
+static bool check_workers(worker_pool& pool) {
+    std::vector<std::atomic<int>> busy(pool.workers());
+    std::atomic<int> overlaps{0};
+    std::atomic<int> out_of_range{0};
+    for (int round = 0; round < 20; round++) {
+        pool.run(200, [&](size_t i, size_t worker) {
+            if (worker >= busy.size()) {
+                out_of_range++;
+                return;
+            }
+            if (busy[worker].fetch_add(1) != 0) {
+                overlaps++;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+            busy[worker].fetch_sub(1);
+        });
+    }
+    return report("worker index held by one item at a time", overlaps == 0 && out_of_range == 0);
+}
+
+/// \brief The first exception reaches the caller, once the batch is done
+static bool check_exception(worker_pool& pool) {
+    std::atomic<int> done{0};
+    bool thrown = false;
+    try {
+        pool.run(50, [&](size_t i, size_t worker) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            done++;
+            if (i == 17) {
+                throw std::runtime_error("item 17");
+            }
+        });
+    }
+    catch (const std::runtime_error& error) {
+        thrown = std::string(error.what()) == "item 17";
+    }
+    bool ok = thrown && done == 50;
+    // and the pool still works
+    std::atomic<int> after{0};
+    pool.run(10, [&](size_t i, size_t worker) { after++; });
+    return report("exception rethrown after the batch", ok && after == 10);
+}
+
+/// \brief Callers on several threads share the pool
+static bool check_callers(worker_pool& pool) {
+    std::atomic<int> wrong{0};
+    std::vector<std::thread> callers;
+    for (int t = 0; t < 4; t++) {
+        callers.emplace_back([&, t] {
+            for (int round = 0; round < 50; round++) {
+                std::vector<int> results(33, -1);
+                pool.run(results.size(), [&](size_t i, size_t worker) { results[i] = t * 1000 + (int)i; });
+                for (size_t i = 0; i < results.size(); i++) {
+                    if (results[i] != t * 1000 + (int)i) {
+                        wrong++;
+                    }
+                }
+            }
+        });
+    }
+    for (std::thread& caller : callers) {
+        caller.join();
+    }
+    return report("concurrent callers", wrong == 0);
+}
+
+/// \brief About the work of decoding and preprocessing one screenshot, into its slice
+static void process(std::vector<float>& payload, size_t index, size_t values) {
+    float* slice = payload.data() + index * values;
+    for (size_t i = 0; i < values; i++) {
+        float x = (float)((i * 2654435761u + index) & 0xff) / 255.0f;
+        for (int k = 0; k < 24; k++) {
+            x = std::sin(x) * 0.5f + 0.25f;
+        }
+        slice[i] = x;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int images = 8;
+    if (argc > 1) images = std::stoi(argv[1]);
+    worker_pool pool(std::min<size_t>(std::max(std::thread::hardware_concurrency(), 2u) - 1, 8));
+    std::cout << "workers: " << pool.workers() << std::endl;
+    bool all_ok = check_order(pool);
+    all_ok &= check_workers(pool);
+    all_ok &= check_exception(pool);
+    all_ok &= check_callers(pool);
+
+    const size_t values = 3 * 448 * 448;
+    std::vector<float> sequential(values * images);
+    std::vector<float> pooled(values * images);
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < images; i++) {
+        process(sequential, i, values);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    pool.run(images, [&](size_t i, size_t worker) { process(pooled, i, values); });
+    auto t2 = std::chrono::steady_clock::now();
+    all_ok &= report("pool payload matches the sequential one", pooled == sequential);
+
+    double sequential_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    double pooled_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << images << " images, sequential " << sequential_ms << " ms, pool " << pooled_ms
+              << " ms, speedup " << sequential_ms / pooled_ms << "x" << std::endl;
+
+    if (!all_ok) {
+        header_print("ERROR", "worker pool test failed");
+        return 1;
+    }
+    header_print("info", "worker pool test passed");
+    return 0;
+}
@@ -0,0 +1,3 @@
+cd ../../test/worker_pool
+make clean
+make test